@@ -0,0 +1,17 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include "session.h"
+
+#include <stdio.h>
+
+// Answers line commands (sessions, chat, board, kick, loglevel, set) on one
+// accepted admin socket connection until EOF or "quit", then closes it.
+void admin_serve(int fd, session_manager_t *sessions);
+
+// Client side of `maum --admin`: sends one command to the admin socket and
+// copies the reply to out. Returns -1 if the server could not be reached or
+// answered with an error.
+int admin_request(const char *path, const char *command, FILE *out);
+
+#endif // ADMIN_H
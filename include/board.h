@@ -6,8 +6,12 @@
 #define BOARD_AUTHOR_MAX 32
 #define BOARD_CONTENT_MAX 512
 #define BOARD_TIMESTAMP_MAX 32
+#define BOARD_NAME_MAX 32
+#define BOARD_TITLE_MAX 64
+#define BOARD_PATH_MAX 256
 
 typedef struct board board_t;
+struct hub;
 
 typedef struct {
     unsigned int id;
@@ -16,11 +20,62 @@ typedef struct {
     char content[BOARD_CONTENT_MAX];
 } board_post_t;
 
+typedef struct {
+    size_t posts;
+    unsigned int next_id;
+    unsigned long long bytes;
+    // Operations since the board was opened.
+    unsigned long long lists;
+    unsigned long long adds;
+    unsigned long long removes;
+} board_stats_t;
+
+// A board as declared in the configuration: name is the key used in
+// commands and read cursors, title is what users see.
+typedef struct {
+    char name[BOARD_NAME_MAX];
+    char title[BOARD_TITLE_MAX];
+    char path[BOARD_PATH_MAX];
+} board_spec_t;
+
+// Where a replica sends writes instead of making them itself. The functions
+// return what board_add() and board_remove() would.
+typedef struct {
+    int (*add)(void *context, const char *board, const char *author, const char *content, board_post_t *post);
+    int (*remove)(void *context, const char *board, unsigned int id, const char *requester, int *not_owner);
+    void *context;
+} board_forward_t;
+
 board_t *board_create(const char *path);
 void board_destroy(board_t *board);
 
 int board_list(board_t *board, board_post_t **posts, size_t *count);
+// Posts with ids above after_id, oldest first. Costs in proportion to the
+// posts returned rather than the size of the board.
+int board_list_since(board_t *board, unsigned int after_id, board_post_t **posts, size_t *count);
+size_t board_count_since(board_t *board, unsigned int after_id);
 int board_add(board_t *board, const char *author, const char *content, board_post_t *out_post);
 int board_remove(board_t *board, unsigned int id, const char *requester, int *not_owner);
+int board_stats(board_t *board, board_stats_t *stats);
+// Pins the file as it is now: fd is open on it and length is its size. Later
+// posts are appended past length and removals replace the file rather than
+// rewrite it, so those bytes stay as captured however long fd is read. fd is
+// -1 when the file does not exist. The board is locked only to open it.
+int board_capture(board_t *board, int *fd, unsigned long long *length);
+
+// New posts are published to hub (NULL for none) as HUB_TOPIC_BOARD_POST and
+// removals as HUB_TOPIC_BOARD_REMOVE, tagged with name.
+void board_set_hub(board_t *board, struct hub *hub, const char *name);
+
+// Replica side. With a forward set (NULL clears it), board_add() and
+// board_remove() go through it and leave the file alone; the file changes
+// only through the two calls below.
+void board_set_forward(board_t *board, const board_forward_t *forward);
+// Appends whole lines that the leader wrote at offset in its copy of the file.
+// Fails, changing nothing, unless offset is the current size of the file.
+// New posts are published as if they had been added here.
+int board_apply(board_t *board, unsigned long long offset, const char *data, size_t length);
+// Renames source over the file, as the leader did when it removed a post.
+int board_replace(board_t *board, const char *source);
 
 #endif // BOARD_H
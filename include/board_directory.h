@@ -0,0 +1,34 @@
+#ifndef BOARD_DIRECTORY_H
+#define BOARD_DIRECTORY_H
+
+#include "board.h"
+
+#include <stddef.h>
+
+struct hub;
+
+// The configured boards. Each has its own file, lock and index; a board is
+// opened the first time it is used, so startup does not read any of them.
+typedef struct board_directory board_directory_t;
+
+// Copies specs; new posts on every board are published to hub (may be NULL).
+board_directory_t *board_directory_create(const board_spec_t *specs, size_t count, struct hub *hub);
+void board_directory_destroy(board_directory_t *directory);
+
+size_t board_directory_count(const board_directory_t *directory);
+const board_spec_t *board_directory_spec(const board_directory_t *directory, size_t index);
+// Index of the board called name, or -1.
+int board_directory_find(const board_directory_t *directory, const char *name);
+
+// Opens the board on first use. NULL if it could not be opened; the next
+// call tries again.
+board_t *board_directory_open(board_directory_t *directory, size_t index);
+// The board if it is already open, without opening it.
+board_t *board_directory_peek(const board_directory_t *directory, size_t index);
+// Every board, open now or later, sends its writes to forward (NULL to stop).
+void board_directory_set_forward(board_directory_t *directory, const board_forward_t *forward);
+// board_capture() for the board at index; one that is not open is captured
+// straight from its file without opening it.
+int board_directory_capture(board_directory_t *directory, size_t index, int *fd, unsigned long long *length);
+
+#endif // BOARD_DIRECTORY_H
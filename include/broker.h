@@ -0,0 +1,17 @@
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <stddef.h>
+
+#define BROKER_PEER_MAX 160
+
+// Daemon side: Unix socket that `maum --stdio` processes attach to.
+int broker_listen(const char *path);
+void broker_close(int listen_fd, const char *path);
+int broker_read_hello(int fd, char *peer, size_t size);
+
+// Client side: proxies stdin/stdout to a running daemon. Returns -1 without
+// touching stdio when no daemon is reachable so the caller can run standalone.
+int broker_attach(const char *path, const char *peer);
+
+#endif // BROKER_H
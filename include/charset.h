@@ -0,0 +1,53 @@
+#ifndef CHARSET_H
+#define CHARSET_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Character sets a connection can use on the wire. Everything inside the
+// server is UTF-8; conversion happens at the connection's edge.
+typedef enum {
+    CHARSET_UTF8 = 0,
+    CHARSET_CP949,
+    CHARSET_COUNT
+} charset_t;
+
+// Builds the CP949 tables once; returns -1 when the C library cannot provide
+// them, in which case only UTF-8 is available.
+int charset_init(void);
+bool charset_available(charset_t charset);
+const char *charset_name(charset_t charset);
+// Accepts utf-8/utf8 and cp949/euc-kr/uhc, case-insensitively.
+int charset_parse(const char *name, charset_t *charset);
+
+// Neither direction grows the text by more than these bounds.
+#define CHARSET_ENCODE_MAX(length) (length)
+#define CHARSET_DECODE_MAX(length) ((length) / 2 * 3 + 1)
+
+// UTF-8 to charset. Bytes that are not valid UTF-8 are passed through, so
+// telnet commands survive; characters charset lacks become '?' and line
+// drawing becomes ASCII. Stops before an incomplete sequence at the end and
+// reports what it used in *consumed.
+size_t charset_encode(charset_t charset, const char *text, size_t length, char *out, size_t *consumed);
+// charset to UTF-8; invalid sequences become '?'. Stops before a lead byte
+// at the end that is missing its trail byte.
+size_t charset_decode(charset_t charset, const char *text, size_t length, char *out, size_t *consumed);
+// True when text is entirely valid in charset.
+bool charset_valid(charset_t charset, const char *text, size_t length);
+
+typedef struct {
+    FILE *raw;
+    const atomic_int *charset;
+    // Start of a UTF-8 sequence split across writes.
+    char pending[4];
+    size_t pending_length;
+} charset_stream_t;
+
+// Unbuffered stream that converts UTF-8 written to it into *charset (read on
+// every write, so it can change) and writes the result to raw. stream is the
+// caller's storage and must outlive the returned FILE.
+FILE *charset_fopen(charset_stream_t *stream, FILE *raw, const atomic_int *charset);
+
+#endif // CHARSET_H
@@ -1,23 +1,103 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "board.h"
+#include "charset.h"
+#include "log.h"
+
 #include <stdbool.h>
 #include <stddef.h>
 
 #define CONFIG_MAX_HOST_LEN 128
+// Boards declared with board= lines, besides the one in board_path.
+#define CONFIG_MAX_BOARDS 15
+// Name of the board stored in board_path.
+#define CONFIG_MAIN_BOARD "main"
+#define CONFIG_MAX_RELAY_PEERS 8
+
+typedef struct {
+    char host[CONFIG_MAX_HOST_LEN];
+    unsigned short port;
+} config_peer_t;
+
+typedef enum {
+    CONFIG_REPLICATION_OFF,
+    // Streams the boards to followers.
+    CONFIG_REPLICATION_LEADER,
+    // Keeps a copy of the leader's boards and forwards writes to it.
+    CONFIG_REPLICATION_FOLLOWER,
+} config_replication_t;
 
 typedef struct {
     char ssh_host[CONFIG_MAX_HOST_LEN];
     unsigned short ssh_port;
     char telnet_host[CONFIG_MAX_HOST_LEN];
     unsigned short telnet_port;
+    char metrics_host[CONFIG_MAX_HOST_LEN];
+    unsigned short metrics_port;
+    char relay_host[CONFIG_MAX_HOST_LEN];
+    unsigned short relay_port;
+    config_peer_t relay_peers[CONFIG_MAX_RELAY_PEERS];
+    unsigned int relay_peer_count;
+    config_replication_t replication_role;
+    char replication_host[CONFIG_MAX_HOST_LEN];
+    unsigned short replication_port;
+    config_peer_t replication_leader;
     char motd_path[256];
-    char board_path[256];
+    char board_path[BOARD_PATH_MAX];
+    board_spec_t boards[CONFIG_MAX_BOARDS];
+    unsigned int board_count;
+    char mailbox_dir[256];
+    char library_dir[256];
+    char cursor_path[256];
+    char snapshot_dir[256];
     char host_key_path[256];
+    char broker_socket_path[108];
+    char upgrade_socket_path[108];
+    char admin_socket_path[108];
+    char trace_path[256];
     bool enable_builtin_ssh;
+    unsigned int max_sessions;
+    unsigned int login_timeout;
+    unsigned int idle_timeout;
+    unsigned int chat_idle_timeout;
+    bool tcp_keepalive;
+    unsigned int tcp_keepalive_idle;
+    unsigned int tcp_keepalive_interval;
+    unsigned int tcp_keepalive_count;
+    unsigned int drain_timeout;
+    unsigned int library_rate_kbps;
+    unsigned int library_max_downloads;
+    charset_t default_charset;
+    unsigned int trace_size_kb;
+    bool lock_profiling;
+    log_level_t log_level;
 } maum_config_t;
 
 void config_init(maum_config_t *config);
 int config_load(maum_config_t *config, const char *path);
+// Logs every invalid value; returns -1 if there was any.
+int config_validate(const maum_config_t *config);
+// The board in board_path followed by the board= ones; specs needs room
+// for CONFIG_MAX_BOARDS + 1. Returns how many were written.
+size_t config_boards(const maum_config_t *config, board_spec_t *specs);
+
+// The running configuration. Readers take config_current() without locking
+// and read fields from that snapshot; writers go through config_update(),
+// which copies the current version, lets edit change the copy and publishes
+// it as the next version. Superseded versions stay allocated for the life of
+// the process because readers may still be looking at them.
+typedef int (*config_edit_fn)(maum_config_t *draft, void *context);
+
+int config_publish(const maum_config_t *config);
+const maum_config_t *config_current(void);
+unsigned int config_version(void);
+// Publishes nothing if edit returns non-zero.
+int config_update(config_edit_fn edit, void *context);
+
+// Re-reads path and publishes the keys that can change while running. Keys
+// bound at startup (listen addresses, socket and storage paths) keep their
+// running values and are reported.
+int config_reload(const char *path);
 
 #endif // CONFIG_H
@@ -0,0 +1,28 @@
+#ifndef CURSOR_H
+#define CURSOR_H
+
+#include <stddef.h>
+
+// Read cursors: the last post id each nickname has seen on each board. The
+// table is an open-addressing hash table in a file mapped into memory, so
+// lookups and updates are memory accesses under one mutex. A background
+// thread writes dirty pages back every few seconds; updates never wait for
+// the disk.
+typedef struct cursor_store cursor_store_t;
+
+// Opens or creates the table at path; a file that is not a cursor table is
+// replaced with an empty one.
+cursor_store_t *cursor_store_open(const char *path);
+// Writes the table back and unmaps it.
+void cursor_store_close(cursor_store_t *store);
+// Copies the whole table, as of one moment, into *copy, which the caller
+// frees.
+int cursor_store_capture(cursor_store_t *store, char **copy, size_t *size);
+
+// 0 when username has no cursor on board yet.
+unsigned int cursor_get(cursor_store_t *store, const char *board, const char *username);
+// Moves the cursor forward to last_seen; never moves it back. Returns -1 if
+// the table could not grow to take a new name.
+int cursor_advance(cursor_store_t *store, const char *board, const char *username, unsigned int last_seen);
+
+#endif // CURSOR_H
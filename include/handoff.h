@@ -0,0 +1,28 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stddef.h>
+
+#define HANDOFF_MAX_LISTENERS 8
+#define HANDOFF_NAME_MAX 16
+
+typedef struct {
+    char name[HANDOFF_NAME_MAX];
+    int fd;
+} handoff_listener_t;
+
+// Running process: answers one takeover request on the upgrade socket by
+// passing its listeners over SCM_RIGHTS. Returns the control connection,
+// which becomes readable when the successor confirms, or -1.
+int handoff_offer(int upgrade_fd, const handoff_listener_t *listeners, size_t count);
+
+// Reads the successor's confirmation and closes the control connection.
+// Returns 0 once the successor is accepting, -1 if the handoff failed.
+int handoff_ready(int control_fd);
+
+// Successor process: receives the listeners and returns the control
+// connection, which handoff_confirm() closes once accepting has started.
+int handoff_request(const char *path, handoff_listener_t *listeners, size_t max, size_t *count);
+int handoff_confirm(int control_fd);
+
+#endif // HANDOFF_H
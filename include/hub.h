@@ -0,0 +1,58 @@
+#ifndef HUB_H
+#define HUB_H
+
+#include "board.h"
+
+#include <stddef.h>
+
+#define HUB_SUMMARY_MAX 96
+
+typedef enum {
+    HUB_TOPIC_BOARD_POST = 0,
+    // Only board, id and author are set.
+    HUB_TOPIC_BOARD_REMOVE,
+    HUB_TOPIC_COUNT
+} hub_topic_t;
+
+typedef struct {
+    hub_topic_t topic;
+    // Name of the board the post went to.
+    char board[BOARD_NAME_MAX];
+    unsigned int id;
+    char author[BOARD_AUTHOR_MAX];
+    // Start of the text, cut at a character boundary.
+    char summary[HUB_SUMMARY_MAX];
+} hub_event_t;
+
+typedef void (*hub_handler_t)(const hub_event_t *event, void *context);
+
+typedef struct hub_subscription {
+    struct hub_subscription *next;
+    struct hub_subscription **pprev;
+    hub_handler_t handler;
+    void *context;
+} hub_subscription_t;
+
+// In-process publish/subscribe. Publishing copies the event into a bounded
+// queue and returns; a dispatcher thread hands it to every subscriber of its
+// topic. When the queue is full the oldest event is dropped.
+typedef struct hub hub_t;
+
+hub_t *hub_create(void);
+// Delivers nothing more; queued events are dropped.
+void hub_destroy(hub_t *hub);
+
+void hub_publish(hub_t *hub, const hub_event_t *event);
+
+// subscription is the caller's storage. Handlers run on the dispatcher
+// thread, one event at a time; unsubscribing waits for a delivery to that
+// subscriber in progress, after which the handler is not called again.
+void hub_subscription_init(hub_subscription_t *subscription, hub_handler_t handler, void *context);
+void hub_subscribe(hub_t *hub, hub_topic_t topic, hub_subscription_t *subscription);
+void hub_unsubscribe(hub_t *hub, hub_subscription_t *subscription);
+
+// Copies the start of text into summary, cut at a character boundary, with
+// "..." when it had to be shortened.
+void hub_summarize(char *summary, size_t size, const char *text);
+
+#endif // HUB_H
@@ -0,0 +1,62 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include "screen.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define LIBRARY_NAME_MAX 256
+
+// File library (자료실): the regular files directly inside one directory,
+// offered for download. The directory is indexed once and re-read only when
+// its mtime or inode changes.
+typedef struct library library_t;
+typedef struct library_index library_index_t;
+
+typedef struct {
+    char name[LIBRARY_NAME_MAX];
+    off_t size;
+} library_entry_t;
+
+library_t *library_create(const char *directory);
+void library_destroy(library_t *library);
+
+// Returns a retained index; release it with library_index_release().
+library_index_t *library_acquire(library_t *library);
+void library_index_release(library_index_t *index);
+size_t library_index_count(const library_index_t *index);
+const library_entry_t *library_index_entry(const library_index_t *index, size_t position);
+// The listing rendered once per index, ending in the download prompt when
+// there is anything to download.
+const screen_t *library_index_screen(const library_index_t *index);
+
+// Caps concurrent downloads across all sessions; returns -1 when
+// max_downloads (0 for no limit) are already running.
+int library_download_begin(library_t *library, unsigned int max_downloads);
+void library_download_end(library_t *library);
+
+typedef struct {
+    // Socket the file is sendfile()d into, or -1 to write it through out.
+    int fd;
+    FILE *out;
+    // Double 0xFF bytes as telnet requires, even in binary mode.
+    bool telnet;
+    // Per-connection limit in KiB/s, 0 for none.
+    unsigned int rate_kbps;
+    // Give up after this many seconds without the client taking data.
+    unsigned int stall_timeout;
+    // Checked between chunks; non-zero aborts the transfer.
+    const atomic_int *cancel;
+} library_transfer_t;
+
+// Sends the file's current contents. *sent counts bytes put on the wire,
+// including telnet escapes, whether or not the transfer completed.
+int library_send(library_t *library, const library_entry_t *entry, const library_transfer_t *transfer,
+                 uint64_t *sent);
+
+#endif // LIBRARY_H
@@ -0,0 +1,56 @@
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define LOCK_PROFILE_SITES 16
+
+#define LOCK_PROFILE_STR_(x) #x
+#define LOCK_PROFILE_STR(x) LOCK_PROFILE_STR_(x)
+#define LOCK_PROFILE_SITE (__FILE__ ":" LOCK_PROFILE_STR(__LINE__))
+
+typedef struct {
+    _Atomic(const char *) site;
+    atomic_uint_fast64_t acquisitions;
+    atomic_uint_fast64_t contended;
+    atomic_uint_fast64_t wait_ns;
+    atomic_uint_fast64_t hold_ns;
+    atomic_uint_fast64_t max_wait_ns;
+} lock_site_stats_t;
+
+// A pthread mutex that, while profiling is enabled, records per call site how
+// often it was taken, how long callers waited for it and how long they held
+// it. The last site slot collects call sites beyond the table.
+typedef struct {
+    pthread_mutex_t mutex;
+    const char *name;
+    uint64_t acquired_at;
+    int holder_site;
+    lock_site_stats_t sites[LOCK_PROFILE_SITES];
+} profiled_mutex_t;
+
+int profiled_mutex_init(profiled_mutex_t *lock, const char *name);
+void profiled_mutex_destroy(profiled_mutex_t *lock);
+int profiled_mutex_lock_at(profiled_mutex_t *lock, const char *site);
+int profiled_mutex_unlock(profiled_mutex_t *lock);
+int profiled_cond_timedwait_at(pthread_cond_t *cond, profiled_mutex_t *lock, const struct timespec *deadline,
+                               const char *site);
+
+#define profiled_mutex_lock(lock) profiled_mutex_lock_at((lock), LOCK_PROFILE_SITE)
+#define profiled_cond_timedwait(cond, lock, deadline) \
+    profiled_cond_timedwait_at((cond), (lock), (deadline), LOCK_PROFILE_SITE)
+
+void lock_profile_set_enabled(bool enabled);
+bool lock_profile_enabled(void);
+
+// Logs one line per lock and call site.
+void lock_profile_dump(void);
+// Appends the same numbers in Prometheus text format.
+void lock_profile_write(FILE *out);
+
+#endif // LOCK_PROFILE_H
@@ -1,6 +1,8 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 
 typedef enum {
@@ -10,12 +12,41 @@ typedef enum {
     LOG_LEVEL_ERROR
 } log_level_t;
 
+// One per LOG_* call site; trace_id is assigned when the site is first traced.
+typedef struct {
+    atomic_uint trace_id;
+    log_level_t level;
+    const char *component;
+    const char *fmt;
+} log_site_t;
+
 void log_set_level(log_level_t level);
+log_level_t log_get_level(void);
+const char *log_level_name(log_level_t level);
+// Accepts debug/info/warn/error in any case; returns -1 for anything else.
+int log_parse_level(const char *name, log_level_t *level);
+
+// Formats into a per-thread ring drained by a background writer, so callers
+// never wait on the log sink. When a thread's ring is full the message is
+// dropped and counted. component must outlive the process (a string literal).
 void log_message(log_level_t level, const char *component, const char *fmt, ...);
+unsigned long long log_dropped_count(void);
+
+// True when a message at level would reach the text log or the binary trace.
+int log_enabled(log_level_t level);
+void log_site_emit(log_site_t *site, ...);
+
+#define LOG_AT(level, component, fmt, ...)                                   \
+    do {                                                                     \
+        static log_site_t log_site_ = {0, (level), (component), (fmt)};      \
+        if (log_enabled(level)) {                                            \
+            log_site_emit(&log_site_, ##__VA_ARGS__);                        \
+        }                                                                    \
+    } while (0)
 
-#define LOG_DEBUG(component, fmt, ...) log_message(LOG_LEVEL_DEBUG, component, fmt, ##__VA_ARGS__)
-#define LOG_INFO(component, fmt, ...)  log_message(LOG_LEVEL_INFO, component, fmt, ##__VA_ARGS__)
-#define LOG_WARN(component, fmt, ...)  log_message(LOG_LEVEL_WARN, component, fmt, ##__VA_ARGS__)
-#define LOG_ERROR(component, fmt, ...) log_message(LOG_LEVEL_ERROR, component, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(component, fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, component, fmt, ##__VA_ARGS__)
+#define LOG_INFO(component, fmt, ...)  LOG_AT(LOG_LEVEL_INFO, component, fmt, ##__VA_ARGS__)
+#define LOG_WARN(component, fmt, ...)  LOG_AT(LOG_LEVEL_WARN, component, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(component, fmt, ...) LOG_AT(LOG_LEVEL_ERROR, component, fmt, ##__VA_ARGS__)
 
 #endif // LOG_H
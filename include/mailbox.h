@@ -0,0 +1,55 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include "board.h"
+
+#include <stddef.h>
+
+typedef struct mailbox_store mailbox_store_t;
+typedef struct mailbox mailbox_t;
+
+typedef struct {
+    unsigned int id;
+    char from[BOARD_AUTHOR_MAX];
+    char timestamp[BOARD_TIMESTAMP_MAX];
+    char text[BOARD_CONTENT_MAX];
+    int read;
+} mail_message_t;
+
+// Private messages (쪽지). Each user has one mailbox, found through a
+// lock-free table keyed by nickname. Messages for a user with a session
+// attached go onto the mailbox's lock-free queue and are drained by that
+// user's session; for anyone else they are appended to <directory>/<hex
+// nickname>.mbox, which is read on the owner's next login. Nicknames are not
+// authenticated, so a mailbox exists only once its owner has registered a
+// password, kept as a crypt(3) hash in <directory>/<hex nickname>.key.
+mailbox_store_t *mailbox_store_create(const char *directory);
+// Writes every mailbox still in memory back to its file.
+void mailbox_store_destroy(mailbox_store_t *store);
+
+// Returns 1 if owner has registered, 0 if not.
+int mailbox_registered(mailbox_store_t *store, const char *owner);
+// Returns 1 if owner is already registered, -1 on failure or when the store
+// is full.
+int mailbox_register(mailbox_store_t *store, const char *owner, const char *password);
+// Returns 0 if password matches, 1 if it does not.
+int mailbox_verify(mailbox_store_t *store, const char *owner, const char *password);
+
+// Called when a session logs in and out as owner; the first attach loads the
+// mailbox file, the last detach writes it back and frees the messages.
+// Returns NULL for an owner that has not registered.
+mailbox_t *mailbox_attach(mailbox_store_t *store, const char *owner);
+void mailbox_detach(mailbox_t *mailbox);
+
+// Returns 1 if to has not registered. from and text must not contain line
+// breaks, nor from a '|'.
+int mailbox_send(mailbox_store_t *store, const char *from, const char *to, const char *text);
+unsigned int mailbox_unread(const mailbox_t *mailbox);
+
+// Copies the messages, oldest first, and marks them all read. The caller
+// frees *messages.
+int mailbox_read_all(mailbox_t *mailbox, mail_message_t **messages, size_t *count);
+// Returns 1 if no message has that id.
+int mailbox_remove(mailbox_t *mailbox, unsigned int id);
+
+#endif // MAILBOX_H
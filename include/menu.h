@@ -1,12 +1,38 @@
 #ifndef MENU_H
 #define MENU_H
 
+#include "vscreen.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Smallest terminal the full-screen menu is drawn on; smaller or unknown
+// sizes keep the line-mode menu.
+#define MENU_MIN_WIDTH 40
+#define MENU_MIN_HEIGHT 18
+#define MENU_ITEM_COUNT 9
+
 typedef struct {
+    // Item highlighted on the next frame, 0-based.
     unsigned int active_index;
+    vscreen_t *screen;
+    // One line under the items for notices and errors; may be NULL.
+    const char *status;
+    // Title of the selected board, shown under the banner; may be NULL.
+    const char *board;
 } menu_context_t;
 
 void menu_init(menu_context_t *menu);
+void menu_release(menu_context_t *menu);
+// Creates or resizes the screen; the next frame is a full repaint.
+int menu_resize(menu_context_t *menu, unsigned int width, unsigned int height);
+
 void menu_render_banner(const menu_context_t *menu);
 void menu_render_main(const menu_context_t *menu);
+// Draws both into the screen and sends what changed since the last frame;
+// returns the bytes written.
+size_t menu_present(menu_context_t *menu, FILE *out);
+// The line editor echoed a choice on the prompt row.
+void menu_input_done(menu_context_t *menu);
 
 #endif // MENU_H
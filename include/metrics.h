@@ -0,0 +1,74 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Process-wide metrics. Counters and histograms are striped per thread and
+// updated with relaxed atomics; rendering reads the stripes without taking
+// any lock.
+
+typedef enum {
+    METRIC_ACCEPTS_TELNET = 0,
+    METRIC_ACCEPTS_SSH,
+    METRIC_ACCEPTS_BROKER,
+    METRIC_CHAT_MESSAGES,
+    METRIC_CHAT_DELIVERIES,
+    METRIC_TELNET_BYTES_IN,
+    METRIC_TELNET_BYTES_OUT,
+    METRIC_LIBRARY_BYTES,
+    METRIC_HUB_EVENTS,
+    METRIC_HUB_DELIVERIES,
+    METRIC_RELAY_SENT,
+    METRIC_RELAY_RECEIVED,
+    METRIC_RELAY_DUPLICATES,
+    METRIC_RELAY_DROPPED,
+    METRIC_RELAY_BATCHES,
+    METRIC_REPLICATION_BYTES_SENT,
+    METRIC_REPLICATION_BYTES_APPLIED,
+    METRIC_REPLICATION_RESYNCS,
+    METRIC_REPLICATION_FORWARDS,
+    METRIC_COUNTER_COUNT
+} metrics_counter_t;
+
+typedef enum {
+    METRIC_SESSIONS_ACTIVE = 0,
+    METRIC_CHAT_MEMBERS,
+    METRIC_LIBRARY_DOWNLOADS,
+    METRIC_BOARDS_OPEN,
+    METRIC_RELAY_LINKS,
+    METRIC_REPLICATION_PEERS,
+    METRIC_REPLICATION_LAG_BYTES,
+    METRIC_GAUGE_COUNT
+} metrics_gauge_t;
+
+typedef enum {
+    METRIC_CHAT_BROADCAST = 0,
+    METRIC_BOARD_LIST,
+    METRIC_BOARD_LIST_SINCE,
+    METRIC_BOARD_ADD,
+    METRIC_BOARD_REMOVE,
+    METRIC_REPLICATION_DELAY,
+    METRIC_HISTOGRAM_COUNT
+} metrics_histogram_t;
+
+void metrics_add(metrics_counter_t counter, uint64_t amount);
+void metrics_gauge_add(metrics_gauge_t gauge, int64_t delta);
+void metrics_gauge_set(metrics_gauge_t gauge, int64_t value);
+void metrics_observe(metrics_histogram_t histogram, uint64_t nanoseconds);
+
+// Monotonic clock in nanoseconds, for timing observations.
+uint64_t metrics_now(void);
+
+// Writes every metric in Prometheus text exposition format.
+void metrics_write(FILE *out);
+
+// Like fdopen(), but bytes moved through the stream are added to counter
+// (METRIC_COUNTER_COUNT for none) and, when non-NULL, to tally.
+FILE *metrics_fdopen(int fd, const char *mode, metrics_counter_t counter, atomic_uint_fast64_t *tally);
+
+// Answers one scrape on an accepted connection and closes it.
+void metrics_serve(int fd);
+
+#endif // METRICS_H
@@ -0,0 +1,49 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RELAY_PEER_MAX (CONFIG_MAX_HOST_LEN + 16)
+#define RELAY_MESSAGE_MAX 1024
+
+// Links this process's chat room with other maum instances over TCP. Every
+// line said here goes to each linked instance, and lines from one link are
+// passed on to the others, so instances need not be fully meshed. Each line
+// carries its origin instance id and sequence number; a line seen before is
+// dropped, which also breaks loops. Lines queued for a link while a frame is
+// being written go out together in the next frame.
+typedef struct relay relay_t;
+
+// Called on a link's reader thread for every new line from elsewhere.
+typedef void (*relay_deliver_t)(const char *message, void *context);
+
+typedef struct {
+    char peer[RELAY_PEER_MAX];
+    int outbound;
+    uint64_t origin;
+    unsigned long long sent;
+    unsigned long long received;
+    unsigned long long duplicates;
+    unsigned long long dropped;
+    size_t queued;
+} relay_link_info_t;
+
+// Dials every peer, and dials again whenever that link drops.
+relay_t *relay_create(const config_peer_t *peers, size_t count, relay_deliver_t deliver, void *context);
+// Closes every link; deliver is not called once this returns.
+void relay_destroy(relay_t *relay);
+
+// Takes over a connection accepted on the relay listener.
+void relay_accept(relay_t *relay, int fd, const char *peer);
+// Sends a line said in this process to every linked instance. Never blocks
+// on the network; a link that has fallen too far behind drops the line.
+void relay_publish(relay_t *relay, const char *message);
+
+uint64_t relay_origin(const relay_t *relay);
+// Caller frees *links.
+int relay_list(relay_t *relay, relay_link_info_t **links, size_t *count);
+
+#endif // RELAY_H
@@ -0,0 +1,33 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include "board_directory.h"
+#include "config.h"
+
+#include <stdio.h>
+
+struct hub;
+
+// Board replication between instances. The leader streams every board file
+// to each follower as it grows; a follower appends what it receives to its
+// own copy and serves reads from it, and sends posts and removals to the
+// leader instead of making them. A follower that reconnects offers the length
+// and a hash of each of its files; when that matches the start of the
+// leader's file it continues from there, otherwise (the leader removed a
+// post since) the board is sent whole.
+typedef struct replica replica_t;
+
+// Streams boards to followers handed to replica_accept(). hub wakes the
+// streams on every post and removal.
+replica_t *replica_leader_create(board_directory_t *boards, struct hub *hub);
+// Follows the leader at leader, reconnecting whenever the link drops, and
+// sets every board in boards to forward its writes there.
+replica_t *replica_follower_create(board_directory_t *boards, const config_peer_t *leader);
+void replica_destroy(replica_t *replica);
+
+// Leader: takes over a connection accepted on the replication listener.
+void replica_accept(replica_t *replica, int fd, const char *peer);
+// Writes the state of every link, one table, for the admin socket.
+void replica_report(replica_t *replica, FILE *out);
+
+#endif // REPLICA_H
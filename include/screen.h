@@ -0,0 +1,28 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Immutable, reference-counted block of terminal output with line endings
+// already converted to CRLF, sent to a client with a single write.
+typedef struct screen screen_t;
+
+// Joins lines with CRLF; trailer (may be NULL) is appended without one, e.g.
+// a prompt.
+screen_t *screen_build(const char *const *lines, size_t count, const char *trailer);
+screen_t *screen_retain(screen_t *screen);
+void screen_release(screen_t *screen);
+void screen_send(const screen_t *screen, FILE *out);
+
+// Caches a text file rendered between a header and footer line, re-reading it
+// only when its mtime, size or inode changes.
+typedef struct motd_cache motd_cache_t;
+
+motd_cache_t *motd_cache_create(const char *path, const char *header, const char *footer);
+void motd_cache_destroy(motd_cache_t *cache);
+
+// Returns a retained screen; release it with screen_release().
+screen_t *motd_cache_acquire(motd_cache_t *cache);
+
+#endif // SCREEN_H
@@ -5,8 +5,12 @@
 
 typedef struct server_context server_context_t;
 
-server_context_t *server_create(const maum_config_t *config);
+// config_path is re-read on SIGHUP.
+server_context_t *server_create(const maum_config_t *config, const char *config_path);
 void server_destroy(server_context_t *ctx);
+// Adopts the listening sockets of a running server (graceful upgrade); the old
+// process stops accepting and drains once server_run() is accepting here.
+int server_takeover(server_context_t *ctx);
 int server_run(server_context_t *ctx);
 
 #endif // SERVER_H
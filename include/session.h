@@ -2,10 +2,17 @@
 #define SESSION_H
 
 #include "board.h"
+#include "board_directory.h"
 #include "config.h"
+#include "relay.h"
+#include "replica.h"
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#define SESSION_PEER_MAX 64
+
 typedef struct session_manager session_manager_t;
 
 typedef enum {
@@ -14,6 +21,19 @@ typedef enum {
     SESSION_TRANSPORT_STDIO
 } session_transport_t;
 
+// Point-in-time view of one connected session, for the admin socket.
+typedef struct {
+    unsigned int id;
+    const char *transport;
+    const char *state;
+    char peer[SESSION_PEER_MAX];
+    char username[BOARD_AUTHOR_MAX];
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    unsigned int connected_seconds;
+    unsigned int idle_seconds;
+} session_info_t;
+
 session_manager_t *session_manager_create(const maum_config_t *config);
 void session_manager_destroy(session_manager_t *manager);
 
@@ -23,4 +43,38 @@ void session_manager_run(session_manager_t *manager,
                          FILE *output,
                          const char *peer_identity);
 
+// Runs a session over a connected descriptor and closes it afterwards.
+int session_manager_run_fd(session_manager_t *manager,
+                           session_transport_t transport,
+                           int fd,
+                           const char *peer_identity);
+
+size_t session_manager_active_count(session_manager_t *manager);
+// Blocks until every session has ended or the timeout passes; returns the
+// number of sessions still running.
+size_t session_manager_wait_idle(session_manager_t *manager, unsigned int timeout_ms);
+// Writes message to every session without holding the session lock; each
+// write gives up after a short send timeout.
+void session_manager_notify_all(session_manager_t *manager, const char *message);
+void session_manager_expire_all(session_manager_t *manager);
+
+int session_manager_list(session_manager_t *manager, session_info_t **sessions, size_t *count);
+// Disconnects the session with the given id; returns -1 if there is none.
+int session_manager_kick(session_manager_t *manager, unsigned int id);
+// The board in board_path, opened if it was not yet.
+board_t *session_manager_board(session_manager_t *manager);
+board_directory_t *session_manager_boards(session_manager_t *manager);
+// Joins the chat room to other instances through a relay (see relay.h).
+int session_manager_start_relay(session_manager_t *manager, const config_peer_t *peers, size_t count);
+// NULL unless started.
+relay_t *session_manager_relay(session_manager_t *manager);
+// Starts replication in the role config->replication_role names (see
+// replica.h); does nothing when it is off.
+int session_manager_start_replication(session_manager_t *manager, const maum_config_t *config);
+// NULL unless started.
+replica_t *session_manager_replica(session_manager_t *manager);
+// snapshot_create() of every board and the read cursors into the configured
+// snapshot_dir.
+int session_manager_snapshot(session_manager_t *manager, char *path, size_t size);
+
 #endif // SESSION_H
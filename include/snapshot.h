@@ -0,0 +1,20 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "board_directory.h"
+#include "cursor.h"
+
+#include <stddef.h>
+
+// Online backup of the board data. Every board file (see board_capture())
+// and the read cursors are captured back to back before anything is copied,
+// so the snapshot is of one moment; the copies are then written without any
+// lock, so posting and deleting carry on meanwhile. The result is a
+// new directory under dir holding <board>.db for every board, cursors.db and
+// a MANIFEST; it appears under its final name only once complete.
+//
+// Returns 0 and the directory in path, 1 if another snapshot is running, or
+// -1 on failure.
+int snapshot_create(board_directory_t *boards, cursor_store_t *cursors, const char *dir, char *path, size_t size);
+
+#endif // SNAPSHOT_H
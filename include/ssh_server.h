@@ -0,0 +1,17 @@
+#ifndef SSH_SERVER_H
+#define SSH_SERVER_H
+
+#include "config.h"
+#include "session.h"
+
+typedef struct ssh_server ssh_server_t;
+
+// Returns NULL when libssh support is not compiled in or the listener fails.
+// A non-negative listen_fd is an already bound socket inherited on upgrade.
+ssh_server_t *ssh_server_create(const maum_config_t *config, session_manager_t *sessions, int listen_fd);
+void ssh_server_destroy(ssh_server_t *server);
+
+int ssh_server_listen_fd(const ssh_server_t *server);
+void ssh_server_accept(ssh_server_t *server);
+
+#endif // SSH_SERVER_H
@@ -1,6 +1,7 @@
 #ifndef TELNET_H
 #define TELNET_H
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stddef.h>
 
@@ -31,7 +32,21 @@
 #define TELNET_OPT_TERMINAL_SPEED 32
 #define TELNET_OPT_LINEMODE 34
 
+// What is known about the client's terminal. The size comes from NAWS and is
+// zero until the client reports one; charset (a charset_t) is what the
+// terminal sends and expects, and is read by the connection's output stream.
+typedef struct {
+    unsigned short width;
+    unsigned short height;
+    atomic_int charset;
+    // Set by the session around password prompts; input echoes as '*'.
+    int masked;
+} telnet_terminal_t;
+
 void telnet_send_initial_negotiation(FILE *out);
-int telnet_read_line(FILE *in, FILE *out, char *buffer, size_t size);
+// Reads a line into buffer as UTF-8, decoding from terminal->charset and
+// echoing to out, which must convert back. terminal is also updated from any
+// NAWS subnegotiation read on the way.
+int telnet_read_line(FILE *in, FILE *out, telnet_terminal_t *terminal, char *buffer, size_t size);
 
 #endif // TELNET_H
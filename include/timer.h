@@ -0,0 +1,27 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+typedef struct timer_wheel timer_wheel_t;
+
+typedef void (*timer_callback_t)(void *arg);
+
+typedef struct timer_entry {
+    struct timer_entry *next;
+    struct timer_entry **pprev;
+    uint64_t expires;
+    timer_callback_t callback;
+    void *arg;
+} timer_entry_t;
+
+timer_wheel_t *timer_wheel_create(unsigned int tick_ms);
+void timer_wheel_destroy(timer_wheel_t *wheel);
+
+// Callbacks run on the wheel thread with the wheel locked: they must be short,
+// must not block and must not call back into the timer API.
+void timer_init(timer_entry_t *timer, timer_callback_t callback, void *arg);
+void timer_arm(timer_wheel_t *wheel, timer_entry_t *timer, unsigned int timeout_ms);
+void timer_cancel(timer_wheel_t *wheel, timer_entry_t *timer);
+
+#endif // TIMER_H
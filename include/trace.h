@@ -0,0 +1,17 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "log.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Binary trace of every LOG_* call, independent of the text log level, kept
+// in a memory-mapped ring file. Decode it with tools/maum-tracedump. An
+// existing file at path is kept as path.1.
+int trace_open(const char *path, size_t size_kb);
+bool trace_active(void);
+void trace_record(log_site_t *site, va_list args);
+
+#endif // TRACE_H
@@ -0,0 +1,83 @@
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// On-disk layout of the binary trace ring shared by the server and
+// tools/maum-tracedump:
+//
+//   trace_file_header_t | trace_site_t[site_capacity] | trace_record_t[record_count]
+//
+// Each log call site is described once in the site table; records carry only
+// the site id, a timestamp, a thread number and the raw arguments.
+
+#define TRACE_MAGIC "MAUMTRC"
+#define TRACE_VERSION 1
+
+#define TRACE_MAX_ARGS 16
+#define TRACE_COMPONENT_MAX 24
+#define TRACE_FORMAT_MAX 210
+#define TRACE_PAYLOAD_MAX 104
+#define TRACE_STRING_MAX 48
+
+#define TRACE_RECORD_TRUNCATED 0x01
+
+typedef enum {
+    TRACE_ARG_INT = 1,
+    TRACE_ARG_UINT,
+    TRACE_ARG_LONG,
+    TRACE_ARG_ULONG,
+    TRACE_ARG_LLONG,
+    TRACE_ARG_ULLONG,
+    TRACE_ARG_SIZE,
+    TRACE_ARG_SSIZE,
+    TRACE_ARG_DOUBLE,
+    TRACE_ARG_STRING,
+    TRACE_ARG_POINTER
+} trace_arg_type_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t record_count;
+    uint32_t site_capacity;
+    _Atomic uint32_t site_count;
+    uint32_t reserved;
+    _Atomic uint64_t next_seq;
+    uint8_t padding[24];
+} trace_file_header_t;
+
+typedef struct {
+    _Atomic uint32_t ready;
+    uint8_t level;
+    uint8_t arg_count;
+    uint8_t arg_types[TRACE_MAX_ARGS];
+    char component[TRACE_COMPONENT_MAX];
+    char format[TRACE_FORMAT_MAX];
+} trace_site_t;
+
+// seq is zero while a record is being written and index + 1 once complete.
+// Integers are stored as 8 bytes, strings as a length byte plus bytes.
+typedef struct {
+    _Atomic uint64_t seq;
+    uint64_t timestamp_ns;
+    uint32_t thread;
+    uint16_t site;
+    uint8_t flags;
+    uint8_t payload_length;
+    unsigned char payload[TRACE_PAYLOAD_MAX];
+} trace_record_t;
+
+_Static_assert(sizeof(trace_file_header_t) == 64, "trace header layout");
+_Static_assert(sizeof(trace_site_t) == 256, "trace site layout");
+_Static_assert(sizeof(trace_record_t) == 128, "trace record layout");
+
+// Fills types with the va_arg type of each conversion in fmt (a '*' width or
+// precision counts as an int). Returns the argument count, or -1 when fmt
+// uses something the trace cannot capture.
+int trace_format_parse(const char *fmt, uint8_t *types, size_t max_types);
+
+#endif // TRACE_FORMAT_H
@@ -0,0 +1,12 @@
+#ifndef UNIX_SOCKET_H
+#define UNIX_SOCKET_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Listens on a Unix stream socket. Unless `replace` is set, a path that still
+// answers connections is left alone and -1 is returned.
+int unix_socket_listen(const char *path, mode_t mode, bool replace);
+int unix_socket_connect(const char *path);
+
+#endif // UNIX_SOCKET_H
@@ -0,0 +1,44 @@
+#ifndef VSCREEN_H
+#define VSCREEN_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define VSCREEN_BOLD 1u
+#define VSCREEN_REVERSE 2u
+
+// Virtual terminal screen for full-screen views. Drawing goes to a back
+// buffer of cells; flushing compares it with what the terminal is known to
+// show and sends only cursor moves, attribute changes and changed cells, as
+// one write. Hangul and other East Asian wide characters take two cells.
+typedef struct vscreen vscreen_t;
+
+vscreen_t *vscreen_create(unsigned int width, unsigned int height);
+void vscreen_destroy(vscreen_t *screen);
+// Keeps nothing; the next flush repaints the terminal.
+int vscreen_resize(vscreen_t *screen, unsigned int width, unsigned int height);
+unsigned int vscreen_width(const vscreen_t *screen);
+unsigned int vscreen_height(const vscreen_t *screen);
+
+// Something else wrote to the terminal: anywhere, or on one row from column
+// on (e.g. echoed input). The next flush erases what may differ and redraws
+// it.
+void vscreen_invalidate(vscreen_t *screen);
+void vscreen_invalidate_row(vscreen_t *screen, unsigned int row, unsigned int column);
+
+// Blanks the back buffer.
+void vscreen_clear(vscreen_t *screen);
+// Draws UTF-8 text from column x, clipped at the right edge, and returns the
+// column after it. Control characters and invalid bytes are drawn as '?'.
+unsigned int vscreen_print(vscreen_t *screen, unsigned int x, unsigned int y, unsigned int attr, const char *text);
+// Where the cursor is left after a flush.
+void vscreen_move(vscreen_t *screen, unsigned int x, unsigned int y);
+// Returns the number of bytes written.
+size_t vscreen_flush(vscreen_t *screen, FILE *out);
+
+// Columns text takes on a terminal.
+unsigned int vscreen_text_width(const char *text);
+// Length in bytes of the longest start of text that fits in columns.
+size_t vscreen_text_fit(const char *text, unsigned int columns);
+
+#endif // VSCREEN_H
@@ -0,0 +1,35 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Framing shared by the instance-to-instance TCP links. A frame is a 4-byte
+// big-endian payload length, a 1-byte type and the payload.
+#define WIRE_HEADER_SIZE 5
+#define WIRE_PAYLOAD_MAX (256 * 1024)
+
+// Connects to host:port over TCP, giving up on each address after
+// timeout_ms, and applies wire_configure(); -1 on failure.
+int wire_connect(const char *host, unsigned short port, unsigned int timeout_ms);
+// Sets TCP_NODELAY and short keepalive and user timeouts, so a link whose
+// peer vanished without closing it fails within about half a minute instead
+// of blocking its reader forever.
+void wire_configure(int fd);
+
+// Writes one frame, retrying short writes. 0 or -1.
+int wire_send(int fd, uint8_t type, const void *payload, size_t length);
+// Reads one frame into buffer (size should be WIRE_PAYLOAD_MAX). Returns 0,
+// 1 on a clean end of stream before a header, or -1 on error or oversize.
+int wire_receive(int fd, uint8_t *type, void *buffer, size_t size, size_t *length);
+
+// Big-endian encoding into and out of payloads; the get functions advance
+// *offset and return -1 when the payload is too short.
+void wire_put_u16(unsigned char *out, uint16_t value);
+void wire_put_u32(unsigned char *out, uint32_t value);
+void wire_put_u64(unsigned char *out, uint64_t value);
+int wire_get_u16(const unsigned char *payload, size_t length, size_t *offset, uint16_t *value);
+int wire_get_u32(const unsigned char *payload, size_t length, size_t *offset, uint32_t *value);
+int wire_get_u64(const unsigned char *payload, size_t length, size_t *offset, uint64_t *value);
+
+#endif // WIRE_H
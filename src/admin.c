@@ -0,0 +1,374 @@
+#include "admin.h"
+
+#include "board.h"
+#include "config.h"
+#include "log.h"
+#include "relay.h"
+#include "replica.h"
+#include "unix_socket.h"
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define COMPONENT "admin"
+
+#define ADMIN_LINE_MAX 256
+#define ADMIN_ERROR_PREFIX "error:"
+
+typedef struct {
+    const char *name;
+    size_t offset;
+} admin_limit_t;
+
+typedef struct {
+    const admin_limit_t *limit;
+    unsigned int value;
+} admin_limit_change_t;
+
+// Session limits that `set` may change; each is an unsigned int in the config.
+static const admin_limit_t admin_limits[] = {
+    {"max_sessions", offsetof(maum_config_t, max_sessions)},
+    {"login_timeout", offsetof(maum_config_t, login_timeout)},
+    {"idle_timeout", offsetof(maum_config_t, idle_timeout)},
+    {"chat_idle_timeout", offsetof(maum_config_t, chat_idle_timeout)},
+    {"library_rate_kbps", offsetof(maum_config_t, library_rate_kbps)},
+    {"library_max_downloads", offsetof(maum_config_t, library_max_downloads)},
+};
+
+static unsigned int read_limit(const maum_config_t *config, const admin_limit_t *limit)
+{
+    return *(const unsigned int *)((const char *)config + limit->offset);
+}
+
+static int apply_limit(maum_config_t *draft, void *context)
+{
+    const admin_limit_change_t *change = context;
+    *(unsigned int *)((char *)draft + change->limit->offset) = change->value;
+    return 0;
+}
+
+static void reply_error(FILE *out, const char *message)
+{
+    fprintf(out, "%s %s\n", ADMIN_ERROR_PREFIX, message);
+}
+
+static void reply_ok(FILE *out)
+{
+    fputs("ok\n", out);
+}
+
+static void list_sessions(session_manager_t *sessions, FILE *out, int chat_only)
+{
+    session_info_t *items = NULL;
+    size_t count = 0;
+    if (session_manager_list(sessions, &items, &count) != 0) {
+        reply_error(out, "could not list sessions");
+        return;
+    }
+
+    fprintf(out, "%-6s %-7s %-6s %-16s %-24s %10s %10s %9s %7s\n", "ID", "VIA", "STATE", "USER", "PEER", "IN",
+            "OUT", "CONNECTED", "IDLE");
+    size_t shown = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const session_info_t *info = &items[i];
+        if (chat_only && strcmp(info->state, "chat") != 0) {
+            continue;
+        }
+        fprintf(out, "%-6u %-7s %-6s %-16s %-24s %10llu %10llu %8us %6us\n", info->id, info->transport,
+                info->state, info->username, info->peer, (unsigned long long)info->bytes_in,
+                (unsigned long long)info->bytes_out, info->connected_seconds, info->idle_seconds);
+        shown++;
+    }
+    fprintf(out, "%zu %s\n", shown, chat_only ? "in chat" : "session(s)");
+    free(items);
+    reply_ok(out);
+}
+
+static void write_board_stats(FILE *out, const board_spec_t *spec, const board_stats_t *stats)
+{
+    fprintf(out, "%-16s %-6s %8zu %8u %12llu %8llu %8llu %8llu\n", spec->name, "open", stats->posts, stats->next_id,
+            stats->bytes, stats->lists, stats->adds, stats->removes);
+}
+
+// Without a name, boards nobody has used yet are listed as closed rather than
+// opened just to be counted.
+static void show_board(session_manager_t *sessions, const char *name, FILE *out)
+{
+    board_directory_t *boards = session_manager_boards(sessions);
+    size_t first = 0;
+    size_t last = board_directory_count(boards);
+    if (name != NULL) {
+        int index = board_directory_find(boards, name);
+        if (index < 0) {
+            reply_error(out, "no such board");
+            return;
+        }
+        if (board_directory_open(boards, (size_t)index) == NULL) {
+            reply_error(out, "could not open board");
+            return;
+        }
+        first = (size_t)index;
+        last = first + 1;
+    }
+
+    fprintf(out, "%-16s %-6s %8s %8s %12s %8s %8s %8s\n", "BOARD", "STATE", "POSTS", "NEXT_ID", "BYTES", "LISTS",
+            "ADDS", "REMOVES");
+    for (size_t i = first; i < last; ++i) {
+        const board_spec_t *spec = board_directory_spec(boards, i);
+        board_t *board = board_directory_peek(boards, i);
+        board_stats_t stats;
+        if (board == NULL) {
+            fprintf(out, "%-16s %-6s\n", spec->name, "closed");
+        } else if (board_stats(board, &stats) != 0) {
+            fprintf(out, "%-16s %-6s\n", spec->name, "error");
+        } else {
+            write_board_stats(out, spec, &stats);
+        }
+    }
+    reply_ok(out);
+}
+
+static void kick_session(session_manager_t *sessions, const char *argument, FILE *out)
+{
+    char *end = NULL;
+    unsigned long id = argument != NULL ? strtoul(argument, &end, 10) : 0;
+    if (argument == NULL || end == argument || *end != '\0' || id == 0) {
+        reply_error(out, "usage: kick <id>");
+        return;
+    }
+    if (session_manager_kick(sessions, (unsigned int)id) != 0) {
+        reply_error(out, "no such session");
+        return;
+    }
+    LOG_INFO(COMPONENT, "Session %lu disconnected by admin", id);
+    reply_ok(out);
+}
+
+static void show_relay(session_manager_t *sessions, FILE *out)
+{
+    relay_t *relay = session_manager_relay(sessions);
+    if (relay == NULL) {
+        reply_error(out, "chat relay is not enabled");
+        return;
+    }
+    relay_link_info_t *links = NULL;
+    size_t count = 0;
+    if (relay_list(relay, &links, &count) != 0) {
+        reply_error(out, "could not list relay links");
+        return;
+    }
+    fprintf(out, "instance %016llx\n", (unsigned long long)relay_origin(relay));
+    fprintf(out, "%-32s %-4s %-16s %10s %10s %10s %8s %8s\n", "PEER", "DIR", "INSTANCE", "SENT", "RECEIVED",
+            "DUPLICATE", "DROPPED", "QUEUED");
+    for (size_t i = 0; i < count; ++i) {
+        const relay_link_info_t *link = &links[i];
+        fprintf(out, "%-32s %-4s %016llx %10llu %10llu %10llu %8llu %8zu\n", link->peer, link->outbound ? "out" : "in",
+                (unsigned long long)link->origin, link->sent, link->received, link->duplicates, link->dropped,
+                link->queued);
+    }
+    fprintf(out, "%zu link(s)\n", count);
+    free(links);
+    reply_ok(out);
+}
+
+static void show_replication(session_manager_t *sessions, FILE *out)
+{
+    replica_t *replica = session_manager_replica(sessions);
+    if (replica == NULL) {
+        reply_error(out, "replication is not enabled");
+        return;
+    }
+    replica_report(replica, out);
+    reply_ok(out);
+}
+
+static void take_snapshot(session_manager_t *sessions, FILE *out)
+{
+    char path[512];
+    int rc = session_manager_snapshot(sessions, path, sizeof(path));
+    if (rc == 1) {
+        reply_error(out, "a snapshot is already running");
+        return;
+    }
+    if (rc != 0) {
+        reply_error(out, "snapshot failed (see the log)");
+        return;
+    }
+    fprintf(out, "snapshot %s\n", path);
+    reply_ok(out);
+}
+
+static void change_log_level(const char *argument, FILE *out)
+{
+    if (argument == NULL) {
+        fprintf(out, "loglevel %s\n", log_level_name(log_get_level()));
+        reply_ok(out);
+        return;
+    }
+    log_level_t level;
+    if (log_parse_level(argument, &level) != 0) {
+        reply_error(out, "usage: loglevel [debug|info|warn|error]");
+        return;
+    }
+    log_set_level(level);
+    LOG_INFO(COMPONENT, "Log level set to %s", log_level_name(level));
+    reply_ok(out);
+}
+
+static void change_limit(const char *key, const char *value, FILE *out)
+{
+    if (key == NULL) {
+        const maum_config_t *config = config_current();
+        for (size_t i = 0; i < sizeof(admin_limits) / sizeof(admin_limits[0]); ++i) {
+            fprintf(out, "%s %u\n", admin_limits[i].name, read_limit(config, &admin_limits[i]));
+        }
+        reply_ok(out);
+        return;
+    }
+
+    char *end = NULL;
+    unsigned long parsed = value != NULL ? strtoul(value, &end, 10) : 0;
+    if (value == NULL || end == value || *end != '\0') {
+        reply_error(out, "usage: set <key> <value>");
+        return;
+    }
+    for (size_t i = 0; i < sizeof(admin_limits) / sizeof(admin_limits[0]); ++i) {
+        if (strcmp(key, admin_limits[i].name) == 0) {
+            admin_limit_change_t change = {&admin_limits[i], (unsigned int)parsed};
+            if (config_update(apply_limit, &change) != 0) {
+                reply_error(out, "could not publish configuration");
+                return;
+            }
+            LOG_INFO(COMPONENT, "%s set to %lu (config version %u)", key, parsed, config_version());
+            reply_ok(out);
+            return;
+        }
+    }
+    reply_error(out, "unknown key (max_sessions, login_timeout, idle_timeout, chat_idle_timeout, "
+                     "library_rate_kbps, library_max_downloads)");
+}
+
+static void show_help(FILE *out)
+{
+    fputs("sessions                 list connected sessions\n"
+          "chat                     list sessions in the chat room\n"
+          "board [name]             per-board statistics\n"
+          "kick <id>                disconnect a session\n"
+          "relay                    list chat relay links\n"
+          "replication              show board replication state\n"
+          "snapshot                 back up every board and the read cursors\n"
+          "loglevel [level]         show or change the log level\n"
+          "set [<key> <value>]      show or change session limits\n"
+          "quit                     close this connection\n",
+          out);
+    reply_ok(out);
+}
+
+// Returns 0 to keep reading commands, 1 on quit.
+static int dispatch(session_manager_t *sessions, char *line, FILE *out)
+{
+    char *saveptr = NULL;
+    char *command = strtok_r(line, " \t", &saveptr);
+    char *first = strtok_r(NULL, " \t", &saveptr);
+    char *second = strtok_r(NULL, " \t", &saveptr);
+
+    if (command == NULL) {
+        return 0;
+    }
+    if (strcmp(command, "sessions") == 0) {
+        list_sessions(sessions, out, 0);
+    } else if (strcmp(command, "chat") == 0) {
+        list_sessions(sessions, out, 1);
+    } else if (strcmp(command, "board") == 0) {
+        show_board(sessions, first, out);
+    } else if (strcmp(command, "kick") == 0) {
+        kick_session(sessions, first, out);
+    } else if (strcmp(command, "relay") == 0) {
+        show_relay(sessions, out);
+    } else if (strcmp(command, "replication") == 0) {
+        show_replication(sessions, out);
+    } else if (strcmp(command, "snapshot") == 0) {
+        take_snapshot(sessions, out);
+    } else if (strcmp(command, "loglevel") == 0) {
+        change_log_level(first, out);
+    } else if (strcmp(command, "set") == 0) {
+        change_limit(first, second, out);
+    } else if (strcmp(command, "help") == 0) {
+        show_help(out);
+    } else if (strcmp(command, "quit") == 0) {
+        return 1;
+    } else {
+        reply_error(out, "unknown command (try help)");
+    }
+    return 0;
+}
+
+void admin_serve(int fd, session_manager_t *sessions)
+{
+    FILE *in = fdopen(fd, "r");
+    if (in == NULL) {
+        close(fd);
+        return;
+    }
+    int out_fd = dup(fd);
+    FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+    if (out == NULL) {
+        if (out_fd >= 0) {
+            close(out_fd);
+        }
+        fclose(in);
+        return;
+    }
+
+    char line[ADMIN_LINE_MAX];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        size_t length = strlen(line);
+        while (length > 0 && isspace((unsigned char)line[length - 1])) {
+            line[--length] = '\0';
+        }
+        if (dispatch(sessions, line, out) != 0) {
+            break;
+        }
+        if (fflush(out) != 0) {
+            break;
+        }
+    }
+
+    fclose(out);
+    fclose(in);
+}
+
+int admin_request(const char *path, const char *command, FILE *out)
+{
+    int fd = unix_socket_connect(path);
+    if (fd < 0) {
+        return -1;
+    }
+
+    size_t length = strlen(command);
+    if (write(fd, command, length) != (ssize_t)length || write(fd, "\n", 1) != 1) {
+        close(fd);
+        return -1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    FILE *in = fdopen(fd, "r");
+    if (in == NULL) {
+        close(fd);
+        return -1;
+    }
+    int result = 0;
+    char line[ADMIN_LINE_MAX];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (strncmp(line, ADMIN_ERROR_PREFIX, strlen(ADMIN_ERROR_PREFIX)) == 0) {
+            result = -1;
+        }
+        fputs(line, out);
+    }
+    fclose(in);
+    return result;
+}
@@ -1,9 +1,15 @@
 #include "board.h"
 
+#include "hub.h"
+#include "lock_profile.h"
 #include "log.h"
+#include "metrics.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,10 +20,34 @@
 
 #define COMPONENT "board"
 
+#define BOARD_LINE_MAX (BOARD_AUTHOR_MAX + BOARD_TIMESTAMP_MAX + BOARD_CONTENT_MAX + 32)
+
+// Where each post's line starts. Posts are appended with rising ids, so the
+// index is sorted and the posts after a given id are a tail of the file.
+typedef struct {
+    unsigned int id;
+    long offset;
+} board_index_entry_t;
+
+typedef struct {
+    board_index_entry_t *entries;
+    size_t length;
+    size_t capacity;
+    // False if the file was edited out of id order; lookups then scan.
+    bool sorted;
+} board_index_t;
+
 struct board {
-    char path[256];
-    pthread_mutex_t lock;
+    char path[BOARD_PATH_MAX];
+    char name[BOARD_NAME_MAX];
+    profiled_mutex_t lock;
     unsigned int next_id;
+    board_index_t index;
+    _Atomic(hub_t *) hub;
+    _Atomic(const board_forward_t *) forward;
+    atomic_ullong lists;
+    atomic_ullong adds;
+    atomic_ullong removes;
 };
 
 static int ensure_directory_exists(const char *path)
@@ -51,8 +81,37 @@ static int ensure_directory_exists(const char *path)
     return 0;
 }
 
-static void update_next_id(board_t *board)
+static int index_append(board_index_t *index, unsigned int id, long offset)
+{
+    if (index->length == index->capacity) {
+        size_t capacity = index->capacity > 0 ? index->capacity * 2 : 64;
+        board_index_entry_t *entries = realloc(index->entries, capacity * sizeof(*entries));
+        if (entries == NULL) {
+            return -1;
+        }
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+    if (index->length > 0 && id <= index->entries[index->length - 1].id) {
+        index->sorted = false;
+    }
+    index->entries[index->length].id = id;
+    index->entries[index->length].offset = offset;
+    index->length++;
+    return 0;
+}
+
+static void index_free(board_index_t *index)
 {
+    free(index->entries);
+    memset(index, 0, sizeof(*index));
+    index->sorted = true;
+}
+
+// Scans the file once for the next id and the line offsets.
+static void load_index(board_t *board)
+{
+    index_free(&board->index);
     FILE *file = fopen(board->path, "r");
     if (file == NULL) {
         board->next_id = 1;
@@ -60,18 +119,40 @@ static void update_next_id(board_t *board)
     }
 
     unsigned int max_id = 0;
-    char line[BOARD_AUTHOR_MAX + BOARD_TIMESTAMP_MAX + BOARD_CONTENT_MAX + 32];
+    char line[BOARD_LINE_MAX];
+    long offset = 0;
     while (fgets(line, sizeof(line), file) != NULL) {
         unsigned long value = strtoul(line, NULL, 10);
         if (value > max_id) {
             max_id = (unsigned int)value;
         }
+        if (value > 0 && index_append(&board->index, (unsigned int)value, offset) != 0) {
+            // Without a complete index, lookups fall back to scanning.
+            board->index.sorted = false;
+        }
+        offset = ftell(file);
     }
 
     fclose(file);
     board->next_id = max_id + 1;
 }
 
+// First entry with an id above after_id.
+static size_t index_upper_bound(const board_index_t *index, unsigned int after_id)
+{
+    size_t low = 0;
+    size_t high = index->length;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (index->entries[middle].id <= after_id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
 board_t *board_create(const char *path)
 {
     if (path == NULL) {
@@ -89,8 +170,13 @@ board_t *board_create(const char *path)
 
     strncpy(board->path, path, sizeof(board->path) - 1);
     board->path[sizeof(board->path) - 1] = '\0';
+    atomic_init(&board->hub, NULL);
+    atomic_init(&board->forward, NULL);
+    atomic_init(&board->lists, 0);
+    atomic_init(&board->adds, 0);
+    atomic_init(&board->removes, 0);
 
-    if (pthread_mutex_init(&board->lock, NULL) != 0) {
+    if (profiled_mutex_init(&board->lock, "board") != 0) {
         free(board);
         return NULL;
     }
@@ -98,13 +184,13 @@ board_t *board_create(const char *path)
     FILE *file = fopen(board->path, "a+");
     if (file == NULL) {
         LOG_ERROR(COMPONENT, "Unable to open board storage '%s': %s", path, strerror(errno));
-        pthread_mutex_destroy(&board->lock);
+        profiled_mutex_destroy(&board->lock);
         free(board);
         return NULL;
     }
     fclose(file);
 
-    update_next_id(board);
+    load_index(board);
     return board;
 }
 
@@ -113,7 +199,8 @@ void board_destroy(board_t *board)
     if (board == NULL) {
         return;
     }
-    pthread_mutex_destroy(&board->lock);
+    index_free(&board->index);
+    profiled_mutex_destroy(&board->lock);
     free(board);
 }
 
@@ -160,7 +247,16 @@ static int parse_line(const char *line, board_post_t *post)
     return 0;
 }
 
-int board_list(board_t *board, board_post_t **posts, size_t *count)
+static void count_operation(atomic_ullong *counter, int rc)
+{
+    if (rc == 0) {
+        atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+    }
+}
+
+// Posts with ids above after_id. With a sorted index only the tail of the file
+// after the last post not wanted is read.
+static int list_posts(board_t *board, unsigned int after_id, board_post_t **posts, size_t *count)
 {
     if (board == NULL || posts == NULL || count == NULL) {
         return -1;
@@ -169,28 +265,40 @@ int board_list(board_t *board, board_post_t **posts, size_t *count)
     *posts = NULL;
     *count = 0;
 
-    if (pthread_mutex_lock(&board->lock) != 0) {
+    if (profiled_mutex_lock(&board->lock) != 0) {
         return -1;
     }
 
+    const board_index_t *index = &board->index;
+    size_t first = index->sorted ? index_upper_bound(index, after_id) : 0;
+    if (index->sorted && first == index->length) {
+        profiled_mutex_unlock(&board->lock);
+        return 0;
+    }
+
     FILE *file = fopen(board->path, "r");
     if (file == NULL) {
-        pthread_mutex_unlock(&board->lock);
+        profiled_mutex_unlock(&board->lock);
+        return -1;
+    }
+    if (index->sorted && first > 0 && fseek(file, index->entries[first].offset, SEEK_SET) != 0) {
+        fclose(file);
+        profiled_mutex_unlock(&board->lock);
         return -1;
     }
 
-    size_t capacity = 8;
+    size_t capacity = index->length - first > 8 ? index->length - first : 8;
     board_post_t *items = calloc(capacity, sizeof(*items));
     if (items == NULL) {
         fclose(file);
-        pthread_mutex_unlock(&board->lock);
+        profiled_mutex_unlock(&board->lock);
         return -1;
     }
 
-    char line[BOARD_AUTHOR_MAX + BOARD_TIMESTAMP_MAX + BOARD_CONTENT_MAX + 32];
+    char line[BOARD_LINE_MAX];
     while (fgets(line, sizeof(line), file) != NULL) {
         board_post_t post;
-        if (parse_line(line, &post) != 0) {
+        if (parse_line(line, &post) != 0 || post.id <= after_id) {
             continue;
         }
         if (*count >= capacity) {
@@ -199,7 +307,7 @@ int board_list(board_t *board, board_post_t **posts, size_t *count)
             if (tmp == NULL) {
                 free(items);
                 fclose(file);
-                pthread_mutex_unlock(&board->lock);
+                profiled_mutex_unlock(&board->lock);
                 return -1;
             }
             items = tmp;
@@ -209,12 +317,52 @@ int board_list(board_t *board, board_post_t **posts, size_t *count)
     }
 
     fclose(file);
-    pthread_mutex_unlock(&board->lock);
+    profiled_mutex_unlock(&board->lock);
 
     *posts = items;
     return 0;
 }
 
+int board_list(board_t *board, board_post_t **posts, size_t *count)
+{
+    uint64_t started = metrics_now();
+    int rc = list_posts(board, 0, posts, count);
+    metrics_observe(METRIC_BOARD_LIST, metrics_now() - started);
+    if (board != NULL) {
+        count_operation(&board->lists, rc);
+    }
+    return rc;
+}
+
+int board_list_since(board_t *board, unsigned int after_id, board_post_t **posts, size_t *count)
+{
+    uint64_t started = metrics_now();
+    int rc = list_posts(board, after_id, posts, count);
+    metrics_observe(METRIC_BOARD_LIST_SINCE, metrics_now() - started);
+    if (board != NULL) {
+        count_operation(&board->lists, rc);
+    }
+    return rc;
+}
+
+size_t board_count_since(board_t *board, unsigned int after_id)
+{
+    if (board == NULL || profiled_mutex_lock(&board->lock) != 0) {
+        return 0;
+    }
+    const board_index_t *index = &board->index;
+    size_t count = 0;
+    if (index->sorted) {
+        count = index->length - index_upper_bound(index, after_id);
+    } else {
+        for (size_t i = 0; i < index->length; ++i) {
+            count += index->entries[i].id > after_id;
+        }
+    }
+    profiled_mutex_unlock(&board->lock);
+    return count;
+}
+
 static void build_timestamp(char *buffer, size_t size)
 {
     time_t now = time(NULL);
@@ -223,7 +371,7 @@ static void build_timestamp(char *buffer, size_t size)
     strftime(buffer, size, "%Y-%m-%d %H:%M", &tm_now);
 }
 
-int board_add(board_t *board, const char *author, const char *content, board_post_t *out_post)
+static int add_post(board_t *board, const char *author, const char *content, board_post_t *out_post)
 {
     if (board == NULL || author == NULL || content == NULL) {
         return -1;
@@ -235,13 +383,13 @@ int board_add(board_t *board, const char *author, const char *content, board_pos
         return -1;
     }
 
-    if (pthread_mutex_lock(&board->lock) != 0) {
+    if (profiled_mutex_lock(&board->lock) != 0) {
         return -1;
     }
 
     FILE *file = fopen(board->path, "a");
     if (file == NULL) {
-        pthread_mutex_unlock(&board->lock);
+        profiled_mutex_unlock(&board->lock);
         return -1;
     }
 
@@ -249,13 +397,18 @@ int board_add(board_t *board, const char *author, const char *content, board_pos
     char timestamp[BOARD_TIMESTAMP_MAX];
     build_timestamp(timestamp, sizeof(timestamp));
 
+    fseek(file, 0, SEEK_END);
+    long offset = ftell(file);
     if (fprintf(file, "%u|%s|%s|%s\n", id, timestamp, author, content) < 0) {
         fclose(file);
-        pthread_mutex_unlock(&board->lock);
+        profiled_mutex_unlock(&board->lock);
         return -1;
     }
     fflush(file);
     fclose(file);
+    if (offset < 0 || index_append(&board->index, id, offset) != 0) {
+        board->index.sorted = false;
+    }
 
     if (out_post != NULL) {
         out_post->id = id;
@@ -267,23 +420,70 @@ int board_add(board_t *board, const char *author, const char *content, board_pos
         out_post->content[sizeof(out_post->content) - 1] = '\0';
     }
 
-    pthread_mutex_unlock(&board->lock);
+    profiled_mutex_unlock(&board->lock);
     return 0;
 }
 
-int board_remove(board_t *board, unsigned int id, const char *requester, int *not_owner)
+static void publish(board_t *board, hub_topic_t topic, unsigned int id, const char *author, const char *content)
+{
+    hub_t *hub = atomic_load_explicit(&board->hub, memory_order_acquire);
+    if (hub == NULL) {
+        return;
+    }
+    hub_event_t event = {.topic = topic, .id = id};
+    snprintf(event.board, sizeof(event.board), "%s", board->name);
+    snprintf(event.author, sizeof(event.author), "%s", author != NULL ? author : "");
+    if (content != NULL) {
+        hub_summarize(event.summary, sizeof(event.summary), content);
+    }
+    hub_publish(hub, &event);
+}
+
+int board_add(board_t *board, const char *author, const char *content, board_post_t *out_post)
+{
+    uint64_t started = metrics_now();
+    board_post_t post;
+    const board_forward_t *forward = board != NULL ? atomic_load_explicit(&board->forward, memory_order_acquire) : NULL;
+    int rc = forward != NULL ? forward->add(forward->context, board->name, author, content, &post)
+                             : add_post(board, author, content, &post);
+    metrics_observe(METRIC_BOARD_ADD, metrics_now() - started);
+    if (rc == 0) {
+        count_operation(&board->adds, rc);
+        // A forwarded post is published when it comes back from the leader.
+        if (forward == NULL) {
+            publish(board, HUB_TOPIC_BOARD_POST, post.id, post.author, post.content);
+        }
+        if (out_post != NULL) {
+            *out_post = post;
+        }
+    }
+    return rc;
+}
+
+void board_set_hub(board_t *board, struct hub *hub, const char *name)
+{
+    if (board == NULL) {
+        return;
+    }
+    // Posts are only published once the hub is visible, so the name is
+    // written before it.
+    snprintf(board->name, sizeof(board->name), "%s", name != NULL ? name : "");
+    atomic_store_explicit(&board->hub, hub, memory_order_release);
+}
+
+static int remove_post(board_t *board, unsigned int id, const char *requester, int *not_owner)
 {
     if (board == NULL) {
         return -1;
     }
 
-    if (pthread_mutex_lock(&board->lock) != 0) {
+    if (profiled_mutex_lock(&board->lock) != 0) {
         return -1;
     }
 
     FILE *file = fopen(board->path, "r");
     if (file == NULL) {
-        pthread_mutex_unlock(&board->lock);
+        profiled_mutex_unlock(&board->lock);
         return -1;
     }
 
@@ -292,13 +492,14 @@ int board_remove(board_t *board, unsigned int id, const char *requester, int *no
     FILE *temp = fopen(temp_path, "w");
     if (temp == NULL) {
         fclose(file);
-        pthread_mutex_unlock(&board->lock);
+        profiled_mutex_unlock(&board->lock);
         return -1;
     }
 
-    char line[BOARD_AUTHOR_MAX + BOARD_TIMESTAMP_MAX + BOARD_CONTENT_MAX + 32];
+    char line[BOARD_LINE_MAX];
     int found = 0;
     int owner_mismatch = 0;
+    board_index_t rebuilt = {.sorted = true};
     while (fgets(line, sizeof(line), file) != NULL) {
         board_post_t post;
         if (parse_line(line, &post) != 0) {
@@ -306,11 +507,13 @@ int board_remove(board_t *board, unsigned int id, const char *requester, int *no
         }
         if (post.id == id) {
             found = 1;
-            if (requester != NULL && requester[0] != '\0' && strcmp(post.author, requester) != 0) {
-                owner_mismatch = 1;
-                fputs(line, temp);
+            if (requester == NULL || requester[0] == '\0' || strcmp(post.author, requester) == 0) {
+                continue;
             }
-            continue;
+            owner_mismatch = 1;
+        }
+        if (index_append(&rebuilt, post.id, ftell(temp)) != 0) {
+            rebuilt.sorted = false;
         }
         fputs(line, temp);
     }
@@ -319,9 +522,12 @@ int board_remove(board_t *board, unsigned int id, const char *requester, int *no
     fflush(temp);
     fclose(temp);
 
+    if (!found || owner_mismatch) {
+        index_free(&rebuilt);
+    }
     if (!found) {
         unlink(temp_path);
-        pthread_mutex_unlock(&board->lock);
+        profiled_mutex_unlock(&board->lock);
         if (not_owner != NULL) {
             *not_owner = 0;
         }
@@ -333,21 +539,187 @@ int board_remove(board_t *board, unsigned int id, const char *requester, int *no
         if (not_owner != NULL) {
             *not_owner = 1;
         }
-        pthread_mutex_unlock(&board->lock);
+        profiled_mutex_unlock(&board->lock);
         return 2;
     }
 
     if (rename(temp_path, board->path) != 0) {
         LOG_ERROR(COMPONENT, "Failed to replace board storage: %s", strerror(errno));
         unlink(temp_path);
-        pthread_mutex_unlock(&board->lock);
+        index_free(&rebuilt);
+        profiled_mutex_unlock(&board->lock);
         return -1;
     }
+    index_free(&board->index);
+    board->index = rebuilt;
 
     if (not_owner != NULL) {
         *not_owner = 0;
     }
 
-    pthread_mutex_unlock(&board->lock);
+    profiled_mutex_unlock(&board->lock);
+    return 0;
+}
+
+int board_remove(board_t *board, unsigned int id, const char *requester, int *not_owner)
+{
+    uint64_t started = metrics_now();
+    const board_forward_t *forward = board != NULL ? atomic_load_explicit(&board->forward, memory_order_acquire) : NULL;
+    int rc = forward != NULL ? forward->remove(forward->context, board->name, id, requester, not_owner)
+                             : remove_post(board, id, requester, not_owner);
+    metrics_observe(METRIC_BOARD_REMOVE, metrics_now() - started);
+    if (board != NULL) {
+        count_operation(&board->removes, rc);
+    }
+    if (rc == 0 && forward == NULL) {
+        publish(board, HUB_TOPIC_BOARD_REMOVE, id, requester, NULL);
+    }
+    return rc;
+}
+
+void board_set_forward(board_t *board, const board_forward_t *forward)
+{
+    if (board != NULL) {
+        atomic_store_explicit(&board->forward, forward, memory_order_release);
+    }
+}
+
+int board_apply(board_t *board, unsigned long long offset, const char *data, size_t length)
+{
+    if (board == NULL || data == NULL || length == 0 || data[length - 1] != '\n') {
+        return -1;
+    }
+    if (profiled_mutex_lock(&board->lock) != 0) {
+        return -1;
+    }
+    int fd = open(board->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (unsigned long long)st.st_size != offset) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        profiled_mutex_unlock(&board->lock);
+        return -1;
+    }
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = write(fd, data + written, length - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // Leave the file as it was so the next attempt starts clean.
+            if (ftruncate(fd, (off_t)offset) != 0) {
+                LOG_ERROR(COMPONENT, "Unable to undo partial write to '%s': %s", board->path, strerror(errno));
+            }
+            close(fd);
+            profiled_mutex_unlock(&board->lock);
+            return -1;
+        }
+        written += (size_t)n;
+    }
+    close(fd);
+
+    for (size_t start = 0; start < length;) {
+        const char *end = memchr(data + start, '\n', length - start);
+        size_t next = (size_t)(end - data) + 1;
+        unsigned long id = strtoul(data + start, NULL, 10);
+        if (id > 0 && index_append(&board->index, (unsigned int)id, (long)(offset + start)) != 0) {
+            board->index.sorted = false;
+        }
+        if (id >= board->next_id) {
+            board->next_id = (unsigned int)id + 1;
+        }
+        start = next;
+    }
+    profiled_mutex_unlock(&board->lock);
+
+    char line[BOARD_LINE_MAX];
+    for (size_t start = 0; start < length;) {
+        const char *end = memchr(data + start, '\n', length - start);
+        size_t next = (size_t)(end - data) + 1;
+        size_t line_length = next - start < sizeof(line) ? next - start : sizeof(line) - 1;
+        memcpy(line, data + start, line_length);
+        line[line_length] = '\0';
+        board_post_t post;
+        if (parse_line(line, &post) == 0) {
+            publish(board, HUB_TOPIC_BOARD_POST, post.id, post.author, post.content);
+        }
+        start = next;
+    }
+    return 0;
+}
+
+int board_replace(board_t *board, const char *source)
+{
+    if (board == NULL || source == NULL) {
+        return -1;
+    }
+    if (profiled_mutex_lock(&board->lock) != 0) {
+        return -1;
+    }
+    int rc = rename(source, board->path);
+    if (rc == 0) {
+        load_index(board);
+    } else {
+        LOG_ERROR(COMPONENT, "Failed to replace board storage: %s", strerror(errno));
+    }
+    profiled_mutex_unlock(&board->lock);
+    return rc;
+}
+
+int board_capture(board_t *board, int *fd, unsigned long long *length)
+{
+    if (board == NULL || fd == NULL || length == NULL) {
+        return -1;
+    }
+    if (profiled_mutex_lock(&board->lock) != 0) {
+        return -1;
+    }
+    int rc = 0;
+    *fd = open(board->path, O_RDONLY);
+    *length = 0;
+    struct stat st;
+    if (*fd >= 0 && fstat(*fd, &st) == 0) {
+        *length = (unsigned long long)st.st_size;
+    } else if (*fd >= 0 || errno != ENOENT) {
+        LOG_WARN(COMPONENT, "Unable to capture board storage '%s': %s", board->path, strerror(errno));
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+        rc = -1;
+    }
+    profiled_mutex_unlock(&board->lock);
+    return rc;
+}
+
+int board_stats(board_t *board, board_stats_t *stats)
+{
+    if (board == NULL || stats == NULL) {
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    if (profiled_mutex_lock(&board->lock) != 0) {
+        return -1;
+    }
+
+    // The index already holds one entry per stored post, so the file is only
+    // stat()ed, never read, while appends wait on the lock.
+    struct stat st;
+    if (stat(board->path, &st) == 0) {
+        stats->bytes = (unsigned long long)st.st_size;
+    } else if (errno != ENOENT) {
+        profiled_mutex_unlock(&board->lock);
+        return -1;
+    }
+    stats->posts = board->index.length;
+    stats->next_id = board->next_id;
+    stats->lists = atomic_load_explicit(&board->lists, memory_order_relaxed);
+    stats->adds = atomic_load_explicit(&board->adds, memory_order_relaxed);
+    stats->removes = atomic_load_explicit(&board->removes, memory_order_relaxed);
+
+    profiled_mutex_unlock(&board->lock);
     return 0;
 }
@@ -0,0 +1,184 @@
+#include "board_directory.h"
+
+#include "hub.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#define COMPONENT "boards"
+
+typedef struct {
+    board_spec_t spec;
+    // Serializes opening; readers that find the board set never take it.
+    pthread_mutex_t open_lock;
+    _Atomic(board_t *) board;
+} board_slot_t;
+
+struct board_directory {
+    hub_t *hub;
+    _Atomic(const board_forward_t *) forward;
+    size_t count;
+    board_slot_t slots[];
+};
+
+board_directory_t *board_directory_create(const board_spec_t *specs, size_t count, struct hub *hub)
+{
+    if (specs == NULL || count == 0) {
+        return NULL;
+    }
+    board_directory_t *directory = calloc(1, sizeof(*directory) + count * sizeof(directory->slots[0]));
+    if (directory == NULL) {
+        return NULL;
+    }
+    directory->hub = hub;
+    atomic_init(&directory->forward, NULL);
+    for (size_t i = 0; i < count; ++i) {
+        board_slot_t *slot = &directory->slots[i];
+        if (pthread_mutex_init(&slot->open_lock, NULL) != 0) {
+            board_directory_destroy(directory);
+            return NULL;
+        }
+        slot->spec = specs[i];
+        atomic_init(&slot->board, NULL);
+        directory->count++;
+    }
+    return directory;
+}
+
+void board_directory_destroy(board_directory_t *directory)
+{
+    if (directory == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < directory->count; ++i) {
+        board_slot_t *slot = &directory->slots[i];
+        board_t *board = atomic_load_explicit(&slot->board, memory_order_acquire);
+        if (board != NULL) {
+            board_destroy(board);
+            metrics_gauge_add(METRIC_BOARDS_OPEN, -1);
+        }
+        pthread_mutex_destroy(&slot->open_lock);
+    }
+    free(directory);
+}
+
+size_t board_directory_count(const board_directory_t *directory)
+{
+    return directory != NULL ? directory->count : 0;
+}
+
+const board_spec_t *board_directory_spec(const board_directory_t *directory, size_t index)
+{
+    if (directory == NULL || index >= directory->count) {
+        return NULL;
+    }
+    return &directory->slots[index].spec;
+}
+
+int board_directory_find(const board_directory_t *directory, const char *name)
+{
+    if (directory == NULL || name == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < directory->count; ++i) {
+        if (strcmp(directory->slots[i].spec.name, name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+board_t *board_directory_open(board_directory_t *directory, size_t index)
+{
+    if (directory == NULL || index >= directory->count) {
+        return NULL;
+    }
+    board_slot_t *slot = &directory->slots[index];
+    board_t *board = atomic_load_explicit(&slot->board, memory_order_acquire);
+    if (board != NULL) {
+        return board;
+    }
+
+    pthread_mutex_lock(&slot->open_lock);
+    board = atomic_load_explicit(&slot->board, memory_order_relaxed);
+    if (board == NULL) {
+        uint64_t started = metrics_now();
+        board = board_create(slot->spec.path);
+        if (board != NULL) {
+            board_set_hub(board, directory->hub, slot->spec.name);
+            board_set_forward(board, atomic_load_explicit(&directory->forward, memory_order_acquire));
+            atomic_store_explicit(&slot->board, board, memory_order_release);
+            metrics_gauge_add(METRIC_BOARDS_OPEN, 1);
+            LOG_INFO(COMPONENT, "Opened board '%s' from %s in %llu us", slot->spec.name, slot->spec.path,
+                     (unsigned long long)((metrics_now() - started) / 1000));
+        } else {
+            LOG_WARN(COMPONENT, "Could not open board '%s' from %s", slot->spec.name, slot->spec.path);
+        }
+    }
+    pthread_mutex_unlock(&slot->open_lock);
+    return board;
+}
+
+board_t *board_directory_peek(const board_directory_t *directory, size_t index)
+{
+    if (directory == NULL || index >= directory->count) {
+        return NULL;
+    }
+    return atomic_load_explicit(&directory->slots[index].board, memory_order_acquire);
+}
+
+void board_directory_set_forward(board_directory_t *directory, const board_forward_t *forward)
+{
+    if (directory == NULL) {
+        return;
+    }
+    atomic_store_explicit(&directory->forward, forward, memory_order_release);
+    for (size_t i = 0; i < directory->count; ++i) {
+        board_slot_t *slot = &directory->slots[i];
+        // Under the open lock, so a board being opened cannot miss it.
+        pthread_mutex_lock(&slot->open_lock);
+        board_set_forward(atomic_load_explicit(&slot->board, memory_order_relaxed), forward);
+        pthread_mutex_unlock(&slot->open_lock);
+    }
+}
+
+int board_directory_capture(board_directory_t *directory, size_t index, int *fd, unsigned long long *length)
+{
+    if (directory == NULL || index >= directory->count || fd == NULL || length == NULL) {
+        return -1;
+    }
+    board_slot_t *slot = &directory->slots[index];
+    // Holding the open lock keeps a closed board from being opened, and so
+    // written, while its file is captured.
+    pthread_mutex_lock(&slot->open_lock);
+    board_t *board = atomic_load_explicit(&slot->board, memory_order_relaxed);
+    int rc = 0;
+    if (board != NULL) {
+        rc = board_capture(board, fd, length);
+    } else {
+        *fd = open(slot->spec.path, O_RDONLY);
+        *length = 0;
+        struct stat st;
+        if (*fd >= 0 && fstat(*fd, &st) == 0) {
+            *length = (unsigned long long)st.st_size;
+        } else if (*fd >= 0 || errno != ENOENT) {
+            LOG_WARN(COMPONENT, "Unable to capture board '%s': %s", slot->spec.name, strerror(errno));
+            if (*fd >= 0) {
+                close(*fd);
+                *fd = -1;
+            }
+            rc = -1;
+        }
+    }
+    pthread_mutex_unlock(&slot->open_lock);
+    return rc;
+}
@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+
+#include "broker.h"
+
+#include "log.h"
+#include "unix_socket.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define COMPONENT "broker"
+
+#define BROKER_HELLO "MAUM/1 "
+#define BROKER_HELLO_MAX 256
+#define RELAY_CHUNK 65536
+
+struct relay {
+    int in;
+    int out;
+    int pipe[2];
+    int splice_in;
+    int splice_out;
+    int open;
+};
+
+static int write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+int broker_listen(const char *path)
+{
+    // Accounts in the daemon's group may attach, e.g. the one sshd runs the
+    // ForceCommand as; everyone else goes through the telnet port.
+    return unix_socket_listen(path, 0660, false);
+}
+
+void broker_close(int listen_fd, const char *path)
+{
+    if (listen_fd < 0) {
+        return;
+    }
+    close(listen_fd);
+    if (path != NULL && path[0] != '\0') {
+        unlink(path);
+    }
+}
+
+int broker_read_hello(int fd, char *peer, size_t size)
+{
+    char line[BROKER_HELLO_MAX];
+    size_t length = 0;
+
+    // Byte-wise so nothing after the header is consumed before the session
+    // wraps the descriptor in its own FILE streams.
+    while (length + 1 < sizeof(line)) {
+        char ch;
+        ssize_t n = read(fd, &ch, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        if (ch == '\n') {
+            break;
+        }
+        line[length++] = ch;
+    }
+    line[length] = '\0';
+
+    size_t prefix = strlen(BROKER_HELLO);
+    if (strncmp(line, BROKER_HELLO, prefix) != 0) {
+        LOG_WARN(COMPONENT, "%s", "Rejecting attach with malformed hello");
+        return -1;
+    }
+    // The address comes from the client and cannot be checked; the account
+    // that connected can, so the session is labelled with both, label first.
+    struct ucred cred;
+    socklen_t cred_length = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_length) == 0) {
+        snprintf(peer, size, "uid %u claims %s", (unsigned int)cred.uid, line + prefix);
+    } else {
+        snprintf(peer, size, "unverified %s", line + prefix);
+    }
+    return 0;
+}
+
+static void relay_fallback(struct relay *relay)
+{
+    char buffer[RELAY_CHUNK];
+    ssize_t n = read(relay->in, buffer, sizeof(buffer));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    if (n <= 0 || write_all(relay->out, buffer, (size_t)n) != 0) {
+        relay->open = 0;
+    }
+}
+
+static int relay_drain_pipe(struct relay *relay, size_t pending)
+{
+    while (pending > 0) {
+        if (relay->splice_out) {
+            ssize_t n = splice(relay->pipe[0], NULL, relay->out, NULL, pending, SPLICE_F_MOVE);
+            if (n > 0) {
+                pending -= (size_t)n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && errno == EINVAL) {
+                relay->splice_out = 0;
+                continue;
+            }
+            return -1;
+        }
+
+        char buffer[RELAY_CHUNK];
+        size_t want = pending < sizeof(buffer) ? pending : sizeof(buffer);
+        ssize_t n = read(relay->pipe[0], buffer, want);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0 || write_all(relay->out, buffer, (size_t)n) != 0) {
+            return -1;
+        }
+        pending -= (size_t)n;
+    }
+    return 0;
+}
+
+// Moves one chunk from relay->in to relay->out. Data goes through a pipe with
+// splice() so it never enters user space; endpoints that cannot splice (ttys)
+// fall back to read/write.
+static void relay_step(struct relay *relay)
+{
+    if (!relay->splice_in) {
+        relay_fallback(relay);
+        return;
+    }
+
+    ssize_t n = splice(relay->in, NULL, relay->pipe[1], NULL, RELAY_CHUNK, SPLICE_F_MOVE);
+    if (n < 0) {
+        if (errno == EINVAL) {
+            relay->splice_in = 0;
+            relay_fallback(relay);
+        } else if (errno != EINTR && errno != EAGAIN) {
+            relay->open = 0;
+        }
+        return;
+    }
+    if (n == 0 || relay_drain_pipe(relay, (size_t)n) != 0) {
+        relay->open = 0;
+    }
+}
+
+static void relay_init(struct relay *relay, int in, int out)
+{
+    memset(relay, 0, sizeof(*relay));
+    relay->in = in;
+    relay->out = out;
+    relay->open = 1;
+    if (pipe(relay->pipe) == 0) {
+        relay->splice_in = 1;
+        relay->splice_out = 1;
+    } else {
+        relay->pipe[0] = -1;
+        relay->pipe[1] = -1;
+    }
+}
+
+static void relay_destroy(struct relay *relay)
+{
+    if (relay->pipe[0] >= 0) {
+        close(relay->pipe[0]);
+    }
+    if (relay->pipe[1] >= 0) {
+        close(relay->pipe[1]);
+    }
+}
+
+int broker_attach(const char *path, const char *peer)
+{
+    int fd = unix_socket_connect(path);
+    if (fd < 0) {
+        return -1;
+    }
+
+    char hello[BROKER_HELLO_MAX];
+    int length = snprintf(hello, sizeof(hello), "%s%s\n", BROKER_HELLO, (peer != NULL) ? peer : "local");
+    if (length < 0 || (size_t)length >= sizeof(hello) || write_all(fd, hello, (size_t)length) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct relay upstream;
+    struct relay downstream;
+    relay_init(&upstream, STDIN_FILENO, fd);
+    relay_init(&downstream, fd, STDOUT_FILENO);
+
+    while (downstream.open) {
+        struct pollfd fds[2];
+        nfds_t nfds = 0;
+        fds[nfds].fd = fd;
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+        if (upstream.open) {
+            fds[nfds].fd = STDIN_FILENO;
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            nfds++;
+        }
+
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            relay_step(&downstream);
+        }
+        if (nfds > 1 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            relay_step(&upstream);
+            if (!upstream.open) {
+                shutdown(fd, SHUT_WR);
+            }
+        }
+    }
+
+    relay_destroy(&upstream);
+    relay_destroy(&downstream);
+    close(fd);
+    return 0;
+}
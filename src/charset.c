@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+
+#include "charset.h"
+
+#include "log.h"
+
+#include <iconv.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define COMPONENT "charset"
+
+#define CP949_LEAD_FIRST 0x81
+#define CP949_LEAD_LAST 0xfe
+#define CP949_TRAIL_FIRST 0x41
+#define CP949_TRAIL_LAST 0xfe
+#define CP949_TRAILS (CP949_TRAIL_LAST - CP949_TRAIL_FIRST + 1)
+#define CP949_CODES ((CP949_LEAD_LAST - CP949_LEAD_FIRST + 1) * CP949_TRAILS)
+
+#define ASCII_MASK 0x8080808080808080ull
+#define STREAM_CHUNK 1024
+
+// CP949 code (lead << 8 | trail) to BMP code point, 0 where unassigned.
+static uint16_t cp949_decode_table[CP949_CODES];
+// BMP code point to CP949 code, by 256-entry page; NULL pages have none.
+static uint16_t *cp949_encode_pages[256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+static bool cp949_ready;
+
+static void build_tables(void)
+{
+    iconv_t cd = iconv_open("UTF-16LE", "CP949");
+    if (cd == (iconv_t)-1) {
+        LOG_WARN(COMPONENT, "%s", "CP949 is not available from iconv; only UTF-8 connections are supported");
+        return;
+    }
+    size_t mapped = 0;
+    for (unsigned int lead = CP949_LEAD_FIRST; lead <= CP949_LEAD_LAST; ++lead) {
+        for (unsigned int trail = CP949_TRAIL_FIRST; trail <= CP949_TRAIL_LAST; ++trail) {
+            char input[2] = {(char)lead, (char)trail};
+            unsigned char output[4];
+            char *in = input;
+            char *out = (char *)output;
+            size_t in_left = sizeof(input);
+            size_t out_left = sizeof(output);
+            iconv(cd, NULL, NULL, NULL, NULL);
+            if (iconv(cd, &in, &in_left, &out, &out_left) == (size_t)-1 || out_left != 2) {
+                continue;
+            }
+            uint16_t codepoint = (uint16_t)(output[0] | (output[1] << 8));
+            if (codepoint < 0x80 || (codepoint >= 0xd800 && codepoint <= 0xdfff)) {
+                continue;
+            }
+            cp949_decode_table[(lead - CP949_LEAD_FIRST) * CP949_TRAILS + (trail - CP949_TRAIL_FIRST)] = codepoint;
+            uint16_t **page = &cp949_encode_pages[codepoint >> 8];
+            if (*page == NULL && (*page = calloc(256, sizeof(**page))) == NULL) {
+                iconv_close(cd);
+                return;
+            }
+            if ((*page)[codepoint & 0xff] == 0) {
+                (*page)[codepoint & 0xff] = (uint16_t)(lead << 8 | trail);
+            }
+            mapped++;
+        }
+    }
+    iconv_close(cd);
+    cp949_ready = mapped > 0;
+    LOG_DEBUG(COMPONENT, "Built CP949 tables: %zu codes", mapped);
+}
+
+int charset_init(void)
+{
+    pthread_once(&tables_once, build_tables);
+    return cp949_ready ? 0 : -1;
+}
+
+bool charset_available(charset_t charset)
+{
+    if (charset == CHARSET_UTF8) {
+        return true;
+    }
+    return charset == CHARSET_CP949 && charset_init() == 0;
+}
+
+const char *charset_name(charset_t charset)
+{
+    switch (charset) {
+    case CHARSET_CP949:
+        return "cp949";
+    case CHARSET_UTF8:
+    default:
+        return "utf-8";
+    }
+}
+
+int charset_parse(const char *name, charset_t *charset)
+{
+    if (name == NULL || charset == NULL) {
+        return -1;
+    }
+    if (strcasecmp(name, "utf-8") == 0 || strcasecmp(name, "utf8") == 0) {
+        *charset = CHARSET_UTF8;
+        return 0;
+    }
+    if (strcasecmp(name, "cp949") == 0 || strcasecmp(name, "euc-kr") == 0 || strcasecmp(name, "euckr") == 0 ||
+        strcasecmp(name, "uhc") == 0) {
+        *charset = CHARSET_CP949;
+        return 0;
+    }
+    return -1;
+}
+
+// Copies the run of ASCII at the start of text eight bytes at a time and
+// returns its length.
+static size_t copy_ascii(const char *text, size_t length, char *out)
+{
+    size_t i = 0;
+    while (i + 8 <= length) {
+        uint64_t word;
+        memcpy(&word, text + i, sizeof(word));
+        if ((word & ASCII_MASK) != 0) {
+            break;
+        }
+        memcpy(out + i, &word, sizeof(word));
+        i += 8;
+    }
+    while (i < length && (unsigned char)text[i] < 0x80) {
+        out[i] = text[i];
+        i++;
+    }
+    return i;
+}
+
+// Length of the UTF-8 sequence at text, 0 if it is invalid, or -1 if it is
+// valid so far but cut off by the end of the buffer.
+static int utf8_sequence(const unsigned char *text, size_t length, uint32_t *codepoint)
+{
+    unsigned char lead = text[0];
+    int size;
+    uint32_t value;
+    if (lead >= 0xc2 && lead <= 0xdf) {
+        size = 2;
+        value = lead & 0x1f;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+        size = 3;
+        value = lead & 0x0f;
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+        size = 4;
+        value = lead & 0x07;
+    } else {
+        return 0;
+    }
+    for (int i = 1; i < size; ++i) {
+        if ((size_t)i >= length) {
+            return -1;
+        }
+        if ((text[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        value = (value << 6) | (text[i] & 0x3f);
+    }
+    if ((size == 3 && (value < 0x800 || (value >= 0xd800 && value <= 0xdfff))) ||
+        (size == 4 && (value < 0x10000 || value > 0x10ffff))) {
+        return 0;
+    }
+    *codepoint = value;
+    return size;
+}
+
+static size_t put_utf8(uint32_t codepoint, char *out)
+{
+    if (codepoint < 0x80) {
+        out[0] = (char)codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800) {
+        out[0] = (char)(0xc0 | (codepoint >> 6));
+        out[1] = (char)(0x80 | (codepoint & 0x3f));
+        return 2;
+    }
+    out[0] = (char)(0xe0 | (codepoint >> 12));
+    out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3f));
+    out[2] = (char)(0x80 | (codepoint & 0x3f));
+    return 3;
+}
+
+static uint16_t cp949_lookup(uint32_t codepoint)
+{
+    if (codepoint > 0xffff) {
+        return 0;
+    }
+    const uint16_t *page = cp949_encode_pages[codepoint >> 8];
+    return page != NULL ? page[codepoint & 0xff] : 0;
+}
+
+// KS X 1001 has the box-drawing characters, but legacy Korean terminals draw
+// them two cells wide, which breaks every frame the menus draw. Send ASCII
+// instead; returns 0 for anything else.
+static char cp949_narrow(uint32_t codepoint)
+{
+    if (codepoint == 0x2013 || codepoint == 0x2014) {
+        return '-';
+    }
+    if (codepoint < 0x2500 || codepoint > 0x257f) {
+        return 0;
+    }
+    switch (codepoint) {
+    case 0x2500:
+    case 0x2501:
+    case 0x2504:
+    case 0x2505:
+    case 0x2508:
+    case 0x2509:
+    case 0x254c:
+    case 0x254d:
+        return '-';
+    case 0x2550:
+        return '=';
+    case 0x2502:
+    case 0x2503:
+    case 0x2506:
+    case 0x2507:
+    case 0x250a:
+    case 0x250b:
+    case 0x254e:
+    case 0x254f:
+    case 0x2551:
+        return '|';
+    default:
+        return '+';
+    }
+}
+
+size_t charset_encode(charset_t charset, const char *text, size_t length, char *out, size_t *consumed)
+{
+    const unsigned char *input = (const unsigned char *)text;
+    bool convert = charset == CHARSET_CP949 && cp949_ready;
+    size_t i = 0;
+    size_t written = 0;
+    while (i < length) {
+        size_t ascii = copy_ascii(text + i, length - i, out + written);
+        i += ascii;
+        written += ascii;
+        if (i >= length) {
+            break;
+        }
+
+        uint32_t codepoint = 0;
+        int size = utf8_sequence(input + i, length - i, &codepoint);
+        if (size < 0) {
+            break;
+        }
+        if (size == 0) {
+            out[written++] = text[i++];
+            continue;
+        }
+        if (!convert) {
+            memcpy(out + written, text + i, (size_t)size);
+            written += (size_t)size;
+        } else {
+            char narrow = cp949_narrow(codepoint);
+            uint16_t code = narrow == 0 ? cp949_lookup(codepoint) : 0;
+            if (code != 0) {
+                out[written++] = (char)(code >> 8);
+                out[written++] = (char)(code & 0xff);
+            } else {
+                out[written++] = narrow != 0 ? narrow : '?';
+            }
+        }
+        i += (size_t)size;
+    }
+    if (consumed != NULL) {
+        *consumed = i;
+    }
+    return written;
+}
+
+static uint16_t cp949_pair(unsigned char lead, unsigned char trail)
+{
+    if (lead < CP949_LEAD_FIRST || lead > CP949_LEAD_LAST || trail < CP949_TRAIL_FIRST ||
+        trail > CP949_TRAIL_LAST) {
+        return 0;
+    }
+    return cp949_decode_table[(lead - CP949_LEAD_FIRST) * CP949_TRAILS + (trail - CP949_TRAIL_FIRST)];
+}
+
+size_t charset_decode(charset_t charset, const char *text, size_t length, char *out, size_t *consumed)
+{
+    if (charset != CHARSET_CP949 || !cp949_ready) {
+        memcpy(out, text, length);
+        if (consumed != NULL) {
+            *consumed = length;
+        }
+        return length;
+    }
+
+    const unsigned char *input = (const unsigned char *)text;
+    size_t i = 0;
+    size_t written = 0;
+    while (i < length) {
+        size_t ascii = copy_ascii(text + i, length - i, out + written);
+        i += ascii;
+        written += ascii;
+        if (i >= length) {
+            break;
+        }
+        if (input[i] < CP949_LEAD_FIRST || input[i] > CP949_LEAD_LAST) {
+            out[written++] = '?';
+            i++;
+            continue;
+        }
+        if (i + 1 >= length) {
+            break;
+        }
+        uint16_t codepoint = cp949_pair(input[i], input[i + 1]);
+        if (codepoint == 0) {
+            out[written++] = '?';
+            i++;
+            continue;
+        }
+        written += put_utf8(codepoint, out + written);
+        i += 2;
+    }
+    if (consumed != NULL) {
+        *consumed = i;
+    }
+    return written;
+}
+
+bool charset_valid(charset_t charset, const char *text, size_t length)
+{
+    const unsigned char *input = (const unsigned char *)text;
+    size_t i = 0;
+    while (i < length) {
+        if (input[i] < 0x80) {
+            i++;
+            continue;
+        }
+        if (charset == CHARSET_CP949) {
+            if (!cp949_ready || i + 1 >= length || cp949_pair(input[i], input[i + 1]) == 0) {
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+        uint32_t codepoint;
+        int size = utf8_sequence(input + i, length - i, &codepoint);
+        if (size <= 0) {
+            return false;
+        }
+        i += (size_t)size;
+    }
+    return true;
+}
+
+static ssize_t charset_stream_write(void *cookie, const char *buffer, size_t size)
+{
+    charset_stream_t *stream = cookie;
+    charset_t charset = (charset_t)atomic_load_explicit(stream->charset, memory_order_relaxed);
+    if (charset == CHARSET_UTF8 && stream->pending_length == 0) {
+        size_t written = fwrite(buffer, 1, size, stream->raw);
+        return written > 0 || size == 0 ? (ssize_t)written : -1;
+    }
+
+    char work[STREAM_CHUNK + sizeof(stream->pending)];
+    char out[CHARSET_ENCODE_MAX(sizeof(work))];
+    size_t taken = 0;
+    while (taken < size) {
+        size_t length = stream->pending_length;
+        memcpy(work, stream->pending, length);
+        size_t chunk = size - taken < STREAM_CHUNK ? size - taken : STREAM_CHUNK;
+        memcpy(work + length, buffer + taken, chunk);
+        length += chunk;
+        taken += chunk;
+
+        size_t used = 0;
+        size_t converted = charset_encode(charset, work, length, out, &used);
+        // An incomplete sequence is at most three bytes; keep it for the
+        // next chunk or write.
+        stream->pending_length = length - used;
+        memcpy(stream->pending, work + used, stream->pending_length);
+        if (converted > 0 && fwrite(out, 1, converted, stream->raw) != converted) {
+            return -1;
+        }
+    }
+    return (ssize_t)size;
+}
+
+FILE *charset_fopen(charset_stream_t *stream, FILE *raw, const atomic_int *charset)
+{
+    if (stream == NULL || raw == NULL || charset == NULL) {
+        return NULL;
+    }
+    memset(stream, 0, sizeof(*stream));
+    stream->raw = raw;
+    stream->charset = charset;
+    cookie_io_functions_t io = {
+        .write = charset_stream_write,
+    };
+    FILE *file = fopencookie(stream, "w", io);
+    if (file == NULL) {
+        return NULL;
+    }
+    setvbuf(file, NULL, _IONBF, 0);
+    return file;
+}
@@ -3,6 +3,9 @@
 #include "log.h"
 
 #include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +13,57 @@
 
 #define COMPONENT "config"
 
+typedef struct published_config {
+    maum_config_t config;
+    unsigned int version;
+    struct published_config *previous;
+} published_config_t;
+
+typedef struct {
+    const char *key;
+    size_t offset;
+    size_t size;
+    bool is_string;
+} config_field_t;
+
+#define CONFIG_FIELD(name, is_string) \
+    {#name, offsetof(maum_config_t, name), sizeof(((maum_config_t *)0)->name), is_string}
+
+// Bound when listeners, storage and the trace file are opened at startup.
+static const config_field_t restart_only_fields[] = {
+    CONFIG_FIELD(ssh_host, true),
+    CONFIG_FIELD(ssh_port, false),
+    CONFIG_FIELD(telnet_host, true),
+    CONFIG_FIELD(telnet_port, false),
+    CONFIG_FIELD(metrics_host, true),
+    CONFIG_FIELD(metrics_port, false),
+    CONFIG_FIELD(relay_host, true),
+    CONFIG_FIELD(relay_port, false),
+    CONFIG_FIELD(relay_peers, false),
+    CONFIG_FIELD(relay_peer_count, false),
+    CONFIG_FIELD(replication_role, false),
+    CONFIG_FIELD(replication_host, true),
+    CONFIG_FIELD(replication_port, false),
+    CONFIG_FIELD(replication_leader, false),
+    CONFIG_FIELD(motd_path, true),
+    CONFIG_FIELD(board_path, true),
+    CONFIG_FIELD(boards, false),
+    CONFIG_FIELD(board_count, false),
+    CONFIG_FIELD(mailbox_dir, true),
+    CONFIG_FIELD(library_dir, true),
+    CONFIG_FIELD(cursor_path, true),
+    CONFIG_FIELD(host_key_path, true),
+    CONFIG_FIELD(broker_socket_path, true),
+    CONFIG_FIELD(upgrade_socket_path, true),
+    CONFIG_FIELD(admin_socket_path, true),
+    CONFIG_FIELD(trace_path, true),
+    CONFIG_FIELD(enable_builtin_ssh, false),
+    CONFIG_FIELD(trace_size_kb, false),
+};
+
+static _Atomic(published_config_t *) current_config;
+static pthread_mutex_t publish_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void trim_whitespace(char *line)
 {
     size_t len = strlen(line);
@@ -33,18 +87,63 @@ void config_init(maum_config_t *config)
     }
     memset(config->ssh_host, 0, sizeof(config->ssh_host));
     memset(config->telnet_host, 0, sizeof(config->telnet_host));
+    memset(config->metrics_host, 0, sizeof(config->metrics_host));
+    memset(config->relay_host, 0, sizeof(config->relay_host));
+    memset(config->relay_peers, 0, sizeof(config->relay_peers));
+    config->relay_peer_count = 0;
+    config->replication_role = CONFIG_REPLICATION_OFF;
+    memset(config->replication_host, 0, sizeof(config->replication_host));
+    memset(&config->replication_leader, 0, sizeof(config->replication_leader));
     memset(config->motd_path, 0, sizeof(config->motd_path));
     memset(config->board_path, 0, sizeof(config->board_path));
+    memset(config->boards, 0, sizeof(config->boards));
+    config->board_count = 0;
+    memset(config->mailbox_dir, 0, sizeof(config->mailbox_dir));
+    memset(config->library_dir, 0, sizeof(config->library_dir));
+    memset(config->cursor_path, 0, sizeof(config->cursor_path));
+    memset(config->snapshot_dir, 0, sizeof(config->snapshot_dir));
     memset(config->host_key_path, 0, sizeof(config->host_key_path));
+    memset(config->broker_socket_path, 0, sizeof(config->broker_socket_path));
+    memset(config->upgrade_socket_path, 0, sizeof(config->upgrade_socket_path));
+    memset(config->admin_socket_path, 0, sizeof(config->admin_socket_path));
+    memset(config->trace_path, 0, sizeof(config->trace_path));
 
     strncpy(config->ssh_host, "0.0.0.0", sizeof(config->ssh_host) - 1);
     config->ssh_port = 2222;
     strncpy(config->telnet_host, "0.0.0.0", sizeof(config->telnet_host) - 1);
     config->telnet_port = 2323;
+    strncpy(config->metrics_host, "127.0.0.1", sizeof(config->metrics_host) - 1);
+    config->metrics_port = 0;
+    strncpy(config->relay_host, "127.0.0.1", sizeof(config->relay_host) - 1);
+    config->relay_port = 0;
+    strncpy(config->replication_host, "127.0.0.1", sizeof(config->replication_host) - 1);
+    config->replication_port = 0;
     strncpy(config->motd_path, "motd.txt", sizeof(config->motd_path) - 1);
     strncpy(config->board_path, "data/posts.db", sizeof(config->board_path) - 1);
+    strncpy(config->mailbox_dir, "data/mail", sizeof(config->mailbox_dir) - 1);
+    strncpy(config->library_dir, "data/library", sizeof(config->library_dir) - 1);
+    strncpy(config->cursor_path, "data/cursors.db", sizeof(config->cursor_path) - 1);
+    strncpy(config->snapshot_dir, "data/snapshots", sizeof(config->snapshot_dir) - 1);
     strncpy(config->host_key_path, "data/maum_host_ed25519", sizeof(config->host_key_path) - 1);
+    strncpy(config->broker_socket_path, "data/maum.sock", sizeof(config->broker_socket_path) - 1);
+    strncpy(config->upgrade_socket_path, "data/maum-upgrade.sock", sizeof(config->upgrade_socket_path) - 1);
+    strncpy(config->admin_socket_path, "data/maum-admin.sock", sizeof(config->admin_socket_path) - 1);
     config->enable_builtin_ssh = false;
+    config->max_sessions = 0;
+    config->login_timeout = 60;
+    config->idle_timeout = 600;
+    config->chat_idle_timeout = 1800;
+    config->tcp_keepalive = true;
+    config->tcp_keepalive_idle = 60;
+    config->tcp_keepalive_interval = 10;
+    config->tcp_keepalive_count = 5;
+    config->drain_timeout = 30;
+    config->library_rate_kbps = 512;
+    config->library_max_downloads = 4;
+    config->default_charset = CHARSET_UTF8;
+    config->trace_size_kb = 8192;
+    config->lock_profiling = false;
+    config->log_level = LOG_LEVEL_INFO;
 }
 
 static bool parse_bool(const char *value)
@@ -58,6 +157,100 @@ static bool parse_bool(const char *value)
     return false;
 }
 
+// board=<name> <path> [title]; the title may contain spaces and defaults to
+// the name.
+static int parse_board(maum_config_t *config, const char *value)
+{
+    if (config->board_count == CONFIG_MAX_BOARDS) {
+        LOG_WARN(COMPONENT, "Ignoring board '%s': at most %d boards besides board_path", value, CONFIG_MAX_BOARDS);
+        return -1;
+    }
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", value);
+    char *saveptr = NULL;
+    char *name = strtok_r(buffer, " \t", &saveptr);
+    char *path = strtok_r(NULL, " \t", &saveptr);
+    char *title = strtok_r(NULL, "", &saveptr);
+    if (name == NULL || path == NULL) {
+        LOG_WARN(COMPONENT, "Invalid board '%s': expected <name> <path> [title]", value);
+        return -1;
+    }
+    board_spec_t *spec = &config->boards[config->board_count++];
+    memset(spec, 0, sizeof(*spec));
+    snprintf(spec->name, sizeof(spec->name), "%s", name);
+    snprintf(spec->path, sizeof(spec->path), "%s", path);
+    if (title != NULL) {
+        trim_whitespace(title);
+    }
+    snprintf(spec->title, sizeof(spec->title), "%s", title != NULL && title[0] != '\0' ? title : name);
+    return 0;
+}
+
+// host:port, or [host]:port for an IPv6 address.
+static int parse_peer(const char *key, const char *value, config_peer_t *peer)
+{
+    char buffer[CONFIG_MAX_HOST_LEN + 8];
+    snprintf(buffer, sizeof(buffer), "%s", value);
+    char *colon = strrchr(buffer, ':');
+    char *end = NULL;
+    unsigned long port = colon != NULL ? strtoul(colon + 1, &end, 10) : 0;
+    if (colon == NULL || colon == buffer || end == colon + 1 || *end != '\0' || port == 0 || port > 65535) {
+        LOG_WARN(COMPONENT, "Invalid %s '%s': expected <host>:<port>", key, value);
+        return -1;
+    }
+    *colon = '\0';
+    char *host = buffer;
+    size_t length = strlen(host);
+    if (host[0] == '[' && length > 2 && host[length - 1] == ']') {
+        host[length - 1] = '\0';
+        host++;
+    }
+    memset(peer, 0, sizeof(*peer));
+    strncpy(peer->host, host, sizeof(peer->host) - 1);
+    peer->port = (unsigned short)port;
+    return 0;
+}
+
+static int parse_relay_peer(maum_config_t *config, const char *value)
+{
+    if (config->relay_peer_count == CONFIG_MAX_RELAY_PEERS) {
+        LOG_WARN(COMPONENT, "Ignoring relay_peer '%s': at most %d peers", value, CONFIG_MAX_RELAY_PEERS);
+        return -1;
+    }
+    if (parse_peer("relay_peer", value, &config->relay_peers[config->relay_peer_count]) != 0) {
+        return -1;
+    }
+    config->relay_peer_count++;
+    return 0;
+}
+
+static int parse_replication_role(const char *value, config_replication_t *role)
+{
+    if (strcmp(value, "off") == 0) {
+        *role = CONFIG_REPLICATION_OFF;
+    } else if (strcmp(value, "leader") == 0) {
+        *role = CONFIG_REPLICATION_LEADER;
+    } else if (strcmp(value, "follower") == 0) {
+        *role = CONFIG_REPLICATION_FOLLOWER;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static bool valid_board_name(const char *name)
+{
+    if (name[0] == '\0') {
+        return false;
+    }
+    for (const char *p = name; *p != '\0'; ++p) {
+        if (!isalnum((unsigned char)*p) && *p != '_' && *p != '-') {
+            return false;
+        }
+    }
+    return true;
+}
+
 static int parse_line(maum_config_t *config, const char *key, const char *value)
 {
     if (strcmp(key, "ssh_host") == 0) {
@@ -72,6 +265,14 @@ static int parse_line(maum_config_t *config, const char *key, const char *value)
         strncpy(config->telnet_host, value, sizeof(config->telnet_host) - 1);
         return 0;
     }
+    if (strcmp(key, "metrics_host") == 0) {
+        strncpy(config->metrics_host, value, sizeof(config->metrics_host) - 1);
+        return 0;
+    }
+    if (strcmp(key, "metrics_port") == 0) {
+        config->metrics_port = (unsigned short)strtoul(value, NULL, 10);
+        return 0;
+    }
     if (strcmp(key, "telnet_port") == 0) {
         config->telnet_port = (unsigned short)strtoul(value, NULL, 10);
         return 0;
@@ -84,14 +285,144 @@ static int parse_line(maum_config_t *config, const char *key, const char *value)
         strncpy(config->board_path, value, sizeof(config->board_path) - 1);
         return 0;
     }
+    if (strcmp(key, "relay_host") == 0) {
+        strncpy(config->relay_host, value, sizeof(config->relay_host) - 1);
+        return 0;
+    }
+    if (strcmp(key, "relay_port") == 0) {
+        config->relay_port = (unsigned short)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "relay_peer") == 0) {
+        return parse_relay_peer(config, value);
+    }
+    if (strcmp(key, "replication_role") == 0) {
+        if (parse_replication_role(value, &config->replication_role) != 0) {
+            LOG_WARN(COMPONENT, "Invalid replication_role '%s': expected off, leader or follower", value);
+            return -1;
+        }
+        return 0;
+    }
+    if (strcmp(key, "replication_host") == 0) {
+        strncpy(config->replication_host, value, sizeof(config->replication_host) - 1);
+        return 0;
+    }
+    if (strcmp(key, "replication_port") == 0) {
+        config->replication_port = (unsigned short)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "replication_leader") == 0) {
+        return parse_peer(key, value, &config->replication_leader);
+    }
+    if (strcmp(key, "board") == 0) {
+        return parse_board(config, value);
+    }
+    if (strcmp(key, "mailbox_dir") == 0) {
+        strncpy(config->mailbox_dir, value, sizeof(config->mailbox_dir) - 1);
+        return 0;
+    }
+    if (strcmp(key, "library_dir") == 0) {
+        strncpy(config->library_dir, value, sizeof(config->library_dir) - 1);
+        return 0;
+    }
+    if (strcmp(key, "cursor_path") == 0) {
+        strncpy(config->cursor_path, value, sizeof(config->cursor_path) - 1);
+        return 0;
+    }
+    if (strcmp(key, "snapshot_dir") == 0) {
+        strncpy(config->snapshot_dir, value, sizeof(config->snapshot_dir) - 1);
+        return 0;
+    }
     if (strcmp(key, "host_key_path") == 0) {
         strncpy(config->host_key_path, value, sizeof(config->host_key_path) - 1);
         return 0;
     }
+    if (strcmp(key, "broker_socket_path") == 0) {
+        strncpy(config->broker_socket_path, value, sizeof(config->broker_socket_path) - 1);
+        return 0;
+    }
+    if (strcmp(key, "upgrade_socket_path") == 0) {
+        strncpy(config->upgrade_socket_path, value, sizeof(config->upgrade_socket_path) - 1);
+        return 0;
+    }
+    if (strcmp(key, "admin_socket_path") == 0) {
+        strncpy(config->admin_socket_path, value, sizeof(config->admin_socket_path) - 1);
+        return 0;
+    }
+    if (strcmp(key, "max_sessions") == 0) {
+        config->max_sessions = (unsigned int)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "drain_timeout") == 0) {
+        config->drain_timeout = (unsigned int)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "library_rate_kbps") == 0) {
+        config->library_rate_kbps = (unsigned int)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "library_max_downloads") == 0) {
+        config->library_max_downloads = (unsigned int)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "trace_path") == 0) {
+        strncpy(config->trace_path, value, sizeof(config->trace_path) - 1);
+        return 0;
+    }
+    if (strcmp(key, "trace_size_kb") == 0) {
+        config->trace_size_kb = (unsigned int)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "log_level") == 0) {
+        if (log_parse_level(value, &config->log_level) != 0) {
+            LOG_WARN(COMPONENT, "Invalid log_level '%s'", value);
+            return -1;
+        }
+        return 0;
+    }
+    if (strcmp(key, "default_charset") == 0) {
+        if (charset_parse(value, &config->default_charset) != 0) {
+            LOG_WARN(COMPONENT, "Invalid default_charset '%s'", value);
+            return -1;
+        }
+        return 0;
+    }
+    if (strcmp(key, "lock_profiling") == 0) {
+        config->lock_profiling = parse_bool(value);
+        return 0;
+    }
     if (strcmp(key, "enable_builtin_ssh") == 0) {
         config->enable_builtin_ssh = parse_bool(value);
         return 0;
     }
+    if (strcmp(key, "login_timeout") == 0) {
+        config->login_timeout = (unsigned int)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "idle_timeout") == 0) {
+        config->idle_timeout = (unsigned int)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "chat_idle_timeout") == 0) {
+        config->chat_idle_timeout = (unsigned int)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "tcp_keepalive") == 0) {
+        config->tcp_keepalive = parse_bool(value);
+        return 0;
+    }
+    if (strcmp(key, "tcp_keepalive_idle") == 0) {
+        config->tcp_keepalive_idle = (unsigned int)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "tcp_keepalive_interval") == 0) {
+        config->tcp_keepalive_interval = (unsigned int)strtoul(value, NULL, 10);
+        return 0;
+    }
+    if (strcmp(key, "tcp_keepalive_count") == 0) {
+        config->tcp_keepalive_count = (unsigned int)strtoul(value, NULL, 10);
+        return 0;
+    }
     LOG_WARN(COMPONENT, "Unknown configuration key '%s'", key);
     return -1;
 }
@@ -132,3 +463,188 @@ int config_load(maum_config_t *config, const char *path)
     fclose(file);
     return 0;
 }
+
+int config_validate(const maum_config_t *config)
+{
+    if (config == NULL) {
+        return -1;
+    }
+    int result = 0;
+    if (config->telnet_port == 0) {
+        LOG_WARN(COMPONENT, "%s", "telnet_port must not be 0");
+        result = -1;
+    }
+    if (config->enable_builtin_ssh && config->ssh_port == 0) {
+        LOG_WARN(COMPONENT, "%s", "ssh_port must not be 0 when enable_builtin_ssh is set");
+        result = -1;
+    }
+    if (config->board_path[0] == '\0') {
+        LOG_WARN(COMPONENT, "%s", "board_path must not be empty");
+        result = -1;
+    }
+    for (unsigned int i = 0; i < config->board_count; ++i) {
+        const board_spec_t *spec = &config->boards[i];
+        if (!valid_board_name(spec->name) || strcmp(spec->name, CONFIG_MAIN_BOARD) == 0) {
+            LOG_WARN(COMPONENT, "board name '%s' must be letters, digits, '_' or '-' and not '%s'", spec->name,
+                     CONFIG_MAIN_BOARD);
+            result = -1;
+        }
+        if (strcmp(spec->path, config->board_path) == 0) {
+            LOG_WARN(COMPONENT, "board '%s' uses board_path as its file", spec->name);
+            result = -1;
+        }
+        for (unsigned int j = 0; j < i; ++j) {
+            if (strcmp(config->boards[j].name, spec->name) == 0 || strcmp(config->boards[j].path, spec->path) == 0) {
+                LOG_WARN(COMPONENT, "board '%s' repeats the name or file of board '%s'", spec->name,
+                         config->boards[j].name);
+                result = -1;
+            }
+        }
+    }
+    if (config->mailbox_dir[0] == '\0') {
+        LOG_WARN(COMPONENT, "%s", "mailbox_dir must not be empty");
+        result = -1;
+    }
+    if (config->library_dir[0] == '\0') {
+        LOG_WARN(COMPONENT, "%s", "library_dir must not be empty");
+        result = -1;
+    }
+    if (config->cursor_path[0] == '\0') {
+        LOG_WARN(COMPONENT, "%s", "cursor_path must not be empty");
+        result = -1;
+    }
+    if (config->snapshot_dir[0] == '\0') {
+        LOG_WARN(COMPONENT, "%s", "snapshot_dir must not be empty");
+        result = -1;
+    }
+    if (config->replication_role == CONFIG_REPLICATION_LEADER && config->replication_port == 0) {
+        LOG_WARN(COMPONENT, "%s", "replication_port must not be 0 when replication_role is leader");
+        result = -1;
+    }
+    if (config->replication_role == CONFIG_REPLICATION_FOLLOWER && config->replication_leader.port == 0) {
+        LOG_WARN(COMPONENT, "%s", "replication_leader must be set when replication_role is follower");
+        result = -1;
+    }
+    if (!charset_available(config->default_charset)) {
+        LOG_WARN(COMPONENT, "default_charset %s is not supported by the C library",
+                 charset_name(config->default_charset));
+        result = -1;
+    }
+    if (config->trace_path[0] != '\0' && config->trace_size_kb == 0) {
+        LOG_WARN(COMPONENT, "%s", "trace_size_kb must be positive when trace_path is set");
+        result = -1;
+    }
+    return result;
+}
+
+size_t config_boards(const maum_config_t *config, board_spec_t *specs)
+{
+    if (config == NULL || specs == NULL) {
+        return 0;
+    }
+    memset(&specs[0], 0, sizeof(specs[0]));
+    snprintf(specs[0].name, sizeof(specs[0].name), "%s", CONFIG_MAIN_BOARD);
+    snprintf(specs[0].title, sizeof(specs[0].title), "%s", "자유게시판");
+    snprintf(specs[0].path, sizeof(specs[0].path), "%s", config->board_path);
+    for (unsigned int i = 0; i < config->board_count; ++i) {
+        specs[i + 1] = config->boards[i];
+    }
+    return config->board_count + 1;
+}
+
+static int publish_locked(const maum_config_t *config)
+{
+    published_config_t *next = malloc(sizeof(*next));
+    if (next == NULL) {
+        return -1;
+    }
+    published_config_t *previous = atomic_load_explicit(&current_config, memory_order_relaxed);
+    next->config = *config;
+    next->version = previous != NULL ? previous->version + 1 : 1;
+    next->previous = previous;
+    atomic_store_explicit(&current_config, next, memory_order_release);
+    return 0;
+}
+
+int config_publish(const maum_config_t *config)
+{
+    if (config == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&publish_lock);
+    int rc = publish_locked(config);
+    pthread_mutex_unlock(&publish_lock);
+    return rc;
+}
+
+const maum_config_t *config_current(void)
+{
+    published_config_t *published = atomic_load_explicit(&current_config, memory_order_acquire);
+    return published != NULL ? &published->config : NULL;
+}
+
+unsigned int config_version(void)
+{
+    published_config_t *published = atomic_load_explicit(&current_config, memory_order_acquire);
+    return published != NULL ? published->version : 0;
+}
+
+int config_update(config_edit_fn edit, void *context)
+{
+    if (edit == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&publish_lock);
+    published_config_t *published = atomic_load_explicit(&current_config, memory_order_relaxed);
+    maum_config_t draft;
+    if (published != NULL) {
+        draft = published->config;
+    } else {
+        config_init(&draft);
+    }
+    int rc = edit(&draft, context);
+    if (rc == 0) {
+        rc = publish_locked(&draft);
+    }
+    pthread_mutex_unlock(&publish_lock);
+    return rc;
+}
+
+static int field_differs(const maum_config_t *left, const maum_config_t *right, const config_field_t *field)
+{
+    const char *a = (const char *)left + field->offset;
+    const char *b = (const char *)right + field->offset;
+    if (field->is_string) {
+        return strncmp(a, b, field->size) != 0;
+    }
+    return memcmp(a, b, field->size) != 0;
+}
+
+static int apply_reload(maum_config_t *draft, void *context)
+{
+    maum_config_t next = *(const maum_config_t *)context;
+    for (size_t i = 0; i < sizeof(restart_only_fields) / sizeof(restart_only_fields[0]); ++i) {
+        const config_field_t *field = &restart_only_fields[i];
+        if (field_differs(draft, &next, field)) {
+            LOG_WARN(COMPONENT, "'%s' cannot change while running; restart to apply it", field->key);
+            memcpy((char *)&next + field->offset, (const char *)draft + field->offset, field->size);
+        }
+    }
+    *draft = next;
+    return 0;
+}
+
+int config_reload(const char *path)
+{
+    maum_config_t loaded;
+    config_init(&loaded);
+    if (config_load(&loaded, path) != 0) {
+        return -1;
+    }
+    if (config_validate(&loaded) != 0) {
+        LOG_WARN(COMPONENT, "Keeping the running configuration; '%s' has invalid values", path);
+        return -1;
+    }
+    return config_update(apply_reload, &loaded);
+}
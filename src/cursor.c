@@ -0,0 +1,448 @@
+#include "cursor.h"
+
+#include "board.h"
+#include "config.h"
+#include "lock_profile.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define COMPONENT "cursor"
+
+#define CURSOR_MAGIC "MAUMCUR2"
+#define CURSOR_LEGACY_MAGIC "MAUMCUR1"
+#define CURSOR_INITIAL_SLOTS 1024u
+#define CURSOR_FLUSH_MS 5000
+
+typedef struct {
+    char magic[8];
+    uint32_t slots;
+    uint32_t used;
+} cursor_header_t;
+
+// An empty username marks a free slot.
+typedef struct {
+    char board[BOARD_NAME_MAX];
+    char username[BOARD_AUTHOR_MAX];
+    uint32_t last_seen;
+} cursor_slot_t;
+
+// MAUMCUR1 slots, from before there was more than one board.
+typedef struct {
+    char username[BOARD_AUTHOR_MAX];
+    uint32_t last_seen;
+} cursor_legacy_slot_t;
+
+typedef struct cursor_mapping {
+    void *base;
+    size_t size;
+    struct cursor_mapping *next;
+} cursor_mapping_t;
+
+struct cursor_store {
+    char path[256];
+    profiled_mutex_t lock;
+    // The current table. Mappings replaced when the table grew stay mapped
+    // until close, so the flusher can msync() without holding the lock.
+    cursor_mapping_t *mapping;
+    cursor_header_t *header;
+    cursor_slot_t *slots;
+    bool dirty;
+
+    pthread_mutex_t flush_lock;
+    pthread_cond_t flush_cond;
+    int running;
+    pthread_t thread;
+};
+
+static size_t table_size(uint32_t slots)
+{
+    return sizeof(cursor_header_t) + (size_t)slots * sizeof(cursor_slot_t);
+}
+
+static uint32_t hash_string(uint32_t hash, const char *text)
+{
+    for (const unsigned char *p = (const unsigned char *)text; *p != '\0'; ++p) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    // The terminator too, so "ab"+"c" and "a"+"bc" differ.
+    return hash * 16777619u;
+}
+
+// The slot holding board and username, or the free slot where it would go.
+// NULL when every slot is taken by other entries.
+static cursor_slot_t *find_slot(cursor_slot_t *slots, uint32_t count, const char *board, const char *username)
+{
+    uint32_t mask = count - 1;
+    uint32_t index = hash_string(hash_string(2166136261u, board), username) & mask;
+    for (uint32_t probes = 0; probes < count; ++probes) {
+        cursor_slot_t *slot = &slots[index];
+        if (slot->username[0] == '\0' ||
+            (strcmp(slot->username, username) == 0 && strcmp(slot->board, board) == 0)) {
+            return slot;
+        }
+        index = (index + 1) & mask;
+    }
+    return NULL;
+}
+
+static uint32_t count_used(const cursor_header_t *header)
+{
+    const cursor_slot_t *slots = (const cursor_slot_t *)(header + 1);
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < header->slots; ++i) {
+        used += slots[i].username[0] != '\0';
+    }
+    return used;
+}
+
+static bool header_valid(const cursor_header_t *header, size_t size)
+{
+    if (size < sizeof(*header) || memcmp(header->magic, CURSOR_MAGIC, sizeof(header->magic)) != 0) {
+        return false;
+    }
+    uint32_t slots = header->slots;
+    if (slots < CURSOR_INITIAL_SLOTS || (slots & (slots - 1)) != 0 || size != table_size(slots)) {
+        return false;
+    }
+    // Growth keeps a quarter of the slots free; a table without any is
+    // damaged, and lookups in it would find no slot to stop at.
+    return header->used < slots && count_used(header) < slots;
+}
+
+// Maps the file at path, creating an empty table of slots entries when it is
+// empty, or when reset is set.
+static cursor_mapping_t *map_table(const char *path, uint32_t slots, bool reset)
+{
+    int fd = open(path, O_RDWR | O_CREAT | (reset ? O_TRUNC : 0), 0644);
+    if (fd < 0) {
+        LOG_ERROR(COMPONENT, "Unable to open cursor table '%s': %s", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    bool empty = st.st_size == 0;
+    size_t size = empty ? table_size(slots) : (size_t)st.st_size;
+    if (empty && ftruncate(fd, (off_t)size) != 0) {
+        LOG_ERROR(COMPONENT, "Unable to size cursor table '%s': %s", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        LOG_ERROR(COMPONENT, "Unable to map cursor table '%s': %s", path, strerror(errno));
+        return NULL;
+    }
+    cursor_mapping_t *mapping = calloc(1, sizeof(*mapping));
+    if (mapping == NULL) {
+        munmap(base, size);
+        return NULL;
+    }
+    mapping->base = base;
+    mapping->size = size;
+    if (empty) {
+        cursor_header_t *header = base;
+        memcpy(header->magic, CURSOR_MAGIC, sizeof(header->magic));
+        header->slots = slots;
+        header->used = 0;
+    }
+    return mapping;
+}
+
+static void unmap_table(cursor_mapping_t *mapping)
+{
+    munmap(mapping->base, mapping->size);
+    free(mapping);
+}
+
+static bool legacy_valid(const cursor_header_t *header, size_t size)
+{
+    if (size < sizeof(*header) || memcmp(header->magic, CURSOR_LEGACY_MAGIC, sizeof(header->magic)) != 0) {
+        return false;
+    }
+    uint32_t slots = header->slots;
+    return slots >= CURSOR_INITIAL_SLOTS && (slots & (slots - 1)) == 0 &&
+           size == sizeof(*header) + (size_t)slots * sizeof(cursor_legacy_slot_t);
+}
+
+// Rewrites a MAUMCUR1 table with every cursor on the main board, the only
+// board there was, and renames it over the old file.
+static cursor_mapping_t *migrate_table(const cursor_store_t *store, const cursor_mapping_t *legacy)
+{
+    const cursor_header_t *old_header = legacy->base;
+    const cursor_legacy_slot_t *old_slots = (const cursor_legacy_slot_t *)(old_header + 1);
+    char temp_path[sizeof(store->path) + 4];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", store->path);
+    cursor_mapping_t *mapping = map_table(temp_path, old_header->slots, true);
+    if (mapping == NULL) {
+        return NULL;
+    }
+
+    cursor_header_t *header = mapping->base;
+    cursor_slot_t *table = (cursor_slot_t *)(header + 1);
+    for (uint32_t i = 0; i < old_header->slots; ++i) {
+        const cursor_legacy_slot_t *old = &old_slots[i];
+        if (old->username[0] == '\0' || memchr(old->username, '\0', sizeof(old->username)) == NULL) {
+            continue;
+        }
+        cursor_slot_t *slot = find_slot(table, header->slots, CONFIG_MAIN_BOARD, old->username);
+        if (slot == NULL || slot->username[0] != '\0' || (header->used + 1) * 4 > header->slots * 3) {
+            continue;
+        }
+        snprintf(slot->board, sizeof(slot->board), "%s", CONFIG_MAIN_BOARD);
+        memcpy(slot->username, old->username, sizeof(slot->username));
+        slot->last_seen = old->last_seen;
+        header->used++;
+    }
+    if (msync(mapping->base, mapping->size, MS_SYNC) != 0 || rename(temp_path, store->path) != 0) {
+        LOG_ERROR(COMPONENT, "Unable to replace cursor table: %s", strerror(errno));
+        unmap_table(mapping);
+        unlink(temp_path);
+        return NULL;
+    }
+    LOG_INFO(COMPONENT, "Moved %u read cursor(s) in '%s' to board '%s'", header->used, store->path,
+             CONFIG_MAIN_BOARD);
+    return mapping;
+}
+
+static void use_mapping(cursor_store_t *store, cursor_mapping_t *mapping)
+{
+    mapping->next = store->mapping;
+    store->mapping = mapping;
+    store->header = mapping->base;
+    store->slots = (cursor_slot_t *)(store->header + 1);
+}
+
+// Rehashes into a table twice the size, written beside the current one and
+// renamed over it once complete. Called with the lock held.
+static int grow_table(cursor_store_t *store)
+{
+    char temp_path[sizeof(store->path) + 4];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", store->path);
+    uint32_t slots = store->header->slots * 2;
+    cursor_mapping_t *mapping = map_table(temp_path, slots, true);
+    if (mapping == NULL) {
+        return -1;
+    }
+
+    cursor_header_t *header = mapping->base;
+    cursor_slot_t *table = (cursor_slot_t *)(header + 1);
+    for (uint32_t i = 0; i < store->header->slots; ++i) {
+        const cursor_slot_t *slot = &store->slots[i];
+        if (slot->username[0] != '\0') {
+            // The new table is at most half full, so a slot is always found.
+            *find_slot(table, slots, slot->board, slot->username) = *slot;
+            header->used++;
+        }
+    }
+    if (msync(mapping->base, mapping->size, MS_SYNC) != 0 || rename(temp_path, store->path) != 0) {
+        LOG_ERROR(COMPONENT, "Unable to replace cursor table: %s", strerror(errno));
+        unmap_table(mapping);
+        unlink(temp_path);
+        return -1;
+    }
+    use_mapping(store, mapping);
+    LOG_INFO(COMPONENT, "Cursor table grown to %u slots", slots);
+    return 0;
+}
+
+static void flush_table(cursor_store_t *store, int flags)
+{
+    profiled_mutex_lock(&store->lock);
+    bool dirty = store->dirty;
+    store->dirty = false;
+    cursor_mapping_t *mapping = store->mapping;
+    profiled_mutex_unlock(&store->lock);
+    if (dirty && msync(mapping->base, mapping->size, flags) != 0) {
+        LOG_WARN(COMPONENT, "Unable to write cursor table back: %s", strerror(errno));
+    }
+}
+
+static void *flush_thread(void *arg)
+{
+    cursor_store_t *store = arg;
+    pthread_mutex_lock(&store->flush_lock);
+    while (store->running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += CURSOR_FLUSH_MS / 1000;
+        deadline.tv_nsec += (long)(CURSOR_FLUSH_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&store->flush_cond, &store->flush_lock, &deadline);
+        if (!store->running) {
+            break;
+        }
+        pthread_mutex_unlock(&store->flush_lock);
+        flush_table(store, MS_SYNC);
+        pthread_mutex_lock(&store->flush_lock);
+    }
+    pthread_mutex_unlock(&store->flush_lock);
+    return NULL;
+}
+
+cursor_store_t *cursor_store_open(const char *path)
+{
+    if (path == NULL || path[0] == '\0') {
+        return NULL;
+    }
+    cursor_store_t *store = calloc(1, sizeof(*store));
+    if (store == NULL) {
+        return NULL;
+    }
+    snprintf(store->path, sizeof(store->path), "%s", path);
+
+    cursor_mapping_t *mapping = map_table(path, CURSOR_INITIAL_SLOTS, false);
+    if (mapping != NULL && legacy_valid(mapping->base, mapping->size)) {
+        cursor_mapping_t *migrated = migrate_table(store, mapping);
+        if (migrated != NULL) {
+            unmap_table(mapping);
+            mapping = migrated;
+        }
+    }
+    if (mapping != NULL && !header_valid(mapping->base, mapping->size)) {
+        LOG_WARN(COMPONENT, "'%s' is not a cursor table; starting an empty one", path);
+        unmap_table(mapping);
+        mapping = map_table(path, CURSOR_INITIAL_SLOTS, true);
+    }
+    if (mapping == NULL) {
+        free(store);
+        return NULL;
+    }
+    use_mapping(store, mapping);
+
+    // A crash can leave used out of step with the slots it counts.
+    uint32_t used = count_used(store->header);
+    store->header->used = used;
+
+    if (profiled_mutex_init(&store->lock, "cursor") != 0) {
+        unmap_table(mapping);
+        free(store);
+        return NULL;
+    }
+    pthread_mutex_init(&store->flush_lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&store->flush_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    store->running = 1;
+    if (pthread_create(&store->thread, NULL, flush_thread, store) != 0) {
+        LOG_ERROR(COMPONENT, "%s", "Failed to start cursor flush thread");
+        pthread_cond_destroy(&store->flush_cond);
+        pthread_mutex_destroy(&store->flush_lock);
+        profiled_mutex_destroy(&store->lock);
+        unmap_table(mapping);
+        free(store);
+        return NULL;
+    }
+    LOG_DEBUG(COMPONENT, "Opened cursor table '%s': %u of %u slots used", path, used, store->header->slots);
+    return store;
+}
+
+void cursor_store_close(cursor_store_t *store)
+{
+    if (store == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&store->flush_lock);
+    store->running = 0;
+    pthread_cond_signal(&store->flush_cond);
+    pthread_mutex_unlock(&store->flush_lock);
+    pthread_join(store->thread, NULL);
+    flush_table(store, MS_SYNC);
+
+    cursor_mapping_t *mapping = store->mapping;
+    while (mapping != NULL) {
+        cursor_mapping_t *next = mapping->next;
+        unmap_table(mapping);
+        mapping = next;
+    }
+    pthread_cond_destroy(&store->flush_cond);
+    pthread_mutex_destroy(&store->flush_lock);
+    profiled_mutex_destroy(&store->lock);
+    free(store);
+}
+
+unsigned int cursor_get(cursor_store_t *store, const char *board, const char *username)
+{
+    if (store == NULL || board == NULL || username == NULL || username[0] == '\0') {
+        return 0;
+    }
+    profiled_mutex_lock(&store->lock);
+    const cursor_slot_t *slot = find_slot(store->slots, store->header->slots, board, username);
+    unsigned int last_seen = slot != NULL && slot->username[0] != '\0' ? slot->last_seen : 0;
+    profiled_mutex_unlock(&store->lock);
+    return last_seen;
+}
+
+int cursor_advance(cursor_store_t *store, const char *board, const char *username, unsigned int last_seen)
+{
+    if (store == NULL || board == NULL || username == NULL || username[0] == '\0' ||
+        strlen(board) >= BOARD_NAME_MAX || strlen(username) >= BOARD_AUTHOR_MAX) {
+        return -1;
+    }
+    profiled_mutex_lock(&store->lock);
+    cursor_slot_t *slot = find_slot(store->slots, store->header->slots, board, username);
+    if (slot == NULL || slot->username[0] == '\0') {
+        // Grow at three quarters full to keep probe runs short.
+        if (slot == NULL || (store->header->used + 1) * 4 > store->header->slots * 3) {
+            if (grow_table(store) != 0) {
+                profiled_mutex_unlock(&store->lock);
+                return -1;
+            }
+            slot = find_slot(store->slots, store->header->slots, board, username);
+        }
+        if (slot == NULL) {
+            profiled_mutex_unlock(&store->lock);
+            return -1;
+        }
+        snprintf(slot->board, sizeof(slot->board), "%s", board);
+        snprintf(slot->username, sizeof(slot->username), "%s", username);
+        slot->last_seen = 0;
+        store->header->used++;
+    }
+    if (last_seen > slot->last_seen) {
+        slot->last_seen = last_seen;
+        store->dirty = true;
+    }
+    profiled_mutex_unlock(&store->lock);
+    return 0;
+}
+
+int cursor_store_capture(cursor_store_t *store, char **copy, size_t *size)
+{
+    if (store == NULL || copy == NULL || size == NULL) {
+        return -1;
+    }
+    profiled_mutex_lock(&store->lock);
+    *size = store->mapping->size;
+    *copy = malloc(*size);
+    if (*copy != NULL) {
+        memcpy(*copy, store->mapping->base, *size);
+    }
+    profiled_mutex_unlock(&store->lock);
+    return *copy != NULL ? 0 : -1;
+}
@@ -0,0 +1,236 @@
+#define _DEFAULT_SOURCE
+
+#include "handoff.h"
+
+#include "log.h"
+#include "unix_socket.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define COMPONENT "handoff"
+
+#define HANDOFF_REQUEST "TAKEOVER"
+#define HANDOFF_READY "READY"
+#define HANDOFF_PAYLOAD_MAX 256
+#define HANDOFF_REQUEST_TIMEOUT_MS 1000
+
+static int read_token(int fd, char *buffer, size_t size)
+{
+    size_t length = 0;
+    while (length + 1 < size) {
+        char ch;
+        ssize_t n = read(fd, &ch, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        if (ch == '\n') {
+            break;
+        }
+        buffer[length++] = ch;
+    }
+    buffer[length] = '\0';
+    return 0;
+}
+
+static int write_token(int fd, const char *token)
+{
+    char line[32];
+    int length = snprintf(line, sizeof(line), "%s\n", token);
+    return (write(fd, line, (size_t)length) == length) ? 0 : -1;
+}
+
+static void set_receive_timeout(int fd, unsigned int timeout_ms)
+{
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (suseconds_t)(timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+static int send_listeners(int fd, const handoff_listener_t *listeners, size_t count)
+{
+    char payload[HANDOFF_PAYLOAD_MAX];
+    size_t used = (size_t)snprintf(payload, sizeof(payload), "LISTENERS");
+    for (size_t i = 0; i < count && used < sizeof(payload); ++i) {
+        used += (size_t)snprintf(payload + used, sizeof(payload) - used, " %s", listeners[i].name);
+    }
+    if (used + 1 >= sizeof(payload)) {
+        return -1;
+    }
+    payload[used++] = '\n';
+
+    int fds[HANDOFF_MAX_LISTENERS];
+    for (size_t i = 0; i < count; ++i) {
+        fds[i] = listeners[i].fd;
+    }
+
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_LISTENERS)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov;
+    iov.iov_base = payload;
+    iov.iov_len = used;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    return (sendmsg(fd, &msg, 0) == (ssize_t)used) ? 0 : -1;
+}
+
+int handoff_offer(int upgrade_fd, const handoff_listener_t *listeners, size_t count)
+{
+    if (listeners == NULL || count == 0 || count > HANDOFF_MAX_LISTENERS) {
+        return -1;
+    }
+
+    int fd = accept(upgrade_fd, NULL, NULL);
+    if (fd < 0) {
+        return -1;
+    }
+    // The successor writes its request as soon as it connects; this runs on
+    // the accept thread, so a connection that stays quiet is not waited on.
+    set_receive_timeout(fd, HANDOFF_REQUEST_TIMEOUT_MS);
+
+    char token[32];
+    if (read_token(fd, token, sizeof(token)) != 0 || strcmp(token, HANDOFF_REQUEST) != 0) {
+        LOG_WARN(COMPONENT, "%s", "Ignoring malformed takeover request");
+        close(fd);
+        return -1;
+    }
+
+    if (send_listeners(fd, listeners, count) != 0) {
+        LOG_ERROR(COMPONENT, "Failed to pass listeners: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int handoff_ready(int control_fd)
+{
+    if (control_fd < 0) {
+        return -1;
+    }
+    char token[32];
+    int rc = read_token(control_fd, token, sizeof(token)) == 0 && strcmp(token, HANDOFF_READY) == 0 ? 0 : -1;
+    if (rc != 0) {
+        LOG_WARN(COMPONENT, "%s", "Successor did not confirm; continuing to serve");
+    }
+    close(control_fd);
+    return rc;
+}
+
+int handoff_request(const char *path, handoff_listener_t *listeners, size_t max, size_t *count)
+{
+    if (listeners == NULL || count == NULL || max == 0) {
+        return -1;
+    }
+    *count = 0;
+
+    int fd = unix_socket_connect(path);
+    if (fd < 0) {
+        LOG_ERROR(COMPONENT, "No running server answers on %s", path);
+        return -1;
+    }
+
+    if (write_token(fd, HANDOFF_REQUEST) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    char payload[HANDOFF_PAYLOAD_MAX];
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_LISTENERS)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov;
+    iov.iov_base = payload;
+    iov.iov_len = sizeof(payload) - 1;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received = recvmsg(fd, &msg, 0);
+    if (received <= 0) {
+        LOG_ERROR(COMPONENT, "%s", "Takeover refused by running server");
+        close(fd);
+        return -1;
+    }
+    payload[received] = '\0';
+
+    int fds[HANDOFF_MAX_LISTENERS];
+    size_t fd_count = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (fd_count > HANDOFF_MAX_LISTENERS) {
+                fd_count = HANDOFF_MAX_LISTENERS;
+            }
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * fd_count);
+        }
+    }
+
+    char *saveptr = NULL;
+    char *name = strtok_r(payload, " \n", &saveptr);
+    if (name == NULL || strcmp(name, "LISTENERS") != 0) {
+        for (size_t i = 0; i < fd_count; ++i) {
+            close(fds[i]);
+        }
+        close(fd);
+        return -1;
+    }
+
+    size_t index = 0;
+    while ((name = strtok_r(NULL, " \n", &saveptr)) != NULL && index < fd_count) {
+        if (index < max) {
+            snprintf(listeners[index].name, sizeof(listeners[index].name), "%s", name);
+            listeners[index].fd = fds[index];
+            (*count)++;
+        } else {
+            close(fds[index]);
+        }
+        index++;
+    }
+    while (index < fd_count) {
+        close(fds[index++]);
+    }
+
+    return fd;
+}
+
+int handoff_confirm(int control_fd)
+{
+    if (control_fd < 0) {
+        return -1;
+    }
+    int rc = write_token(control_fd, HANDOFF_READY);
+    close(control_fd);
+    return rc;
+}
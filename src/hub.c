@@ -0,0 +1,211 @@
+#include "hub.h"
+
+#include "lock_profile.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMPONENT "hub"
+
+#define HUB_QUEUE_SIZE 256
+
+struct hub {
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_cond;
+    hub_event_t queue[HUB_QUEUE_SIZE];
+    unsigned int head;
+    unsigned int length;
+    uint64_t dropped;
+    int running;
+    pthread_t thread;
+    // Held while delivering, so unsubscribing waits out a handler call.
+    profiled_mutex_t subscribers_lock;
+    hub_subscription_t *subscribers[HUB_TOPIC_COUNT];
+};
+
+static size_t deliver(hub_t *hub, const hub_event_t *event)
+{
+    size_t deliveries = 0;
+    profiled_mutex_lock(&hub->subscribers_lock);
+    for (hub_subscription_t *subscription = hub->subscribers[event->topic]; subscription != NULL;
+         subscription = subscription->next) {
+        subscription->handler(event, subscription->context);
+        deliveries++;
+    }
+    profiled_mutex_unlock(&hub->subscribers_lock);
+    return deliveries;
+}
+
+static void *hub_thread(void *arg)
+{
+    hub_t *hub = arg;
+    pthread_mutex_lock(&hub->queue_lock);
+    while (1) {
+        while (hub->running && hub->length == 0) {
+            pthread_cond_wait(&hub->queue_cond, &hub->queue_lock);
+        }
+        if (!hub->running) {
+            break;
+        }
+        hub_event_t event = hub->queue[hub->head];
+        hub->head = (hub->head + 1) % HUB_QUEUE_SIZE;
+        hub->length--;
+        uint64_t dropped = hub->dropped;
+        hub->dropped = 0;
+        pthread_mutex_unlock(&hub->queue_lock);
+
+        if (dropped > 0) {
+            LOG_WARN(COMPONENT, "Dropped %llu events: subscribers fell behind", (unsigned long long)dropped);
+        }
+        metrics_add(METRIC_HUB_DELIVERIES, deliver(hub, &event));
+
+        pthread_mutex_lock(&hub->queue_lock);
+    }
+    pthread_mutex_unlock(&hub->queue_lock);
+    return NULL;
+}
+
+hub_t *hub_create(void)
+{
+    hub_t *hub = calloc(1, sizeof(*hub));
+    if (hub == NULL) {
+        return NULL;
+    }
+    if (pthread_mutex_init(&hub->queue_lock, NULL) != 0) {
+        free(hub);
+        return NULL;
+    }
+    if (pthread_cond_init(&hub->queue_cond, NULL) != 0) {
+        pthread_mutex_destroy(&hub->queue_lock);
+        free(hub);
+        return NULL;
+    }
+    if (profiled_mutex_init(&hub->subscribers_lock, "hub") != 0) {
+        pthread_cond_destroy(&hub->queue_cond);
+        pthread_mutex_destroy(&hub->queue_lock);
+        free(hub);
+        return NULL;
+    }
+
+    hub->running = 1;
+    if (pthread_create(&hub->thread, NULL, hub_thread, hub) != 0) {
+        LOG_ERROR(COMPONENT, "%s", "Failed to start hub dispatcher thread");
+        profiled_mutex_destroy(&hub->subscribers_lock);
+        pthread_cond_destroy(&hub->queue_cond);
+        pthread_mutex_destroy(&hub->queue_lock);
+        free(hub);
+        return NULL;
+    }
+    return hub;
+}
+
+void hub_destroy(hub_t *hub)
+{
+    if (hub == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&hub->queue_lock);
+    hub->running = 0;
+    pthread_cond_signal(&hub->queue_cond);
+    pthread_mutex_unlock(&hub->queue_lock);
+    pthread_join(hub->thread, NULL);
+
+    profiled_mutex_destroy(&hub->subscribers_lock);
+    pthread_cond_destroy(&hub->queue_cond);
+    pthread_mutex_destroy(&hub->queue_lock);
+    free(hub);
+}
+
+void hub_publish(hub_t *hub, const hub_event_t *event)
+{
+    if (hub == NULL || event == NULL || event->topic >= HUB_TOPIC_COUNT) {
+        return;
+    }
+
+    pthread_mutex_lock(&hub->queue_lock);
+    if (hub->length == HUB_QUEUE_SIZE) {
+        hub->head = (hub->head + 1) % HUB_QUEUE_SIZE;
+        hub->length--;
+        hub->dropped++;
+    }
+    hub->queue[(hub->head + hub->length) % HUB_QUEUE_SIZE] = *event;
+    hub->length++;
+    pthread_cond_signal(&hub->queue_cond);
+    pthread_mutex_unlock(&hub->queue_lock);
+    metrics_add(METRIC_HUB_EVENTS, 1);
+}
+
+void hub_subscription_init(hub_subscription_t *subscription, hub_handler_t handler, void *context)
+{
+    if (subscription == NULL) {
+        return;
+    }
+    memset(subscription, 0, sizeof(*subscription));
+    subscription->handler = handler;
+    subscription->context = context;
+}
+
+void hub_subscribe(hub_t *hub, hub_topic_t topic, hub_subscription_t *subscription)
+{
+    if (hub == NULL || subscription == NULL || subscription->handler == NULL || topic >= HUB_TOPIC_COUNT) {
+        return;
+    }
+
+    profiled_mutex_lock(&hub->subscribers_lock);
+    if (subscription->pprev == NULL) {
+        hub_subscription_t **head = &hub->subscribers[topic];
+        subscription->next = *head;
+        if (*head != NULL) {
+            (*head)->pprev = &subscription->next;
+        }
+        *head = subscription;
+        subscription->pprev = head;
+    }
+    profiled_mutex_unlock(&hub->subscribers_lock);
+}
+
+void hub_unsubscribe(hub_t *hub, hub_subscription_t *subscription)
+{
+    if (hub == NULL || subscription == NULL) {
+        return;
+    }
+
+    profiled_mutex_lock(&hub->subscribers_lock);
+    if (subscription->pprev != NULL) {
+        *subscription->pprev = subscription->next;
+        if (subscription->next != NULL) {
+            subscription->next->pprev = subscription->pprev;
+        }
+        subscription->next = NULL;
+        subscription->pprev = NULL;
+    }
+    profiled_mutex_unlock(&hub->subscribers_lock);
+}
+
+void hub_summarize(char *summary, size_t size, const char *text)
+{
+    if (summary == NULL || size == 0) {
+        return;
+    }
+    size_t length = text != NULL ? strlen(text) : 0;
+    if (length < size) {
+        memcpy(summary, text, length);
+        summary[length] = '\0';
+        return;
+    }
+    if (size < 4) {
+        summary[0] = '\0';
+        return;
+    }
+    length = size - 4;
+    while (length > 0 && ((unsigned char)text[length] & 0xc0) == 0x80) {
+        length--;
+    }
+    memcpy(summary, text, length);
+    memcpy(summary + length, "...", 4);
+}
@@ -0,0 +1,518 @@
+#include "library.h"
+
+#include "log.h"
+#include "metrics.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#define COMPONENT "library"
+
+#define LIBRARY_CHUNK (64 * 1024)
+#define LIBRARY_MIN_CHUNK 1024
+#define LIBRARY_POLL_MS 1000
+#define LIBRARY_LINE_MAX (LIBRARY_NAME_MAX + 64)
+
+struct library_index {
+    atomic_size_t refs;
+    library_entry_t *entries;
+    size_t count;
+    screen_t *screen;
+};
+
+struct library {
+    char directory[256];
+    pthread_mutex_t lock;
+    library_index_t *current;
+    bool loaded;
+    bool present;
+    dev_t device;
+    ino_t inode;
+    struct timespec mtime;
+    atomic_uint downloads;
+};
+
+library_t *library_create(const char *directory)
+{
+    if (directory == NULL) {
+        return NULL;
+    }
+    library_t *library = calloc(1, sizeof(*library));
+    if (library == NULL) {
+        return NULL;
+    }
+    snprintf(library->directory, sizeof(library->directory), "%s", directory);
+    atomic_init(&library->downloads, 0);
+    if (pthread_mutex_init(&library->lock, NULL) != 0) {
+        free(library);
+        return NULL;
+    }
+    return library;
+}
+
+void library_destroy(library_t *library)
+{
+    if (library == NULL) {
+        return;
+    }
+    library_index_release(library->current);
+    pthread_mutex_destroy(&library->lock);
+    free(library);
+}
+
+static library_index_t *index_retain(library_index_t *index)
+{
+    if (index != NULL) {
+        atomic_fetch_add_explicit(&index->refs, 1, memory_order_relaxed);
+    }
+    return index;
+}
+
+void library_index_release(library_index_t *index)
+{
+    if (index == NULL) {
+        return;
+    }
+    if (atomic_fetch_sub_explicit(&index->refs, 1, memory_order_acq_rel) == 1) {
+        screen_release(index->screen);
+        free(index->entries);
+        free(index);
+    }
+}
+
+size_t library_index_count(const library_index_t *index)
+{
+    return index != NULL ? index->count : 0;
+}
+
+const library_entry_t *library_index_entry(const library_index_t *index, size_t position)
+{
+    if (index == NULL || position >= index->count) {
+        return NULL;
+    }
+    return &index->entries[position];
+}
+
+const screen_t *library_index_screen(const library_index_t *index)
+{
+    return index != NULL ? index->screen : NULL;
+}
+
+// Names are echoed to terminals, so anything with control bytes is skipped.
+static bool listable_name(const char *name)
+{
+    if (name[0] == '.') {
+        return false;
+    }
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; ++p) {
+        if (*p < 0x20 || *p == 0x7f) {
+            return false;
+        }
+    }
+    return strlen(name) < LIBRARY_NAME_MAX;
+}
+
+static int compare_entries(const void *left, const void *right)
+{
+    return strcmp(((const library_entry_t *)left)->name, ((const library_entry_t *)right)->name);
+}
+
+static void format_size(char *buffer, size_t size, off_t bytes)
+{
+    static const char *const units[] = {"KiB", "MiB", "GiB", "TiB"};
+    if (bytes < 1024) {
+        snprintf(buffer, size, "%lld B", (long long)bytes);
+        return;
+    }
+    double value = (double)bytes / 1024.0;
+    size_t unit = 0;
+    while (value >= 1024.0 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        value /= 1024.0;
+        unit++;
+    }
+    snprintf(buffer, size, "%.1f %s", value, units[unit]);
+}
+
+static screen_t *render_index(const library_index_t *index)
+{
+    if (index->count == 0) {
+        static const char *const empty[] = {"", "자료실에 파일이 없습니다."};
+        return screen_build(empty, sizeof(empty) / sizeof(empty[0]), NULL);
+    }
+
+    char **lines = calloc(index->count + 2, sizeof(*lines));
+    if (lines == NULL) {
+        return NULL;
+    }
+    size_t count = 0;
+    screen_t *screen = NULL;
+    lines[count++] = "";
+    char *header = malloc(64);
+    if (header == NULL) {
+        free(lines);
+        return NULL;
+    }
+    snprintf(header, 64, "자료실 파일 %zu개:", index->count);
+    lines[count++] = header;
+    for (size_t i = 0; i < index->count; ++i) {
+        char size[32];
+        format_size(size, sizeof(size), index->entries[i].size);
+        lines[count] = malloc(LIBRARY_LINE_MAX);
+        if (lines[count] == NULL) {
+            goto done;
+        }
+        snprintf(lines[count], LIBRARY_LINE_MAX, "[%zu] %s (%s)", i + 1, index->entries[i].name, size);
+        count++;
+    }
+    screen = screen_build((const char *const *)lines, count, "받을 파일 번호 (Enter: 돌아가기): ");
+
+done:
+    for (size_t i = 1; i < count; ++i) {
+        free(lines[i]);
+    }
+    free(lines);
+    return screen;
+}
+
+static library_index_t *scan_directory(const library_t *library)
+{
+    library_index_t *index = calloc(1, sizeof(*index));
+    if (index == NULL) {
+        return NULL;
+    }
+    atomic_init(&index->refs, 1);
+
+    DIR *dir = opendir(library->directory);
+    if (dir != NULL) {
+        size_t capacity = 0;
+        struct dirent *item;
+        while ((item = readdir(dir)) != NULL) {
+            struct stat st;
+            if (!listable_name(item->d_name) ||
+                fstatat(dirfd(dir), item->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+            if (index->count == capacity) {
+                size_t grown_capacity = capacity ? capacity * 2 : 32;
+                library_entry_t *grown = realloc(index->entries, grown_capacity * sizeof(*grown));
+                if (grown == NULL) {
+                    closedir(dir);
+                    library_index_release(index);
+                    return NULL;
+                }
+                index->entries = grown;
+                capacity = grown_capacity;
+            }
+            library_entry_t *entry = &index->entries[index->count++];
+            snprintf(entry->name, sizeof(entry->name), "%s", item->d_name);
+            entry->size = st.st_size;
+        }
+        closedir(dir);
+        if (index->count > 1) {
+            qsort(index->entries, index->count, sizeof(*index->entries), compare_entries);
+        }
+    }
+
+    index->screen = render_index(index);
+    if (index->screen == NULL) {
+        library_index_release(index);
+        return NULL;
+    }
+    return index;
+}
+
+static bool directory_changed(const library_t *library, bool present, const struct stat *st)
+{
+    if (!library->loaded || library->present != present) {
+        return true;
+    }
+    if (!present) {
+        return false;
+    }
+    return library->device != st->st_dev || library->inode != st->st_ino ||
+           library->mtime.tv_sec != st->st_mtim.tv_sec || library->mtime.tv_nsec != st->st_mtim.tv_nsec;
+}
+
+library_index_t *library_acquire(library_t *library)
+{
+    if (library == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&library->lock);
+    struct stat st;
+    bool present = stat(library->directory, &st) == 0 && S_ISDIR(st.st_mode);
+    if (directory_changed(library, present, &st)) {
+        library_index_t *index = scan_directory(library);
+        if (index != NULL) {
+            library_index_release(library->current);
+            library->current = index;
+            library->loaded = true;
+            library->present = present;
+            if (present) {
+                library->device = st.st_dev;
+                library->inode = st.st_ino;
+                library->mtime = st.st_mtim;
+            }
+            LOG_DEBUG(COMPONENT, "Indexed %s: %zu files", library->directory, index->count);
+        } else {
+            LOG_WARN(COMPONENT, "Failed to index %s: %s", library->directory, strerror(errno));
+        }
+    }
+    library_index_t *index = index_retain(library->current);
+    pthread_mutex_unlock(&library->lock);
+    return index;
+}
+
+int library_download_begin(library_t *library, unsigned int max_downloads)
+{
+    if (library == NULL) {
+        return -1;
+    }
+    unsigned int running = atomic_load_explicit(&library->downloads, memory_order_relaxed);
+    do {
+        if (max_downloads > 0 && running >= max_downloads) {
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&library->downloads, &running, running + 1,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    metrics_gauge_add(METRIC_LIBRARY_DOWNLOADS, 1);
+    return 0;
+}
+
+void library_download_end(library_t *library)
+{
+    if (library == NULL) {
+        return;
+    }
+    atomic_fetch_sub_explicit(&library->downloads, 1, memory_order_relaxed);
+    metrics_gauge_add(METRIC_LIBRARY_DOWNLOADS, -1);
+}
+
+static bool cancelled(const library_transfer_t *transfer)
+{
+    return transfer->cancel != NULL && atomic_load(transfer->cancel) != 0;
+}
+
+// Waits for room in the socket buffer a second at a time, so cancellation is
+// noticed while a slow client holds the transfer up.
+static int wait_writable(const library_transfer_t *transfer, unsigned int *stalled)
+{
+    struct pollfd pfd = {.fd = transfer->fd, .events = POLLOUT};
+    while (!cancelled(transfer)) {
+        int rc = poll(&pfd, 1, LIBRARY_POLL_MS);
+        if (rc > 0) {
+            return (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) ? -1 : 0;
+        }
+        if (rc < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (rc == 0 && transfer->stall_timeout > 0 && ++*stalled >= transfer->stall_timeout) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+// Sleeps until sent bytes are back under the rate, in slices short enough to
+// notice cancellation.
+static void pace(const library_transfer_t *transfer, uint64_t started, uint64_t sent)
+{
+    if (transfer->rate_kbps == 0) {
+        return;
+    }
+    uint64_t due = sent * 1000000000ull / ((uint64_t)transfer->rate_kbps * 1024u);
+    uint64_t elapsed = metrics_now() - started;
+    while (due > elapsed && !cancelled(transfer)) {
+        uint64_t wait = due - elapsed;
+        if (wait > 100000000ull) {
+            wait = 100000000ull;
+        }
+        struct timespec delay = {.tv_sec = 0, .tv_nsec = (long)wait};
+        nanosleep(&delay, NULL);
+        elapsed = metrics_now() - started;
+    }
+}
+
+// Sends from data when the bytes were read into a buffer, otherwise straight
+// from the file with sendfile().
+static ssize_t put_bytes(const library_transfer_t *transfer, int file, const unsigned char *data, off_t offset,
+                         size_t length)
+{
+    if (data == NULL) {
+        off_t position = offset;
+        return sendfile(transfer->fd, file, &position, length);
+    }
+    if (transfer->fd >= 0) {
+        return write(transfer->fd, data, length);
+    }
+    size_t written = fwrite(data, 1, length, transfer->out);
+    fflush(transfer->out);
+    return written > 0 ? (ssize_t)written : -1;
+}
+
+static ssize_t put_escape(const library_transfer_t *transfer)
+{
+    static const unsigned char iac = 0xFF;
+    if (transfer->fd >= 0) {
+        return write(transfer->fd, &iac, 1);
+    }
+    size_t written = fwrite(&iac, 1, 1, transfer->out);
+    fflush(transfer->out);
+    return written == 1 ? 1 : -1;
+}
+
+static int transfer_file(const library_transfer_t *transfer, int file, off_t size, uint64_t *sent)
+{
+    size_t chunk_max = LIBRARY_CHUNK;
+    if (transfer->rate_kbps > 0) {
+        // About ten chunks a second keeps pacing smooth.
+        size_t per_tick = (size_t)transfer->rate_kbps * 1024u / 10u;
+        chunk_max = per_tick < LIBRARY_MIN_CHUNK ? LIBRARY_MIN_CHUNK : per_tick < chunk_max ? per_tick : chunk_max;
+    }
+
+    // Bytes telnet must escape have to be seen, and stdio has no socket to
+    // sendfile() into; both read the file a chunk at a time with pread(), so
+    // a file cut short underneath ends the transfer instead of faulting.
+    unsigned char *buffer = NULL;
+    if (transfer->telnet || transfer->fd < 0) {
+        buffer = malloc(chunk_max);
+        if (buffer == NULL) {
+            return -1;
+        }
+    }
+    size_t buffered = 0;
+    size_t consumed = 0;
+
+    uint64_t started = metrics_now();
+    off_t offset = 0;
+    bool escape_pending = false;
+    unsigned int stalled = 0;
+    int rc = 0;
+    while (offset < size || escape_pending) {
+        if (cancelled(transfer)) {
+            rc = -1;
+            break;
+        }
+        pace(transfer, started, *sent);
+
+        ssize_t n;
+        size_t length = 0;
+        bool escape_after = false;
+        if (escape_pending) {
+            n = put_escape(transfer);
+        } else if (buffer == NULL) {
+            length = (size_t)(size - offset) < chunk_max ? (size_t)(size - offset) : chunk_max;
+            n = put_bytes(transfer, file, NULL, offset, length);
+        } else {
+            if (consumed == buffered) {
+                size_t want = (size_t)(size - offset) < chunk_max ? (size_t)(size - offset) : chunk_max;
+                ssize_t got = pread(file, buffer, want, offset);
+                if (got < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (got <= 0) {
+                    LOG_WARN(COMPONENT, "Library file shrank to %lld bytes during a download", (long long)offset);
+                    rc = -1;
+                    break;
+                }
+                buffered = (size_t)got;
+                consumed = 0;
+            }
+            length = buffered - consumed;
+            if (transfer->telnet) {
+                const unsigned char *iac = memchr(buffer + consumed, 0xFF, length);
+                if (iac != NULL) {
+                    length = (size_t)(iac - (buffer + consumed)) + 1;
+                    escape_after = true;
+                }
+            }
+            n = put_bytes(transfer, file, buffer + consumed, offset, length);
+        }
+
+        if (n < 0) {
+            if ((errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) && transfer->fd >= 0 &&
+                wait_writable(transfer, &stalled) == 0) {
+                continue;
+            }
+            rc = -1;
+            break;
+        }
+        if (n == 0) {
+            // sendfile() past a shortened file's end.
+            rc = -1;
+            break;
+        }
+        stalled = 0;
+        *sent += (uint64_t)n;
+        if (escape_pending) {
+            escape_pending = false;
+        } else {
+            offset += n;
+            consumed += buffer != NULL ? (size_t)n : 0;
+            escape_pending = escape_after && (size_t)n == length;
+        }
+    }
+
+    free(buffer);
+    return rc;
+}
+
+int library_send(library_t *library, const library_entry_t *entry, const library_transfer_t *transfer,
+                 uint64_t *sent)
+{
+    if (library == NULL || entry == NULL || transfer == NULL || sent == NULL ||
+        (transfer->fd < 0 && transfer->out == NULL)) {
+        return -1;
+    }
+    *sent = 0;
+
+    int dir = open(library->directory, O_RDONLY | O_DIRECTORY);
+    if (dir < 0) {
+        return -1;
+    }
+    int file = openat(dir, entry->name, O_RDONLY | O_NOFOLLOW);
+    close(dir);
+    if (file < 0) {
+        LOG_WARN(COMPONENT, "Cannot open %s/%s: %s", library->directory, entry->name, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(file);
+        return -1;
+    }
+    posix_fadvise(file, 0, st.st_size, POSIX_FADV_SEQUENTIAL);
+
+    // The session's socket is blocking; the transfer runs it non-blocking so
+    // a stalled client cannot pin the thread past cancellation.
+    int flags = -1;
+    if (transfer->fd >= 0) {
+        flags = fcntl(transfer->fd, F_GETFL);
+        if (flags < 0 || fcntl(transfer->fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+            close(file);
+            return -1;
+        }
+    } else {
+        fflush(transfer->out);
+    }
+
+    int rc = transfer_file(transfer, file, st.st_size, sent);
+
+    if (flags >= 0) {
+        fcntl(transfer->fd, F_SETFL, flags);
+    }
+    close(file);
+    metrics_add(METRIC_LIBRARY_BYTES, *sent);
+    return rc;
+}
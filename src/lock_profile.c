@@ -0,0 +1,294 @@
+#include "lock_profile.h"
+
+#include "log.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMPONENT "lockprof"
+
+// Initial registry size; it doubles when full (one lock per open board).
+#define LOCK_PROFILE_INITIAL_LOCKS 32
+#define LOCK_PROFILE_OVERFLOW_SITE "(other)"
+
+static atomic_bool profiling_enabled;
+
+// Registry of live locks so dumps can find them; guarded by its own mutex,
+// never by a profiled lock.
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static profiled_mutex_t **registry;
+static size_t registry_capacity;
+// Locks left out because the registry could not grow; reported with the
+// profile so it is never silently incomplete.
+static size_t registry_dropped;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void lock_profile_set_enabled(bool enabled)
+{
+    atomic_store_explicit(&profiling_enabled, enabled, memory_order_relaxed);
+}
+
+bool lock_profile_enabled(void)
+{
+    return atomic_load_explicit(&profiling_enabled, memory_order_relaxed);
+}
+
+int profiled_mutex_init(profiled_mutex_t *lock, const char *name)
+{
+    memset(lock, 0, sizeof(*lock));
+    if (pthread_mutex_init(&lock->mutex, NULL) != 0) {
+        return -1;
+    }
+    lock->name = name;
+    lock->holder_site = -1;
+
+    pthread_mutex_lock(&registry_lock);
+    size_t slot = 0;
+    while (slot < registry_capacity && registry[slot] != NULL) {
+        slot++;
+    }
+    if (slot == registry_capacity) {
+        size_t capacity = registry_capacity > 0 ? registry_capacity * 2 : LOCK_PROFILE_INITIAL_LOCKS;
+        profiled_mutex_t **grown = realloc(registry, capacity * sizeof(*grown));
+        if (grown != NULL) {
+            memset(grown + registry_capacity, 0, (capacity - registry_capacity) * sizeof(*grown));
+            registry = grown;
+            registry_capacity = capacity;
+        }
+    }
+    if (slot < registry_capacity) {
+        registry[slot] = lock;
+    } else if (registry_dropped++ == 0) {
+        LOG_WARN(COMPONENT, "Lock '%s' and later ones will not appear in the profile: out of memory", name);
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return 0;
+}
+
+void profiled_mutex_destroy(profiled_mutex_t *lock)
+{
+    pthread_mutex_lock(&registry_lock);
+    for (size_t i = 0; i < registry_capacity; ++i) {
+        if (registry[i] == lock) {
+            registry[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+    pthread_mutex_destroy(&lock->mutex);
+}
+
+static int site_slot(profiled_mutex_t *lock, const char *site)
+{
+    for (int i = 0; i < LOCK_PROFILE_SITES - 1; ++i) {
+        const char *current = atomic_load_explicit(&lock->sites[i].site, memory_order_acquire);
+        if (current == site) {
+            return i;
+        }
+        if (current == NULL) {
+            const char *expected = NULL;
+            if (atomic_compare_exchange_strong(&lock->sites[i].site, &expected, site) || expected == site) {
+                return i;
+            }
+        }
+    }
+    const char *expected = NULL;
+    atomic_compare_exchange_strong(&lock->sites[LOCK_PROFILE_SITES - 1].site, &expected,
+                                   LOCK_PROFILE_OVERFLOW_SITE);
+    return LOCK_PROFILE_SITES - 1;
+}
+
+static void record_acquire(profiled_mutex_t *lock, const char *site, uint64_t started, int contended)
+{
+    uint64_t acquired = now_ns();
+    uint64_t waited = acquired - started;
+    int slot = site_slot(lock, site);
+    lock_site_stats_t *stats = &lock->sites[slot];
+
+    atomic_fetch_add_explicit(&stats->acquisitions, 1, memory_order_relaxed);
+    if (contended) {
+        atomic_fetch_add_explicit(&stats->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->wait_ns, waited, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&stats->max_wait_ns, memory_order_relaxed);
+        while (waited > max &&
+               !atomic_compare_exchange_weak_explicit(&stats->max_wait_ns, &max, waited, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+        }
+    }
+
+    lock->acquired_at = acquired;
+    lock->holder_site = slot;
+}
+
+static void record_release(profiled_mutex_t *lock)
+{
+    if (lock->holder_site < 0) {
+        return;
+    }
+    atomic_fetch_add_explicit(&lock->sites[lock->holder_site].hold_ns, now_ns() - lock->acquired_at,
+                              memory_order_relaxed);
+    lock->holder_site = -1;
+}
+
+int profiled_mutex_lock_at(profiled_mutex_t *lock, const char *site)
+{
+    if (!lock_profile_enabled()) {
+        return pthread_mutex_lock(&lock->mutex);
+    }
+
+    uint64_t started = now_ns();
+    int contended = 0;
+    int rc = pthread_mutex_trylock(&lock->mutex);
+    if (rc == EBUSY) {
+        contended = 1;
+        rc = pthread_mutex_lock(&lock->mutex);
+    }
+    if (rc == 0) {
+        record_acquire(lock, site, started, contended);
+    }
+    return rc;
+}
+
+int profiled_mutex_unlock(profiled_mutex_t *lock)
+{
+    record_release(lock);
+    return pthread_mutex_unlock(&lock->mutex);
+}
+
+int profiled_cond_timedwait_at(pthread_cond_t *cond, profiled_mutex_t *lock, const struct timespec *deadline,
+                               const char *site)
+{
+    // Time spent blocked in the wait is neither holding nor waiting for the
+    // lock, so the hold ends here and a new acquisition starts on wakeup.
+    record_release(lock);
+    int rc = pthread_cond_timedwait(cond, &lock->mutex, deadline);
+    if (lock_profile_enabled()) {
+        record_acquire(lock, site, now_ns(), 0);
+    }
+    return rc;
+}
+
+typedef void (*site_visitor_t)(void *context, const profiled_mutex_t *lock, const char *site,
+                               const lock_site_stats_t *stats);
+
+static void visit_sites(site_visitor_t visitor, void *context)
+{
+    pthread_mutex_lock(&registry_lock);
+    for (size_t i = 0; i < registry_capacity; ++i) {
+        const profiled_mutex_t *lock = registry[i];
+        if (lock == NULL) {
+            continue;
+        }
+        for (int s = 0; s < LOCK_PROFILE_SITES; ++s) {
+            const char *site = atomic_load_explicit(&lock->sites[s].site, memory_order_acquire);
+            if (site != NULL) {
+                visitor(context, lock, site, &lock->sites[s]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static void log_site(void *context, const profiled_mutex_t *lock, const char *site, const lock_site_stats_t *stats)
+{
+    (void)context;
+    unsigned long long acquisitions = atomic_load_explicit(&stats->acquisitions, memory_order_relaxed);
+    unsigned long long contended = atomic_load_explicit(&stats->contended, memory_order_relaxed);
+    double wait_ms = (double)atomic_load_explicit(&stats->wait_ns, memory_order_relaxed) / 1e6;
+    double hold_ms = (double)atomic_load_explicit(&stats->hold_ns, memory_order_relaxed) / 1e6;
+    double max_wait_ms = (double)atomic_load_explicit(&stats->max_wait_ns, memory_order_relaxed) / 1e6;
+    LOG_INFO(COMPONENT, "%s @ %s: %llu acquisitions, %llu contended, wait %.3f ms (max %.3f), hold %.3f ms",
+             lock->name, site, acquisitions, contended, wait_ms, max_wait_ms, hold_ms);
+}
+
+static size_t unprofiled_locks(void)
+{
+    pthread_mutex_lock(&registry_lock);
+    size_t dropped = registry_dropped;
+    pthread_mutex_unlock(&registry_lock);
+    return dropped;
+}
+
+void lock_profile_dump(void)
+{
+    if (!lock_profile_enabled()) {
+        LOG_INFO(COMPONENT, "%s", "Lock profiling is disabled (set lock_profiling=true)");
+        return;
+    }
+    visit_sites(log_site, NULL);
+    size_t dropped = unprofiled_locks();
+    if (dropped > 0) {
+        LOG_WARN(COMPONENT, "%zu lock(s) are missing from this profile", dropped);
+    }
+}
+
+typedef struct {
+    const char *name;
+    const char *help;
+    const char *type;
+} lock_family_t;
+
+static const lock_family_t lock_families[] = {
+    {"maum_lock_acquisitions_total", "Lock acquisitions by call site", "counter"},
+    {"maum_lock_contended_total", "Acquisitions that found the lock already held", "counter"},
+    {"maum_lock_wait_seconds_total", "Time spent waiting for the lock", "counter"},
+    {"maum_lock_hold_seconds_total", "Time the lock was held", "counter"},
+    {"maum_lock_max_wait_seconds", "Longest single wait for the lock", "gauge"},
+};
+
+typedef struct {
+    FILE *out;
+    size_t family;
+} write_context_t;
+
+static void write_site(void *context, const profiled_mutex_t *lock, const char *site,
+                       const lock_site_stats_t *stats)
+{
+    write_context_t *write = context;
+    const char *name = lock_families[write->family].name;
+
+    switch (write->family) {
+    case 0:
+        fprintf(write->out, "%s{lock=\"%s\",site=\"%s\"} %llu\n", name, lock->name, site,
+                (unsigned long long)atomic_load_explicit(&stats->acquisitions, memory_order_relaxed));
+        break;
+    case 1:
+        fprintf(write->out, "%s{lock=\"%s\",site=\"%s\"} %llu\n", name, lock->name, site,
+                (unsigned long long)atomic_load_explicit(&stats->contended, memory_order_relaxed));
+        break;
+    case 2:
+        fprintf(write->out, "%s{lock=\"%s\",site=\"%s\"} %.9f\n", name, lock->name, site,
+                (double)atomic_load_explicit(&stats->wait_ns, memory_order_relaxed) / 1e9);
+        break;
+    case 3:
+        fprintf(write->out, "%s{lock=\"%s\",site=\"%s\"} %.9f\n", name, lock->name, site,
+                (double)atomic_load_explicit(&stats->hold_ns, memory_order_relaxed) / 1e9);
+        break;
+    default:
+        fprintf(write->out, "%s{lock=\"%s\",site=\"%s\"} %.9f\n", name, lock->name, site,
+                (double)atomic_load_explicit(&stats->max_wait_ns, memory_order_relaxed) / 1e9);
+        break;
+    }
+}
+
+void lock_profile_write(FILE *out)
+{
+    if (out == NULL || !lock_profile_enabled()) {
+        return;
+    }
+    for (size_t i = 0; i < sizeof(lock_families) / sizeof(lock_families[0]); ++i) {
+        const lock_family_t *family = &lock_families[i];
+        fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", family->name, family->help, family->name, family->type);
+        write_context_t context = {out, i};
+        visit_sites(write_site, &context);
+    }
+    fprintf(out, "# HELP maum_lock_unprofiled Locks missing from the profile because the registry could not grow\n"
+                 "# TYPE maum_lock_unprofiled gauge\nmaum_lock_unprofiled %zu\n",
+            unprofiled_locks());
+}
@@ -1,10 +1,66 @@
 #include "log.h"
 
+#include "trace.h"
+
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <time.h>
 
-static log_level_t current_level = LOG_LEVEL_INFO;
+#define LOG_RING_SLOTS 64
+#define LOG_MESSAGE_MAX 240
+#define LOG_TIMESTAMP_MAX 32
+#define LOG_IDLE_WAIT_MS 100
+#define LOG_BATCH_MAX 16384
+
+typedef struct {
+    time_t when;
+    log_level_t level;
+    const char *component;
+    char text[LOG_MESSAGE_MAX];
+} log_entry_t;
+
+// Single-producer (the owning thread) / single-consumer (the writer) ring.
+struct log_ring {
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_int orphaned;
+    struct log_ring *next;
+    struct log_ring *next_pending;
+    log_entry_t entries[LOG_RING_SLOTS];
+};
+
+typedef struct {
+    char data[LOG_BATCH_MAX];
+    size_t length;
+    FILE *stream;
+} log_batch_t;
+
+static atomic_int current_level = LOG_LEVEL_INFO;
+static atomic_ullong dropped_messages;
+
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static _Thread_local struct log_ring *thread_ring;
+
+static _Atomic(struct log_ring *) pending_rings;
+static atomic_bool writer_running;
+static atomic_bool writer_stopping;
+static atomic_bool writer_idle;
+static pthread_t writer_thread;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+
+// Writer-private state.
+static struct log_ring *rings;
+static time_t cached_second = (time_t)-1;
+static char cached_timestamp[LOG_TIMESTAMP_MAX];
+static unsigned long long reported_drops;
+static time_t reported_at;
 
 static const char *level_to_string(log_level_t level)
 {
@@ -21,35 +77,335 @@ static const char *level_to_string(log_level_t level)
     return "UNKNOWN";
 }
 
+const char *log_level_name(log_level_t level)
+{
+    return level_to_string(level);
+}
+
+int log_parse_level(const char *name, log_level_t *level)
+{
+    static const char *const names[] = {"debug", "info", "warn", "error"};
+    if (name == NULL || level == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (strcasecmp(name, names[i]) == 0) {
+            *level = (log_level_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
 void log_set_level(log_level_t level)
 {
-    current_level = level;
+    atomic_store_explicit(&current_level, level, memory_order_relaxed);
 }
 
-void log_message(log_level_t level, const char *component, const char *fmt, ...)
+log_level_t log_get_level(void)
+{
+    return (log_level_t)atomic_load_explicit(&current_level, memory_order_relaxed);
+}
+
+unsigned long long log_dropped_count(void)
+{
+    return atomic_load_explicit(&dropped_messages, memory_order_relaxed);
+}
+
+static void format_timestamp(time_t when, char *buffer, size_t size)
 {
-    if (level < current_level) {
+    struct tm tm_snapshot;
+    if (localtime_r(&when, &tm_snapshot) == NULL ||
+        strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &tm_snapshot) == 0) {
+        snprintf(buffer, size, "%lld", (long long)when);
+    }
+}
+
+static const char *timestamp_for(time_t when)
+{
+    if (when != cached_second) {
+        format_timestamp(when, cached_timestamp, sizeof(cached_timestamp));
+        cached_second = when;
+    }
+    return cached_timestamp;
+}
+
+static void batch_flush(log_batch_t *batch)
+{
+    if (batch->length > 0) {
+        fwrite(batch->data, 1, batch->length, batch->stream);
+        fflush(batch->stream);
+        batch->length = 0;
+    }
+}
+
+static void batch_append(log_batch_t *batch, time_t when, log_level_t level, const char *component,
+                         const char *text)
+{
+    char line[LOG_MESSAGE_MAX + 96];
+    int length = snprintf(line, sizeof(line), "%s [%s] %s: %s\n", timestamp_for(when), level_to_string(level),
+                          component, text);
+    if (length < 0) {
         return;
     }
+    size_t size = ((size_t)length < sizeof(line)) ? (size_t)length : sizeof(line) - 1;
+    if (batch->length + size > sizeof(batch->data)) {
+        batch_flush(batch);
+    }
+    memcpy(batch->data + batch->length, line, size);
+    batch->length += size;
+}
+
+static void adopt_pending_rings(void)
+{
+    struct log_ring *ring = atomic_exchange_explicit(&pending_rings, NULL, memory_order_acquire);
+    while (ring != NULL) {
+        struct log_ring *next = ring->next_pending;
+        ring->next = rings;
+        rings = ring;
+        ring = next;
+    }
+}
+
+// Drains every ring once; returns the number of entries written. Rings whose
+// thread has exited are freed once empty.
+static size_t drain_rings(log_batch_t *out, log_batch_t *err)
+{
+    size_t written = 0;
+
+    adopt_pending_rings();
+
+    struct log_ring **link = &rings;
+    while (*link != NULL) {
+        struct log_ring *ring = *link;
+        int orphaned = atomic_load_explicit(&ring->orphaned, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
 
+        while (tail != head) {
+            const log_entry_t *entry = &ring->entries[tail % LOG_RING_SLOTS];
+            log_batch_t *batch = (entry->level >= LOG_LEVEL_WARN) ? err : out;
+            batch_append(batch, entry->when, entry->level, entry->component, entry->text);
+            tail++;
+            written++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        if (orphaned) {
+            *link = ring->next;
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+
+    // Drops are summarised at most once per second.
+    unsigned long long dropped = log_dropped_count();
     time_t now = time(NULL);
-    struct tm *tm_snapshot = localtime(&now);
-    if (tm_snapshot == NULL) {
+    if (dropped != reported_drops && now != reported_at) {
+        char text[LOG_MESSAGE_MAX];
+        snprintf(text, sizeof(text), "%llu log message(s) dropped (buffer full)", dropped - reported_drops);
+        batch_append(err, now, LOG_LEVEL_WARN, "log", text);
+        reported_drops = dropped;
+        reported_at = now;
+    }
+
+    batch_flush(out);
+    batch_flush(err);
+    return written;
+}
+
+static void *writer_main(void *arg)
+{
+    (void)arg;
+
+    static log_batch_t out_batch;
+    static log_batch_t err_batch;
+    out_batch.stream = stdout;
+    err_batch.stream = stderr;
+
+    while (!atomic_load_explicit(&writer_stopping, memory_order_acquire)) {
+        if (drain_rings(&out_batch, &err_batch) > 0) {
+            continue;
+        }
+
+        // Producers signal without taking the lock, so a wakeup can be
+        // missed; the timeout bounds the resulting delay.
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_IDLE_WAIT_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&writer_lock);
+        atomic_store_explicit(&writer_idle, true, memory_order_release);
+        if (!atomic_load_explicit(&writer_stopping, memory_order_acquire)) {
+            pthread_cond_timedwait(&writer_cond, &writer_lock, &deadline);
+        }
+        atomic_store_explicit(&writer_idle, false, memory_order_relaxed);
+        pthread_mutex_unlock(&writer_lock);
+    }
+
+    // Orphaned rings are freed on this pass; live ones stay for the exiting
+    // process.
+    drain_rings(&out_batch, &err_batch);
+    return NULL;
+}
+
+static void release_ring(void *arg)
+{
+    struct log_ring *ring = arg;
+    thread_ring = NULL;
+    atomic_store_explicit(&ring->orphaned, 1, memory_order_release);
+}
+
+static void stop_writer(void)
+{
+    if (!atomic_load(&writer_running)) {
         return;
     }
+    pthread_mutex_lock(&writer_lock);
+    atomic_store(&writer_stopping, true);
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+    pthread_join(writer_thread, NULL);
+    atomic_store(&writer_running, false);
+}
 
-    char timestamp[32];
-    if (strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_snapshot) == 0) {
+static void start_writer(void)
+{
+    if (pthread_key_create(&ring_key, release_ring) != 0) {
         return;
     }
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        return;
+    }
+    atomic_store(&writer_running, true);
+    atexit(stop_writer);
+}
+
+static struct log_ring *acquire_ring(void)
+{
+    if (thread_ring != NULL) {
+        return thread_ring;
+    }
+
+    struct log_ring *ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    pthread_setspecific(ring_key, ring);
 
+    struct log_ring *head = atomic_load_explicit(&pending_rings, memory_order_relaxed);
+    do {
+        ring->next_pending = head;
+    } while (!atomic_compare_exchange_weak_explicit(&pending_rings, &head, ring, memory_order_release,
+                                                    memory_order_relaxed));
+
+    thread_ring = ring;
+    return ring;
+}
+
+static void write_direct(log_level_t level, const char *component, const char *text)
+{
+    char timestamp[LOG_TIMESTAMP_MAX];
+    format_timestamp(time(NULL), timestamp, sizeof(timestamp));
+
+    char line[LOG_MESSAGE_MAX + 96];
+    int length = snprintf(line, sizeof(line), "%s [%s] %s: %s\n", timestamp, level_to_string(level), component, text);
+    if (length < 0) {
+        return;
+    }
+    size_t size = ((size_t)length < sizeof(line)) ? (size_t)length : sizeof(line) - 1;
     FILE *output = (level >= LOG_LEVEL_WARN) ? stderr : stdout;
-    fprintf(output, "%s [%s] %s: ", timestamp, level_to_string(level), component);
+    fwrite(line, 1, size, output);
+    fflush(output);
+}
+
+// vsnprintf() cuts a long message at a byte count; a multibyte character
+// split there is dropped whole so the line stays valid UTF-8.
+static void format_message(char *text, size_t size, const char *fmt, va_list args)
+{
+    int length = vsnprintf(text, size, fmt, args);
+    if (length < 0 || (size_t)length < size) {
+        return;
+    }
+    size_t end = size - 1;
+    size_t start = end;
+    while (start > 0 && ((unsigned char)text[start - 1] & 0xC0) == 0x80) {
+        start--;
+    }
+    if (start == 0) {
+        return;
+    }
+    unsigned char lead = (unsigned char)text[start - 1];
+    size_t need = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+    if (end - (start - 1) < need) {
+        text[start - 1] = '\0';
+    }
+}
+
+static void log_vmessage(log_level_t level, const char *component, const char *fmt, va_list args)
+{
+    pthread_once(&writer_once, start_writer);
+
+    struct log_ring *ring = atomic_load_explicit(&writer_running, memory_order_acquire) ? acquire_ring() : NULL;
+    if (ring == NULL) {
+        char text[LOG_MESSAGE_MAX];
+        format_message(text, sizeof(text), fmt, args);
+        write_direct(level, component, text);
+        return;
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= LOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&dropped_messages, 1, memory_order_relaxed);
+        return;
+    }
+
+    log_entry_t *entry = &ring->entries[head % LOG_RING_SLOTS];
+    entry->when = time(NULL);
+    entry->level = level;
+    entry->component = component;
+    format_message(entry->text, sizeof(entry->text), fmt, args);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    if (atomic_load_explicit(&writer_idle, memory_order_acquire)) {
+        pthread_cond_signal(&writer_cond);
+    }
+}
+
+void log_message(log_level_t level, const char *component, const char *fmt, ...)
+{
+    if (level < log_get_level()) {
+        return;
+    }
 
     va_list args;
     va_start(args, fmt);
-    vfprintf(output, fmt, args);
+    log_vmessage(level, component, fmt, args);
     va_end(args);
+}
+
+int log_enabled(log_level_t level)
+{
+    return level >= log_get_level() || trace_active();
+}
 
-    fputc('\n', output);
+void log_site_emit(log_site_t *site, ...)
+{
+    va_list args;
+    va_start(args, site);
+    if (trace_active()) {
+        va_list copy;
+        va_copy(copy, args);
+        trace_record(site, copy);
+        va_end(copy);
+    }
+    if (site->level >= log_get_level()) {
+        log_vmessage(site->level, site->component, site->fmt, args);
+    }
+    va_end(args);
 }
@@ -0,0 +1,683 @@
+#include "mailbox.h"
+
+#include "log.h"
+
+#include <crypt.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#define COMPONENT "mailbox"
+
+#define MAILBOX_BUCKETS 1024
+// Registered owners, and so mailboxes held in memory, are capped here.
+#define MAILBOX_MAX_OWNERS 10000
+#define MAILBOX_PATH_MAX 384
+#define MAILBOX_LINE_MAX (BOARD_AUTHOR_MAX + BOARD_TIMESTAMP_MAX + BOARD_CONTENT_MAX + 16)
+
+struct mail_node {
+    _Atomic(struct mail_node *) next;
+    mail_message_t message;
+};
+
+struct mailbox {
+    char owner[BOARD_AUTHOR_MAX];
+    char path[MAILBOX_PATH_MAX];
+    // Table chain. Mailboxes are only ever added, so readers walk it freely.
+    _Atomic(struct mailbox *) next;
+
+    // Intrusive MPSC queue: senders swap head without locking, the owner
+    // pops from tail under lock.
+    _Atomic(struct mail_node *) head;
+    struct mail_node *tail;
+    struct mail_node stub;
+
+    // Unread messages, counting ones still in the queue.
+    atomic_uint unread;
+    atomic_int sessions;
+
+    // Owner side; loaded is set exactly while a session is attached.
+    pthread_mutex_t lock;
+    int loaded;
+    int dirty;
+    mail_message_t *messages;
+    size_t count;
+    size_t capacity;
+    unsigned int next_id;
+};
+
+struct mailbox_store {
+    char directory[256];
+    _Atomic(struct mailbox *) buckets[MAILBOX_BUCKETS];
+    atomic_uint owners;
+};
+
+static int create_directories(const char *path)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", path);
+    for (char *p = buffer + 1;; ++p) {
+        if (*p != '/' && *p != '\0') {
+            continue;
+        }
+        char saved = *p;
+        *p = '\0';
+        if (mkdir(buffer, 0755) != 0 && errno != EEXIST) {
+            LOG_ERROR(COMPONENT, "Failed to create directory '%s': %s", buffer, strerror(errno));
+            return -1;
+        }
+        if (saved == '\0') {
+            return 0;
+        }
+        *p = saved;
+    }
+}
+
+static uint32_t hash_owner(const char *owner)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)owner; *p != '\0'; ++p) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+// Nicknames may hold any bytes, so file names are their hex encoding.
+static void build_path(const mailbox_store_t *store, const char *owner, const char *suffix, char *path, size_t size)
+{
+    int length = snprintf(path, size, "%s/", store->directory);
+    for (const unsigned char *p = (const unsigned char *)owner; *p != '\0' && (size_t)length < size; ++p) {
+        length += snprintf(path + length, size - (size_t)length, "%02x", *p);
+    }
+    if ((size_t)length < size) {
+        snprintf(path + length, size - (size_t)length, "%s", suffix);
+    }
+}
+
+static void build_timestamp(char *buffer, size_t size)
+{
+    time_t now = time(NULL);
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+    strftime(buffer, size, "%Y-%m-%d %H:%M", &tm_now);
+}
+
+static void queue_push(mailbox_t *mailbox, struct mail_node *node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    struct mail_node *previous = atomic_exchange_explicit(&mailbox->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&previous->next, node, memory_order_release);
+}
+
+// Returns NULL when the queue is empty or a push is halfway done; that
+// message is picked up by the next pop.
+static struct mail_node *queue_pop(mailbox_t *mailbox)
+{
+    struct mail_node *tail = mailbox->tail;
+    struct mail_node *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &mailbox->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        mailbox->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next != NULL) {
+        mailbox->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&mailbox->head, memory_order_acquire)) {
+        return NULL;
+    }
+    queue_push(mailbox, &mailbox->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL) {
+        mailbox->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static int add_message_locked(mailbox_t *mailbox, const mail_message_t *message)
+{
+    if (mailbox->count == mailbox->capacity) {
+        size_t capacity = mailbox->capacity > 0 ? mailbox->capacity * 2 : 8;
+        mail_message_t *grown = realloc(mailbox->messages, capacity * sizeof(*grown));
+        if (grown == NULL) {
+            return -1;
+        }
+        mailbox->messages = grown;
+        mailbox->capacity = capacity;
+    }
+    mail_message_t *slot = &mailbox->messages[mailbox->count++];
+    *slot = *message;
+    slot->id = ++mailbox->next_id;
+    return 0;
+}
+
+static void drain_locked(mailbox_t *mailbox)
+{
+    struct mail_node *node;
+    while ((node = queue_pop(mailbox)) != NULL) {
+        if (add_message_locked(mailbox, &node->message) != 0) {
+            LOG_WARN(COMPONENT, "Dropped a message for %s: out of memory", mailbox->owner);
+            atomic_fetch_sub_explicit(&mailbox->unread, 1, memory_order_relaxed);
+        }
+        mailbox->dirty = 1;
+        free(node);
+    }
+}
+
+static int write_message(FILE *file, const mail_message_t *message)
+{
+    return fprintf(file, "%s|%s|%d|%s\n", message->timestamp, message->from, message->read ? 1 : 0,
+                   message->text) < 0
+               ? -1
+               : 0;
+}
+
+static int parse_message(char *line, mail_message_t *message)
+{
+    char *saveptr = NULL;
+    const char *timestamp = strtok_r(line, "|", &saveptr);
+    const char *from = strtok_r(NULL, "|", &saveptr);
+    const char *read = strtok_r(NULL, "|", &saveptr);
+    char *text = strtok_r(NULL, "", &saveptr);
+    if (timestamp == NULL || from == NULL || read == NULL || text == NULL) {
+        return -1;
+    }
+    text[strcspn(text, "\r\n")] = '\0';
+
+    memset(message, 0, sizeof(*message));
+    snprintf(message->timestamp, sizeof(message->timestamp), "%s", timestamp);
+    snprintf(message->from, sizeof(message->from), "%s", from);
+    snprintf(message->text, sizeof(message->text), "%s", text);
+    message->read = (read[0] == '1');
+    return 0;
+}
+
+static void load_locked(mailbox_t *mailbox)
+{
+    FILE *file = fopen(mailbox->path, "r");
+    if (file == NULL) {
+        if (errno != ENOENT) {
+            LOG_WARN(COMPONENT, "Unable to read '%s': %s", mailbox->path, strerror(errno));
+        }
+        return;
+    }
+
+    unsigned int unread = 0;
+    char line[MAILBOX_LINE_MAX];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        mail_message_t message;
+        if (parse_message(line, &message) != 0 || add_message_locked(mailbox, &message) != 0) {
+            continue;
+        }
+        unread += message.read ? 0 : 1;
+    }
+    fclose(file);
+    atomic_fetch_add_explicit(&mailbox->unread, unread, memory_order_relaxed);
+}
+
+static void save_locked(mailbox_t *mailbox)
+{
+    if (!mailbox->dirty) {
+        return;
+    }
+    if (mailbox->count == 0) {
+        if (unlink(mailbox->path) != 0 && errno != ENOENT) {
+            LOG_WARN(COMPONENT, "Unable to remove '%s': %s", mailbox->path, strerror(errno));
+        }
+        mailbox->dirty = 0;
+        return;
+    }
+
+    char temp_path[MAILBOX_PATH_MAX + 4];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", mailbox->path);
+    FILE *file = fopen(temp_path, "w");
+    if (file == NULL) {
+        LOG_WARN(COMPONENT, "Unable to write '%s': %s", temp_path, strerror(errno));
+        return;
+    }
+    int rc = 0;
+    for (size_t i = 0; i < mailbox->count && rc == 0; ++i) {
+        rc = write_message(file, &mailbox->messages[i]);
+    }
+    if (fclose(file) != 0 || rc != 0 || rename(temp_path, mailbox->path) != 0) {
+        LOG_WARN(COMPONENT, "Failed to save mailbox of %s: %s", mailbox->owner, strerror(errno));
+        unlink(temp_path);
+        return;
+    }
+    mailbox->dirty = 0;
+}
+
+static int append_locked(mailbox_t *mailbox, const mail_message_t *message)
+{
+    FILE *file = fopen(mailbox->path, "a");
+    if (file == NULL) {
+        LOG_WARN(COMPONENT, "Unable to append to '%s': %s", mailbox->path, strerror(errno));
+        return -1;
+    }
+    int rc = write_message(file, message);
+    if (fclose(file) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+static void unload_locked(mailbox_t *mailbox)
+{
+    drain_locked(mailbox);
+    save_locked(mailbox);
+
+    unsigned int unread = 0;
+    for (size_t i = 0; i < mailbox->count; ++i) {
+        unread += mailbox->messages[i].read ? 0 : 1;
+    }
+    // A sender that saw the session a moment ago may still push; its message
+    // stays queued, and counted, until the next attach.
+    atomic_fetch_sub_explicit(&mailbox->unread, unread, memory_order_relaxed);
+
+    free(mailbox->messages);
+    mailbox->messages = NULL;
+    mailbox->count = 0;
+    mailbox->capacity = 0;
+    mailbox->loaded = 0;
+}
+
+static mailbox_t *mailbox_new(const mailbox_store_t *store, const char *owner)
+{
+    mailbox_t *mailbox = calloc(1, sizeof(*mailbox));
+    if (mailbox == NULL) {
+        return NULL;
+    }
+    if (pthread_mutex_init(&mailbox->lock, NULL) != 0) {
+        free(mailbox);
+        return NULL;
+    }
+    snprintf(mailbox->owner, sizeof(mailbox->owner), "%s", owner);
+    build_path(store, mailbox->owner, ".mbox", mailbox->path, sizeof(mailbox->path));
+
+    atomic_init(&mailbox->next, NULL);
+    atomic_init(&mailbox->stub.next, NULL);
+    atomic_init(&mailbox->head, &mailbox->stub);
+    mailbox->tail = &mailbox->stub;
+    atomic_init(&mailbox->unread, 0);
+    atomic_init(&mailbox->sessions, 0);
+    return mailbox;
+}
+
+static void mailbox_free(mailbox_t *mailbox)
+{
+    pthread_mutex_destroy(&mailbox->lock);
+    free(mailbox->messages);
+    free(mailbox);
+}
+
+static mailbox_t *find_mailbox(mailbox_t *from, const mailbox_t *until, const char *owner)
+{
+    for (mailbox_t *mailbox = from; mailbox != until; mailbox = atomic_load(&mailbox->next)) {
+        if (strcmp(mailbox->owner, owner) == 0) {
+            return mailbox;
+        }
+    }
+    return NULL;
+}
+
+static int key_exists(const mailbox_store_t *store, const char *owner)
+{
+    char path[MAILBOX_PATH_MAX];
+    build_path(store, owner, ".key", path, sizeof(path));
+    return access(path, F_OK) == 0;
+}
+
+// Only registered owners get an entry, so the table never outgrows
+// MAILBOX_MAX_OWNERS. Returns NULL for anyone else.
+static mailbox_t *lookup(mailbox_store_t *store, const char *owner)
+{
+    _Atomic(mailbox_t *) *bucket = &store->buckets[hash_owner(owner) % MAILBOX_BUCKETS];
+    mailbox_t *head = atomic_load(bucket);
+    mailbox_t *found = find_mailbox(head, NULL, owner);
+    if (found != NULL) {
+        return found;
+    }
+    if (!key_exists(store, owner)) {
+        return NULL;
+    }
+
+    mailbox_t *fresh = mailbox_new(store, owner);
+    if (fresh == NULL) {
+        return NULL;
+    }
+    while (1) {
+        atomic_store(&fresh->next, head);
+        if (atomic_compare_exchange_weak(bucket, &head, fresh)) {
+            return fresh;
+        }
+        // Someone else inserted; only the new entries can be a duplicate.
+        found = find_mailbox(head, atomic_load(&fresh->next), owner);
+        if (found != NULL) {
+            mailbox_free(fresh);
+            return found;
+        }
+    }
+}
+
+static unsigned int count_owners(const char *directory)
+{
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        return 0;
+    }
+    unsigned int owners = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length > 4 && strcmp(entry->d_name + length - 4, ".key") == 0) {
+            owners++;
+        }
+    }
+    closedir(dir);
+    return owners;
+}
+
+mailbox_store_t *mailbox_store_create(const char *directory)
+{
+    if (directory == NULL || directory[0] == '\0' || strlen(directory) >= sizeof(((mailbox_store_t *)0)->directory)) {
+        return NULL;
+    }
+    if (create_directories(directory) != 0) {
+        return NULL;
+    }
+    mailbox_store_t *store = calloc(1, sizeof(*store));
+    if (store == NULL) {
+        return NULL;
+    }
+    snprintf(store->directory, sizeof(store->directory), "%s", directory);
+    for (size_t i = 0; i < MAILBOX_BUCKETS; ++i) {
+        atomic_init(&store->buckets[i], NULL);
+    }
+    atomic_init(&store->owners, count_owners(directory));
+    return store;
+}
+
+void mailbox_store_destroy(mailbox_store_t *store)
+{
+    if (store == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < MAILBOX_BUCKETS; ++i) {
+        mailbox_t *mailbox = atomic_load(&store->buckets[i]);
+        while (mailbox != NULL) {
+            mailbox_t *next = atomic_load(&mailbox->next);
+            pthread_mutex_lock(&mailbox->lock);
+            if (mailbox->loaded) {
+                unload_locked(mailbox);
+            } else {
+                struct mail_node *node;
+                while ((node = queue_pop(mailbox)) != NULL) {
+                    append_locked(mailbox, &node->message);
+                    free(node);
+                }
+            }
+            pthread_mutex_unlock(&mailbox->lock);
+            mailbox_free(mailbox);
+            mailbox = next;
+        }
+    }
+    free(store);
+}
+
+mailbox_t *mailbox_attach(mailbox_store_t *store, const char *owner)
+{
+    if (store == NULL || owner == NULL || owner[0] == '\0') {
+        return NULL;
+    }
+    mailbox_t *mailbox = lookup(store, owner);
+    if (mailbox == NULL) {
+        return NULL;
+    }
+    // Counted before taking the lock so a sender that checks afterwards
+    // queues the message instead of appending to the file being loaded.
+    atomic_fetch_add(&mailbox->sessions, 1);
+    pthread_mutex_lock(&mailbox->lock);
+    if (!mailbox->loaded) {
+        load_locked(mailbox);
+        mailbox->loaded = 1;
+    }
+    drain_locked(mailbox);
+    pthread_mutex_unlock(&mailbox->lock);
+    return mailbox;
+}
+
+int mailbox_registered(mailbox_store_t *store, const char *owner)
+{
+    if (store == NULL || owner == NULL || owner[0] == '\0' || strlen(owner) >= BOARD_AUTHOR_MAX) {
+        return -1;
+    }
+    return key_exists(store, owner);
+}
+
+// crypt_data is too large for a session thread's stack.
+static int hash_password(const char *password, const char *setting, char *hash, size_t size)
+{
+    struct crypt_data *data = calloc(1, sizeof(*data));
+    if (data == NULL) {
+        return -1;
+    }
+    const char *result = crypt_r(password, setting, data);
+    int rc = -1;
+    if (result != NULL && result[0] != '*' && strlen(result) < size) {
+        snprintf(hash, size, "%s", result);
+        rc = 0;
+    }
+    free(data);
+    return rc;
+}
+
+int mailbox_register(mailbox_store_t *store, const char *owner, const char *password)
+{
+    if (store == NULL || owner == NULL || password == NULL || owner[0] == '\0' ||
+        strlen(owner) >= BOARD_AUTHOR_MAX || password[0] == '\0') {
+        return -1;
+    }
+    char salt[CRYPT_GENSALT_OUTPUT_SIZE];
+    char hash[CRYPT_OUTPUT_SIZE];
+    if (crypt_gensalt_rn(NULL, 0, NULL, 0, salt, sizeof(salt)) == NULL ||
+        hash_password(password, salt, hash, sizeof(hash)) != 0) {
+        LOG_ERROR(COMPONENT, "Failed to hash a mailbox password: %s", strerror(errno));
+        return -1;
+    }
+
+    if (atomic_fetch_add(&store->owners, 1) >= MAILBOX_MAX_OWNERS) {
+        atomic_fetch_sub(&store->owners, 1);
+        LOG_WARN(COMPONENT, "Refused to register %s: %d mailboxes already exist", owner, MAILBOX_MAX_OWNERS);
+        return -1;
+    }
+    char path[MAILBOX_PATH_MAX];
+    build_path(store, owner, ".key", path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        atomic_fetch_sub(&store->owners, 1);
+        if (errno == EEXIST) {
+            return 1;
+        }
+        LOG_ERROR(COMPONENT, "Unable to create '%s': %s", path, strerror(errno));
+        return -1;
+    }
+    size_t length = strlen(hash);
+    hash[length] = '\n';
+    int rc = write(fd, hash, length + 1) == (ssize_t)(length + 1) ? 0 : -1;
+    if (close(fd) != 0 || rc != 0) {
+        LOG_ERROR(COMPONENT, "Failed to write '%s': %s", path, strerror(errno));
+        unlink(path);
+        atomic_fetch_sub(&store->owners, 1);
+        return -1;
+    }
+    LOG_INFO(COMPONENT, "Registered a mailbox for %s", owner);
+    return 0;
+}
+
+int mailbox_verify(mailbox_store_t *store, const char *owner, const char *password)
+{
+    if (store == NULL || owner == NULL || password == NULL || owner[0] == '\0' ||
+        strlen(owner) >= BOARD_AUTHOR_MAX) {
+        return -1;
+    }
+    char path[MAILBOX_PATH_MAX];
+    build_path(store, owner, ".key", path, sizeof(path));
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        if (errno != ENOENT) {
+            LOG_WARN(COMPONENT, "Unable to read '%s': %s", path, strerror(errno));
+        }
+        return -1;
+    }
+    char stored[CRYPT_OUTPUT_SIZE];
+    int found = fgets(stored, sizeof(stored), file) != NULL;
+    fclose(file);
+    if (!found) {
+        return -1;
+    }
+    stored[strcspn(stored, "\r\n")] = '\0';
+
+    char hash[CRYPT_OUTPUT_SIZE];
+    if (hash_password(password, stored, hash, sizeof(hash)) != 0) {
+        return 1;
+    }
+    return strcmp(hash, stored) == 0 ? 0 : 1;
+}
+
+void mailbox_detach(mailbox_t *mailbox)
+{
+    if (mailbox == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&mailbox->lock);
+    if (atomic_fetch_sub(&mailbox->sessions, 1) == 1) {
+        unload_locked(mailbox);
+    }
+    pthread_mutex_unlock(&mailbox->lock);
+}
+
+int mailbox_send(mailbox_store_t *store, const char *from, const char *to, const char *text)
+{
+    if (store == NULL || from == NULL || to == NULL || text == NULL || to[0] == '\0' ||
+        strlen(to) >= BOARD_AUTHOR_MAX || text[0] == '\0' || strlen(text) >= BOARD_CONTENT_MAX) {
+        return -1;
+    }
+    // The file has one '|'-separated message per line; the text is the last
+    // field, so only line breaks would corrupt it.
+    if (from[strcspn(from, "|\r\n")] != '\0' || text[strcspn(text, "\r\n")] != '\0') {
+        return -1;
+    }
+    mailbox_t *mailbox = lookup(store, to);
+    if (mailbox == NULL) {
+        return 1;
+    }
+    struct mail_node *node = calloc(1, sizeof(*node));
+    if (node == NULL) {
+        return -1;
+    }
+    snprintf(node->message.from, sizeof(node->message.from), "%s", from);
+    snprintf(node->message.text, sizeof(node->message.text), "%s", text);
+    build_timestamp(node->message.timestamp, sizeof(node->message.timestamp));
+
+    if (atomic_load(&mailbox->sessions) > 0) {
+        // Counted first so a drain racing the push never takes unread below
+        // zero.
+        atomic_fetch_add_explicit(&mailbox->unread, 1, memory_order_relaxed);
+        queue_push(mailbox, node);
+        return 0;
+    }
+
+    pthread_mutex_lock(&mailbox->lock);
+    if (atomic_load(&mailbox->sessions) > 0) {
+        pthread_mutex_unlock(&mailbox->lock);
+        atomic_fetch_add_explicit(&mailbox->unread, 1, memory_order_relaxed);
+        queue_push(mailbox, node);
+        return 0;
+    }
+    int rc = append_locked(mailbox, &node->message);
+    pthread_mutex_unlock(&mailbox->lock);
+    free(node);
+    return rc;
+}
+
+unsigned int mailbox_unread(const mailbox_t *mailbox)
+{
+    return mailbox != NULL ? atomic_load_explicit(&mailbox->unread, memory_order_relaxed) : 0;
+}
+
+int mailbox_read_all(mailbox_t *mailbox, mail_message_t **messages, size_t *count)
+{
+    if (mailbox == NULL || messages == NULL || count == NULL) {
+        return -1;
+    }
+    *messages = NULL;
+    *count = 0;
+
+    pthread_mutex_lock(&mailbox->lock);
+    drain_locked(mailbox);
+    mail_message_t *copy = NULL;
+    if (mailbox->count > 0) {
+        copy = malloc(mailbox->count * sizeof(*copy));
+        if (copy == NULL) {
+            pthread_mutex_unlock(&mailbox->lock);
+            return -1;
+        }
+        memcpy(copy, mailbox->messages, mailbox->count * sizeof(*copy));
+    }
+    unsigned int newly_read = 0;
+    for (size_t i = 0; i < mailbox->count; ++i) {
+        if (!mailbox->messages[i].read) {
+            mailbox->messages[i].read = 1;
+            newly_read++;
+        }
+    }
+    if (newly_read > 0) {
+        mailbox->dirty = 1;
+        atomic_fetch_sub_explicit(&mailbox->unread, newly_read, memory_order_relaxed);
+    }
+    *count = mailbox->count;
+    pthread_mutex_unlock(&mailbox->lock);
+
+    *messages = copy;
+    return 0;
+}
+
+int mailbox_remove(mailbox_t *mailbox, unsigned int id)
+{
+    if (mailbox == NULL) {
+        return -1;
+    }
+    int result = 1;
+    pthread_mutex_lock(&mailbox->lock);
+    for (size_t i = 0; i < mailbox->count; ++i) {
+        if (mailbox->messages[i].id != id) {
+            continue;
+        }
+        if (!mailbox->messages[i].read) {
+            atomic_fetch_sub_explicit(&mailbox->unread, 1, memory_order_relaxed);
+        }
+        memmove(&mailbox->messages[i], &mailbox->messages[i + 1],
+                (mailbox->count - i - 1) * sizeof(mailbox->messages[0]));
+        mailbox->count--;
+        mailbox->dirty = 1;
+        result = 0;
+        break;
+    }
+    pthread_mutex_unlock(&mailbox->lock);
+    return result;
+}
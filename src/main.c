@@ -1,8 +1,12 @@
+#include "admin.h"
+#include "broker.h"
 #include "config.h"
+#include "lock_profile.h"
 #include "log.h"
 #include "maum.h"
 #include "server.h"
 #include "session.h"
+#include "trace.h"
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -11,34 +15,39 @@
 
 static void usage(const char *program)
 {
-    fprintf(stderr, "Usage: %s [--config path] [--log-level level] [--stdio]\n", program);
+    fprintf(stderr, "Usage: %s [--config path] [--log-level level] [--stdio [--standalone] | --upgrade | --admin command]\n",
+            program);
 }
 
-static log_level_t parse_log_level(const char *value)
+static void describe_stdio_peer(char *buffer, size_t size)
 {
-    if (value == NULL) {
-        return LOG_LEVEL_INFO;
-    }
-    if (strcmp(value, "debug") == 0) {
-        return LOG_LEVEL_DEBUG;
-    }
-    if (strcmp(value, "info") == 0) {
-        return LOG_LEVEL_INFO;
-    }
-    if (strcmp(value, "warn") == 0) {
-        return LOG_LEVEL_WARN;
+    // sshd exports "client_ip client_port server_port" for ForceCommand sessions.
+    const char *ssh_client = getenv("SSH_CLIENT");
+    char host[64];
+    unsigned int port = 0;
+    if (ssh_client != NULL && sscanf(ssh_client, "%63s %u", host, &port) == 2) {
+        snprintf(buffer, size, "%s:%u", host, port);
+        return;
     }
-    if (strcmp(value, "error") == 0) {
-        return LOG_LEVEL_ERROR;
-    }
-    return LOG_LEVEL_INFO;
+    snprintf(buffer, size, "%s", "local");
+}
+
+static log_level_t parse_log_level(const char *value)
+{
+    log_level_t level = LOG_LEVEL_INFO;
+    log_parse_level(value, &level);
+    return level;
 }
 
 int main(int argc, char *argv[])
 {
     const char *config_path = "maum.conf";
     log_level_t level = LOG_LEVEL_INFO;
+    bool level_given = false;
     bool stdio_mode = false;
+    bool standalone = false;
+    bool upgrade = false;
+    const char *admin_command = NULL;
 
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
@@ -47,12 +56,25 @@ int main(int argc, char *argv[])
         }
         if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
             level = parse_log_level(argv[++i]);
+            level_given = true;
             continue;
         }
         if (strcmp(argv[i], "--stdio") == 0) {
             stdio_mode = true;
             continue;
         }
+        if (strcmp(argv[i], "--standalone") == 0) {
+            standalone = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--admin") == 0 && i + 1 < argc) {
+            admin_command = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--upgrade") == 0) {
+            upgrade = true;
+            continue;
+        }
         usage(argv[0]);
         return EXIT_FAILURE;
     }
@@ -62,24 +84,58 @@ int main(int argc, char *argv[])
     maum_config_t config;
     config_init(&config);
     config_load(&config, config_path);
+    // --log-level wins at startup; a later SIGHUP applies log_level from the
+    // file only if the file changed it.
+    if (!level_given) {
+        log_set_level(config.log_level);
+    }
+    config_publish(&config);
+
+    if (admin_command != NULL) {
+        return admin_request(config.admin_socket_path, admin_command, stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
     if (stdio_mode) {
+        char peer[BROKER_PEER_MAX];
+        describe_stdio_peer(peer, sizeof(peer));
+
+        if (!standalone && config.broker_socket_path[0] != '\0' &&
+            broker_attach(config.broker_socket_path, peer) == 0) {
+            return EXIT_SUCCESS;
+        }
+
         session_manager_t *sessions = session_manager_create(&config);
         if (sessions == NULL) {
             LOG_ERROR("main", "%s", "세션 매니저를 초기화할 수 없습니다");
             return EXIT_FAILURE;
         }
-        session_manager_run(sessions, SESSION_TRANSPORT_STDIO, stdin, stdout, "local");
+        session_manager_run(sessions, SESSION_TRANSPORT_STDIO, stdin, stdout, peer);
         session_manager_destroy(sessions);
         return EXIT_SUCCESS;
     }
 
-    server_context_t *server = server_create(&config);
+    if (config_validate(&config) != 0) {
+        LOG_ERROR("main", "Invalid configuration in '%s'", config_path);
+        return EXIT_FAILURE;
+    }
+
+    if (config.trace_path[0] != '\0') {
+        trace_open(config.trace_path, config.trace_size_kb);
+    }
+    lock_profile_set_enabled(config.lock_profiling);
+
+    server_context_t *server = server_create(&config, config_path);
     if (server == NULL) {
         LOG_ERROR("main", "%s", "Failed to initialize server context");
         return EXIT_FAILURE;
     }
 
+    if (upgrade && server_takeover(server) != 0) {
+        LOG_ERROR("main", "%s", "Upgrade failed: could not take over listeners from the running server");
+        server_destroy(server);
+        return EXIT_FAILURE;
+    }
+
     int result = server_run(server);
     server_destroy(server);
 
@@ -1,6 +1,19 @@
 #include "menu.h"
 
-#include <stdio.h>
+#include "board.h"
+
+#define MENU_BOX_WIDTH 62
+#define MENU_ITEMS_TOP 4
+#define MENU_STATUS_ROW (MENU_ITEMS_TOP + MENU_ITEM_COUNT + 2)
+#define MENU_PROMPT_ROW (MENU_STATUS_ROW + 2)
+
+static const char *const menu_items[MENU_ITEM_COUNT] = {
+    "실시간 채팅 참여 (대화방)", "게시물 목록 보기 (게시판)", "새 게시물 등록", "내 게시물 삭제",
+    "쪽지함",                  "자료실",                   "새 글 보기",     "게시판 선택",
+    "종료",
+};
+
+static const char menu_prompt[] = "메뉴 선택 (1-9): ";
 
 void menu_init(menu_context_t *menu)
 {
@@ -8,29 +21,111 @@ void menu_init(menu_context_t *menu)
         return;
     }
     menu->active_index = 0;
+    menu->screen = NULL;
+    menu->status = NULL;
+    menu->board = NULL;
+}
+
+void menu_release(menu_context_t *menu)
+{
+    if (menu == NULL) {
+        return;
+    }
+    vscreen_destroy(menu->screen);
+    menu->screen = NULL;
+}
+
+int menu_resize(menu_context_t *menu, unsigned int width, unsigned int height)
+{
+    if (menu == NULL) {
+        return -1;
+    }
+    if (menu->screen == NULL) {
+        menu->screen = vscreen_create(width, height);
+        return menu->screen != NULL ? 0 : -1;
+    }
+    return vscreen_resize(menu->screen, width, height);
+}
+
+static unsigned int box_width(const menu_context_t *menu)
+{
+    unsigned int width = vscreen_width(menu->screen);
+    return width < MENU_BOX_WIDTH ? width : MENU_BOX_WIDTH;
+}
+
+// Horizontal rule from left to right corner, or a blank row between walls.
+static void draw_row(const menu_context_t *menu, unsigned int y, const char *left, const char *fill,
+                     const char *right)
+{
+    unsigned int width = box_width(menu);
+    vscreen_print(menu->screen, 0, y, 0, left);
+    for (unsigned int x = 1; x + 1 < width; ++x) {
+        vscreen_print(menu->screen, x, y, 0, fill);
+    }
+    vscreen_print(menu->screen, width - 1, y, 0, right);
+}
+
+static void draw_centered(const menu_context_t *menu, unsigned int y, unsigned int attr, const char *text)
+{
+    unsigned int width = box_width(menu);
+    unsigned int columns = vscreen_text_width(text);
+    unsigned int x = columns + 2 < width ? (width - columns) / 2 : 1;
+    vscreen_print(menu->screen, x, y, attr, text);
 }
 
 void menu_render_banner(const menu_context_t *menu)
 {
-    (void)menu;
-    printf("\n");
-    printf("╔════════════════════════════════════════════════════════════╗\n");
-    printf("║                   마음 (Maum) BBS                          ║\n");
-    printf("║              Classic Korean BBS Revival                     ║\n");
-    printf("╠════════════════════════════════════════════════════════════╣\n");
+    if (menu == NULL || menu->screen == NULL) {
+        return;
+    }
+    vscreen_clear(menu->screen);
+    draw_row(menu, 0, "╔", "═", "╗");
+    draw_row(menu, 1, "║", " ", "║");
+    draw_centered(menu, 1, VSCREEN_BOLD, "마음 (Maum) BBS");
+    draw_row(menu, 2, "║", " ", "║");
+    draw_centered(menu, 2, 0, "Classic Korean BBS Revival");
+    draw_row(menu, 3, "╠", "═", "╣");
+    if (menu->board != NULL) {
+        char label[BOARD_TITLE_MAX + 4];
+        snprintf(label, sizeof(label), " %s ", menu->board);
+        draw_centered(menu, 3, VSCREEN_BOLD, label);
+    }
 }
 
 void menu_render_main(const menu_context_t *menu)
 {
-    (void)menu;
-    printf("║  [1] Bulletin Boards (게시판)                               ║\n");
-    printf("║  [2] File Libraries (자료실)                                ║\n");
-    printf("║  [3] Chat Rooms (대화방)                                    ║\n");
-    printf("║  [4] Private Messages (쪽지함)                              ║\n");
-    printf("║  [5] User Profile (내 정보)                                 ║\n");
-    printf("║  [6] System Info (시스템 정보)                              ║\n");
-    printf("║  [7] Help (도움말)                                          ║\n");
-    printf("║  [Q] Quit (종료)                                            ║\n");
-    printf("╚════════════════════════════════════════════════════════════╝\n");
-    printf("\nSelect [1-7, Q]: _\n");
+    if (menu == NULL || menu->screen == NULL) {
+        return;
+    }
+    unsigned int y = MENU_ITEMS_TOP;
+    for (unsigned int i = 0; i < MENU_ITEM_COUNT; ++i, ++y) {
+        char label[96];
+        snprintf(label, sizeof(label), " [%u] %s ", i + 1, menu_items[i]);
+        draw_row(menu, y, "║", " ", "║");
+        vscreen_print(menu->screen, 2, y, i == menu->active_index ? VSCREEN_REVERSE : 0, label);
+    }
+    draw_row(menu, y, "╚", "═", "╝");
+
+    if (menu->status != NULL) {
+        vscreen_print(menu->screen, 0, MENU_STATUS_ROW, VSCREEN_BOLD, menu->status);
+    }
+    unsigned int x = vscreen_print(menu->screen, 0, MENU_PROMPT_ROW, 0, menu_prompt);
+    vscreen_move(menu->screen, x, MENU_PROMPT_ROW);
+}
+
+size_t menu_present(menu_context_t *menu, FILE *out)
+{
+    if (menu == NULL || menu->screen == NULL) {
+        return 0;
+    }
+    menu_render_banner(menu);
+    menu_render_main(menu);
+    return vscreen_flush(menu->screen, out);
+}
+
+void menu_input_done(menu_context_t *menu)
+{
+    if (menu != NULL) {
+        vscreen_invalidate_row(menu->screen, MENU_PROMPT_ROW, vscreen_text_width(menu_prompt));
+    }
 }
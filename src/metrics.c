@@ -0,0 +1,447 @@
+#define _GNU_SOURCE
+
+#include "metrics.h"
+
+#include "lock_profile.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COMPONENT "metrics"
+
+#define METRICS_STRIPES 16
+
+// Log-linear (HDR-style) buckets over microseconds: values below 8us get a
+// bucket each, above that every power of two is split into 8 sub-buckets,
+// i.e. about 12% relative precision up to 2^36us.
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_COUNT (1u << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_EXPONENT 36
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BITS + 2) * HISTOGRAM_SUB_COUNT)
+
+// Exported "le" bounds are the powers of two from 1us to 2^26us (~67s).
+#define HISTOGRAM_EXPORT_OCTAVES 27
+
+#define SCRAPE_REQUEST_MAX 4096
+#define SCRAPE_TIMEOUT_MS 1000
+
+typedef struct {
+    const char *name;
+    const char *help;
+    const char *labels;
+} metric_info_t;
+
+typedef struct {
+    _Alignas(64) atomic_uint_fast64_t values[METRIC_COUNTER_COUNT];
+} counter_stripe_t;
+
+typedef struct {
+    _Alignas(64) atomic_uint_fast64_t buckets[HISTOGRAM_BUCKETS];
+    atomic_uint_fast64_t sum_ns;
+} histogram_stripe_t;
+
+typedef struct {
+    int fd;
+    metrics_counter_t counter;
+    atomic_uint_fast64_t *tally;
+} counted_stream_t;
+
+static const metric_info_t counter_info[METRIC_COUNTER_COUNT] = {
+    [METRIC_ACCEPTS_TELNET] = {"maum_connections_accepted_total", "Connections accepted by listener",
+                               "listener=\"telnet\""},
+    [METRIC_ACCEPTS_SSH] = {"maum_connections_accepted_total", NULL, "listener=\"ssh\""},
+    [METRIC_ACCEPTS_BROKER] = {"maum_connections_accepted_total", NULL, "listener=\"broker\""},
+    [METRIC_CHAT_MESSAGES] = {"maum_chat_messages_total", "Chat lines broadcast", NULL},
+    [METRIC_CHAT_DELIVERIES] = {"maum_chat_deliveries_total", "Chat lines written to members", NULL},
+    [METRIC_TELNET_BYTES_IN] = {"maum_telnet_bytes_total", "Bytes moved on telnet connections",
+                                "direction=\"in\""},
+    [METRIC_TELNET_BYTES_OUT] = {"maum_telnet_bytes_total", NULL, "direction=\"out\""},
+    [METRIC_LIBRARY_BYTES] = {"maum_library_bytes_total", "File library bytes sent", NULL},
+    [METRIC_HUB_EVENTS] = {"maum_hub_events_total", "Events published to the notification hub", NULL},
+    [METRIC_HUB_DELIVERIES] = {"maum_hub_deliveries_total", "Notification hub events handed to subscribers", NULL},
+    [METRIC_RELAY_SENT] = {"maum_relay_messages_total", "Chat lines exchanged with relay links", "direction=\"out\""},
+    [METRIC_RELAY_RECEIVED] = {"maum_relay_messages_total", NULL, "direction=\"in\""},
+    [METRIC_RELAY_DUPLICATES] = {"maum_relay_duplicates_total", "Relayed chat lines dropped as already seen", NULL},
+    [METRIC_RELAY_DROPPED] = {"maum_relay_dropped_total", "Chat lines not queued because a relay link was behind",
+                              NULL},
+    [METRIC_RELAY_BATCHES] = {"maum_relay_frames_total", "Chat frames written to relay links", NULL},
+    [METRIC_REPLICATION_BYTES_SENT] = {"maum_replication_bytes_total",
+                                       "Board bytes streamed to followers or applied from the leader",
+                                       "direction=\"out\""},
+    [METRIC_REPLICATION_BYTES_APPLIED] = {"maum_replication_bytes_total", NULL, "direction=\"in\""},
+    [METRIC_REPLICATION_RESYNCS] = {"maum_replication_resyncs_total", "Boards sent or received whole", NULL},
+    [METRIC_REPLICATION_FORWARDS] = {"maum_replication_forwards_total", "Board writes forwarded to the leader",
+                                     NULL},
+};
+
+static const metric_info_t gauge_info[METRIC_GAUGE_COUNT] = {
+    [METRIC_SESSIONS_ACTIVE] = {"maum_sessions_active", "Sessions currently connected", NULL},
+    [METRIC_CHAT_MEMBERS] = {"maum_chat_members", "Sessions currently in the chat room", NULL},
+    [METRIC_LIBRARY_DOWNLOADS] = {"maum_library_downloads_active", "File library downloads in progress", NULL},
+    [METRIC_BOARDS_OPEN] = {"maum_boards_open", "Configured boards opened so far", NULL},
+    [METRIC_RELAY_LINKS] = {"maum_relay_links", "Chat relay links currently up", NULL},
+    [METRIC_REPLICATION_PEERS] = {"maum_replication_peers",
+                                  "Followers connected (leader) or 1 while linked to the leader (follower)", NULL},
+    [METRIC_REPLICATION_LAG_BYTES] = {"maum_replication_lag_bytes",
+                                      "Board bytes the leader has that this follower has not applied", NULL},
+};
+
+static const metric_info_t histogram_info[METRIC_HISTOGRAM_COUNT] = {
+    [METRIC_CHAT_BROADCAST] = {"maum_chat_broadcast_seconds", "Time to fan one chat line out to all members",
+                               NULL},
+    [METRIC_BOARD_LIST] = {"maum_board_operation_seconds", "Board operation latency including lock wait",
+                           "op=\"list\""},
+    [METRIC_BOARD_LIST_SINCE] = {"maum_board_operation_seconds", NULL, "op=\"list_since\""},
+    [METRIC_BOARD_ADD] = {"maum_board_operation_seconds", NULL, "op=\"add\""},
+    [METRIC_BOARD_REMOVE] = {"maum_board_operation_seconds", NULL, "op=\"remove\""},
+    [METRIC_REPLICATION_DELAY] = {"maum_replication_delay_seconds",
+                                  "Time from a board write on the leader to its apply on this follower", NULL},
+};
+
+static counter_stripe_t counters[METRICS_STRIPES];
+static histogram_stripe_t histograms[METRIC_HISTOGRAM_COUNT][METRICS_STRIPES];
+static atomic_int_fast64_t gauges[METRIC_GAUGE_COUNT];
+
+static atomic_uint next_stripe;
+static _Thread_local unsigned int thread_stripe;
+
+static unsigned int stripe_index(void)
+{
+    if (thread_stripe == 0) {
+        thread_stripe = atomic_fetch_add_explicit(&next_stripe, 1, memory_order_relaxed) % METRICS_STRIPES + 1;
+    }
+    return thread_stripe - 1;
+}
+
+void metrics_add(metrics_counter_t counter, uint64_t amount)
+{
+    if ((unsigned int)counter >= METRIC_COUNTER_COUNT) {
+        return;
+    }
+    atomic_fetch_add_explicit(&counters[stripe_index()].values[counter], amount, memory_order_relaxed);
+}
+
+void metrics_gauge_add(metrics_gauge_t gauge, int64_t delta)
+{
+    if ((unsigned int)gauge >= METRIC_GAUGE_COUNT) {
+        return;
+    }
+    atomic_fetch_add_explicit(&gauges[gauge], delta, memory_order_relaxed);
+}
+
+void metrics_gauge_set(metrics_gauge_t gauge, int64_t value)
+{
+    if ((unsigned int)gauge >= METRIC_GAUGE_COUNT) {
+        return;
+    }
+    atomic_store_explicit(&gauges[gauge], value, memory_order_relaxed);
+}
+
+static unsigned int bucket_for(uint64_t micros)
+{
+    if (micros < HISTOGRAM_SUB_COUNT) {
+        return (unsigned int)micros;
+    }
+    unsigned int exponent = 63u - (unsigned int)__builtin_clzll(micros);
+    if (exponent > HISTOGRAM_MAX_EXPONENT) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    unsigned int sub = (unsigned int)(micros >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_COUNT - 1);
+    return (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT + sub;
+}
+
+// Exclusive upper bound of a bucket, in microseconds.
+static uint64_t bucket_upper(unsigned int index)
+{
+    if (index < HISTOGRAM_SUB_COUNT) {
+        return index + 1;
+    }
+    unsigned int exponent = index / HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = index % HISTOGRAM_SUB_COUNT;
+    return (HISTOGRAM_SUB_COUNT + sub + 1) << (exponent - HISTOGRAM_SUB_BITS);
+}
+
+void metrics_observe(metrics_histogram_t histogram, uint64_t nanoseconds)
+{
+    if ((unsigned int)histogram >= METRIC_HISTOGRAM_COUNT) {
+        return;
+    }
+    histogram_stripe_t *stripe = &histograms[histogram][stripe_index()];
+    atomic_fetch_add_explicit(&stripe->buckets[bucket_for(nanoseconds / 1000u)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stripe->sum_ns, nanoseconds, memory_order_relaxed);
+}
+
+uint64_t metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void write_header(FILE *out, const metric_info_t *info, const char *type)
+{
+    if (info->help != NULL) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", info->name, info->help, info->name, type);
+    }
+}
+
+static void write_sample(FILE *out, const char *name, const char *suffix, const char *labels, const char *extra,
+                         const char *value)
+{
+    bool has_labels = (labels != NULL) || (extra != NULL);
+    fprintf(out, "%s%s%s%s%s%s%s %s\n", name, suffix, has_labels ? "{" : "", labels != NULL ? labels : "",
+            (labels != NULL && extra != NULL) ? "," : "", extra != NULL ? extra : "", has_labels ? "}" : "",
+            value);
+}
+
+// Sums the stripes; returns the total observation count.
+static uint64_t collect_histogram(metrics_histogram_t histogram, uint64_t *buckets, uint64_t *sum_ns)
+{
+    uint64_t total = 0;
+    *sum_ns = 0;
+    memset(buckets, 0, HISTOGRAM_BUCKETS * sizeof(*buckets));
+    for (unsigned int s = 0; s < METRICS_STRIPES; ++s) {
+        histogram_stripe_t *stripe = &histograms[histogram][s];
+        for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+            buckets[i] += atomic_load_explicit(&stripe->buckets[i], memory_order_relaxed);
+        }
+        *sum_ns += atomic_load_explicit(&stripe->sum_ns, memory_order_relaxed);
+    }
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        total += buckets[i];
+    }
+    return total;
+}
+
+static void write_histogram(FILE *out, metrics_histogram_t histogram)
+{
+    const metric_info_t *info = &histogram_info[histogram];
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t sum_ns;
+    uint64_t total = collect_histogram(histogram, buckets, &sum_ns);
+
+    write_header(out, info, "histogram");
+
+    char bound[32];
+    char value[32];
+    uint64_t cumulative = 0;
+    unsigned int next = 0;
+    for (unsigned int octave = 0; octave < HISTOGRAM_EXPORT_OCTAVES; ++octave) {
+        uint64_t limit = 1ull << octave;
+        while (next < HISTOGRAM_BUCKETS && bucket_upper(next) <= limit) {
+            cumulative += buckets[next++];
+        }
+        snprintf(bound, sizeof(bound), "le=\"%g\"", (double)limit / 1e6);
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)cumulative);
+        write_sample(out, info->name, "_bucket", info->labels, bound, value);
+    }
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)total);
+    write_sample(out, info->name, "_bucket", info->labels, "le=\"+Inf\"", value);
+    snprintf(value, sizeof(value), "%.9f", (double)sum_ns / 1e9);
+    write_sample(out, info->name, "_sum", info->labels, NULL, value);
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)total);
+    write_sample(out, info->name, "_count", info->labels, NULL, value);
+}
+
+// Quantiles from the fine buckets, reported as the bucket's upper bound.
+static void write_quantiles(FILE *out, metrics_histogram_t histogram)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+    const metric_info_t *info = &histogram_info[histogram];
+
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t sum_ns;
+    uint64_t total = collect_histogram(histogram, buckets, &sum_ns);
+
+    if (info->help != NULL) {
+        fprintf(out, "# HELP %s_quantile Estimated latency quantiles\n# TYPE %s_quantile gauge\n", info->name,
+                info->name);
+    }
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q) {
+        uint64_t rank = (uint64_t)(quantiles[q] * (double)total + 0.5);
+        uint64_t seen = 0;
+        uint64_t upper = 0;
+        for (unsigned int i = 0; i < HISTOGRAM_BUCKETS && total > 0; ++i) {
+            seen += buckets[i];
+            if (seen >= rank && buckets[i] > 0) {
+                upper = bucket_upper(i);
+                break;
+            }
+        }
+        char label[32];
+        char value[32];
+        snprintf(label, sizeof(label), "quantile=\"%g\"", quantiles[q]);
+        snprintf(value, sizeof(value), "%g", (double)upper / 1e6);
+        write_sample(out, info->name, "_quantile", info->labels, label, value);
+    }
+}
+
+void metrics_write(FILE *out)
+{
+    if (out == NULL) {
+        return;
+    }
+
+    char value[32];
+    for (unsigned int c = 0; c < METRIC_COUNTER_COUNT; ++c) {
+        uint64_t total = 0;
+        for (unsigned int s = 0; s < METRICS_STRIPES; ++s) {
+            total += atomic_load_explicit(&counters[s].values[c], memory_order_relaxed);
+        }
+        write_header(out, &counter_info[c], "counter");
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)total);
+        write_sample(out, counter_info[c].name, "", counter_info[c].labels, NULL, value);
+    }
+
+    for (unsigned int g = 0; g < METRIC_GAUGE_COUNT; ++g) {
+        write_header(out, &gauge_info[g], "gauge");
+        snprintf(value, sizeof(value), "%lld",
+                 (long long)atomic_load_explicit(&gauges[g], memory_order_relaxed));
+        write_sample(out, gauge_info[g].name, "", gauge_info[g].labels, NULL, value);
+    }
+
+    for (unsigned int h = 0; h < METRIC_HISTOGRAM_COUNT; ++h) {
+        write_histogram(out, (metrics_histogram_t)h);
+    }
+    for (unsigned int h = 0; h < METRIC_HISTOGRAM_COUNT; ++h) {
+        write_quantiles(out, (metrics_histogram_t)h);
+    }
+
+    static const metric_info_t dropped = {"maum_log_dropped_total", "Log messages dropped because a buffer was full",
+                                          NULL};
+    write_header(out, &dropped, "counter");
+    snprintf(value, sizeof(value), "%llu", log_dropped_count());
+    write_sample(out, dropped.name, "", NULL, NULL, value);
+
+    lock_profile_write(out);
+}
+
+static void count_bytes(counted_stream_t *stream, ssize_t n)
+{
+    if (n <= 0) {
+        return;
+    }
+    metrics_add(stream->counter, (uint64_t)n);
+    if (stream->tally != NULL) {
+        atomic_fetch_add_explicit(stream->tally, (uint64_t)n, memory_order_relaxed);
+    }
+}
+
+static ssize_t counted_read(void *cookie, char *buffer, size_t size)
+{
+    counted_stream_t *stream = cookie;
+    ssize_t n = read(stream->fd, buffer, size);
+    count_bytes(stream, n);
+    return n;
+}
+
+static ssize_t counted_write(void *cookie, const char *buffer, size_t size)
+{
+    counted_stream_t *stream = cookie;
+    ssize_t n = write(stream->fd, buffer, size);
+    count_bytes(stream, n);
+    return n;
+}
+
+static int counted_close(void *cookie)
+{
+    counted_stream_t *stream = cookie;
+    int rc = close(stream->fd);
+    free(stream);
+    return rc;
+}
+
+FILE *metrics_fdopen(int fd, const char *mode, metrics_counter_t counter, atomic_uint_fast64_t *tally)
+{
+    counted_stream_t *stream = malloc(sizeof(*stream));
+    if (stream == NULL) {
+        return NULL;
+    }
+    stream->fd = fd;
+    stream->counter = counter;
+    stream->tally = tally;
+
+    cookie_io_functions_t io = {
+        .read = counted_read,
+        .write = counted_write,
+        .seek = NULL,
+        .close = counted_close,
+    };
+    FILE *file = fopencookie(stream, mode, io);
+    if (file == NULL) {
+        free(stream);
+    }
+    return file;
+}
+
+static int write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+void metrics_serve(int fd)
+{
+    struct timeval timeout = {SCRAPE_TIMEOUT_MS / 1000, (SCRAPE_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // The request itself is not interpreted; any path returns the metrics.
+    char request[SCRAPE_REQUEST_MAX];
+    size_t length = 0;
+    while (length + 1 < sizeof(request)) {
+        ssize_t n = read(fd, request + length, sizeof(request) - 1 - length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        length += (size_t)n;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+            break;
+        }
+    }
+
+    char *body = NULL;
+    size_t body_length = 0;
+    FILE *memory = open_memstream(&body, &body_length);
+    if (memory == NULL) {
+        LOG_WARN(COMPONENT, "open_memstream failed: %s", strerror(errno));
+        close(fd);
+        return;
+    }
+    metrics_write(memory);
+    fclose(memory);
+
+    char header[160];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                                 body_length);
+    if (header_length > 0 && write_all(fd, header, (size_t)header_length) == 0) {
+        write_all(fd, body, body_length);
+    }
+
+    free(body);
+    close(fd);
+}
@@ -0,0 +1,630 @@
+#include "relay.h"
+
+#include "log.h"
+#include "metrics.h"
+#include "wire.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COMPONENT "relay"
+
+#define RELAY_VERSION 1
+#define RELAY_FRAME_HELLO 1
+#define RELAY_FRAME_CHAT 2
+// A chat frame is a run of records: origin (8), sequence (8), length (2), text.
+#define RELAY_RECORD_HEADER 18
+// Encoded records waiting for one link's writer; more than this is dropped.
+#define RELAY_QUEUE_MAX (64 * 1024)
+#define RELAY_HELLO_TIMEOUT_S 10
+#define RELAY_CONNECT_TIMEOUT_MS 5000
+#define RELAY_RETRY_MIN_MS 500
+#define RELAY_RETRY_MAX_MS 10000
+// Origins remembered for deduplication, and how far behind the newest
+// sequence number of an origin a line may arrive and still be recognized.
+#define RELAY_ORIGINS_MAX 64
+#define RELAY_WINDOW 64
+
+typedef struct relay_link {
+    relay_t *relay;
+    int fd;
+    int outbound;
+    char peer[RELAY_PEER_MAX];
+    uint64_t origin;
+    pthread_t writer;
+    // Guards everything below. The writer swaps queue for spare and sends it
+    // as one frame, so whatever piles up during a write goes out together.
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned char *queue;
+    unsigned char *spare;
+    size_t queued;
+    int closing;
+    unsigned long long sent;
+    unsigned long long received;
+    unsigned long long duplicates;
+    unsigned long long dropped;
+    struct relay_link *next;
+} relay_link_t;
+
+typedef struct {
+    uint64_t origin;
+    uint64_t newest;
+    // Bit i set: newest - i has been seen.
+    uint64_t window;
+    uint64_t touched;
+} relay_origin_t;
+
+typedef struct {
+    relay_t *relay;
+    config_peer_t peer;
+    pthread_t thread;
+} relay_dialer_t;
+
+struct relay {
+    relay_deliver_t deliver;
+    void *context;
+    uint64_t origin;
+    // Guards everything below; taken before a link's lock, never after.
+    pthread_mutex_t lock;
+    // Broadcast when stopping and when an accepted link's thread ends.
+    pthread_cond_t cond;
+    int stopping;
+    uint64_t next_sequence;
+    relay_link_t *links;
+    size_t accepted_threads;
+    relay_origin_t origins[RELAY_ORIGINS_MAX];
+    size_t origin_count;
+    uint64_t touches;
+    relay_dialer_t *dialers;
+    size_t dialer_count;
+};
+
+static uint64_t random_origin(void)
+{
+    uint64_t origin = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        ssize_t n = read(fd, &origin, sizeof(origin));
+        close(fd);
+        if (n == (ssize_t)sizeof(origin) && origin != 0) {
+            return origin;
+        }
+    }
+    return ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid() ^ metrics_now();
+}
+
+// Records origin/sequence; 1 if it is new. Called with relay->lock held.
+static int mark_seen(relay_t *relay, uint64_t origin, uint64_t sequence)
+{
+    if (origin == relay->origin) {
+        return 0;
+    }
+    relay_origin_t *entry = NULL;
+    for (size_t i = 0; i < relay->origin_count; ++i) {
+        if (relay->origins[i].origin == origin) {
+            entry = &relay->origins[i];
+            break;
+        }
+    }
+    if (entry == NULL) {
+        if (relay->origin_count < RELAY_ORIGINS_MAX) {
+            entry = &relay->origins[relay->origin_count++];
+        } else {
+            entry = &relay->origins[0];
+            for (size_t i = 1; i < RELAY_ORIGINS_MAX; ++i) {
+                if (relay->origins[i].touched < entry->touched) {
+                    entry = &relay->origins[i];
+                }
+            }
+        }
+        entry->origin = origin;
+        entry->newest = sequence;
+        entry->window = 1;
+        entry->touched = ++relay->touches;
+        return 1;
+    }
+    entry->touched = ++relay->touches;
+    if (sequence > entry->newest) {
+        uint64_t shift = sequence - entry->newest;
+        entry->window = shift >= RELAY_WINDOW ? 1 : (entry->window << shift) | 1;
+        entry->newest = sequence;
+        return 1;
+    }
+    uint64_t age = entry->newest - sequence;
+    if (age >= RELAY_WINDOW || (entry->window & ((uint64_t)1 << age)) != 0) {
+        return 0;
+    }
+    entry->window |= (uint64_t)1 << age;
+    return 1;
+}
+
+static void link_enqueue(relay_link_t *link, const unsigned char *record, size_t length)
+{
+    pthread_mutex_lock(&link->lock);
+    if (link->closing || link->queued + length > RELAY_QUEUE_MAX) {
+        if (!link->closing) {
+            link->dropped++;
+            metrics_add(METRIC_RELAY_DROPPED, 1);
+        }
+        pthread_mutex_unlock(&link->lock);
+        return;
+    }
+    memcpy(link->queue + link->queued, record, length);
+    link->queued += length;
+    pthread_cond_signal(&link->cond);
+    pthread_mutex_unlock(&link->lock);
+}
+
+// Queues record on every link but except. Called with relay->lock held.
+static void enqueue_all(relay_t *relay, const unsigned char *record, size_t length, const relay_link_t *except)
+{
+    for (relay_link_t *link = relay->links; link != NULL; link = link->next) {
+        if (link != except) {
+            link_enqueue(link, record, length);
+        }
+    }
+}
+
+static size_t encode_record(unsigned char *record, uint64_t origin, uint64_t sequence, const char *text,
+                            size_t length)
+{
+    wire_put_u64(record, origin);
+    wire_put_u64(record + 8, sequence);
+    wire_put_u16(record + 16, (uint16_t)length);
+    memcpy(record + RELAY_RECORD_HEADER, text, length);
+    return RELAY_RECORD_HEADER + length;
+}
+
+static void *writer_thread(void *arg)
+{
+    relay_link_t *link = arg;
+    pthread_mutex_lock(&link->lock);
+    while (1) {
+        while (!link->closing && link->queued == 0) {
+            pthread_cond_wait(&link->cond, &link->lock);
+        }
+        if (link->closing) {
+            break;
+        }
+        unsigned char *batch = link->queue;
+        size_t length = link->queued;
+        link->queue = link->spare;
+        link->spare = batch;
+        link->queued = 0;
+        pthread_mutex_unlock(&link->lock);
+
+        size_t records = 0;
+        for (size_t offset = 0; offset + RELAY_RECORD_HEADER <= length; ++records) {
+            offset += RELAY_RECORD_HEADER + ((size_t)batch[offset + 16] << 8 | batch[offset + 17]);
+        }
+        int rc = wire_send(link->fd, RELAY_FRAME_CHAT, batch, length);
+
+        pthread_mutex_lock(&link->lock);
+        if (rc != 0) {
+            // The reader notices and tears the link down.
+            shutdown(link->fd, SHUT_RDWR);
+            break;
+        }
+        link->sent += records;
+        metrics_add(METRIC_RELAY_SENT, records);
+        metrics_add(METRIC_RELAY_BATCHES, 1);
+    }
+    pthread_mutex_unlock(&link->lock);
+    return NULL;
+}
+
+static void handle_chat_frame(relay_link_t *link, const unsigned char *payload, size_t length)
+{
+    relay_t *relay = link->relay;
+    size_t offset = 0;
+    while (offset < length) {
+        size_t start = offset;
+        uint64_t origin = 0;
+        uint64_t sequence = 0;
+        uint16_t text_length = 0;
+        if (wire_get_u64(payload, length, &offset, &origin) != 0 ||
+            wire_get_u64(payload, length, &offset, &sequence) != 0 ||
+            wire_get_u16(payload, length, &offset, &text_length) != 0 || text_length >= RELAY_MESSAGE_MAX ||
+            length - offset < text_length) {
+            LOG_WARN(COMPONENT, "Malformed chat frame from %s", link->peer);
+            return;
+        }
+        char text[RELAY_MESSAGE_MAX];
+        memcpy(text, payload + offset, text_length);
+        text[text_length] = '\0';
+        offset += text_length;
+        // Lines are shown as-is on terminals; keep control bytes out.
+        for (char *p = text; *p != '\0'; ++p) {
+            if ((unsigned char)*p < 0x20 || *p == 0x7f) {
+                *p = ' ';
+            }
+        }
+
+        pthread_mutex_lock(&relay->lock);
+        int fresh = mark_seen(relay, origin, sequence);
+        if (fresh) {
+            enqueue_all(relay, payload + start, offset - start, link);
+        }
+        pthread_mutex_unlock(&relay->lock);
+
+        pthread_mutex_lock(&link->lock);
+        if (fresh) {
+            link->received++;
+        } else {
+            link->duplicates++;
+        }
+        pthread_mutex_unlock(&link->lock);
+        if (!fresh) {
+            metrics_add(METRIC_RELAY_DUPLICATES, 1);
+            continue;
+        }
+        metrics_add(METRIC_RELAY_RECEIVED, 1);
+        relay->deliver(text, relay->context);
+    }
+}
+
+static int exchange_hello(relay_t *relay, int fd, uint64_t *origin, unsigned char *buffer)
+{
+    unsigned char hello[9];
+    hello[0] = RELAY_VERSION;
+    wire_put_u64(hello + 1, relay->origin);
+    if (wire_send(fd, RELAY_FRAME_HELLO, hello, sizeof(hello)) != 0) {
+        return -1;
+    }
+
+    struct timeval timeout = {.tv_sec = RELAY_HELLO_TIMEOUT_S, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    uint8_t type = 0;
+    size_t length = 0;
+    size_t offset = 1;
+    if (wire_receive(fd, &type, buffer, WIRE_PAYLOAD_MAX, &length) != 0 || type != RELAY_FRAME_HELLO ||
+        length < 1 || buffer[0] != RELAY_VERSION || wire_get_u64(buffer, length, &offset, origin) != 0) {
+        return -1;
+    }
+    timeout.tv_sec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return 0;
+}
+
+static void destroy_link(relay_link_t *link)
+{
+    pthread_cond_destroy(&link->cond);
+    pthread_mutex_destroy(&link->lock);
+    free(link->queue);
+    free(link->spare);
+    free(link);
+}
+
+static relay_link_t *create_link(relay_t *relay, int fd, int outbound, const char *peer)
+{
+    relay_link_t *link = calloc(1, sizeof(*link));
+    if (link == NULL) {
+        return NULL;
+    }
+    link->relay = relay;
+    link->fd = fd;
+    link->outbound = outbound;
+    snprintf(link->peer, sizeof(link->peer), "%s", peer);
+    link->queue = malloc(RELAY_QUEUE_MAX);
+    link->spare = malloc(RELAY_QUEUE_MAX);
+    if (link->queue == NULL || link->spare == NULL || pthread_mutex_init(&link->lock, NULL) != 0) {
+        free(link->queue);
+        free(link->spare);
+        free(link);
+        return NULL;
+    }
+    if (pthread_cond_init(&link->cond, NULL) != 0) {
+        pthread_mutex_destroy(&link->lock);
+        free(link->queue);
+        free(link->spare);
+        free(link);
+        return NULL;
+    }
+    return link;
+}
+
+// Runs one connection until it drops, on the calling thread; closes fd.
+static void run_link(relay_t *relay, int fd, int outbound, const char *peer)
+{
+    unsigned char *buffer = malloc(WIRE_PAYLOAD_MAX);
+    relay_link_t *link = buffer != NULL ? create_link(relay, fd, outbound, peer) : NULL;
+    if (link == NULL) {
+        free(buffer);
+        close(fd);
+        return;
+    }
+    if (exchange_hello(relay, fd, &link->origin, buffer) != 0) {
+        LOG_WARN(COMPONENT, "Relay handshake with %s failed", peer);
+        destroy_link(link);
+        free(buffer);
+        close(fd);
+        return;
+    }
+    if (link->origin == relay->origin) {
+        LOG_WARN(COMPONENT, "Relay peer %s is this instance; ignoring it", peer);
+        destroy_link(link);
+        free(buffer);
+        close(fd);
+        return;
+    }
+
+    pthread_mutex_lock(&relay->lock);
+    int stopping = relay->stopping;
+    if (!stopping && pthread_create(&link->writer, NULL, writer_thread, link) == 0) {
+        link->next = relay->links;
+        relay->links = link;
+    } else {
+        stopping = 1;
+    }
+    pthread_mutex_unlock(&relay->lock);
+    if (stopping) {
+        destroy_link(link);
+        free(buffer);
+        close(fd);
+        return;
+    }
+    metrics_gauge_add(METRIC_RELAY_LINKS, 1);
+    LOG_INFO(COMPONENT, "Relay link %s %s (instance %016llx)", outbound ? "to" : "from", peer,
+             (unsigned long long)link->origin);
+
+    while (1) {
+        uint8_t type = 0;
+        size_t length = 0;
+        if (wire_receive(fd, &type, buffer, WIRE_PAYLOAD_MAX, &length) != 0) {
+            break;
+        }
+        if (type == RELAY_FRAME_CHAT) {
+            handle_chat_frame(link, buffer, length);
+        }
+    }
+
+    pthread_mutex_lock(&relay->lock);
+    for (relay_link_t **cursor = &relay->links; *cursor != NULL; cursor = &(*cursor)->next) {
+        if (*cursor == link) {
+            *cursor = link->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&relay->lock);
+
+    pthread_mutex_lock(&link->lock);
+    link->closing = 1;
+    pthread_cond_signal(&link->cond);
+    pthread_mutex_unlock(&link->lock);
+    shutdown(fd, SHUT_RDWR);
+    pthread_join(link->writer, NULL);
+    metrics_gauge_add(METRIC_RELAY_LINKS, -1);
+    LOG_INFO(COMPONENT, "Relay link %s %s closed", outbound ? "to" : "from", peer);
+    destroy_link(link);
+    free(buffer);
+    close(fd);
+}
+
+// Sleeps up to ms; 1 if the relay is stopping.
+static int wait_stopping(relay_t *relay, unsigned int ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&relay->lock);
+    while (!relay->stopping && pthread_cond_timedwait(&relay->cond, &relay->lock, &deadline) != ETIMEDOUT) {
+    }
+    int stopping = relay->stopping;
+    pthread_mutex_unlock(&relay->lock);
+    return stopping;
+}
+
+static void *dialer_thread(void *arg)
+{
+    relay_dialer_t *dialer = arg;
+    relay_t *relay = dialer->relay;
+    char peer[RELAY_PEER_MAX];
+    snprintf(peer, sizeof(peer), "%s:%u", dialer->peer.host, dialer->peer.port);
+    unsigned int retry_ms = RELAY_RETRY_MIN_MS;
+    while (!wait_stopping(relay, 0)) {
+        int fd = wire_connect(dialer->peer.host, dialer->peer.port, RELAY_CONNECT_TIMEOUT_MS);
+        if (fd >= 0) {
+            uint64_t started = metrics_now();
+            run_link(relay, fd, 1, peer);
+            // A link that held for a while was not a failed attempt.
+            if (metrics_now() - started > (uint64_t)RELAY_RETRY_MAX_MS * 1000000u) {
+                retry_ms = RELAY_RETRY_MIN_MS;
+            }
+        } else {
+            LOG_DEBUG(COMPONENT, "Relay peer %s unreachable: %s", peer, strerror(errno));
+        }
+        if (wait_stopping(relay, retry_ms)) {
+            break;
+        }
+        retry_ms = retry_ms * 2 > RELAY_RETRY_MAX_MS ? RELAY_RETRY_MAX_MS : retry_ms * 2;
+    }
+    return NULL;
+}
+
+relay_t *relay_create(const config_peer_t *peers, size_t count, relay_deliver_t deliver, void *context)
+{
+    if (deliver == NULL) {
+        return NULL;
+    }
+    relay_t *relay = calloc(1, sizeof(*relay));
+    if (relay == NULL) {
+        return NULL;
+    }
+    relay->deliver = deliver;
+    relay->context = context;
+    relay->origin = random_origin();
+    relay->next_sequence = 1;
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int cond_rc = pthread_cond_init(&relay->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (cond_rc != 0 || pthread_mutex_init(&relay->lock, NULL) != 0) {
+        if (cond_rc == 0) {
+            pthread_cond_destroy(&relay->cond);
+        }
+        free(relay);
+        return NULL;
+    }
+
+    relay->dialers = count > 0 ? calloc(count, sizeof(relay->dialers[0])) : NULL;
+    if (count > 0 && relay->dialers == NULL) {
+        relay_destroy(relay);
+        return NULL;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        relay_dialer_t *dialer = &relay->dialers[relay->dialer_count];
+        dialer->relay = relay;
+        dialer->peer = peers[i];
+        if (pthread_create(&dialer->thread, NULL, dialer_thread, dialer) != 0) {
+            LOG_ERROR(COMPONENT, "Unable to start dialer for %s:%u", peers[i].host, peers[i].port);
+            continue;
+        }
+        relay->dialer_count++;
+    }
+    LOG_INFO(COMPONENT, "Chat relay started as instance %016llx with %zu peer(s)", (unsigned long long)relay->origin,
+             relay->dialer_count);
+    return relay;
+}
+
+void relay_destroy(relay_t *relay)
+{
+    if (relay == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&relay->lock);
+    relay->stopping = 1;
+    pthread_cond_broadcast(&relay->cond);
+    for (relay_link_t *link = relay->links; link != NULL; link = link->next) {
+        shutdown(link->fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&relay->lock);
+
+    for (size_t i = 0; i < relay->dialer_count; ++i) {
+        pthread_join(relay->dialers[i].thread, NULL);
+    }
+    pthread_mutex_lock(&relay->lock);
+    while (relay->accepted_threads > 0) {
+        pthread_cond_wait(&relay->cond, &relay->lock);
+    }
+    pthread_mutex_unlock(&relay->lock);
+
+    free(relay->dialers);
+    pthread_cond_destroy(&relay->cond);
+    pthread_mutex_destroy(&relay->lock);
+    free(relay);
+}
+
+struct accepted_args {
+    relay_t *relay;
+    int fd;
+    char peer[RELAY_PEER_MAX];
+};
+
+static void *accepted_thread(void *arg)
+{
+    struct accepted_args *args = arg;
+    relay_t *relay = args->relay;
+    run_link(relay, args->fd, 0, args->peer);
+    free(args);
+
+    pthread_mutex_lock(&relay->lock);
+    relay->accepted_threads--;
+    pthread_cond_broadcast(&relay->cond);
+    pthread_mutex_unlock(&relay->lock);
+    return NULL;
+}
+
+void relay_accept(relay_t *relay, int fd, const char *peer)
+{
+    struct accepted_args *args = relay != NULL ? calloc(1, sizeof(*args)) : NULL;
+    if (args == NULL) {
+        close(fd);
+        return;
+    }
+    args->relay = relay;
+    args->fd = fd;
+    snprintf(args->peer, sizeof(args->peer), "%s", peer != NULL ? peer : "unknown");
+
+    pthread_mutex_lock(&relay->lock);
+    pthread_t thread;
+    if (relay->stopping || pthread_create(&thread, NULL, accepted_thread, args) != 0) {
+        pthread_mutex_unlock(&relay->lock);
+        free(args);
+        close(fd);
+        return;
+    }
+    relay->accepted_threads++;
+    pthread_mutex_unlock(&relay->lock);
+    pthread_detach(thread);
+}
+
+void relay_publish(relay_t *relay, const char *message)
+{
+    if (relay == NULL || message == NULL) {
+        return;
+    }
+    unsigned char record[RELAY_RECORD_HEADER + RELAY_MESSAGE_MAX];
+    size_t length = strnlen(message, RELAY_MESSAGE_MAX - 1);
+
+    pthread_mutex_lock(&relay->lock);
+    if (relay->links != NULL) {
+        size_t size = encode_record(record, relay->origin, relay->next_sequence++, message, length);
+        enqueue_all(relay, record, size, NULL);
+    }
+    pthread_mutex_unlock(&relay->lock);
+}
+
+uint64_t relay_origin(const relay_t *relay)
+{
+    return relay != NULL ? relay->origin : 0;
+}
+
+int relay_list(relay_t *relay, relay_link_info_t **links, size_t *count)
+{
+    if (relay == NULL || links == NULL || count == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&relay->lock);
+    size_t total = 0;
+    for (relay_link_t *link = relay->links; link != NULL; link = link->next) {
+        total++;
+    }
+    relay_link_info_t *items = total > 0 ? calloc(total, sizeof(*items)) : NULL;
+    if (total > 0 && items == NULL) {
+        pthread_mutex_unlock(&relay->lock);
+        return -1;
+    }
+    size_t i = 0;
+    for (relay_link_t *link = relay->links; link != NULL; link = link->next, ++i) {
+        relay_link_info_t *info = &items[i];
+        snprintf(info->peer, sizeof(info->peer), "%s", link->peer);
+        info->outbound = link->outbound;
+        info->origin = link->origin;
+        pthread_mutex_lock(&link->lock);
+        info->sent = link->sent;
+        info->received = link->received;
+        info->duplicates = link->duplicates;
+        info->dropped = link->dropped;
+        info->queued = link->queued;
+        pthread_mutex_unlock(&link->lock);
+    }
+    pthread_mutex_unlock(&relay->lock);
+    *links = items;
+    *count = total;
+    return 0;
+}
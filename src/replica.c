@@ -0,0 +1,1392 @@
+#include "replica.h"
+
+#include "hub.h"
+#include "log.h"
+#include "metrics.h"
+#include "wire.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COMPONENT "replica"
+
+#define REPLICA_VERSION 2
+// Follower to leader: version, board count, then name, length and hash of
+// each board file. The leader answers with its version.
+#define REPLICA_FRAME_HELLO 1
+// Leader to follower: name, offset, leader write time (ns), whole lines.
+#define REPLICA_FRAME_DATA 2
+// Leader to follower: name. The DATA that follows, from offset 0, builds a
+// new copy of the board that replaces the old one at COMMIT.
+#define REPLICA_FRAME_RESET 3
+#define REPLICA_FRAME_COMMIT 4
+// Leader to follower: send time (ns), then name and length of every board.
+#define REPLICA_FRAME_HEARTBEAT 5
+// Follower to leader, answered by REPLY with the same request number.
+#define REPLICA_FRAME_ADD 6
+#define REPLICA_FRAME_REMOVE 7
+#define REPLICA_FRAME_REPLY 8
+// Leader to follower: name, expected length, count, then offset and length of
+// each range to cut, in the follower's current file. Lines a removal took out
+// of the middle of the board; the DATA that follows appends the rest.
+#define REPLICA_FRAME_CUT 9
+
+#define REPLICA_HEARTBEAT_MS 1000
+#define REPLICA_HELLO_TIMEOUT_S 10
+#define REPLICA_CONNECT_TIMEOUT_MS 5000
+#define REPLICA_REQUEST_TIMEOUT_MS 5000
+// How long a forwarded post may take to come back before board_add() returns.
+#define REPLICA_ECHO_TIMEOUT_MS 2000
+#define REPLICA_RETRY_MIN_MS 500
+#define REPLICA_RETRY_MAX_MS 10000
+#define REPLICA_HASH_BLOCK (64 * 1024)
+// Removals coalesced into one CUT; more than this sends the board whole.
+#define REPLICA_CUTS_MAX 256
+#define REPLICA_TEMP_SUFFIX ".sync"
+
+// Leader side: what one follower has of one board.
+typedef struct {
+    // The leader's file as last sent; held open so the inode stays the one
+    // whose bytes were sent, and a removal shows up as a different inode.
+    int fd;
+    dev_t device;
+    ino_t inode;
+    unsigned long long sent;
+    // From the follower's hello, until the first sync uses it.
+    int offered;
+    unsigned long long offered_length;
+    uint64_t offered_hash;
+} replica_stream_t;
+
+typedef struct replica_follower {
+    replica_t *replica;
+    int fd;
+    char peer[CONFIG_MAX_HOST_LEN + 16];
+    time_t connected_at;
+    // Held for a whole frame; the streamer and replies share the socket.
+    pthread_mutex_t send_lock;
+    pthread_t streamer;
+    replica_stream_t *streams;
+    unsigned char *buffer;
+    atomic_ullong bytes_sent;
+    atomic_ullong resyncs;
+    // Under replica->lock.
+    int closing;
+    struct replica_follower *next;
+} replica_follower_t;
+
+typedef struct {
+    unsigned long long offset;
+    unsigned long long length;
+} replica_cut_t;
+
+// Follower side: one board.
+typedef struct {
+    unsigned long long applied;
+    unsigned long long leader_length;
+    // Between RESET and COMMIT: the new copy being written.
+    int sync_fd;
+    unsigned long long sync_length;
+} replica_board_t;
+
+// A forwarded write waiting for its REPLY; lives on the caller's stack.
+typedef struct replica_request {
+    uint32_t id;
+    int done;
+    int rc;
+    int not_owner;
+    unsigned int post_id;
+    char timestamp[BOARD_TIMESTAMP_MAX];
+    struct replica_request *next;
+} replica_request_t;
+
+struct replica {
+    int leader;
+    board_directory_t *boards;
+    size_t board_count;
+    hub_t *hub;
+    hub_subscription_t post_events;
+    hub_subscription_t remove_events;
+    // Guards everything below; never held across network I/O.
+    pthread_mutex_t lock;
+    // Broadcast on board changes, applied frames, replies and stopping.
+    pthread_cond_t cond;
+    int stopping;
+
+    // Leader.
+    uint64_t changes;
+    replica_follower_t *followers;
+    size_t accepted_threads;
+
+    // Follower.
+    config_peer_t leader_peer;
+    pthread_t thread;
+    int thread_started;
+    int connected;
+    int fd;
+    // Taken before lock by request senders; the link thread takes it before
+    // closing fd, so fd stays valid for a sender holding it.
+    pthread_mutex_t send_lock;
+    uint32_t next_request;
+    replica_request_t *pending;
+    replica_board_t *states;
+    uint64_t last_heartbeat;
+    board_forward_t forward;
+};
+
+static uint64_t wall_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void deadline_after(struct timespec *deadline, unsigned int ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static void put_string(unsigned char *out, size_t *offset, const char *text, size_t max)
+{
+    size_t length = strnlen(text, max);
+    out[(*offset)++] = (unsigned char)length;
+    memcpy(out + *offset, text, length);
+    *offset += length;
+}
+
+static int get_string(const unsigned char *payload, size_t length, size_t *offset, char *out, size_t size)
+{
+    if (*offset >= length) {
+        return -1;
+    }
+    size_t text_length = payload[(*offset)++];
+    if (text_length >= size || length - *offset < text_length) {
+        return -1;
+    }
+    memcpy(out, payload + *offset, text_length);
+    out[text_length] = '\0';
+    *offset += text_length;
+    return 0;
+}
+
+// FNV-1a over the first length bytes of fd; -1 if they cannot all be read.
+static int hash_prefix(int fd, unsigned long long length, uint64_t *hash)
+{
+    unsigned char block[4096];
+    uint64_t value = 14695981039346656037ull;
+    unsigned long long done = 0;
+    while (done < length) {
+        size_t want = length - done < sizeof(block) ? (size_t)(length - done) : sizeof(block);
+        ssize_t n = pread(fd, block, want, (off_t)done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        for (ssize_t i = 0; i < n; ++i) {
+            value = (value ^ block[i]) * 1099511628211ull;
+        }
+        done += (unsigned long long)n;
+    }
+    *hash = value;
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t length)
+{
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = write(fd, (const char *)data + done, length - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+static replica_t *replica_alloc(board_directory_t *boards)
+{
+    replica_t *replica = calloc(1, sizeof(*replica));
+    if (replica == NULL) {
+        return NULL;
+    }
+    replica->boards = boards;
+    replica->board_count = board_directory_count(boards);
+    replica->fd = -1;
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int cond_rc = pthread_cond_init(&replica->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (cond_rc != 0) {
+        free(replica);
+        return NULL;
+    }
+    if (pthread_mutex_init(&replica->lock, NULL) != 0) {
+        pthread_cond_destroy(&replica->cond);
+        free(replica);
+        return NULL;
+    }
+    if (pthread_mutex_init(&replica->send_lock, NULL) != 0) {
+        pthread_mutex_destroy(&replica->lock);
+        pthread_cond_destroy(&replica->cond);
+        free(replica);
+        return NULL;
+    }
+    return replica;
+}
+
+static void replica_free(replica_t *replica)
+{
+    free(replica->states);
+    pthread_mutex_destroy(&replica->send_lock);
+    pthread_mutex_destroy(&replica->lock);
+    pthread_cond_destroy(&replica->cond);
+    free(replica);
+}
+
+// ---------------------------------------------------------------------------
+// Leader
+
+static void board_changed(const hub_event_t *event, void *context)
+{
+    (void)event;
+    replica_t *replica = context;
+    pthread_mutex_lock(&replica->lock);
+    replica->changes++;
+    pthread_cond_broadcast(&replica->cond);
+    pthread_mutex_unlock(&replica->lock);
+}
+
+static int follower_send(replica_follower_t *follower, uint8_t type, const void *payload, size_t length)
+{
+    pthread_mutex_lock(&follower->send_lock);
+    int rc = wire_send(follower->fd, type, payload, length);
+    pthread_mutex_unlock(&follower->send_lock);
+    return rc;
+}
+
+static int send_name_frame(replica_follower_t *follower, uint8_t type, const char *name, unsigned long long length)
+{
+    unsigned char frame[BOARD_NAME_MAX + 16];
+    size_t offset = 0;
+    put_string(frame, &offset, name, BOARD_NAME_MAX - 1);
+    if (type == REPLICA_FRAME_COMMIT) {
+        wire_put_u64(frame + offset, length);
+        offset += 8;
+    }
+    return follower_send(follower, type, frame, offset);
+}
+
+// Sends bytes [from, to) of fd as DATA frames, each ending on a line.
+static int send_range(replica_follower_t *follower, const char *name, int fd, unsigned long long from,
+                      unsigned long long to, uint64_t written_at)
+{
+    unsigned char *frame = follower->buffer;
+    size_t header = 0;
+    put_string(frame, &header, name, BOARD_NAME_MAX - 1);
+    header += 16;
+    size_t room = WIRE_PAYLOAD_MAX - header;
+    while (from < to) {
+        size_t want = to - from < room ? (size_t)(to - from) : room;
+        ssize_t n = pread(fd, frame + header, want, (off_t)from);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        size_t length = (size_t)n;
+        if (from + length < to) {
+            while (length > 0 && frame[header + length - 1] != '\n') {
+                length--;
+            }
+            if (length == 0) {
+                return -1;
+            }
+        }
+        size_t offset = header - 16;
+        wire_put_u64(frame + offset, from);
+        wire_put_u64(frame + offset + 8, written_at);
+        if (follower_send(follower, REPLICA_FRAME_DATA, frame, header + length) != 0) {
+            return -1;
+        }
+        from += length;
+        atomic_fetch_add_explicit(&follower->bytes_sent, length, memory_order_relaxed);
+        metrics_add(METRIC_REPLICATION_BYTES_SENT, length);
+    }
+    return 0;
+}
+
+static void hold_file(replica_stream_t *stream, int fd, const struct stat *st, unsigned long long sent)
+{
+    if (stream->fd >= 0 && stream->fd != fd) {
+        close(stream->fd);
+    }
+    stream->fd = fd;
+    stream->device = fd >= 0 ? st->st_dev : 0;
+    stream->inode = fd >= 0 ? st->st_ino : 0;
+    stream->sent = sent;
+}
+
+static FILE *open_lines(int fd)
+{
+    int copy = dup(fd);
+    FILE *file = copy >= 0 ? fdopen(copy, "r") : NULL;
+    if (file == NULL) {
+        if (copy >= 0) {
+            close(copy);
+        }
+        return NULL;
+    }
+    rewind(file);
+    return file;
+}
+
+// Removing a post rewrites the board without its line, and posts are only
+// ever appended, so walking the old file (what the follower has, up to
+// old_length) and the new one line by line tells which old lines are gone.
+// Returns the number of cuts, or -1 when the files cannot be read or there
+// are more than REPLICA_CUTS_MAX; *tail is where the new file's unmatched
+// rest, sent as DATA, starts. Costs a local read of both files instead of
+// sending the whole board over the network.
+static int find_cuts(int old_fd, unsigned long long old_length, int new_fd, replica_cut_t *cuts,
+                     unsigned long long *tail)
+{
+    FILE *old_file = open_lines(old_fd);
+    FILE *new_file = open_lines(new_fd);
+    char *old_line = NULL;
+    char *new_line = NULL;
+    size_t old_capacity = 0;
+    size_t new_capacity = 0;
+    int count = old_file != NULL && new_file != NULL ? 0 : -1;
+    ssize_t new_length = count == 0 ? getline(&new_line, &new_capacity, new_file) : -1;
+    unsigned long long old_position = 0;
+    unsigned long long new_position = 0;
+    while (count >= 0 && old_position < old_length) {
+        ssize_t old_length_read = getline(&old_line, &old_capacity, old_file);
+        if (old_length_read <= 0 || old_position + (unsigned long long)old_length_read > old_length) {
+            count = -1;
+            break;
+        }
+        if (new_length == old_length_read && memcmp(old_line, new_line, (size_t)old_length_read) == 0) {
+            new_position += (unsigned long long)new_length;
+            new_length = getline(&new_line, &new_capacity, new_file);
+        } else if (count > 0 && cuts[count - 1].offset + cuts[count - 1].length == old_position) {
+            cuts[count - 1].length += (unsigned long long)old_length_read;
+        } else if (count == REPLICA_CUTS_MAX) {
+            count = -1;
+        } else {
+            cuts[count++] = (replica_cut_t){old_position, (unsigned long long)old_length_read};
+        }
+        old_position += (unsigned long long)old_length_read;
+    }
+    free(old_line);
+    free(new_line);
+    if (old_file != NULL) {
+        fclose(old_file);
+    }
+    if (new_file != NULL) {
+        fclose(new_file);
+    }
+    *tail = new_position;
+    return count;
+}
+
+static int send_cuts(replica_follower_t *follower, const char *name, unsigned long long expected,
+                     const replica_cut_t *cuts, int count)
+{
+    unsigned char *frame = follower->buffer;
+    size_t offset = 0;
+    put_string(frame, &offset, name, BOARD_NAME_MAX - 1);
+    wire_put_u64(frame + offset, expected);
+    wire_put_u32(frame + offset + 8, (uint32_t)count);
+    offset += 12;
+    for (int i = 0; i < count; ++i) {
+        wire_put_u64(frame + offset, cuts[i].offset);
+        wire_put_u64(frame + offset + 8, cuts[i].length);
+        offset += 16;
+    }
+    return follower_send(follower, REPLICA_FRAME_CUT, frame, offset);
+}
+
+// Brings the follower's copy of board index up to the leader's file.
+static int sync_board(replica_follower_t *follower, size_t index)
+{
+    replica_t *replica = follower->replica;
+    replica_stream_t *stream = &follower->streams[index];
+    const char *name = board_directory_spec(replica->boards, index)->name;
+    int fd = -1;
+    unsigned long long length = 0;
+    if (board_directory_capture(replica->boards, index, &fd, &length) != 0) {
+        return 0;
+    }
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    if (fd >= 0 && fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    uint64_t written_at = fd >= 0 ? (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec : 0;
+
+    if (fd >= 0 && stream->fd >= 0 && st.st_dev == stream->device && st.st_ino == stream->inode &&
+        length >= stream->sent) {
+        close(fd);
+        if (length == stream->sent) {
+            return 0;
+        }
+        int rc = send_range(follower, name, stream->fd, stream->sent, length, written_at);
+        stream->sent = length;
+        return rc;
+    }
+    if (stream->offered) {
+        stream->offered = 0;
+        uint64_t hash = 0;
+        unsigned long long have = fd >= 0 ? length : 0;
+        if (stream->offered_length <= have &&
+            (stream->offered_length == 0 || hash_prefix(fd, stream->offered_length, &hash) == 0) &&
+            (stream->offered_length == 0 || hash == stream->offered_hash)) {
+            hold_file(stream, fd, &st, stream->offered_length);
+            if (fd < 0 || length == stream->offered_length) {
+                return 0;
+            }
+            int rc = send_range(follower, name, fd, stream->offered_length, length, written_at);
+            stream->sent = length;
+            return rc;
+        }
+        LOG_INFO(COMPONENT, "Follower %s has diverged on board '%s'; sending it whole", follower->peer, name);
+    } else if (fd < 0 && stream->fd < 0) {
+        return 0;
+    } else if (fd >= 0 && stream->fd >= 0) {
+        // A post was removed: send which lines went instead of the board.
+        replica_cut_t cuts[REPLICA_CUTS_MAX];
+        unsigned long long tail = 0;
+        int count = find_cuts(stream->fd, stream->sent, fd, cuts, &tail);
+        if (count >= 0 && tail <= length) {
+            unsigned long long expected = stream->sent;
+            hold_file(stream, fd, &st, tail);
+            if (count > 0 && send_cuts(follower, name, expected, cuts, count) != 0) {
+                return -1;
+            }
+            int rc = tail < length ? send_range(follower, name, fd, tail, length, written_at) : 0;
+            stream->sent = length;
+            return rc;
+        }
+    }
+
+    atomic_fetch_add_explicit(&follower->resyncs, 1, memory_order_relaxed);
+    metrics_add(METRIC_REPLICATION_RESYNCS, 1);
+    hold_file(stream, fd, &st, 0);
+    if (send_name_frame(follower, REPLICA_FRAME_RESET, name, 0) != 0 ||
+        (fd >= 0 && send_range(follower, name, fd, 0, length, written_at) != 0) ||
+        send_name_frame(follower, REPLICA_FRAME_COMMIT, name, length) != 0) {
+        return -1;
+    }
+    stream->sent = length;
+    return 0;
+}
+
+// Carries each board's length as of now, not as last sent, so the follower
+// sees how far behind the stream is.
+static int send_heartbeat(replica_follower_t *follower)
+{
+    replica_t *replica = follower->replica;
+    unsigned char *frame = follower->buffer;
+    size_t offset = 0;
+    wire_put_u64(frame, wall_now());
+    offset += 8;
+    for (size_t i = 0; i < replica->board_count; ++i) {
+        int fd = -1;
+        unsigned long long length = 0;
+        if (board_directory_capture(replica->boards, i, &fd, &length) != 0) {
+            length = follower->streams[i].sent;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        put_string(frame, &offset, board_directory_spec(replica->boards, i)->name, BOARD_NAME_MAX - 1);
+        wire_put_u64(frame + offset, length);
+        offset += 8;
+    }
+    return follower_send(follower, REPLICA_FRAME_HEARTBEAT, frame, offset);
+}
+
+static void *streamer_thread(void *arg)
+{
+    replica_follower_t *follower = arg;
+    replica_t *replica = follower->replica;
+    uint64_t seen = 0;
+    uint64_t last_heartbeat = 0;
+    while (1) {
+        // Ahead of the data it describes, so what is still to be sent counts
+        // as lag until the follower has applied it.
+        uint64_t now = metrics_now();
+        if (now - last_heartbeat >= (uint64_t)REPLICA_HEARTBEAT_MS * 1000000u) {
+            if (send_heartbeat(follower) != 0) {
+                shutdown(follower->fd, SHUT_RDWR);
+                return NULL;
+            }
+            last_heartbeat = now;
+        }
+        for (size_t i = 0; i < replica->board_count; ++i) {
+            if (sync_board(follower, i) != 0) {
+                shutdown(follower->fd, SHUT_RDWR);
+                return NULL;
+            }
+        }
+
+        struct timespec deadline;
+        deadline_after(&deadline, REPLICA_HEARTBEAT_MS);
+        pthread_mutex_lock(&replica->lock);
+        while (!follower->closing && replica->changes == seen &&
+               pthread_cond_timedwait(&replica->cond, &replica->lock, &deadline) != ETIMEDOUT) {
+        }
+        seen = replica->changes;
+        int closing = follower->closing;
+        pthread_mutex_unlock(&replica->lock);
+        if (closing) {
+            return NULL;
+        }
+    }
+}
+
+// Runs a forwarded ADD or REMOVE and sends the REPLY.
+static void serve_request(replica_follower_t *follower, uint8_t type, const unsigned char *payload, size_t length)
+{
+    replica_t *replica = follower->replica;
+    size_t offset = 0;
+    uint32_t request = 0;
+    char name[BOARD_NAME_MAX];
+    char author[BOARD_AUTHOR_MAX];
+    if (wire_get_u32(payload, length, &offset, &request) != 0 ||
+        get_string(payload, length, &offset, name, sizeof(name)) != 0) {
+        return;
+    }
+    int index = board_directory_find(replica->boards, name);
+    board_t *board = index >= 0 ? board_directory_open(replica->boards, (size_t)index) : NULL;
+    int rc = -1;
+    int not_owner = 0;
+    board_post_t post;
+    memset(&post, 0, sizeof(post));
+
+    if (type == REPLICA_FRAME_ADD) {
+        uint16_t content_length = 0;
+        if (get_string(payload, length, &offset, author, sizeof(author)) == 0 &&
+            wire_get_u16(payload, length, &offset, &content_length) == 0 && content_length < BOARD_CONTENT_MAX &&
+            length - offset >= content_length && board != NULL) {
+            char content[BOARD_CONTENT_MAX];
+            memcpy(content, payload + offset, content_length);
+            content[content_length] = '\0';
+            rc = board_add(board, author, content, &post);
+        }
+    } else {
+        uint32_t id = 0;
+        if (wire_get_u32(payload, length, &offset, &id) == 0 &&
+            get_string(payload, length, &offset, author, sizeof(author)) == 0 && author[0] != '\0' &&
+            board != NULL) {
+            // A NULL requester would skip the ownership check, so followers
+            // can only remove on behalf of a named user.
+            rc = board_remove(board, id, author, &not_owner);
+        }
+    }
+
+    unsigned char reply[16 + BOARD_TIMESTAMP_MAX];
+    size_t reply_length = 0;
+    wire_put_u32(reply, request);
+    wire_put_u32(reply + 4, (uint32_t)rc);
+    reply[8] = (unsigned char)(not_owner != 0);
+    wire_put_u32(reply + 9, post.id);
+    reply_length = 13;
+    put_string(reply, &reply_length, post.timestamp, BOARD_TIMESTAMP_MAX - 1);
+    follower_send(follower, REPLICA_FRAME_REPLY, reply, reply_length);
+}
+
+static int read_hello(replica_follower_t *follower)
+{
+    replica_t *replica = follower->replica;
+    unsigned char *payload = follower->buffer;
+    struct timeval timeout = {.tv_sec = REPLICA_HELLO_TIMEOUT_S, .tv_usec = 0};
+    setsockopt(follower->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    uint8_t type = 0;
+    size_t length = 0;
+    size_t offset = 1;
+    uint16_t count = 0;
+    if (wire_receive(follower->fd, &type, payload, WIRE_PAYLOAD_MAX, &length) != 0 ||
+        type != REPLICA_FRAME_HELLO || length < 1 || payload[0] != REPLICA_VERSION ||
+        wire_get_u16(payload, length, &offset, &count) != 0) {
+        return -1;
+    }
+    for (uint16_t i = 0; i < count; ++i) {
+        char name[BOARD_NAME_MAX];
+        uint64_t board_length = 0;
+        uint64_t hash = 0;
+        if (get_string(payload, length, &offset, name, sizeof(name)) != 0 ||
+            wire_get_u64(payload, length, &offset, &board_length) != 0 ||
+            wire_get_u64(payload, length, &offset, &hash) != 0) {
+            return -1;
+        }
+        int index = board_directory_find(replica->boards, name);
+        if (index < 0) {
+            LOG_WARN(COMPONENT, "Follower %s has board '%s', which this leader does not", follower->peer, name);
+            continue;
+        }
+        replica_stream_t *stream = &follower->streams[index];
+        stream->offered = 1;
+        stream->offered_length = board_length;
+        stream->offered_hash = hash;
+    }
+    timeout.tv_sec = 0;
+    setsockopt(follower->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    unsigned char ack = REPLICA_VERSION;
+    return follower_send(follower, REPLICA_FRAME_HELLO, &ack, 1);
+}
+
+static void free_follower(replica_follower_t *follower)
+{
+    if (follower->streams != NULL) {
+        for (size_t i = 0; i < follower->replica->board_count; ++i) {
+            if (follower->streams[i].fd >= 0) {
+                close(follower->streams[i].fd);
+            }
+        }
+    }
+    free(follower->streams);
+    free(follower->buffer);
+    pthread_mutex_destroy(&follower->send_lock);
+    close(follower->fd);
+    free(follower);
+}
+
+static void serve_follower(replica_follower_t *follower)
+{
+    replica_t *replica = follower->replica;
+    if (read_hello(follower) != 0) {
+        LOG_WARN(COMPONENT, "Replication handshake with %s failed", follower->peer);
+        return;
+    }
+
+    pthread_mutex_lock(&replica->lock);
+    int started = !replica->stopping && pthread_create(&follower->streamer, NULL, streamer_thread, follower) == 0;
+    if (started) {
+        follower->next = replica->followers;
+        replica->followers = follower;
+    }
+    pthread_mutex_unlock(&replica->lock);
+    if (!started) {
+        return;
+    }
+    metrics_gauge_add(METRIC_REPLICATION_PEERS, 1);
+    LOG_INFO(COMPONENT, "Follower %s connected", follower->peer);
+
+    // The hello is done with the shared buffer; requests get their own.
+    unsigned char *payload = malloc(WIRE_PAYLOAD_MAX);
+    while (payload != NULL) {
+        uint8_t type = 0;
+        size_t length = 0;
+        if (wire_receive(follower->fd, &type, payload, WIRE_PAYLOAD_MAX, &length) != 0) {
+            break;
+        }
+        if (type == REPLICA_FRAME_ADD || type == REPLICA_FRAME_REMOVE) {
+            serve_request(follower, type, payload, length);
+        }
+    }
+    free(payload);
+
+    pthread_mutex_lock(&replica->lock);
+    for (replica_follower_t **cursor = &replica->followers; *cursor != NULL; cursor = &(*cursor)->next) {
+        if (*cursor == follower) {
+            *cursor = follower->next;
+            break;
+        }
+    }
+    follower->closing = 1;
+    pthread_cond_broadcast(&replica->cond);
+    pthread_mutex_unlock(&replica->lock);
+    shutdown(follower->fd, SHUT_RDWR);
+    pthread_join(follower->streamer, NULL);
+    metrics_gauge_add(METRIC_REPLICATION_PEERS, -1);
+    LOG_INFO(COMPONENT, "Follower %s disconnected after %llu bytes", follower->peer,
+             (unsigned long long)atomic_load(&follower->bytes_sent));
+}
+
+static void *follower_connection_thread(void *arg)
+{
+    replica_follower_t *follower = arg;
+    replica_t *replica = follower->replica;
+    serve_follower(follower);
+    free_follower(follower);
+
+    pthread_mutex_lock(&replica->lock);
+    replica->accepted_threads--;
+    pthread_cond_broadcast(&replica->cond);
+    pthread_mutex_unlock(&replica->lock);
+    return NULL;
+}
+
+void replica_accept(replica_t *replica, int fd, const char *peer)
+{
+    if (replica == NULL || !replica->leader) {
+        close(fd);
+        return;
+    }
+    replica_follower_t *follower = calloc(1, sizeof(*follower));
+    if (follower == NULL) {
+        close(fd);
+        return;
+    }
+    follower->replica = replica;
+    follower->fd = fd;
+    follower->connected_at = time(NULL);
+    snprintf(follower->peer, sizeof(follower->peer), "%s", peer != NULL ? peer : "unknown");
+    atomic_init(&follower->bytes_sent, 0);
+    atomic_init(&follower->resyncs, 0);
+    follower->streams = calloc(replica->board_count, sizeof(follower->streams[0]));
+    follower->buffer = malloc(WIRE_PAYLOAD_MAX);
+    if (follower->streams == NULL || follower->buffer == NULL ||
+        pthread_mutex_init(&follower->send_lock, NULL) != 0) {
+        free(follower->streams);
+        free(follower->buffer);
+        free(follower);
+        close(fd);
+        return;
+    }
+    for (size_t i = 0; i < replica->board_count; ++i) {
+        follower->streams[i].fd = -1;
+    }
+
+    pthread_mutex_lock(&replica->lock);
+    pthread_t thread;
+    if (replica->stopping || pthread_create(&thread, NULL, follower_connection_thread, follower) != 0) {
+        pthread_mutex_unlock(&replica->lock);
+        free_follower(follower);
+        return;
+    }
+    replica->accepted_threads++;
+    pthread_mutex_unlock(&replica->lock);
+    pthread_detach(thread);
+}
+
+replica_t *replica_leader_create(board_directory_t *boards, struct hub *hub)
+{
+    if (boards == NULL || hub == NULL) {
+        return NULL;
+    }
+    replica_t *replica = replica_alloc(boards);
+    if (replica == NULL) {
+        return NULL;
+    }
+    replica->leader = 1;
+    replica->hub = hub;
+    hub_subscription_init(&replica->post_events, board_changed, replica);
+    hub_subscription_init(&replica->remove_events, board_changed, replica);
+    hub_subscribe(hub, HUB_TOPIC_BOARD_POST, &replica->post_events);
+    hub_subscribe(hub, HUB_TOPIC_BOARD_REMOVE, &replica->remove_events);
+    LOG_INFO(COMPONENT, "Replicating %zu board(s) as leader", replica->board_count);
+    return replica;
+}
+
+// ---------------------------------------------------------------------------
+// Follower
+
+// Sends a request and waits for its reply; the caller has filled payload
+// from offset 4 on.
+static int forward_request(replica_t *replica, uint8_t type, unsigned char *payload, size_t length,
+                           replica_request_t *request)
+{
+    memset(request, 0, sizeof(*request));
+    request->rc = -1;
+    pthread_mutex_lock(&replica->send_lock);
+    pthread_mutex_lock(&replica->lock);
+    if (!replica->connected) {
+        pthread_mutex_unlock(&replica->lock);
+        pthread_mutex_unlock(&replica->send_lock);
+        return -1;
+    }
+    request->id = replica->next_request++;
+    request->next = replica->pending;
+    replica->pending = request;
+    int fd = replica->fd;
+    pthread_mutex_unlock(&replica->lock);
+
+    wire_put_u32(payload, request->id);
+    int rc = wire_send(fd, type, payload, length);
+    pthread_mutex_unlock(&replica->send_lock);
+    metrics_add(METRIC_REPLICATION_FORWARDS, 1);
+
+    struct timespec deadline;
+    deadline_after(&deadline, REPLICA_REQUEST_TIMEOUT_MS);
+    pthread_mutex_lock(&replica->lock);
+    while (rc == 0 && !request->done && replica->connected &&
+           pthread_cond_timedwait(&replica->cond, &replica->lock, &deadline) != ETIMEDOUT) {
+    }
+    for (replica_request_t **cursor = &replica->pending; *cursor != NULL; cursor = &(*cursor)->next) {
+        if (*cursor == request) {
+            *cursor = request->next;
+            break;
+        }
+    }
+    int done = request->done;
+    pthread_mutex_unlock(&replica->lock);
+    if (!done) {
+        LOG_WARN(COMPONENT, "%s", "No reply from the leader for a forwarded write");
+        return -1;
+    }
+    return request->rc;
+}
+
+static int forward_add(void *context, const char *name, const char *author, const char *content,
+                       board_post_t *post)
+{
+    replica_t *replica = context;
+    unsigned char payload[8 + BOARD_NAME_MAX + BOARD_AUTHOR_MAX + BOARD_CONTENT_MAX];
+    size_t offset = 4;
+    size_t content_length = strnlen(content, BOARD_CONTENT_MAX);
+    if (author[0] == '\0' || content_length == 0 || content_length >= BOARD_CONTENT_MAX ||
+        strnlen(author, BOARD_AUTHOR_MAX) >= BOARD_AUTHOR_MAX) {
+        return -1;
+    }
+    put_string(payload, &offset, name, BOARD_NAME_MAX - 1);
+    put_string(payload, &offset, author, BOARD_AUTHOR_MAX - 1);
+    wire_put_u16(payload + offset, (uint16_t)content_length);
+    offset += 2;
+    memcpy(payload + offset, content, content_length);
+    offset += content_length;
+
+    replica_request_t request;
+    int rc = forward_request(replica, REPLICA_FRAME_ADD, payload, offset, &request);
+    if (rc != 0) {
+        return rc;
+    }
+    memset(post, 0, sizeof(*post));
+    post->id = request.post_id;
+    snprintf(post->author, sizeof(post->author), "%s", author);
+    snprintf(post->timestamp, sizeof(post->timestamp), "%s", request.timestamp);
+    snprintf(post->content, sizeof(post->content), "%s", content);
+
+    // Wait for the post to come back so the author sees it when listing.
+    int index = board_directory_find(replica->boards, name);
+    board_t *board = index >= 0 ? board_directory_open(replica->boards, (size_t)index) : NULL;
+    struct timespec deadline;
+    deadline_after(&deadline, REPLICA_ECHO_TIMEOUT_MS);
+    pthread_mutex_lock(&replica->lock);
+    while (board != NULL && board_count_since(board, post->id - 1) == 0 && replica->connected &&
+           pthread_cond_timedwait(&replica->cond, &replica->lock, &deadline) != ETIMEDOUT) {
+    }
+    pthread_mutex_unlock(&replica->lock);
+    return 0;
+}
+
+static int forward_remove(void *context, const char *name, unsigned int id, const char *requester, int *not_owner)
+{
+    replica_t *replica = context;
+    unsigned char payload[16 + BOARD_NAME_MAX + BOARD_AUTHOR_MAX];
+    size_t offset = 4;
+    put_string(payload, &offset, name, BOARD_NAME_MAX - 1);
+    wire_put_u32(payload + offset, id);
+    offset += 4;
+    put_string(payload, &offset, requester != NULL ? requester : "", BOARD_AUTHOR_MAX - 1);
+
+    replica_request_t request;
+    int rc = forward_request(replica, REPLICA_FRAME_REMOVE, payload, offset, &request);
+    if (not_owner != NULL) {
+        *not_owner = request.not_owner;
+    }
+    return rc;
+}
+
+static void update_lag(replica_t *replica)
+{
+    unsigned long long lag = 0;
+    for (size_t i = 0; i < replica->board_count; ++i) {
+        const replica_board_t *state = &replica->states[i];
+        if (state->leader_length > state->applied) {
+            lag += state->leader_length - state->applied;
+        }
+    }
+    metrics_gauge_set(METRIC_REPLICATION_LAG_BYTES, (int64_t)lag);
+}
+
+static void temp_path(const board_spec_t *spec, char *path, size_t size)
+{
+    snprintf(path, size, "%s%s", spec->path, REPLICA_TEMP_SUFFIX);
+}
+
+static void abandon_sync(replica_t *replica, size_t index)
+{
+    replica_board_t *state = &replica->states[index];
+    if (state->sync_fd >= 0) {
+        close(state->sync_fd);
+        state->sync_fd = -1;
+        char path[BOARD_PATH_MAX + 8];
+        temp_path(board_directory_spec(replica->boards, index), path, sizeof(path));
+        unlink(path);
+    }
+}
+
+// Rewrites the board without the ranges a CUT names, as the leader's removal
+// did to its own file.
+static int apply_cuts(replica_t *replica, size_t index, const unsigned char *payload, size_t length, size_t offset)
+{
+    replica_board_t *state = &replica->states[index];
+    const board_spec_t *spec = board_directory_spec(replica->boards, index);
+    uint64_t expected = 0;
+    uint32_t count = 0;
+    if (state->sync_fd >= 0 || wire_get_u64(payload, length, &offset, &expected) != 0 ||
+        wire_get_u32(payload, length, &offset, &count) != 0 || count > REPLICA_CUTS_MAX) {
+        return -1;
+    }
+    int fd = -1;
+    unsigned long long have = 0;
+    if (board_directory_capture(replica->boards, index, &fd, &have) != 0 || fd < 0 || have != expected) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        LOG_WARN(COMPONENT, "Board '%s' is not what the leader cut from; resynchronizing", spec->name);
+        return -1;
+    }
+
+    char path[BOARD_PATH_MAX + 8];
+    temp_path(spec, path, sizeof(path));
+    int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int rc = out >= 0 ? 0 : -1;
+    unsigned long long kept = 0;
+    off_t position = 0;
+    for (uint32_t i = 0; rc == 0 && i <= count; ++i) {
+        uint64_t cut_offset = expected;
+        uint64_t cut_length = 0;
+        if (i < count && (wire_get_u64(payload, length, &offset, &cut_offset) != 0 ||
+                          wire_get_u64(payload, length, &offset, &cut_length) != 0 ||
+                          cut_offset < (uint64_t)position || cut_length > expected - cut_offset)) {
+            rc = -1;
+            break;
+        }
+        while (rc == 0 && (uint64_t)position < cut_offset) {
+            ssize_t n = sendfile(out, fd, &position, (size_t)(cut_offset - (uint64_t)position));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                rc = -1;
+            } else {
+                kept += (unsigned long long)n;
+            }
+        }
+        position = (off_t)(cut_offset + cut_length);
+    }
+    close(fd);
+    if (out >= 0 && fsync(out) != 0) {
+        rc = -1;
+    }
+    if (out >= 0 && close(out) != 0) {
+        rc = -1;
+    }
+    board_t *board = rc == 0 ? board_directory_open(replica->boards, index) : NULL;
+    if (board == NULL || board_replace(board, path) != 0) {
+        unlink(path);
+        return -1;
+    }
+    LOG_INFO(COMPONENT, "Board '%s': removal from the leader applied (%llu bytes cut)", spec->name,
+             (unsigned long long)(expected - kept));
+    pthread_mutex_lock(&replica->lock);
+    state->applied = kept;
+    update_lag(replica);
+    pthread_cond_broadcast(&replica->cond);
+    pthread_mutex_unlock(&replica->lock);
+    return 0;
+}
+
+// Applies one frame from the leader; -1 drops the link so the next hello
+// starts over from what is on disk.
+static int apply_frame(replica_t *replica, uint8_t type, const unsigned char *payload, size_t length)
+{
+    size_t offset = 0;
+    char name[BOARD_NAME_MAX];
+    if (type == REPLICA_FRAME_HEARTBEAT) {
+        uint64_t sent_at = 0;
+        if (wire_get_u64(payload, length, &offset, &sent_at) != 0) {
+            return -1;
+        }
+        pthread_mutex_lock(&replica->lock);
+        while (offset < length) {
+            uint64_t board_length = 0;
+            if (get_string(payload, length, &offset, name, sizeof(name)) != 0 ||
+                wire_get_u64(payload, length, &offset, &board_length) != 0) {
+                break;
+            }
+            int index = board_directory_find(replica->boards, name);
+            if (index >= 0) {
+                replica->states[index].leader_length = board_length;
+            }
+        }
+        replica->last_heartbeat = metrics_now();
+        update_lag(replica);
+        pthread_mutex_unlock(&replica->lock);
+        return 0;
+    }
+    if (type == REPLICA_FRAME_REPLY) {
+        uint32_t request_id = 0;
+        uint32_t rc = 0;
+        uint32_t post_id = 0;
+        if (wire_get_u32(payload, length, &offset, &request_id) != 0 ||
+            wire_get_u32(payload, length, &offset, &rc) != 0 || offset >= length) {
+            return -1;
+        }
+        int not_owner = payload[offset++];
+        char timestamp[BOARD_TIMESTAMP_MAX] = "";
+        if (wire_get_u32(payload, length, &offset, &post_id) != 0 ||
+            get_string(payload, length, &offset, timestamp, sizeof(timestamp)) != 0) {
+            return -1;
+        }
+        pthread_mutex_lock(&replica->lock);
+        for (replica_request_t *request = replica->pending; request != NULL; request = request->next) {
+            if (request->id == request_id) {
+                request->rc = (int)(int32_t)rc;
+                request->not_owner = not_owner;
+                request->post_id = post_id;
+                snprintf(request->timestamp, sizeof(request->timestamp), "%s", timestamp);
+                request->done = 1;
+                pthread_cond_broadcast(&replica->cond);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&replica->lock);
+        return 0;
+    }
+
+    if (get_string(payload, length, &offset, name, sizeof(name)) != 0) {
+        return -1;
+    }
+    int found = board_directory_find(replica->boards, name);
+    if (found < 0) {
+        // A board only the leader has; nothing to keep it in.
+        return 0;
+    }
+    size_t index = (size_t)found;
+    replica_board_t *state = &replica->states[index];
+    const board_spec_t *spec = board_directory_spec(replica->boards, index);
+    char path[BOARD_PATH_MAX + 8];
+    temp_path(spec, path, sizeof(path));
+
+    if (type == REPLICA_FRAME_CUT) {
+        return apply_cuts(replica, index, payload, length, offset);
+    }
+    if (type == REPLICA_FRAME_RESET) {
+        abandon_sync(replica, index);
+        state->sync_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        state->sync_length = 0;
+        if (state->sync_fd < 0) {
+            LOG_ERROR(COMPONENT, "Unable to create '%s': %s", path, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+    if (type == REPLICA_FRAME_COMMIT) {
+        uint64_t committed = 0;
+        if (state->sync_fd < 0 || wire_get_u64(payload, length, &offset, &committed) != 0 ||
+            committed != state->sync_length || fsync(state->sync_fd) != 0) {
+            return -1;
+        }
+        close(state->sync_fd);
+        state->sync_fd = -1;
+        board_t *board = board_directory_open(replica->boards, index);
+        if (board == NULL || board_replace(board, path) != 0) {
+            unlink(path);
+            return -1;
+        }
+        metrics_add(METRIC_REPLICATION_RESYNCS, 1);
+        LOG_INFO(COMPONENT, "Board '%s' replaced by the leader's copy (%llu bytes)", name,
+                 (unsigned long long)committed);
+        pthread_mutex_lock(&replica->lock);
+        state->applied = committed;
+        update_lag(replica);
+        pthread_cond_broadcast(&replica->cond);
+        pthread_mutex_unlock(&replica->lock);
+        return 0;
+    }
+    if (type != REPLICA_FRAME_DATA) {
+        return 0;
+    }
+
+    uint64_t data_offset = 0;
+    uint64_t written_at = 0;
+    if (wire_get_u64(payload, length, &offset, &data_offset) != 0 ||
+        wire_get_u64(payload, length, &offset, &written_at) != 0 || offset >= length) {
+        return -1;
+    }
+    const char *data = (const char *)payload + offset;
+    size_t data_length = length - offset;
+    if (state->sync_fd >= 0) {
+        if (data_offset != state->sync_length || write_all(state->sync_fd, data, data_length) != 0) {
+            return -1;
+        }
+        state->sync_length += data_length;
+    } else {
+        board_t *board = board_directory_open(replica->boards, index);
+        if (board == NULL || board_apply(board, data_offset, data, data_length) != 0) {
+            LOG_WARN(COMPONENT, "Could not apply %zu bytes at %llu to board '%s'; resynchronizing", data_length,
+                     (unsigned long long)data_offset, name);
+            return -1;
+        }
+        uint64_t now = wall_now();
+        metrics_observe(METRIC_REPLICATION_DELAY, now > written_at ? now - written_at : 0);
+    }
+    metrics_add(METRIC_REPLICATION_BYTES_APPLIED, data_length);
+
+    pthread_mutex_lock(&replica->lock);
+    if (state->sync_fd < 0) {
+        state->applied = data_offset + data_length;
+    }
+    if (data_offset + data_length > state->leader_length) {
+        state->leader_length = data_offset + data_length;
+    }
+    update_lag(replica);
+    pthread_cond_broadcast(&replica->cond);
+    pthread_mutex_unlock(&replica->lock);
+    return 0;
+}
+
+// Offers what is on disk: for every board its length and a hash of it.
+static int send_hello(replica_t *replica, int fd)
+{
+    unsigned char *payload = malloc(8 + replica->board_count * (BOARD_NAME_MAX + 17));
+    if (payload == NULL) {
+        return -1;
+    }
+    size_t offset = 0;
+    payload[offset++] = REPLICA_VERSION;
+    wire_put_u16(payload + offset, (uint16_t)replica->board_count);
+    offset += 2;
+    for (size_t i = 0; i < replica->board_count; ++i) {
+        int board_fd = -1;
+        unsigned long long length = 0;
+        uint64_t hash = 0;
+        if (board_directory_capture(replica->boards, i, &board_fd, &length) != 0 ||
+            (board_fd >= 0 && hash_prefix(board_fd, length, &hash) != 0)) {
+            length = 0;
+            hash = 0;
+        }
+        if (board_fd >= 0) {
+            close(board_fd);
+        }
+        put_string(payload, &offset, board_directory_spec(replica->boards, i)->name, BOARD_NAME_MAX - 1);
+        wire_put_u64(payload + offset, length);
+        wire_put_u64(payload + offset + 8, hash);
+        offset += 16;
+        pthread_mutex_lock(&replica->lock);
+        replica->states[i].applied = length;
+        replica->states[i].leader_length = length;
+        pthread_mutex_unlock(&replica->lock);
+    }
+    int rc = wire_send(fd, REPLICA_FRAME_HELLO, payload, offset);
+    free(payload);
+    return rc;
+}
+
+static void follow(replica_t *replica, int fd, const char *peer, unsigned char *buffer)
+{
+    uint8_t type = 0;
+    size_t length = 0;
+    struct timeval timeout = {.tv_sec = REPLICA_HELLO_TIMEOUT_S, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (send_hello(replica, fd) != 0 || wire_receive(fd, &type, buffer, WIRE_PAYLOAD_MAX, &length) != 0 ||
+        type != REPLICA_FRAME_HELLO || length < 1 || buffer[0] != REPLICA_VERSION) {
+        LOG_WARN(COMPONENT, "Replication handshake with leader %s failed", peer);
+        return;
+    }
+    // Heartbeats arrive every second; a silent leader is a dead link.
+    timeout.tv_sec = REPLICA_HELLO_TIMEOUT_S;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    pthread_mutex_lock(&replica->lock);
+    replica->fd = fd;
+    replica->connected = 1;
+    replica->last_heartbeat = metrics_now();
+    pthread_mutex_unlock(&replica->lock);
+    metrics_gauge_set(METRIC_REPLICATION_PEERS, 1);
+    LOG_INFO(COMPONENT, "Following leader %s", peer);
+
+    while (wire_receive(fd, &type, buffer, WIRE_PAYLOAD_MAX, &length) == 0 &&
+           apply_frame(replica, type, buffer, length) == 0) {
+    }
+
+    pthread_mutex_lock(&replica->lock);
+    replica->connected = 0;
+    pthread_cond_broadcast(&replica->cond);
+    pthread_mutex_unlock(&replica->lock);
+    // Wait out a request being sent before fd is closed.
+    shutdown(fd, SHUT_RDWR);
+    pthread_mutex_lock(&replica->send_lock);
+    pthread_mutex_lock(&replica->lock);
+    replica->fd = -1;
+    pthread_mutex_unlock(&replica->lock);
+    pthread_mutex_unlock(&replica->send_lock);
+    for (size_t i = 0; i < replica->board_count; ++i) {
+        abandon_sync(replica, i);
+    }
+    metrics_gauge_set(METRIC_REPLICATION_PEERS, 0);
+    LOG_INFO(COMPONENT, "Lost leader %s", peer);
+}
+
+static int wait_stopping(replica_t *replica, unsigned int ms)
+{
+    struct timespec deadline;
+    deadline_after(&deadline, ms);
+    pthread_mutex_lock(&replica->lock);
+    while (!replica->stopping && pthread_cond_timedwait(&replica->cond, &replica->lock, &deadline) != ETIMEDOUT) {
+    }
+    int stopping = replica->stopping;
+    pthread_mutex_unlock(&replica->lock);
+    return stopping;
+}
+
+static void *follower_thread(void *arg)
+{
+    replica_t *replica = arg;
+    char peer[CONFIG_MAX_HOST_LEN + 16];
+    snprintf(peer, sizeof(peer), "%s:%u", replica->leader_peer.host, replica->leader_peer.port);
+    unsigned char *buffer = malloc(WIRE_PAYLOAD_MAX);
+    unsigned int retry_ms = REPLICA_RETRY_MIN_MS;
+    while (buffer != NULL && !wait_stopping(replica, 0)) {
+        int fd = wire_connect(replica->leader_peer.host, replica->leader_peer.port, REPLICA_CONNECT_TIMEOUT_MS);
+        if (fd >= 0) {
+            uint64_t started = metrics_now();
+            follow(replica, fd, peer, buffer);
+            close(fd);
+            if (metrics_now() - started > (uint64_t)REPLICA_RETRY_MAX_MS * 1000000u) {
+                retry_ms = REPLICA_RETRY_MIN_MS;
+            }
+        } else {
+            LOG_DEBUG(COMPONENT, "Leader %s unreachable: %s", peer, strerror(errno));
+        }
+        if (wait_stopping(replica, retry_ms)) {
+            break;
+        }
+        retry_ms = retry_ms * 2 > REPLICA_RETRY_MAX_MS ? REPLICA_RETRY_MAX_MS : retry_ms * 2;
+    }
+    free(buffer);
+    return NULL;
+}
+
+replica_t *replica_follower_create(board_directory_t *boards, const config_peer_t *leader)
+{
+    if (boards == NULL || leader == NULL) {
+        return NULL;
+    }
+    replica_t *replica = replica_alloc(boards);
+    if (replica == NULL) {
+        return NULL;
+    }
+    replica->leader_peer = *leader;
+    replica->next_request = 1;
+    replica->states = calloc(replica->board_count, sizeof(replica->states[0]));
+    if (replica->states == NULL) {
+        replica_free(replica);
+        return NULL;
+    }
+    for (size_t i = 0; i < replica->board_count; ++i) {
+        replica->states[i].sync_fd = -1;
+    }
+    replica->forward.add = forward_add;
+    replica->forward.remove = forward_remove;
+    replica->forward.context = replica;
+    board_directory_set_forward(boards, &replica->forward);
+    if (pthread_create(&replica->thread, NULL, follower_thread, replica) != 0) {
+        board_directory_set_forward(boards, NULL);
+        replica_free(replica);
+        return NULL;
+    }
+    replica->thread_started = 1;
+    LOG_INFO(COMPONENT, "Replicating %zu board(s) from leader %s:%u", replica->board_count, leader->host,
+             leader->port);
+    return replica;
+}
+
+void replica_destroy(replica_t *replica)
+{
+    if (replica == NULL) {
+        return;
+    }
+    if (replica->hub != NULL) {
+        hub_unsubscribe(replica->hub, &replica->post_events);
+        hub_unsubscribe(replica->hub, &replica->remove_events);
+    }
+    pthread_mutex_lock(&replica->lock);
+    replica->stopping = 1;
+    pthread_cond_broadcast(&replica->cond);
+    for (replica_follower_t *follower = replica->followers; follower != NULL; follower = follower->next) {
+        shutdown(follower->fd, SHUT_RDWR);
+    }
+    if (replica->fd >= 0) {
+        shutdown(replica->fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&replica->lock);
+
+    if (replica->thread_started) {
+        pthread_join(replica->thread, NULL);
+        board_directory_set_forward(replica->boards, NULL);
+    }
+    pthread_mutex_lock(&replica->lock);
+    while (replica->accepted_threads > 0) {
+        pthread_cond_wait(&replica->cond, &replica->lock);
+    }
+    pthread_mutex_unlock(&replica->lock);
+    replica_free(replica);
+}
+
+void replica_report(replica_t *replica, FILE *out)
+{
+    if (replica == NULL || out == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&replica->lock);
+    if (replica->leader) {
+        fprintf(out, "role leader\n%-32s %14s %8s %9s\n", "FOLLOWER", "SENT_BYTES", "RESYNCS", "CONNECTED");
+        size_t count = 0;
+        time_t now = time(NULL);
+        for (replica_follower_t *follower = replica->followers; follower != NULL; follower = follower->next) {
+            fprintf(out, "%-32s %14llu %8llu %8llds\n", follower->peer,
+                    (unsigned long long)atomic_load(&follower->bytes_sent),
+                    (unsigned long long)atomic_load(&follower->resyncs), (long long)(now - follower->connected_at));
+            count++;
+        }
+        fprintf(out, "%zu follower(s)\n", count);
+    } else {
+        fprintf(out, "role follower of %s:%u, %s", replica->leader_peer.host, replica->leader_peer.port,
+                replica->connected ? "connected" : "disconnected");
+        if (replica->connected) {
+            fprintf(out, ", last heartbeat %llu ms ago",
+                    (unsigned long long)((metrics_now() - replica->last_heartbeat) / 1000000));
+        }
+        fprintf(out, "\n%-16s %14s %14s %10s\n", "BOARD", "APPLIED", "LEADER", "LAG");
+        for (size_t i = 0; i < replica->board_count; ++i) {
+            const replica_board_t *state = &replica->states[i];
+            unsigned long long lag = state->leader_length > state->applied ? state->leader_length - state->applied : 0;
+            fprintf(out, "%-16s %14llu %14llu %10llu\n", board_directory_spec(replica->boards, i)->name,
+                    state->applied, state->leader_length, lag);
+        }
+    }
+    pthread_mutex_unlock(&replica->lock);
+}
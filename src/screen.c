@@ -0,0 +1,275 @@
+#include "screen.h"
+
+#include "log.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define COMPONENT "screen"
+
+#define SCREEN_EOL "\r\n"
+#define SCREEN_EOL_LEN 2
+
+struct screen {
+    atomic_size_t refs;
+    size_t length;
+    char data[];
+};
+
+struct motd_cache {
+    pthread_mutex_t lock;
+    char *path;
+    char *header;
+    char *footer;
+    screen_t *current;
+    bool loaded;
+    bool present;
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+};
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} screen_buffer_t;
+
+static void buffer_append(screen_buffer_t *buffer, const char *data, size_t length)
+{
+    if (buffer->failed) {
+        return;
+    }
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        char *grown = realloc(buffer->data, capacity);
+        if (grown == NULL) {
+            buffer->failed = true;
+            return;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+static void buffer_append_line(screen_buffer_t *buffer, const char *line, size_t length)
+{
+    buffer_append(buffer, line, length);
+    buffer_append(buffer, SCREEN_EOL, SCREEN_EOL_LEN);
+}
+
+static screen_t *screen_from_buffer(screen_buffer_t *buffer)
+{
+    if (buffer->failed) {
+        free(buffer->data);
+        return NULL;
+    }
+
+    screen_t *screen = malloc(sizeof(*screen) + buffer->length);
+    if (screen != NULL) {
+        atomic_init(&screen->refs, 1);
+        screen->length = buffer->length;
+        if (buffer->length > 0) {
+            memcpy(screen->data, buffer->data, buffer->length);
+        }
+    }
+    free(buffer->data);
+    return screen;
+}
+
+screen_t *screen_build(const char *const *lines, size_t count, const char *trailer)
+{
+    screen_buffer_t buffer = {0};
+    for (size_t i = 0; i < count; ++i) {
+        buffer_append_line(&buffer, lines[i], strlen(lines[i]));
+    }
+    if (trailer != NULL) {
+        buffer_append(&buffer, trailer, strlen(trailer));
+    }
+    return screen_from_buffer(&buffer);
+}
+
+screen_t *screen_retain(screen_t *screen)
+{
+    if (screen != NULL) {
+        atomic_fetch_add_explicit(&screen->refs, 1, memory_order_relaxed);
+    }
+    return screen;
+}
+
+void screen_release(screen_t *screen)
+{
+    if (screen == NULL) {
+        return;
+    }
+    if (atomic_fetch_sub_explicit(&screen->refs, 1, memory_order_acq_rel) == 1) {
+        free(screen);
+    }
+}
+
+void screen_send(const screen_t *screen, FILE *out)
+{
+    if (screen == NULL || out == NULL || screen->length == 0) {
+        return;
+    }
+    // Session streams are unbuffered, so this reaches the socket as one write.
+    fwrite(screen->data, 1, screen->length, out);
+    fflush(out);
+}
+
+static char *duplicate(const char *text)
+{
+    size_t length = strlen(text) + 1;
+    char *copy = malloc(length);
+    if (copy != NULL) {
+        memcpy(copy, text, length);
+    }
+    return copy;
+}
+
+motd_cache_t *motd_cache_create(const char *path, const char *header, const char *footer)
+{
+    if (path == NULL) {
+        return NULL;
+    }
+
+    motd_cache_t *cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->path = duplicate(path);
+    cache->header = duplicate(header != NULL ? header : "");
+    cache->footer = duplicate(footer != NULL ? footer : "");
+    if (cache->path == NULL || cache->header == NULL || cache->footer == NULL ||
+        pthread_mutex_init(&cache->lock, NULL) != 0) {
+        free(cache->path);
+        free(cache->header);
+        free(cache->footer);
+        free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void motd_cache_destroy(motd_cache_t *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    screen_release(cache->current);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->path);
+    free(cache->header);
+    free(cache->footer);
+    free(cache);
+}
+
+// Same per-line treatment the MOTD always had: surrounding CR/LF and leading
+// whitespace are dropped.
+static void append_motd_text(screen_buffer_t *buffer, const char *text, size_t length)
+{
+    size_t start = 0;
+    while (start < length) {
+        const char *newline = memchr(text + start, '\n', length - start);
+        size_t end = (newline != NULL) ? (size_t)(newline - text) : length;
+        size_t line_end = end;
+        while (line_end > start && text[line_end - 1] == '\r') {
+            line_end--;
+        }
+        size_t line_start = start;
+        while (line_start < line_end && isspace((unsigned char)text[line_start])) {
+            line_start++;
+        }
+        buffer_append_line(buffer, text + line_start, line_end - line_start);
+        start = end + 1;
+    }
+}
+
+static screen_t *render_motd(const motd_cache_t *cache, FILE *file)
+{
+    screen_buffer_t buffer = {0};
+    buffer_append_line(&buffer, cache->header, strlen(cache->header));
+
+    if (file != NULL) {
+        screen_buffer_t text = {0};
+        char chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            buffer_append(&text, chunk, n);
+        }
+        if (text.failed) {
+            buffer.failed = true;
+        } else if (text.length > 0) {
+            append_motd_text(&buffer, text.data, text.length);
+        }
+        free(text.data);
+    }
+
+    buffer_append_line(&buffer, cache->footer, strlen(cache->footer));
+    return screen_from_buffer(&buffer);
+}
+
+static bool motd_changed(const motd_cache_t *cache, bool present, const struct stat *st)
+{
+    if (!cache->loaded || cache->present != present) {
+        return true;
+    }
+    if (!present) {
+        return false;
+    }
+    return cache->device != st->st_dev || cache->inode != st->st_ino || cache->size != st->st_size ||
+           cache->mtime.tv_sec != st->st_mtim.tv_sec || cache->mtime.tv_nsec != st->st_mtim.tv_nsec;
+}
+
+screen_t *motd_cache_acquire(motd_cache_t *cache)
+{
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    struct stat st;
+    bool present = stat(cache->path, &st) == 0;
+    if (motd_changed(cache, present, &st)) {
+        FILE *file = present ? fopen(cache->path, "r") : NULL;
+        screen_t *rendered = render_motd(cache, file);
+        if (file != NULL) {
+            fclose(file);
+        }
+        if (rendered != NULL) {
+            screen_release(cache->current);
+            cache->current = rendered;
+            cache->loaded = true;
+            cache->present = present;
+            if (present) {
+                cache->device = st.st_dev;
+                cache->inode = st.st_ino;
+                cache->size = st.st_size;
+                cache->mtime = st.st_mtim;
+            }
+            LOG_DEBUG(COMPONENT, "Loaded MOTD %s (%zu bytes rendered)", cache->path, rendered->length);
+        } else {
+            LOG_WARN(COMPONENT, "Failed to render MOTD %s: %s", cache->path, strerror(errno));
+        }
+    }
+
+    screen_t *screen = screen_retain(cache->current);
+    pthread_mutex_unlock(&cache->lock);
+    return screen;
+}
@@ -1,14 +1,27 @@
 #include "server.h"
 
+#include "admin.h"
+#include "broker.h"
+#include "handoff.h"
+#include "lock_profile.h"
 #include "log.h"
 #include "maum.h"
+#include "metrics.h"
 #include "session.h"
-#include "telnet.h"
+#include "ssh_server.h"
+#include "unix_socket.h"
+#include "wire.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,33 +33,84 @@
 #define PEER_HOST_MAX 128
 #define PEER_SERVICE_MAX 16
 
+#define DRAIN_POLL_MS 250
+#define DRAIN_GRACE_MS 5000
+#define HANDOFF_READY_TIMEOUT_MS 10000
+
+enum {
+    LISTENER_WAKE = 0,
+    LISTENER_TELNET,
+    LISTENER_SSH,
+    LISTENER_BROKER,
+    LISTENER_UPGRADE,
+    LISTENER_METRICS,
+    LISTENER_ADMIN,
+    LISTENER_RELAY,
+    LISTENER_REPLICATION,
+    LISTENER_HANDOFF,
+    LISTENER_COUNT
+};
+
 struct server_context {
+    // Startup values; keys that may change while running are read through
+    // config_current() instead.
     maum_config_t config;
+    char config_path[256];
     session_manager_t *sessions;
+    ssh_server_t *ssh;
     int running;
     int telnet_listen_fd;
+    int broker_listen_fd;
+    int upgrade_listen_fd;
+    int metrics_listen_fd;
+    int admin_listen_fd;
+    int relay_listen_fd;
+    int replication_listen_fd;
+    int inherited_ssh_fd;
+    int takeover_fd;
+    // Control connection of a handoff waiting for the successor's READY.
+    int handoff_fd;
+    uint64_t handoff_deadline;
+    int handed_off;
+    int wake_pipe[2];
+    // SIGUSR2 snapshots run on their own thread so accepting carries on.
+    pthread_t snapshot_thread;
+    int snapshot_started;
+    atomic_int snapshot_done;
 };
 
 struct client_args {
     session_manager_t *sessions;
     int fd;
     session_transport_t transport;
-    char peer[PEER_HOST_MAX + PEER_SERVICE_MAX + 2];
+    int brokered;
+    char peer[BROKER_PEER_MAX];
 };
 
 static server_context_t *g_server = NULL;
+static volatile sig_atomic_t g_stop_requests = 0;
+static volatile sig_atomic_t g_dump_requested = 0;
+static volatile sig_atomic_t g_reload_requested = 0;
+static volatile sig_atomic_t g_snapshot_requested = 0;
 
 static void handle_signal(int signum)
 {
-    (void)signum;
-    if (g_server == NULL) {
-        return;
+    if (signum == SIGUSR1) {
+        g_dump_requested = 1;
+    } else if (signum == SIGHUP) {
+        g_reload_requested = 1;
+    } else if (signum == SIGUSR2) {
+        g_snapshot_requested = 1;
+    } else {
+        g_stop_requests = g_stop_requests + 1;
     }
-    g_server->running = 0;
-    if (g_server->telnet_listen_fd >= 0) {
-        close(g_server->telnet_listen_fd);
-        g_server->telnet_listen_fd = -1;
+    if (g_server == NULL || g_server->wake_pipe[1] < 0) {
+        return;
     }
+    int saved_errno = errno;
+    ssize_t ignored = write(g_server->wake_pipe[1], "!", 1);
+    (void)ignored;
+    errno = saved_errno;
 }
 
 static void *client_thread(void *arg)
@@ -56,44 +120,40 @@ static void *client_thread(void *arg)
         return NULL;
     }
 
-    FILE *input = fdopen(client->fd, "r");
-    if (input == NULL) {
-        LOG_WARN(COMPONENT, "%s", "fdopen failed for client input");
+    if (client->brokered && broker_read_hello(client->fd, client->peer, sizeof(client->peer)) != 0) {
         close(client->fd);
         free(client);
         return NULL;
     }
 
-    int dup_fd = dup(client->fd);
-    if (dup_fd < 0) {
-        LOG_WARN(COMPONENT, "%s", "dup failed for client output");
-        fclose(input);
-        free(client);
-        return NULL;
-    }
+    session_manager_run_fd(client->sessions, client->transport, client->fd, client->peer);
+    free(client);
+    return NULL;
+}
 
-    FILE *output = fdopen(dup_fd, "w");
-    if (output == NULL) {
-        LOG_WARN(COMPONENT, "%s", "fdopen failed for client output");
-        fclose(input);
-        close(dup_fd);
-        free(client);
-        return NULL;
+static void configure_keepalive(int fd, const maum_config_t *config)
+{
+    int enable = config->tcp_keepalive ? 1 : 0;
+    if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable)) != 0) {
+        LOG_WARN(COMPONENT, "SO_KEEPALIVE failed: %s", strerror(errno));
+        return;
     }
-
-    setvbuf(input, NULL, _IONBF, 0);
-    setvbuf(output, NULL, _IONBF, 0);
-
-    if (client->transport == SESSION_TRANSPORT_TELNET) {
-        telnet_send_initial_negotiation(output);
+    if (!enable) {
+        return;
     }
 
-    session_manager_run(client->sessions, client->transport, input, output, client->peer);
-
-    fclose(output);
-    fclose(input);
-    free(client);
-    return NULL;
+    int idle = (int)config->tcp_keepalive_idle;
+    int interval = (int)config->tcp_keepalive_interval;
+    int count = (int)config->tcp_keepalive_count;
+    if (idle > 0) {
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    }
+    if (interval > 0) {
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    }
+    if (count > 0) {
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    }
 }
 
 static int open_listen_socket(const char *host, unsigned short port)
@@ -138,7 +198,7 @@ static int open_listen_socket(const char *host, unsigned short port)
     return listen_fd;
 }
 
-server_context_t *server_create(const maum_config_t *config)
+server_context_t *server_create(const maum_config_t *config, const char *config_path)
 {
     if (config == NULL) {
         return NULL;
@@ -150,7 +210,20 @@ server_context_t *server_create(const maum_config_t *config)
     }
 
     ctx->config = *config;
+    snprintf(ctx->config_path, sizeof(ctx->config_path), "%s", config_path != NULL ? config_path : "");
     ctx->telnet_listen_fd = -1;
+    ctx->broker_listen_fd = -1;
+    ctx->upgrade_listen_fd = -1;
+    ctx->metrics_listen_fd = -1;
+    ctx->admin_listen_fd = -1;
+    ctx->relay_listen_fd = -1;
+    ctx->replication_listen_fd = -1;
+    ctx->inherited_ssh_fd = -1;
+    ctx->takeover_fd = -1;
+    ctx->handoff_fd = -1;
+    ctx->wake_pipe[0] = -1;
+    ctx->wake_pipe[1] = -1;
+    atomic_init(&ctx->snapshot_done, 0);
     ctx->running = 1;
 
     ctx->sessions = session_manager_create(config);
@@ -162,103 +235,689 @@ server_context_t *server_create(const maum_config_t *config)
     return ctx;
 }
 
+static void stop_accepting(server_context_t *ctx)
+{
+    if (ctx->handoff_fd >= 0) {
+        close(ctx->handoff_fd);
+        ctx->handoff_fd = -1;
+    }
+    // Only the listener goes; SSH connections already accepted run on their
+    // own threads and are drained with the other sessions.
+    ssh_server_destroy(ctx->ssh);
+    ctx->ssh = NULL;
+    if (ctx->telnet_listen_fd >= 0) {
+        close(ctx->telnet_listen_fd);
+        ctx->telnet_listen_fd = -1;
+    }
+    if (ctx->metrics_listen_fd >= 0) {
+        close(ctx->metrics_listen_fd);
+        ctx->metrics_listen_fd = -1;
+    }
+    if (ctx->relay_listen_fd >= 0) {
+        close(ctx->relay_listen_fd);
+        ctx->relay_listen_fd = -1;
+    }
+    if (ctx->replication_listen_fd >= 0) {
+        close(ctx->replication_listen_fd);
+        ctx->replication_listen_fd = -1;
+    }
+
+    // After a handoff the socket paths belong to the successor.
+    if (ctx->handed_off) {
+        if (ctx->broker_listen_fd >= 0) {
+            close(ctx->broker_listen_fd);
+        }
+        if (ctx->upgrade_listen_fd >= 0) {
+            close(ctx->upgrade_listen_fd);
+        }
+        if (ctx->admin_listen_fd >= 0) {
+            close(ctx->admin_listen_fd);
+        }
+    } else {
+        broker_close(ctx->broker_listen_fd, ctx->config.broker_socket_path);
+        if (ctx->upgrade_listen_fd >= 0) {
+            close(ctx->upgrade_listen_fd);
+            unlink(ctx->config.upgrade_socket_path);
+        }
+        if (ctx->admin_listen_fd >= 0) {
+            close(ctx->admin_listen_fd);
+            unlink(ctx->config.admin_socket_path);
+        }
+    }
+    ctx->broker_listen_fd = -1;
+    ctx->upgrade_listen_fd = -1;
+    ctx->admin_listen_fd = -1;
+}
+
 void server_destroy(server_context_t *ctx)
 {
     if (ctx == NULL) {
         return;
     }
 
-    if (ctx->telnet_listen_fd >= 0) {
-        close(ctx->telnet_listen_fd);
+    stop_accepting(ctx);
+    if (ctx->takeover_fd >= 0) {
+        close(ctx->takeover_fd);
+    }
+    ssh_server_destroy(ctx->ssh);
+    for (int i = 0; i < 2; ++i) {
+        if (ctx->wake_pipe[i] >= 0) {
+            close(ctx->wake_pipe[i]);
+        }
+    }
+    if (g_server == ctx) {
+        g_server = NULL;
     }
 
-    session_manager_destroy(ctx->sessions);
+    // Session threads that ignored the drain deadline still reference the
+    // manager; leak it rather than free memory under them at exit.
+    if (session_manager_active_count(ctx->sessions) == 0) {
+        session_manager_destroy(ctx->sessions);
+    } else {
+        LOG_WARN(COMPONENT, "%s", "Sessions still running at shutdown; leaving session manager allocated");
+    }
     free(ctx);
 }
 
+int server_takeover(server_context_t *ctx)
+{
+    if (ctx == NULL) {
+        return -1;
+    }
+
+    handoff_listener_t listeners[HANDOFF_MAX_LISTENERS];
+    size_t count = 0;
+    int control_fd = handoff_request(ctx->config.upgrade_socket_path, listeners, HANDOFF_MAX_LISTENERS, &count);
+    if (control_fd < 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(listeners[i].name, "telnet") == 0) {
+            ctx->telnet_listen_fd = listeners[i].fd;
+        } else if (strcmp(listeners[i].name, "ssh") == 0) {
+            ctx->inherited_ssh_fd = listeners[i].fd;
+        } else if (strcmp(listeners[i].name, "broker") == 0) {
+            ctx->broker_listen_fd = listeners[i].fd;
+        } else if (strcmp(listeners[i].name, "metrics") == 0) {
+            ctx->metrics_listen_fd = listeners[i].fd;
+        } else if (strcmp(listeners[i].name, "relay") == 0) {
+            ctx->relay_listen_fd = listeners[i].fd;
+        } else if (strcmp(listeners[i].name, "replication") == 0) {
+            ctx->replication_listen_fd = listeners[i].fd;
+        } else {
+            close(listeners[i].fd);
+        }
+    }
+
+    ctx->takeover_fd = control_fd;
+    LOG_INFO(COMPONENT, "Took over %zu listener(s) from the running server", count);
+    return 0;
+}
+
+static int offer_listeners(server_context_t *ctx)
+{
+    handoff_listener_t listeners[HANDOFF_MAX_LISTENERS];
+    size_t count = 0;
+
+    if (ctx->telnet_listen_fd >= 0) {
+        snprintf(listeners[count].name, sizeof(listeners[count].name), "%s", "telnet");
+        listeners[count++].fd = ctx->telnet_listen_fd;
+    }
+    if (ctx->ssh != NULL) {
+        snprintf(listeners[count].name, sizeof(listeners[count].name), "%s", "ssh");
+        listeners[count++].fd = ssh_server_listen_fd(ctx->ssh);
+    }
+    if (ctx->broker_listen_fd >= 0) {
+        snprintf(listeners[count].name, sizeof(listeners[count].name), "%s", "broker");
+        listeners[count++].fd = ctx->broker_listen_fd;
+    }
+    if (ctx->metrics_listen_fd >= 0) {
+        snprintf(listeners[count].name, sizeof(listeners[count].name), "%s", "metrics");
+        listeners[count++].fd = ctx->metrics_listen_fd;
+    }
+    if (ctx->relay_listen_fd >= 0) {
+        snprintf(listeners[count].name, sizeof(listeners[count].name), "%s", "relay");
+        listeners[count++].fd = ctx->relay_listen_fd;
+    }
+    if (ctx->replication_listen_fd >= 0) {
+        snprintf(listeners[count].name, sizeof(listeners[count].name), "%s", "replication");
+        listeners[count++].fd = ctx->replication_listen_fd;
+    }
+
+    // The successor's READY arrives on the control connection, which the
+    // accept loop polls with the listeners it keeps serving meanwhile.
+    int control_fd = handoff_offer(ctx->upgrade_listen_fd, listeners, count);
+    if (control_fd < 0) {
+        return -1;
+    }
+    ctx->handoff_fd = control_fd;
+    ctx->handoff_deadline = metrics_now() + HANDOFF_READY_TIMEOUT_MS * 1000000ull;
+    LOG_INFO(COMPONENT, "%s", "Listeners passed to successor; waiting for it to confirm");
+    return 0;
+}
+
+static void finish_handoff(server_context_t *ctx)
+{
+    int control_fd = ctx->handoff_fd;
+    ctx->handoff_fd = -1;
+    if (handoff_ready(control_fd) != 0) {
+        return;
+    }
+    LOG_INFO(COMPONENT, "%s", "Listeners handed to successor; no longer accepting");
+    ctx->handed_off = 1;
+    ctx->running = 0;
+}
+
+static void drain_sessions(server_context_t *ctx)
+{
+    size_t active = session_manager_active_count(ctx->sessions);
+    if (active == 0) {
+        return;
+    }
+
+    unsigned int drain_timeout = config_current()->drain_timeout;
+    unsigned int timeout_ms = drain_timeout * 1000u;
+    LOG_INFO(COMPONENT, "Draining %zu session(s) for up to %u seconds", active, drain_timeout);
+
+    char notice[256];
+    if (ctx->handed_off) {
+        snprintf(notice, sizeof(notice),
+                 "[알림] 서버가 새 버전으로 교체되었습니다. %u초 안에 연결이 종료되며, 다시 접속하면 새 서버로 연결됩니다.",
+                 drain_timeout);
+    } else {
+        snprintf(notice, sizeof(notice), "[알림] 서버가 곧 종료됩니다. %u초 안에 연결이 끊어집니다.",
+                 drain_timeout);
+    }
+    session_manager_notify_all(ctx->sessions, notice);
+
+    // A further SIGINT/SIGTERM during the drain cuts it short.
+    sig_atomic_t stop_baseline = g_stop_requests;
+    unsigned int waited = 0;
+    while (active > 0 && waited < timeout_ms && g_stop_requests == stop_baseline) {
+        active = session_manager_wait_idle(ctx->sessions, DRAIN_POLL_MS);
+        waited += DRAIN_POLL_MS;
+    }
+
+    if (active > 0) {
+        LOG_WARN(COMPONENT, "Disconnecting %zu session(s) still connected", active);
+        session_manager_expire_all(ctx->sessions);
+        active = session_manager_wait_idle(ctx->sessions, DRAIN_GRACE_MS);
+    }
+    LOG_INFO(COMPONENT, "Drain finished with %zu session(s) remaining", active);
+}
+
+static void spawn_client(server_context_t *ctx,
+                         int client_fd,
+                         session_transport_t transport,
+                         int brokered,
+                         const char *host,
+                         const char *service)
+{
+    struct client_args *client = calloc(1, sizeof(*client));
+    if (client == NULL) {
+        LOG_WARN(COMPONENT, "%s", "Unable to allocate client args");
+        close(client_fd);
+        return;
+    }
+    client->sessions = ctx->sessions;
+    client->fd = client_fd;
+    client->transport = transport;
+    client->brokered = brokered;
+    if (host != NULL && service != NULL) {
+        snprintf(client->peer, sizeof(client->peer), "%s:%s", host, service);
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, client_thread, client) != 0) {
+        LOG_WARN(COMPONENT, "%s", "Failed to create client thread");
+        close(client_fd);
+        free(client);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static void accept_telnet_client(server_context_t *ctx, int listen_fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int client_fd = accept(listen_fd, (struct sockaddr *)&addr, &addrlen);
+    if (client_fd < 0) {
+        if (errno != EINTR && errno != EAGAIN && ctx->running) {
+            LOG_WARN(COMPONENT, "accept failed: %s", strerror(errno));
+        }
+        return;
+    }
+
+    configure_keepalive(client_fd, config_current());
+
+    char host[PEER_HOST_MAX];
+    char service[PEER_SERVICE_MAX];
+    if (getnameinfo((struct sockaddr *)&addr, addrlen, host, sizeof(host), service, sizeof(service),
+                    NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+        strncpy(host, "unknown", sizeof(host) - 1);
+        host[sizeof(host) - 1] = '\0';
+        strncpy(service, "0", sizeof(service) - 1);
+        service[sizeof(service) - 1] = '\0';
+    }
+
+    metrics_add(METRIC_ACCEPTS_TELNET, 1);
+    spawn_client(ctx, client_fd, SESSION_TRANSPORT_TELNET, 0, host, service);
+}
+
+static void accept_broker_client(server_context_t *ctx, int listen_fd)
+{
+    int client_fd = accept(listen_fd, NULL, NULL);
+    if (client_fd < 0) {
+        if (errno != EINTR && errno != EAGAIN && ctx->running) {
+            LOG_WARN(COMPONENT, "broker accept failed: %s", strerror(errno));
+        }
+        return;
+    }
+    metrics_add(METRIC_ACCEPTS_BROKER, 1);
+    spawn_client(ctx, client_fd, SESSION_TRANSPORT_STDIO, 1, NULL, NULL);
+}
+
+// Accepts a link from another instance; peer gets its numeric address.
+static int accept_instance(server_context_t *ctx, int listen_fd, const char *kind, char *peer, size_t size)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int peer_fd = accept(listen_fd, (struct sockaddr *)&addr, &addrlen);
+    if (peer_fd < 0) {
+        if (errno != EINTR && errno != EAGAIN && ctx->running) {
+            LOG_WARN(COMPONENT, "%s accept failed: %s", kind, strerror(errno));
+        }
+        return -1;
+    }
+    wire_configure(peer_fd);
+
+    char host[PEER_HOST_MAX];
+    char service[PEER_SERVICE_MAX];
+    if (getnameinfo((struct sockaddr *)&addr, addrlen, host, sizeof(host), service, sizeof(service),
+                    NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+        snprintf(peer, size, "%s:%s", host, service);
+    } else {
+        snprintf(peer, size, "%s", "unknown");
+    }
+    return peer_fd;
+}
+
+static void accept_relay_peer(server_context_t *ctx, int listen_fd)
+{
+    char peer[RELAY_PEER_MAX];
+    int peer_fd = accept_instance(ctx, listen_fd, "relay", peer, sizeof(peer));
+    if (peer_fd < 0) {
+        return;
+    }
+    relay_t *relay = session_manager_relay(ctx->sessions);
+    if (relay == NULL) {
+        close(peer_fd);
+        return;
+    }
+    relay_accept(relay, peer_fd, peer);
+}
+
+static void accept_follower(server_context_t *ctx, int listen_fd)
+{
+    char peer[RELAY_PEER_MAX];
+    int peer_fd = accept_instance(ctx, listen_fd, "replication", peer, sizeof(peer));
+    if (peer_fd < 0) {
+        return;
+    }
+    replica_t *replica = session_manager_replica(ctx->sessions);
+    if (replica == NULL) {
+        close(peer_fd);
+        return;
+    }
+    replica_accept(replica, peer_fd, peer);
+}
+
+static void *snapshot_thread(void *arg)
+{
+    server_context_t *ctx = arg;
+    char path[512];
+    if (session_manager_snapshot(ctx->sessions, path, sizeof(path)) == 1) {
+        LOG_WARN(COMPONENT, "%s", "Snapshot requested while one is already running");
+    }
+    atomic_store(&ctx->snapshot_done, 1);
+    return NULL;
+}
+
+static void start_snapshot(server_context_t *ctx)
+{
+    if (ctx->snapshot_started) {
+        if (!atomic_load(&ctx->snapshot_done)) {
+            LOG_WARN(COMPONENT, "%s", "Snapshot requested while one is already running");
+            return;
+        }
+        pthread_join(ctx->snapshot_thread, NULL);
+        ctx->snapshot_started = 0;
+    }
+    atomic_store(&ctx->snapshot_done, 0);
+    if (pthread_create(&ctx->snapshot_thread, NULL, snapshot_thread, ctx) != 0) {
+        LOG_ERROR(COMPONENT, "%s", "Unable to start snapshot thread");
+        return;
+    }
+    ctx->snapshot_started = 1;
+}
+
+static void *metrics_thread(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    metrics_serve(fd);
+    return NULL;
+}
+
+static void accept_metrics_client(server_context_t *ctx, int listen_fd)
+{
+    int client_fd = accept(listen_fd, NULL, NULL);
+    if (client_fd < 0) {
+        if (errno != EINTR && errno != EAGAIN && ctx->running) {
+            LOG_WARN(COMPONENT, "metrics accept failed: %s", strerror(errno));
+        }
+        return;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, metrics_thread, (void *)(intptr_t)client_fd) != 0) {
+        close(client_fd);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+struct admin_args {
+    session_manager_t *sessions;
+    int fd;
+};
+
+static void *admin_thread(void *arg)
+{
+    struct admin_args *args = arg;
+    admin_serve(args->fd, args->sessions);
+    free(args);
+    return NULL;
+}
+
+static void accept_admin_client(server_context_t *ctx, int listen_fd)
+{
+    int client_fd = accept(listen_fd, NULL, NULL);
+    if (client_fd < 0) {
+        if (errno != EINTR && errno != EAGAIN && ctx->running) {
+            LOG_WARN(COMPONENT, "admin accept failed: %s", strerror(errno));
+        }
+        return;
+    }
+
+    struct admin_args *args = malloc(sizeof(*args));
+    if (args == NULL) {
+        close(client_fd);
+        return;
+    }
+    args->sessions = ctx->sessions;
+    args->fd = client_fd;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, admin_thread, args) != 0) {
+        close(client_fd);
+        free(args);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static void reload_config(server_context_t *ctx)
+{
+    if (ctx->config_path[0] == '\0') {
+        return;
+    }
+    const maum_config_t *before = config_current();
+    if (config_reload(ctx->config_path) != 0) {
+        LOG_WARN(COMPONENT, "Reload of '%s' failed; configuration unchanged", ctx->config_path);
+        return;
+    }
+    const maum_config_t *after = config_current();
+    if (after->log_level != before->log_level) {
+        log_set_level(after->log_level);
+    }
+    lock_profile_set_enabled(after->lock_profiling);
+    LOG_INFO(COMPONENT, "Reloaded '%s' (config version %u)", ctx->config_path, config_version());
+}
+
+static void drain_wake_pipe(int fd)
+{
+    char buffer[64];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+static int open_wake_pipe(server_context_t *ctx)
+{
+    if (pipe(ctx->wake_pipe) != 0) {
+        LOG_ERROR(COMPONENT, "pipe failed: %s", strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < 2; ++i) {
+        int flags = fcntl(ctx->wake_pipe[i], F_GETFL);
+        fcntl(ctx->wake_pipe[i], F_SETFL, flags | O_NONBLOCK);
+    }
+    return 0;
+}
+
 int server_run(server_context_t *ctx)
 {
     if (ctx == NULL) {
         return -1;
     }
 
+    if (open_wake_pipe(ctx) != 0) {
+        return -1;
+    }
+
+    g_server = ctx;
+
     signal(SIGPIPE, SIG_IGN);
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = handle_signal;
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
-
-    g_server = ctx;
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
 
     LOG_INFO(COMPONENT, "Starting %s v%s", MAUM_APP_NAME, MAUM_APP_VERSION);
 
-    int listen_fd = open_listen_socket(ctx->config.telnet_host, ctx->config.telnet_port);
-    if (listen_fd < 0) {
-        LOG_ERROR(COMPONENT, "%s", "Unable to create TELNET listener");
-        return -1;
+    if (ctx->telnet_listen_fd < 0) {
+        ctx->telnet_listen_fd = open_listen_socket(ctx->config.telnet_host, ctx->config.telnet_port);
+        if (ctx->telnet_listen_fd < 0) {
+            LOG_ERROR(COMPONENT, "%s", "Unable to create TELNET listener");
+            return -1;
+        }
     }
 
-    ctx->telnet_listen_fd = listen_fd;
-
     LOG_INFO(COMPONENT, "TELNET listening on %s:%u", ctx->config.telnet_host, ctx->config.telnet_port);
 
-    if (ctx->config.enable_builtin_ssh) {
-#ifdef MAUM_HAVE_LIBSSH
-        LOG_INFO(COMPONENT, "%s", "Built-in SSH server support is enabled (not yet implemented in this build)");
-#else
-        LOG_WARN(COMPONENT, "%s", "Built-in SSH server requested but libssh is not available. Use --stdio mode with your SSH daemon.");
-#endif
+    if (ctx->config.enable_builtin_ssh || ctx->inherited_ssh_fd >= 0) {
+        ctx->ssh = ssh_server_create(&ctx->config, ctx->sessions, ctx->inherited_ssh_fd);
+    }
+
+    if (ctx->broker_listen_fd < 0 && ctx->config.broker_socket_path[0] != '\0') {
+        ctx->broker_listen_fd = broker_listen(ctx->config.broker_socket_path);
+    }
+    if (ctx->broker_listen_fd >= 0) {
+        LOG_INFO(COMPONENT, "Accepting --stdio sessions on %s", ctx->config.broker_socket_path);
+    }
+
+    if (ctx->metrics_listen_fd < 0 && ctx->config.metrics_port != 0) {
+        ctx->metrics_listen_fd = open_listen_socket(ctx->config.metrics_host, ctx->config.metrics_port);
+        if (ctx->metrics_listen_fd < 0) {
+            LOG_WARN(COMPONENT, "Unable to listen for metrics on %s:%u", ctx->config.metrics_host,
+                     ctx->config.metrics_port);
+        }
+    }
+    if (ctx->metrics_listen_fd >= 0) {
+        LOG_INFO(COMPONENT, "Metrics on http://%s:%u/metrics", ctx->config.metrics_host, ctx->config.metrics_port);
+    }
+
+    if (ctx->relay_listen_fd < 0 && ctx->config.relay_port != 0) {
+        ctx->relay_listen_fd = open_listen_socket(ctx->config.relay_host, ctx->config.relay_port);
+        if (ctx->relay_listen_fd < 0) {
+            LOG_WARN(COMPONENT, "Unable to listen for chat relay links on %s:%u", ctx->config.relay_host,
+                     ctx->config.relay_port);
+        }
+    }
+    if (ctx->relay_listen_fd >= 0 || ctx->config.relay_peer_count > 0) {
+        if (session_manager_start_relay(ctx->sessions, ctx->config.relay_peers, ctx->config.relay_peer_count) != 0) {
+            LOG_WARN(COMPONENT, "%s", "Unable to start the chat relay");
+        } else if (ctx->relay_listen_fd >= 0) {
+            LOG_INFO(COMPONENT, "Chat relay listening on %s:%u", ctx->config.relay_host, ctx->config.relay_port);
+        }
+    }
+
+    if (ctx->replication_listen_fd < 0 && ctx->config.replication_role == CONFIG_REPLICATION_LEADER) {
+        ctx->replication_listen_fd = open_listen_socket(ctx->config.replication_host, ctx->config.replication_port);
+        if (ctx->replication_listen_fd < 0) {
+            LOG_WARN(COMPONENT, "Unable to listen for followers on %s:%u", ctx->config.replication_host,
+                     ctx->config.replication_port);
+        }
+    }
+    if (session_manager_start_replication(ctx->sessions, &ctx->config) != 0) {
+        LOG_WARN(COMPONENT, "%s", "Unable to start board replication");
+    } else if (ctx->replication_listen_fd >= 0) {
+        LOG_INFO(COMPONENT, "Followers accepted on %s:%u", ctx->config.replication_host,
+                 ctx->config.replication_port);
+    }
+
+    if (ctx->config.upgrade_socket_path[0] != '\0') {
+        ctx->upgrade_listen_fd = unix_socket_listen(ctx->config.upgrade_socket_path, 0600, ctx->takeover_fd >= 0);
+    }
+    if (ctx->config.admin_socket_path[0] != '\0') {
+        ctx->admin_listen_fd = unix_socket_listen(ctx->config.admin_socket_path, 0600, ctx->takeover_fd >= 0);
+        if (ctx->admin_listen_fd >= 0) {
+            LOG_INFO(COMPONENT, "Admin socket on %s", ctx->config.admin_socket_path);
+        }
+    }
+
+    if (ctx->takeover_fd >= 0) {
+        handoff_confirm(ctx->takeover_fd);
+        ctx->takeover_fd = -1;
     }
 
     while (ctx->running) {
-        struct sockaddr_storage addr;
-        socklen_t addrlen = sizeof(addr);
-        int client_fd = accept(listen_fd, (struct sockaddr *)&addr, &addrlen);
-        if (client_fd < 0) {
-            if (!ctx->running) {
-                break;
-            }
-            if (errno == EINTR) {
-                continue;
+        int timeout_ms = -1;
+        if (ctx->handoff_fd >= 0) {
+            uint64_t now = metrics_now();
+            if (now >= ctx->handoff_deadline) {
+                LOG_WARN(COMPONENT, "%s", "Successor did not confirm in time; continuing to serve");
+                close(ctx->handoff_fd);
+                ctx->handoff_fd = -1;
+            } else {
+                timeout_ms = (int)((ctx->handoff_deadline - now + 999999u) / 1000000u);
             }
-            LOG_WARN(COMPONENT, "accept failed: %s", strerror(errno));
-            continue;
         }
 
-        char host[PEER_HOST_MAX];
-        char service[PEER_SERVICE_MAX];
-        if (getnameinfo((struct sockaddr *)&addr, addrlen, host, sizeof(host), service, sizeof(service),
-                        NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
-            strncpy(host, "unknown", sizeof(host) - 1);
-            host[sizeof(host) - 1] = '\0';
-            strncpy(service, "0", sizeof(service) - 1);
-            service[sizeof(service) - 1] = '\0';
+        struct pollfd fds[LISTENER_COUNT];
+        int kinds[LISTENER_COUNT];
+        nfds_t nfds = 0;
+        int candidates[LISTENER_COUNT] = {
+            [LISTENER_WAKE] = ctx->wake_pipe[0],
+            [LISTENER_TELNET] = ctx->telnet_listen_fd,
+            [LISTENER_SSH] = ssh_server_listen_fd(ctx->ssh),
+            [LISTENER_BROKER] = ctx->broker_listen_fd,
+            // One takeover at a time.
+            [LISTENER_UPGRADE] = ctx->handoff_fd >= 0 ? -1 : ctx->upgrade_listen_fd,
+            [LISTENER_METRICS] = ctx->metrics_listen_fd,
+            [LISTENER_ADMIN] = ctx->admin_listen_fd,
+            [LISTENER_RELAY] = ctx->relay_listen_fd,
+            [LISTENER_REPLICATION] = ctx->replication_listen_fd,
+            [LISTENER_HANDOFF] = ctx->handoff_fd,
+        };
+        for (int kind = 0; kind < LISTENER_COUNT; ++kind) {
+            if (candidates[kind] < 0) {
+                continue;
+            }
+            fds[nfds].fd = candidates[kind];
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            kinds[nfds] = kind;
+            nfds++;
         }
 
-        struct client_args *client = calloc(1, sizeof(*client));
-        if (client == NULL) {
-            LOG_WARN(COMPONENT, "%s", "Unable to allocate client args");
-            close(client_fd);
+        if (poll(fds, nfds, timeout_ms) < 0) {
+            if (errno != EINTR) {
+                LOG_WARN(COMPONENT, "poll failed: %s", strerror(errno));
+            }
             continue;
         }
-        client->sessions = ctx->sessions;
-        client->fd = client_fd;
-        client->transport = SESSION_TRANSPORT_TELNET;
-        snprintf(client->peer, sizeof(client->peer), "%s:%s", host, service);
 
-        pthread_t thread;
-        if (pthread_create(&thread, NULL, client_thread, client) != 0) {
-            LOG_WARN(COMPONENT, "%s", "Failed to create client thread");
-            close(client_fd);
-            free(client);
-            continue;
+        for (nfds_t i = 0; i < nfds && ctx->running; ++i) {
+            // A successor that exits before confirming shows up as a hangup.
+            short ready = kinds[i] == LISTENER_HANDOFF ? POLLIN | POLLHUP | POLLERR : POLLIN;
+            if (!(fds[i].revents & ready)) {
+                continue;
+            }
+            switch (kinds[i]) {
+            case LISTENER_WAKE:
+                drain_wake_pipe(fds[i].fd);
+                if (g_reload_requested) {
+                    g_reload_requested = 0;
+                    reload_config(ctx);
+                }
+                if (g_dump_requested) {
+                    g_dump_requested = 0;
+                    lock_profile_dump();
+                }
+                if (g_snapshot_requested) {
+                    g_snapshot_requested = 0;
+                    start_snapshot(ctx);
+                }
+                if (g_stop_requests > 0) {
+                    LOG_INFO(COMPONENT, "%s", "Shutdown requested");
+                    ctx->running = 0;
+                }
+                break;
+            case LISTENER_TELNET:
+                accept_telnet_client(ctx, fds[i].fd);
+                break;
+            case LISTENER_SSH:
+                ssh_server_accept(ctx->ssh);
+                break;
+            case LISTENER_BROKER:
+                accept_broker_client(ctx, fds[i].fd);
+                break;
+            case LISTENER_METRICS:
+                accept_metrics_client(ctx, fds[i].fd);
+                break;
+            case LISTENER_ADMIN:
+                accept_admin_client(ctx, fds[i].fd);
+                break;
+            case LISTENER_RELAY:
+                accept_relay_peer(ctx, fds[i].fd);
+                break;
+            case LISTENER_REPLICATION:
+                accept_follower(ctx, fds[i].fd);
+                break;
+            case LISTENER_UPGRADE:
+                offer_listeners(ctx);
+                break;
+            case LISTENER_HANDOFF:
+                finish_handoff(ctx);
+                break;
+            default:
+                break;
+            }
         }
-        pthread_detach(thread);
     }
 
-    close(listen_fd);
-    ctx->telnet_listen_fd = -1;
+    stop_accepting(ctx);
+    drain_sessions(ctx);
+    if (ctx->snapshot_started) {
+        pthread_join(ctx->snapshot_thread, NULL);
+        ctx->snapshot_started = 0;
+    }
     LOG_INFO(COMPONENT, "%s", "Server shutdown");
     return 0;
 }
@@ -1,21 +1,86 @@
 #include "session.h"
 
+#include "board_directory.h"
+#include "charset.h"
+#include "cursor.h"
+#include "hub.h"
+#include "library.h"
+#include "lock_profile.h"
 #include "log.h"
+#include "mailbox.h"
+#include "menu.h"
+#include "metrics.h"
+#include "relay.h"
+#include "replica.h"
+#include "screen.h"
+#include "snapshot.h"
 #include "telnet.h"
+#include "timer.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 #define COMPONENT "session"
 #define USERNAME_MAX BOARD_AUTHOR_MAX
+#define PASSWORD_MAX 128
+#define TIMER_TICK_MS 1000
+#define CHAT_LINE_MAX (BOARD_CONTENT_MAX + 128)
+#define MAIN_MENU_PROMPT "메뉴 선택 (1-9): "
+
+#define WELCOME_LINE "마음 (Maum) BBS에 오신 것을 환영합니다!"
+// ASCII, so it is readable whichever charset the terminal uses.
+#define CHARSET_HINT "(CP949/EUC-KR terminal? Type /cp949 at the nickname prompt. /utf8 switches back.)"
+// Bounds how long a drain notice may wait on one client that stopped reading.
+#define NOTIFY_SEND_TIMEOUT_MS 2000
+#define SCREEN_DIVIDER "────────────────────────────────────"
+
+static const char *const main_menu_lines[] = {
+    "",
+    "┌──────────────────────────────┐",
+    "│ 1) 실시간 채팅 참여          │",
+    "│ 2) 게시물 목록 보기          │",
+    "│ 3) 새 게시물 등록            │",
+    "│ 4) 내 게시물 삭제            │",
+    "│ 5) 쪽지함                    │",
+    "│ 6) 자료실                    │",
+    "│ 7) 새 글 보기                │",
+    "│ 8) 게시판 선택               │",
+    "│ 9) 종료                      │",
+    "└──────────────────────────────┘",
+};
+
+typedef enum {
+    SESSION_EXPIRE_NONE = 0,
+    SESSION_EXPIRE_IDLE,
+    SESSION_EXPIRE_SHUTDOWN,
+    SESSION_EXPIRE_KICKED
+} session_expire_reason_t;
+
+typedef enum {
+    SESSION_PHASE_LOGIN = 0,
+    SESSION_PHASE_MENU,
+    SESSION_PHASE_CHAT
+} session_phase_t;
 
 struct chat_client {
-    FILE *out;
+    // Broadcasts are written already encoded, bypassing the session's
+    // converting stream.
+    FILE *raw;
+    const atomic_int *charset;
     session_transport_t transport;
     char username[USERNAME_MAX];
     char peer[64];
@@ -23,12 +88,86 @@ struct chat_client {
 };
 
 struct session_manager {
-    board_t *board;
-    pthread_mutex_t lock;
+    board_directory_t *boards;
+    mailbox_store_t *mail;
+    library_t *library;
+    cursor_store_t *cursors;
+    hub_t *hub;
+    // Links the chat room to other instances; NULL unless the server started it.
+    relay_t *relay;
+    // Board replication; NULL unless the server started it.
+    replica_t *replica;
+    profiled_mutex_t lock;
     struct chat_client *chat_clients;
-    char motd_path[256];
+    motd_cache_t *motd;
+    screen_t *menu_screen;
+    timer_wheel_t *timers;
+    struct session *sessions;
+    size_t active_sessions;
+    unsigned int next_session_id;
+    pthread_cond_t idle_cond;
+};
+
+struct session {
+    session_manager_t *manager;
+    session_transport_t transport;
+    FILE *in;
+    // out is raw_out, the connection, until the terminal uses another
+    // charset; then it is converted, which encodes into raw_out. Changed by
+    // the session thread under manager->lock.
+    FILE *out;
+    FILE *raw_out;
+    FILE *converted;
+    charset_stream_t out_stream;
+    int fd;
+    pthread_t thread;
+    const char *peer;
+    char username[USERNAME_MAX];
+    // Index of the board the board menu items act on.
+    size_t board;
+    // Attached at login for a registered nickname, but only opened once the
+    // mailbox password has been given in this session.
+    mailbox_t *mailbox;
+    int mailbox_unlocked;
+    // Subscribed while logged in. The handler runs on the hub's thread; it
+    // only records the latest post under notice_lock and writes a byte to
+    // wake_pipe, and the session thread draws it.
+    hub_subscription_t post_events;
+    pthread_mutex_t notice_lock;
+    hub_event_t notice;
+    unsigned int notices;
+    // Socket sessions only; otherwise -1 and notices wait for the next menu.
+    int wake_pipe[2];
+    // Set while read_line waits for a main menu choice.
+    int at_menu_prompt;
+    char notice_line[BOARD_TITLE_MAX + BOARD_AUTHOR_MAX + HUB_SUMMARY_MAX + 48];
+    telnet_terminal_t terminal;
+    menu_context_t menu;
+    // Written by the session thread under manager->lock so the admin socket
+    // can read it; username is stable once the phase has left LOGIN.
+    session_phase_t phase;
+    unsigned int id;
+    time_t connected_at;
+    atomic_llong last_input;
+    atomic_uint_fast64_t bytes_in;
+    atomic_uint_fast64_t bytes_out;
+    timer_entry_t idle_timer;
+    atomic_int expired;
+    int expiry_notified;
+    // Other threads writing to out; unregistering waits for them, since the
+    // session and its streams go away after that. Under manager->lock.
+    unsigned int holds;
+    struct session *prev;
+    struct session *next;
 };
 
+static time_t monotonic_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
 static void trim_line(char *line)
 {
     size_t len = strlen(line);
@@ -70,47 +209,212 @@ static void send_line(FILE *out, const char *fmt, ...)
     fflush(out);
 }
 
-static int read_line(session_transport_t transport, FILE *in, FILE *out, char *buffer, size_t size)
+// Read from the published configuration on every prompt, so reloads and
+// admin changes apply from the next read.
+static unsigned int phase_timeout(const struct session *session)
 {
-    int result = 0;
-    if (transport == SESSION_TRANSPORT_TELNET) {
-        result = telnet_read_line(in, out, buffer, size);
-    } else {
-        if (fgets(buffer, (int)size, in) == NULL) {
-            return -1;
-        }
+    const maum_config_t *config = config_current();
+    switch (session->phase) {
+    case SESSION_PHASE_LOGIN:
+        return config->login_timeout;
+    case SESSION_PHASE_CHAT:
+        return config->chat_idle_timeout;
+    case SESSION_PHASE_MENU:
+    default:
+        return config->idle_timeout;
     }
+}
 
-    if (result != 0) {
-        return -1;
+static void session_timeout_signal(int signum)
+{
+    (void)signum;
+}
+
+static void session_interrupt(struct session *session, session_expire_reason_t reason)
+{
+    int expected = SESSION_EXPIRE_NONE;
+    atomic_compare_exchange_strong(&session->expired, &expected, (int)reason);
+    // shutdown() wakes a reader blocked on a socket; pipes and ttys (stdio
+    // mode) need the blocking read interrupted with a signal instead.
+    if (session->fd >= 0 && shutdown(session->fd, SHUT_RD) == 0) {
+        return;
     }
+    pthread_kill(session->thread, SIGALRM);
+}
 
-    trim_line(buffer);
-    return 0;
+static void session_expire(void *arg)
+{
+    session_interrupt(arg, SESSION_EXPIRE_IDLE);
 }
 
-static void send_motd(session_manager_t *manager, FILE *out)
+// Line-mode input arrives in the terminal's charset; the rest of the server
+// works in UTF-8. Whatever no longer fits is cut at a character boundary.
+static void decode_line(struct session *session, char *buffer, size_t size)
 {
-    if (manager == NULL || out == NULL) {
+    charset_t charset = (charset_t)atomic_load_explicit(&session->terminal.charset, memory_order_relaxed);
+    size_t length = strlen(buffer);
+    if (charset == CHARSET_UTF8 || length == 0) {
         return;
     }
+    char *decoded = malloc(CHARSET_DECODE_MAX(length));
+    if (decoded == NULL) {
+        return;
+    }
+    length = charset_decode(charset, buffer, length, decoded, NULL);
+    if (length >= size) {
+        length = size - 1;
+        while (length > 0 && ((unsigned char)decoded[length] & 0xc0) == 0x80) {
+            length--;
+        }
+    }
+    memcpy(buffer, decoded, length);
+    buffer[length] = '\0';
+    free(decoded);
+}
+
+// Runs on the hub thread with the hub's subscriber lock held, so it only
+// records the post and wakes the session; it never writes to the client.
+static void session_post_published(const hub_event_t *event, void *context)
+{
+    struct session *session = context;
+    if (strcmp(event->author, session->username) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&session->notice_lock);
+    session->notice = *event;
+    session->notices++;
+    pthread_mutex_unlock(&session->notice_lock);
+    if (session->wake_pipe[1] >= 0) {
+        ssize_t ignored = write(session->wake_pipe[1], "!", 1);
+        (void)ignored;
+    }
+}
+
+// Formats the posts recorded since the last prompt into status; returns 0 if
+// there were none.
+static int session_take_notice(struct session *session, char *status, size_t size)
+{
+    pthread_mutex_lock(&session->notice_lock);
+    hub_event_t event = session->notice;
+    unsigned int notices = session->notices;
+    session->notices = 0;
+    pthread_mutex_unlock(&session->notice_lock);
+    if (notices == 0) {
+        return 0;
+    }
+
+    board_directory_t *boards = session->manager->boards;
+    int index = board_directory_count(boards) > 1 ? board_directory_find(boards, event.board) : -1;
+    int length;
+    if (index >= 0) {
+        length = snprintf(status, size, "[새 글] %s #%u %s: %s", board_directory_spec(boards, (size_t)index)->title,
+                          event.id, event.author, event.summary);
+    } else {
+        length = snprintf(status, size, "[새 글] #%u %s: %s", event.id, event.author, event.summary);
+    }
+    if (notices > 1 && length > 0 && (size_t)length < size) {
+        snprintf(status + length, size - (size_t)length, " 외 %u개", notices - 1);
+    }
+    return 1;
+}
 
-    FILE *file = fopen(manager->motd_path, "r");
-    if (file == NULL) {
+// Draws a notice that arrived while waiting at the main menu prompt; the
+// cursor ends up back on the prompt.
+static void session_show_notice(struct session *session)
+{
+    if (!session_take_notice(session, session->notice_line, sizeof(session->notice_line))) {
         return;
     }
+    if (session->menu.screen != NULL) {
+        session->menu.status = session->notice_line;
+        menu_present(&session->menu, session->out);
+    } else {
+        send_text(session->out, "\r\n%s\r\n%s", session->notice_line, MAIN_MENU_PROMPT);
+    }
+}
 
-    char line[256];
-    while (fgets(line, sizeof(line), file) != NULL) {
-        trim_line(line);
-        if (line[0] == '\0') {
-            send_line(out, "");
+// Blocks until the client sends something, drawing notices as the hub
+// handler wakes it. A line half typed when one arrives is left alone; its
+// notice waits for the next prompt.
+static void wait_for_input(struct session *session)
+{
+    struct pollfd fds[2] = {
+        {.fd = session->fd, .events = POLLIN},
+        {.fd = session->wake_pipe[0], .events = POLLIN},
+    };
+    session_show_notice(session);
+    while (!atomic_load(&session->expired)) {
+        int ready = poll(fds, 2, -1);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready < 0 || fds[0].revents != 0) {
+            return;
+        }
+        if (fds[1].revents != 0) {
+            char drained[64];
+            while (read(session->wake_pipe[0], drained, sizeof(drained)) > 0) {
+            }
+            session_show_notice(session);
+        }
+    }
+}
+
+static int read_line(struct session *session, char *buffer, size_t size)
+{
+    if (atomic_load(&session->expired)) {
+        return -1;
+    }
+
+    unsigned int timeout = phase_timeout(session);
+    if (timeout > 0) {
+        timer_arm(session->manager->timers, &session->idle_timer, timeout * 1000u);
+    } else {
+        timer_cancel(session->manager->timers, &session->idle_timer);
+    }
+
+    if (session->at_menu_prompt && session->wake_pipe[0] >= 0) {
+        wait_for_input(session);
+    }
+
+    int result = 0;
+    // Built-in SSH channels carry raw pty keystrokes, so they share the
+    // telnet line editor for server-side echo.
+    if (session->transport == SESSION_TRANSPORT_TELNET || session->transport == SESSION_TRANSPORT_SSH) {
+        result = telnet_read_line(session->in, session->out, &session->terminal, buffer, size);
+    } else {
+        if (fgets(buffer, (int)size, session->in) == NULL) {
+            result = -1;
         } else {
-            send_line(out, "%s", line);
+            decode_line(session, buffer, size);
+        }
+    }
+
+    int reason = atomic_load(&session->expired);
+    if (reason != SESSION_EXPIRE_NONE) {
+        if (!session->expiry_notified) {
+            session->expiry_notified = 1;
+            send_line(session->out, "");
+            if (reason == SESSION_EXPIRE_SHUTDOWN) {
+                send_line(session->out, "서버가 종료되어 연결을 끊습니다.");
+            } else if (reason == SESSION_EXPIRE_KICKED) {
+                send_line(session->out, "관리자에 의해 연결이 종료되었습니다.");
+            } else {
+                send_line(session->out, "입력이 없어 연결 시간이 초과되었습니다.");
+                LOG_INFO(COMPONENT, "Session %s (%s) timed out", session->peer != NULL ? session->peer : "-",
+                         session->username[0] != '\0' ? session->username : "-");
+            }
         }
+        return -1;
+    }
+
+    if (result != 0) {
+        return -1;
     }
 
-    fclose(file);
+    atomic_store_explicit(&session->last_input, (long long)monotonic_seconds(), memory_order_relaxed);
+    trim_line(buffer);
+    return 0;
 }
 
 static const char *transport_label(session_transport_t transport)
@@ -138,20 +442,65 @@ session_manager_t *session_manager_create(const maum_config_t *config)
         return NULL;
     }
 
-    manager->board = board_create(config->board_path);
-    if (manager->board == NULL) {
+    if (profiled_mutex_init(&manager->lock, "session_manager") != 0) {
+        free(manager);
+        return NULL;
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int cond_rc = pthread_cond_init(&manager->idle_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (cond_rc != 0) {
+        profiled_mutex_destroy(&manager->lock);
+        free(manager);
+        return NULL;
+    }
+
+    manager->timers = timer_wheel_create(TIMER_TICK_MS);
+    if (manager->timers == NULL) {
+        pthread_cond_destroy(&manager->idle_cond);
+        profiled_mutex_destroy(&manager->lock);
         free(manager);
         return NULL;
     }
 
-    if (pthread_mutex_init(&manager->lock, NULL) != 0) {
-        board_destroy(manager->board);
+    // Without CP949 tables sessions still work, in UTF-8 only.
+    charset_init();
+    manager->motd = motd_cache_create(config->motd_path, SCREEN_DIVIDER, SCREEN_DIVIDER);
+    manager->menu_screen = screen_build(main_menu_lines, sizeof(main_menu_lines) / sizeof(main_menu_lines[0]),
+                                        MAIN_MENU_PROMPT);
+    manager->mail = mailbox_store_create(config->mailbox_dir);
+    manager->library = library_create(config->library_dir);
+    manager->cursors = cursor_store_open(config->cursor_path);
+    manager->hub = hub_create();
+    board_spec_t boards[CONFIG_MAX_BOARDS + 1];
+    manager->boards = board_directory_create(boards, config_boards(config, boards), manager->hub);
+    if (manager->motd == NULL || manager->menu_screen == NULL || manager->mail == NULL || manager->library == NULL ||
+        manager->cursors == NULL || manager->hub == NULL || manager->boards == NULL) {
+        board_directory_destroy(manager->boards);
+        hub_destroy(manager->hub);
+        cursor_store_close(manager->cursors);
+        library_destroy(manager->library);
+        mailbox_store_destroy(manager->mail);
+        motd_cache_destroy(manager->motd);
+        screen_release(manager->menu_screen);
+        timer_wheel_destroy(manager->timers);
+        pthread_cond_destroy(&manager->idle_cond);
+        profiled_mutex_destroy(&manager->lock);
         free(manager);
         return NULL;
     }
+    if (config_current() == NULL) {
+        config_publish(config);
+    }
 
-    strncpy(manager->motd_path, config->motd_path, sizeof(manager->motd_path) - 1);
-    manager->motd_path[sizeof(manager->motd_path) - 1] = '\0';
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = session_timeout_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, NULL);
 
     return manager;
 }
@@ -162,8 +511,21 @@ void session_manager_destroy(session_manager_t *manager)
         return;
     }
 
-    board_destroy(manager->board);
-    pthread_mutex_destroy(&manager->lock);
+    // Stops relay deliveries into the chat room before it is freed.
+    relay_destroy(manager->relay);
+    // Uses the boards and the hub.
+    replica_destroy(manager->replica);
+    timer_wheel_destroy(manager->timers);
+    // Boards go first: they publish to the hub.
+    board_directory_destroy(manager->boards);
+    hub_destroy(manager->hub);
+    motd_cache_destroy(manager->motd);
+    screen_release(manager->menu_screen);
+    mailbox_store_destroy(manager->mail);
+    library_destroy(manager->library);
+    cursor_store_close(manager->cursors);
+    pthread_cond_destroy(&manager->idle_cond);
+    profiled_mutex_destroy(&manager->lock);
 
     struct chat_client *client = manager->chat_clients;
     while (client != NULL) {
@@ -175,27 +537,73 @@ void session_manager_destroy(session_manager_t *manager)
     free(manager);
 }
 
-static void chat_broadcast(session_manager_t *manager, const char *message)
+static void session_set_phase(struct session *session, session_phase_t phase)
+{
+    profiled_mutex_lock(&session->manager->lock);
+    session->phase = phase;
+    profiled_mutex_unlock(&session->manager->lock);
+}
+
+// Writes message to every member in this process.
+static void chat_deliver(session_manager_t *manager, const char *message)
 {
     if (manager == NULL || message == NULL) {
         return;
     }
 
-    if (pthread_mutex_lock(&manager->lock) != 0) {
+    if (profiled_mutex_lock(&manager->lock) != 0) {
         return;
     }
 
+    // Each charset's bytes are produced on first use and shared by every
+    // member using it.
+    char line[CHAT_LINE_MAX + 2];
+    size_t length = strnlen(message, CHAT_LINE_MAX);
+    memcpy(line, message, length);
+    memcpy(line + length, "\r\n", 2);
+    length += 2;
+    char encoded[CHARSET_COUNT][CHARSET_ENCODE_MAX(sizeof(line))];
+    size_t encoded_length[CHARSET_COUNT] = {0};
+
+    uint64_t started = metrics_now();
+    uint64_t deliveries = 0;
     struct chat_client *client = manager->chat_clients;
     while (client != NULL) {
-        send_line(client->out, "%s", message);
+        int charset = atomic_load_explicit(client->charset, memory_order_relaxed);
+        if (charset == CHARSET_UTF8) {
+            fwrite(line, 1, length, client->raw);
+        } else {
+            if (encoded_length[charset] == 0) {
+                encoded_length[charset] = charset_encode((charset_t)charset, line, length, encoded[charset], NULL);
+            }
+            fwrite(encoded[charset], 1, encoded_length[charset], client->raw);
+        }
+        fflush(client->raw);
         client = client->next;
+        deliveries++;
     }
 
-    pthread_mutex_unlock(&manager->lock);
+    profiled_mutex_unlock(&manager->lock);
+
+    metrics_observe(METRIC_CHAT_BROADCAST, metrics_now() - started);
+    metrics_add(METRIC_CHAT_MESSAGES, 1);
+    metrics_add(METRIC_CHAT_DELIVERIES, deliveries);
+}
+
+static void chat_broadcast(session_manager_t *manager, const char *message)
+{
+    chat_deliver(manager, message);
+    relay_publish(manager->relay, message);
+}
+
+static void relay_deliver(const char *message, void *context)
+{
+    chat_deliver(context, message);
 }
 
 static struct chat_client *chat_join(session_manager_t *manager,
-                                     FILE *out,
+                                     FILE *raw,
+                                     const atomic_int *charset,
                                      const char *username,
                                      session_transport_t transport,
                                      const char *peer)
@@ -205,7 +613,8 @@ static struct chat_client *chat_join(session_manager_t *manager,
         return NULL;
     }
 
-    client->out = out;
+    client->raw = raw;
+    client->charset = charset;
     client->transport = transport;
     strncpy(client->username, username, sizeof(client->username) - 1);
     client->username[sizeof(client->username) - 1] = '\0';
@@ -214,7 +623,7 @@ static struct chat_client *chat_join(session_manager_t *manager,
         client->peer[sizeof(client->peer) - 1] = '\0';
     }
 
-    if (pthread_mutex_lock(&manager->lock) != 0) {
+    if (profiled_mutex_lock(&manager->lock) != 0) {
         free(client);
         return NULL;
     }
@@ -222,7 +631,8 @@ static struct chat_client *chat_join(session_manager_t *manager,
     client->next = manager->chat_clients;
     manager->chat_clients = client;
 
-    pthread_mutex_unlock(&manager->lock);
+    profiled_mutex_unlock(&manager->lock);
+    metrics_gauge_add(METRIC_CHAT_MEMBERS, 1);
 
     char notice[256];
     snprintf(notice, sizeof(notice), "[알림] %s (%s) 님이 입장했습니다.",
@@ -238,7 +648,7 @@ static void chat_leave(session_manager_t *manager, struct chat_client *client)
         return;
     }
 
-    if (pthread_mutex_lock(&manager->lock) != 0) {
+    if (profiled_mutex_lock(&manager->lock) != 0) {
         free(client);
         return;
     }
@@ -247,12 +657,13 @@ static void chat_leave(session_manager_t *manager, struct chat_client *client)
     while (*cursor != NULL) {
         if (*cursor == client) {
             *cursor = client->next;
+            metrics_gauge_add(METRIC_CHAT_MEMBERS, -1);
             break;
         }
         cursor = &(*cursor)->next;
     }
 
-    pthread_mutex_unlock(&manager->lock);
+    profiled_mutex_unlock(&manager->lock);
 
     char notice[256];
     snprintf(notice, sizeof(notice), "[알림] %s 님이 퇴장했습니다.", client->username);
@@ -261,25 +672,24 @@ static void chat_leave(session_manager_t *manager, struct chat_client *client)
     free(client);
 }
 
-static void handle_chat(session_manager_t *manager,
-                        FILE *in,
-                        FILE *out,
-                        const char *username,
-                        session_transport_t transport,
-                        const char *peer)
+static void handle_chat(struct session *session)
 {
-    struct chat_client *client = chat_join(manager, out, username, transport, peer);
+    session_manager_t *manager = session->manager;
+    FILE *out = session->out;
+    struct chat_client *client = chat_join(manager, session->raw_out, &session->terminal.charset, session->username,
+                                           session->transport, session->peer);
     if (client == NULL) {
         send_line(out, "채팅방에 입장할 수 없습니다. 잠시 후 다시 시도해주세요.");
         return;
     }
 
     send_line(out, "채팅방에 입장했습니다. '/exit' 입력 시 나갑니다.");
+    session_set_phase(session, SESSION_PHASE_CHAT);
 
     char buffer[BOARD_CONTENT_MAX];
     while (1) {
         send_text(out, "> ");
-        if (read_line(transport, in, out, buffer, sizeof(buffer)) != 0) {
+        if (read_line(session, buffer, sizeof(buffer)) != 0) {
             break;
         }
         if (strcmp(buffer, "/exit") == 0) {
@@ -294,20 +704,58 @@ static void handle_chat(session_manager_t *manager,
             }
         }
 
-        char message[BOARD_CONTENT_MAX + 128];
-        snprintf(message, sizeof(message), "[%s][%s] %s", transport_label(transport), username, buffer);
+        char message[CHAT_LINE_MAX];
+        snprintf(message, sizeof(message), "[%s][%s] %s", transport_label(session->transport),
+                 session->username, buffer);
         chat_broadcast(manager, message);
     }
 
+    session_set_phase(session, SESSION_PHASE_MENU);
     chat_leave(manager, client);
     send_line(out, "채팅방을 떠났습니다.");
 }
 
-static void handle_board_list(session_manager_t *manager, FILE *out)
+static void show_posts(FILE *out, const board_post_t *posts, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        send_line(out, "[%u] %s — %s", posts[i].id, posts[i].author, posts[i].timestamp);
+        send_line(out, "    %s", posts[i].content);
+    }
+}
+
+// The selected board, opened on first use; NULL if it cannot be opened, which
+// the board calls report as a failure.
+static board_t *session_board(struct session *session)
+{
+    return board_directory_open(session->manager->boards, session->board);
+}
+
+static const char *session_board_name(struct session *session)
+{
+    return board_directory_spec(session->manager->boards, session->board)->name;
+}
+
+// Whatever was shown counts as read.
+static void advance_cursor(struct session *session, const board_post_t *posts, size_t count)
+{
+    unsigned int last_seen = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (posts[i].id > last_seen) {
+            last_seen = posts[i].id;
+        }
+    }
+    if (last_seen > 0 &&
+        cursor_advance(session->manager->cursors, session_board_name(session), session->username, last_seen) != 0) {
+        LOG_WARN(COMPONENT, "Could not record read cursor for %s", session->username);
+    }
+}
+
+static void handle_board_list(struct session *session)
 {
+    FILE *out = session->out;
     board_post_t *posts = NULL;
     size_t count = 0;
-    if (board_list(manager->board, &posts, &count) != 0) {
+    if (board_list(session_board(session), &posts, &count) != 0) {
         send_line(out, "게시판을 불러오지 못했습니다.");
         return;
     }
@@ -319,11 +767,31 @@ static void handle_board_list(session_manager_t *manager, FILE *out)
     }
 
     send_line(out, "총 %zu개의 게시물이 있습니다:", count);
-    for (size_t i = 0; i < count; ++i) {
-        send_line(out, "[%u] %s — %s", posts[i].id, posts[i].author, posts[i].timestamp);
-        send_line(out, "    %s", posts[i].content);
+    show_posts(out, posts, count);
+    advance_cursor(session, posts, count);
+    free(posts);
+}
+
+static void handle_board_unread(struct session *session)
+{
+    FILE *out = session->out;
+    unsigned int last_seen = cursor_get(session->manager->cursors, session_board_name(session), session->username);
+    board_post_t *posts = NULL;
+    size_t count = 0;
+    if (board_list_since(session_board(session), last_seen, &posts, &count) != 0) {
+        send_line(out, "게시판을 불러오지 못했습니다.");
+        return;
+    }
+
+    if (count == 0) {
+        send_line(out, "지난번 이후 새 게시물이 없습니다.");
+        free(posts);
+        return;
     }
 
+    send_line(out, "새 게시물 %zu개:", count);
+    show_posts(out, posts, count);
+    advance_cursor(session, posts, count);
     free(posts);
 }
 
@@ -336,15 +804,12 @@ static void sanitize_content(char *content)
     }
 }
 
-static void handle_board_add(session_manager_t *manager,
-                             session_transport_t transport,
-                             FILE *in,
-                             FILE *out,
-                             const char *username)
+static void handle_board_add(struct session *session)
 {
+    FILE *out = session->out;
     send_text(out, "게시물 내용을 입력하세요 (한 줄): ");
     char buffer[BOARD_CONTENT_MAX];
-    if (read_line(transport, in, out, buffer, sizeof(buffer)) != 0) {
+    if (read_line(session, buffer, sizeof(buffer)) != 0) {
         send_line(out, "입력을 받지 못했습니다.");
         return;
     }
@@ -355,7 +820,7 @@ static void handle_board_add(session_manager_t *manager,
     }
 
     board_post_t post;
-    if (board_add(manager->board, username, buffer, &post) != 0) {
+    if (board_add(session_board(session), session->username, buffer, &post) != 0) {
         send_line(out, "게시물을 저장하는데 실패했습니다.");
         return;
     }
@@ -363,15 +828,12 @@ static void handle_board_add(session_manager_t *manager,
     send_line(out, "[#%u] 등록 완료 (%s)", post.id, post.timestamp);
 }
 
-static void handle_board_delete(session_manager_t *manager,
-                                session_transport_t transport,
-                                FILE *in,
-                                FILE *out,
-                                const char *username)
+static void handle_board_delete(struct session *session)
 {
+    FILE *out = session->out;
     send_text(out, "삭제할 게시물 번호: ");
     char buffer[32];
-    if (read_line(transport, in, out, buffer, sizeof(buffer)) != 0) {
+    if (read_line(session, buffer, sizeof(buffer)) != 0) {
         send_line(out, "입력을 받지 못했습니다.");
         return;
     }
@@ -382,7 +844,7 @@ static void handle_board_delete(session_manager_t *manager,
     }
 
     int not_owner = 0;
-    int result = board_remove(manager->board, (unsigned int)id, username, &not_owner);
+    int result = board_remove(session_board(session), (unsigned int)id, session->username, &not_owner);
     if (result == 0) {
         send_line(out, "게시물이 삭제되었습니다.");
     } else if (result == 1) {
@@ -394,20 +856,362 @@ static void handle_board_delete(session_manager_t *manager,
     }
 }
 
-static int prompt_username(session_transport_t transport,
-                           FILE *in,
-                           FILE *out,
-                           char *username,
-                           size_t size)
+// Lists the boards with what is known about the open ones, without opening
+// the rest, then switches to the one chosen.
+static void handle_board_select(struct session *session)
+{
+    FILE *out = session->out;
+    board_directory_t *boards = session->manager->boards;
+    size_t count = board_directory_count(boards);
+    send_line(out, "게시판 목록:");
+    for (size_t i = 0; i < count; ++i) {
+        const board_spec_t *spec = board_directory_spec(boards, i);
+        board_t *board = board_directory_peek(boards, i);
+        char detail[64] = "";
+        if (board != NULL) {
+            unsigned int last_seen = cursor_get(session->manager->cursors, spec->name, session->username);
+            snprintf(detail, sizeof(detail), " — 글 %zu개, 새 글 %zu개", board_count_since(board, 0),
+                     board_count_since(board, last_seen));
+        }
+        send_line(out, "%s%zu) %s (%s)%s", i == session->board ? "*" : " ", i + 1, spec->title, spec->name, detail);
+    }
+
+    send_text(out, "이동할 게시판 번호 또는 이름 (Enter: 취소): ");
+    char buffer[BOARD_NAME_MAX];
+    if (read_line(session, buffer, sizeof(buffer)) != 0) {
+        send_line(out, "입력을 받지 못했습니다.");
+        return;
+    }
+    if (buffer[0] == '\0') {
+        return;
+    }
+    char *end = NULL;
+    unsigned long number = strtoul(buffer, &end, 10);
+    int index = board_directory_find(boards, buffer);
+    if (*end == '\0' && number >= 1 && number <= count) {
+        index = (int)(number - 1);
+    }
+    if (index < 0) {
+        send_line(out, "그런 게시판이 없습니다.");
+        return;
+    }
+    if (board_directory_open(boards, (size_t)index) == NULL) {
+        send_line(out, "게시판을 열지 못했습니다.");
+        return;
+    }
+    session->board = (size_t)index;
+    send_line(out, "%s(으)로 이동했습니다.", board_directory_spec(boards, (size_t)index)->title);
+}
+
+static void show_inbox(FILE *out, const mail_message_t *messages, size_t count)
+{
+    if (count == 0) {
+        send_line(out, "받은 쪽지가 없습니다.");
+        return;
+    }
+    send_line(out, "받은 쪽지 %zu통:", count);
+    for (size_t i = 0; i < count; ++i) {
+        send_line(out, "[%zu]%s %s — %s", i + 1, messages[i].read ? "" : " (새)", messages[i].from,
+                  messages[i].timestamp);
+        send_line(out, "    %s", messages[i].text);
+    }
+}
+
+static void handle_mail_send(struct session *session)
+{
+    FILE *out = session->out;
+    char recipient[USERNAME_MAX];
+    send_text(out, "받는 사람 닉네임: ");
+    if (read_line(session, recipient, sizeof(recipient)) != 0) {
+        send_line(out, "입력을 받지 못했습니다.");
+        return;
+    }
+    sanitize_content(recipient);
+    if (recipient[0] == '\0') {
+        send_line(out, "닉네임이 비어 있습니다.");
+        return;
+    }
+
+    char buffer[BOARD_CONTENT_MAX];
+    send_text(out, "쪽지 내용을 입력하세요 (한 줄): ");
+    if (read_line(session, buffer, sizeof(buffer)) != 0) {
+        send_line(out, "입력을 받지 못했습니다.");
+        return;
+    }
+    sanitize_content(buffer);
+    if (buffer[0] == '\0') {
+        send_line(out, "내용이 비어 있습니다.");
+        return;
+    }
+
+    int rc = mailbox_send(session->manager->mail, session->username, recipient, buffer);
+    if (rc == 1) {
+        send_line(out, "%s님은 쪽지함을 만들지 않았습니다.", recipient);
+        return;
+    }
+    if (rc != 0) {
+        send_line(out, "쪽지를 보내지 못했습니다.");
+        return;
+    }
+    send_line(out, "%s님에게 쪽지를 보냈습니다.", recipient);
+}
+
+static void handle_mail_delete(struct session *session, const mail_message_t *messages, size_t count)
+{
+    FILE *out = session->out;
+    send_text(out, "삭제할 쪽지 번호: ");
+    char buffer[32];
+    if (read_line(session, buffer, sizeof(buffer)) != 0) {
+        send_line(out, "입력을 받지 못했습니다.");
+        return;
+    }
+    unsigned long index = strtoul(buffer, NULL, 10);
+    if (index == 0 || index > count) {
+        send_line(out, "올바른 번호를 입력하세요.");
+        return;
+    }
+    if (mailbox_remove(session->mailbox, messages[index - 1].id) != 0) {
+        send_line(out, "해당 번호의 쪽지가 없습니다.");
+        return;
+    }
+    send_line(out, "쪽지를 삭제했습니다.");
+}
+
+static int read_password(struct session *session, const char *prompt, char *buffer, size_t size)
+{
+    send_text(session->out, "%s", prompt);
+    session->terminal.masked = 1;
+    int rc = read_line(session, buffer, size);
+    session->terminal.masked = 0;
+    return rc;
+}
+
+// Nicknames are not authenticated, so the mailbox asks for its own password:
+// the first use registers one, later sessions must give it.
+static int unlock_mailbox(struct session *session)
+{
+    FILE *out = session->out;
+    mailbox_store_t *store = session->manager->mail;
+    char password[PASSWORD_MAX];
+    int registered = mailbox_registered(store, session->username);
+    if (registered < 0) {
+        send_line(out, "쪽지함을 열 수 없습니다.");
+        return -1;
+    }
+
+    if (!registered) {
+        send_line(out, "쪽지함을 처음 사용합니다. 쪽지함 비밀번호를 정해 주세요.");
+        char confirm[PASSWORD_MAX];
+        if (read_password(session, "비밀번호: ", password, sizeof(password)) != 0 ||
+            read_password(session, "비밀번호 확인: ", confirm, sizeof(confirm)) != 0) {
+            send_line(out, "입력을 받지 못했습니다.");
+            return -1;
+        }
+        if (password[0] == '\0') {
+            send_line(out, "비밀번호가 비어 있습니다.");
+            return -1;
+        }
+        if (strcmp(password, confirm) != 0) {
+            send_line(out, "비밀번호가 일치하지 않습니다.");
+            return -1;
+        }
+        int rc = mailbox_register(store, session->username, password);
+        if (rc == 1) {
+            send_line(out, "방금 다른 사용자가 이 닉네임으로 쪽지함을 만들었습니다.");
+            return -1;
+        }
+        if (rc != 0) {
+            send_line(out, "쪽지함을 만들지 못했습니다.");
+            return -1;
+        }
+    } else {
+        if (read_password(session, "쪽지함 비밀번호: ", password, sizeof(password)) != 0) {
+            send_line(out, "입력을 받지 못했습니다.");
+            return -1;
+        }
+        if (mailbox_verify(store, session->username, password) != 0) {
+            LOG_INFO(COMPONENT, "Wrong mailbox password for %s from %s", session->username,
+                     session->peer != NULL ? session->peer : "-");
+            send_line(out, "비밀번호가 맞지 않습니다.");
+            return -1;
+        }
+    }
+
+    if (session->mailbox == NULL) {
+        session->mailbox = mailbox_attach(store, session->username);
+    }
+    if (session->mailbox == NULL) {
+        send_line(out, "쪽지함을 열 수 없습니다.");
+        return -1;
+    }
+    session->mailbox_unlocked = 1;
+    return 0;
+}
+
+static void handle_mail(struct session *session)
+{
+    FILE *out = session->out;
+    if (!session->mailbox_unlocked && unlock_mailbox(session) != 0) {
+        return;
+    }
+
+    while (!atomic_load(&session->expired)) {
+        mail_message_t *messages = NULL;
+        size_t count = 0;
+        if (mailbox_read_all(session->mailbox, &messages, &count) != 0) {
+            send_line(out, "쪽지함을 불러오지 못했습니다.");
+            return;
+        }
+        show_inbox(out, messages, count);
+
+        char choice[16];
+        send_text(out, "1) 쪽지 보내기  2) 쪽지 삭제  3) 돌아가기: ");
+        int running = read_line(session, choice, sizeof(choice)) == 0;
+        if (running && strcmp(choice, "1") == 0) {
+            handle_mail_send(session);
+        } else if (running && strcmp(choice, "2") == 0) {
+            handle_mail_delete(session, messages, count);
+        } else {
+            running = 0;
+        }
+        free(messages);
+        if (!running) {
+            break;
+        }
+    }
+}
+
+static void handle_library_download(struct session *session, const library_entry_t *entry)
+{
+    session_manager_t *manager = session->manager;
+    FILE *out = session->out;
+    const maum_config_t *config = config_current();
+    if (library_download_begin(manager->library, config->library_max_downloads) != 0) {
+        send_line(out, "내려받는 사용자가 많습니다. 잠시 후 다시 시도해주세요.");
+        return;
+    }
+
+    // stdio sessions have no socket to sendfile() into; fd is their input.
+    library_transfer_t transfer = {
+        .fd = session->transport == SESSION_TRANSPORT_STDIO ? -1 : session->fd,
+        .out = session->raw_out,
+        .telnet = session->transport == SESSION_TRANSPORT_TELNET,
+        .rate_kbps = config->library_rate_kbps,
+        .stall_timeout = config->idle_timeout,
+        .cancel = &session->expired,
+    };
+    send_line(out, "%s 전송을 시작합니다 (%lld 바이트).", entry->name, (long long)entry->size);
+    // The transfer can outlast idle_timeout; it has its own stall timeout.
+    timer_cancel(manager->timers, &session->idle_timer);
+
+    uint64_t sent = 0;
+    int rc = library_send(manager->library, entry, &transfer, &sent);
+    library_download_end(manager->library);
+
+    // sendfile() bypasses the counting stream.
+    if (transfer.fd >= 0) {
+        atomic_fetch_add_explicit(&session->bytes_out, sent, memory_order_relaxed);
+        if (transfer.telnet) {
+            metrics_add(METRIC_TELNET_BYTES_OUT, sent);
+        }
+    }
+    LOG_INFO(COMPONENT, "%s downloaded %s: %llu bytes%s", session->username, entry->name, (unsigned long long)sent,
+             rc == 0 ? "" : " (aborted)");
+    if (atomic_load(&session->expired)) {
+        return;
+    }
+    send_line(out, "");
+    if (rc != 0) {
+        send_line(out, "전송이 중단되었습니다.");
+        return;
+    }
+    send_line(out, "전송을 마쳤습니다.");
+}
+
+static void handle_library(struct session *session)
+{
+    session_manager_t *manager = session->manager;
+    FILE *out = session->out;
+    library_index_t *index = library_acquire(manager->library);
+    if (index == NULL) {
+        send_line(out, "자료실 목록을 불러오지 못했습니다.");
+        return;
+    }
+
+    screen_send(library_index_screen(index), out);
+    size_t count = library_index_count(index);
+    char buffer[32];
+    if (count == 0 || read_line(session, buffer, sizeof(buffer)) != 0 || buffer[0] == '\0') {
+        library_index_release(index);
+        return;
+    }
+    unsigned long choice = strtoul(buffer, NULL, 10);
+    if (choice == 0 || choice > count) {
+        send_line(out, "올바른 번호를 입력하세요.");
+    } else {
+        handle_library_download(session, library_index_entry(index, choice - 1));
+    }
+    library_index_release(index);
+}
+
+static int session_set_charset(struct session *session, charset_t charset)
 {
+    if (charset != CHARSET_UTF8 && session->converted == NULL) {
+        session->converted = charset_fopen(&session->out_stream, session->raw_out, &session->terminal.charset);
+        if (session->converted == NULL) {
+            LOG_WARN(COMPONENT, "%s", "Unable to open a charset stream");
+            return -1;
+        }
+    }
+    profiled_mutex_lock(&session->manager->lock);
+    atomic_store_explicit(&session->terminal.charset, (int)charset, memory_order_relaxed);
+    session->out = charset == CHARSET_UTF8 ? session->raw_out : session->converted;
+    profiled_mutex_unlock(&session->manager->lock);
+    LOG_DEBUG(COMPONENT, "Session %u uses %s", session->id, charset_name(charset));
+    return 0;
+}
+
+// "/cp949" and the like switch the terminal's charset. Otherwise a nickname
+// that is not UTF-8 but is valid CP949 came from a CP949 terminal: switch and
+// decode it.
+static int session_choose_charset(struct session *session, char *line, size_t size)
+{
+    charset_t charset;
+    if (line[0] == '/' && charset_parse(line + 1, &charset) == 0) {
+        if (!charset_available(charset) || session_set_charset(session, charset) != 0) {
+            send_line(session->out, "이 서버에서는 %s 를 사용할 수 없습니다.", charset_name(charset));
+            return 1;
+        }
+        send_line(session->out, "문자 집합을 %s 로 바꿨습니다.", charset_name(charset));
+        return 1;
+    }
+
+    size_t length = strlen(line);
+    if (atomic_load_explicit(&session->terminal.charset, memory_order_relaxed) == CHARSET_UTF8 &&
+        !charset_valid(CHARSET_UTF8, line, length) && charset_available(CHARSET_CP949) &&
+        charset_valid(CHARSET_CP949, line, length) && session_set_charset(session, CHARSET_CP949) == 0) {
+        decode_line(session, line, size);
+    }
+    return 0;
+}
+
+static int prompt_username(struct session *session)
+{
+    char *username = session->username;
+    size_t size = sizeof(session->username);
     for (int attempts = 0; attempts < 3; ++attempts) {
-        send_text(out, "사용할 닉네임을 입력하세요: ");
-        if (read_line(transport, in, out, username, size) != 0) {
+        send_text(session->out, "사용할 닉네임을 입력하세요: ");
+        if (read_line(session, username, size) != 0) {
+            username[0] = '\0';
             return -1;
         }
+        if (session_choose_charset(session, username, size)) {
+            attempts--;
+            continue;
+        }
         sanitize_content(username);
         if (username[0] == '\0') {
-            send_line(out, "닉네임은 비워둘 수 없습니다.");
+            send_line(session->out, "닉네임은 비워둘 수 없습니다.");
             continue;
         }
         if (strlen(username) >= size) {
@@ -415,69 +1219,556 @@ static int prompt_username(session_transport_t transport,
         }
         return 0;
     }
+    username[0] = '\0';
     return -1;
 }
 
-void session_manager_run(session_manager_t *manager,
-                         session_transport_t transport,
-                         FILE *input,
-                         FILE *output,
-                         const char *peer_identity)
+static int session_register(session_manager_t *manager, struct session *session)
 {
-    if (manager == NULL || input == NULL || output == NULL) {
+    profiled_mutex_lock(&manager->lock);
+    unsigned int max_sessions = config_current()->max_sessions;
+    if (max_sessions > 0 && manager->active_sessions >= max_sessions) {
+        profiled_mutex_unlock(&manager->lock);
+        return -1;
+    }
+    session->id = ++manager->next_session_id;
+    session->prev = NULL;
+    session->next = manager->sessions;
+    if (manager->sessions != NULL) {
+        manager->sessions->prev = session;
+    }
+    manager->sessions = session;
+    manager->active_sessions++;
+    profiled_mutex_unlock(&manager->lock);
+    metrics_gauge_add(METRIC_SESSIONS_ACTIVE, 1);
+    return 0;
+}
+
+static void session_unregister(session_manager_t *manager, struct session *session)
+{
+    profiled_mutex_lock(&manager->lock);
+    if (session->prev != NULL) {
+        session->prev->next = session->next;
+    } else {
+        manager->sessions = session->next;
+    }
+    if (session->next != NULL) {
+        session->next->prev = session->prev;
+    }
+    manager->active_sessions--;
+    if (manager->active_sessions == 0) {
+        pthread_cond_broadcast(&manager->idle_cond);
+    }
+    while (session->holds > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += 1;
+        profiled_cond_timedwait(&manager->idle_cond, &manager->lock, &deadline);
+    }
+    profiled_mutex_unlock(&manager->lock);
+    metrics_gauge_add(METRIC_SESSIONS_ACTIVE, -1);
+}
+
+// Telnet clients that report a large enough window get the full-screen menu,
+// redrawn by difference; everyone else the line-mode one.
+static int session_fullscreen(struct session *session)
+{
+    menu_context_t *menu = &session->menu;
+    unsigned int width = session->terminal.width;
+    unsigned int height = session->terminal.height;
+    if (session->transport != SESSION_TRANSPORT_TELNET || width < MENU_MIN_WIDTH || height < MENU_MIN_HEIGHT) {
+        menu_release(menu);
+        return 0;
+    }
+    if (vscreen_width(menu->screen) != width || vscreen_height(menu->screen) != height) {
+        if (menu_resize(menu, width, height) != 0) {
+            menu_release(menu);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Output from a menu action scrolls the full-screen menu away; let it be read
+// before the menu is repainted.
+static void session_pause(struct session *session)
+{
+    if (session->menu.screen == NULL || atomic_load(&session->expired)) {
         return;
     }
+    char buffer[16];
+    send_text(session->out, "[Enter] 메뉴로 돌아가기 ");
+    read_line(session, buffer, sizeof(buffer));
+    vscreen_invalidate(session->menu.screen);
+}
 
-    setvbuf(output, NULL, _IONBF, 0);
+static void run_session(struct session *session)
+{
+    session_manager_t *manager = session->manager;
+    FILE *output = session->out;
 
-    send_line(output, "마음 (Maum) BBS에 오신 것을 환영합니다!");
-    if (peer_identity != NULL) {
-        send_line(output, "접속: %s [%s]", peer_identity, transport_label(transport));
+    if (session->peer != NULL) {
+        send_text(output, "%s\r\n접속: %s [%s]\r\n", WELCOME_LINE, session->peer,
+                  transport_label(session->transport));
     } else {
-        send_line(output, "접속: %s", transport_label(transport));
+        send_text(output, "%s\r\n접속: %s\r\n", WELCOME_LINE, transport_label(session->transport));
     }
-    send_line(output, "────────────────────────────────────");
-    send_motd(manager, output);
-    send_line(output, "────────────────────────────────────");
-
-    char username[USERNAME_MAX];
-    if (prompt_username(transport, input, output, username, sizeof(username)) != 0) {
-        send_line(output, "닉네임 설정에 실패했습니다. 연결을 종료합니다.");
+    send_line(output, "%s", CHARSET_HINT);
+    screen_t *motd = motd_cache_acquire(manager->motd);
+    screen_send(motd, output);
+    screen_release(motd);
+
+    if (prompt_username(session) != 0) {
+        if (!atomic_load(&session->expired)) {
+            send_line(session->out, "닉네임 설정에 실패했습니다. 연결을 종료합니다.");
+        }
         return;
     }
+    // The nickname prompt may have switched the charset.
+    output = session->out;
 
-    send_line(output, "환영합니다, %s님!", username);
+    send_line(output, "환영합니다, %s님!", session->username);
+    session_set_phase(session, SESSION_PHASE_MENU);
+    session->mailbox = mailbox_attach(manager->mail, session->username);
 
+    menu_context_t *menu = &session->menu;
+    menu_init(menu);
     char choice[16];
+    char status[BOARD_TITLE_MAX + BOARD_AUTHOR_MAX + HUB_SUMMARY_MAX + 48] = "";
+    size_t unseen = board_count_since(session_board(session),
+                                      cursor_get(manager->cursors, session_board_name(session), session->username));
+    if (unseen > 0) {
+        snprintf(status, sizeof(status), "[게시판] 지난번 이후 새 글이 %zu개 있습니다. (7번 메뉴)", unseen);
+    }
+    // New posts by others are announced at the menu instead of users
+    // re-listing the board to look for them.
+    hub_subscribe(manager->hub, HUB_TOPIC_BOARD_POST, &session->post_events);
     int running = 1;
-    while (running) {
-        send_line(output, "");
-        send_line(output, "┌──────────────────────────────┐");
-        send_line(output, "│ 1) 실시간 채팅 참여          │");
-        send_line(output, "│ 2) 게시물 목록 보기          │");
-        send_line(output, "│ 3) 새 게시물 등록            │");
-        send_line(output, "│ 4) 내 게시물 삭제            │");
-        send_line(output, "│ 5) 종료                      │");
-        send_line(output, "└──────────────────────────────┘");
-        send_text(output, "메뉴 선택 (1-5): ");
-        if (read_line(transport, input, output, choice, sizeof(choice)) != 0) {
+    unsigned int unread_shown = 0;
+    while (running && !atomic_load(&session->expired)) {
+        if (status[0] == '\0') {
+            session_take_notice(session, status, sizeof(status));
+        }
+        unsigned int unread = mailbox_unread(session->mailbox);
+        if (unread > unread_shown) {
+            snprintf(status, sizeof(status), "[쪽지] 읽지 않은 쪽지가 %u통 있습니다. (5번 메뉴)", unread);
+        }
+        unread_shown = unread;
+        // With one board there is nothing to choose, so it is not named.
+        const char *board_title = board_directory_count(manager->boards) > 1
+                                      ? board_directory_spec(manager->boards, session->board)->title
+                                      : NULL;
+        if (session_fullscreen(session)) {
+            menu->status = status[0] != '\0' ? status : NULL;
+            menu->board = board_title;
+            menu_present(menu, output);
+        } else {
+            if (status[0] != '\0') {
+                send_line(output, "%s", status);
+            }
+            if (board_title != NULL) {
+                send_line(output, "[현재 게시판: %s]", board_title);
+            }
+            screen_send(manager->menu_screen, output);
+        }
+        status[0] = '\0';
+        session->at_menu_prompt = 1;
+        int rc = read_line(session, choice, sizeof(choice));
+        session->at_menu_prompt = 0;
+        if (rc != 0) {
             break;
         }
+        menu_input_done(menu);
 
+        unsigned long item = strtoul(choice, NULL, 10);
+        if (strcasecmp(choice, "q") == 0) {
+            item = MENU_ITEM_COUNT;
+        }
+        if (item >= 1 && item <= MENU_ITEM_COUNT) {
+            menu->active_index = (unsigned int)(item - 1);
+        }
         if (strcmp(choice, "1") == 0) {
-            handle_chat(manager, input, output, username, transport, peer_identity);
+            handle_chat(session);
+            vscreen_invalidate(menu->screen);
         } else if (strcmp(choice, "2") == 0) {
-            handle_board_list(manager, output);
+            handle_board_list(session);
+            session_pause(session);
         } else if (strcmp(choice, "3") == 0) {
-            handle_board_add(manager, transport, input, output, username);
+            handle_board_add(session);
+            session_pause(session);
         } else if (strcmp(choice, "4") == 0) {
-            handle_board_delete(manager, transport, input, output, username);
-        } else if (strcmp(choice, "5") == 0 || strcasecmp(choice, "q") == 0) {
+            handle_board_delete(session);
+            session_pause(session);
+        } else if (strcmp(choice, "5") == 0) {
+            handle_mail(session);
+            session_pause(session);
+        } else if (strcmp(choice, "6") == 0) {
+            handle_library(session);
+            session_pause(session);
+        } else if (strcmp(choice, "7") == 0) {
+            handle_board_unread(session);
+            session_pause(session);
+        } else if (strcmp(choice, "8") == 0) {
+            handle_board_select(session);
+            session_pause(session);
+        } else if (strcmp(choice, "9") == 0 || strcasecmp(choice, "q") == 0) {
             running = 0;
         } else {
-            send_line(output, "알 수 없는 선택입니다.");
+            snprintf(status, sizeof(status), "%s", "알 수 없는 선택입니다.");
+        }
+    }
+    hub_unsubscribe(manager->hub, &session->post_events);
+    menu_release(menu);
+
+    mailbox_detach(session->mailbox);
+    session->mailbox = NULL;
+    send_line(output, "안녕히 가세요, %s님!", session->username);
+}
+
+static void session_prepare(struct session *session,
+                            session_manager_t *manager,
+                            session_transport_t transport,
+                            int fd,
+                            const char *peer_identity)
+{
+    memset(session, 0, sizeof(*session));
+    session->manager = manager;
+    session->transport = transport;
+    session->fd = fd;
+    session->thread = pthread_self();
+    session->peer = peer_identity;
+    session->phase = SESSION_PHASE_LOGIN;
+    session->connected_at = monotonic_seconds();
+    atomic_init(&session->last_input, (long long)session->connected_at);
+    atomic_init(&session->bytes_in, 0);
+    atomic_init(&session->bytes_out, 0);
+    atomic_init(&session->expired, SESSION_EXPIRE_NONE);
+    atomic_init(&session->terminal.charset, CHARSET_UTF8);
+    timer_init(&session->idle_timer, session_expire, session);
+    hub_subscription_init(&session->post_events, session_post_published, session);
+}
+
+static void run_streams(struct session *session, FILE *input, FILE *output)
+{
+    session_manager_t *manager = session->manager;
+    setvbuf(output, NULL, _IONBF, 0);
+    session->in = input;
+    session->out = output;
+    session->raw_out = output;
+    charset_t charset = config_current()->default_charset;
+    if (charset != CHARSET_UTF8) {
+        session_set_charset(session, charset);
+    }
+
+    pthread_mutex_init(&session->notice_lock, NULL);
+    // Stdio input may sit in a stdio buffer that poll() cannot see.
+    if (session->transport != SESSION_TRANSPORT_STDIO && session->fd >= 0 && pipe(session->wake_pipe) == 0) {
+        for (int i = 0; i < 2; ++i) {
+            int flags = fcntl(session->wake_pipe[i], F_GETFL);
+            fcntl(session->wake_pipe[i], F_SETFL, flags | O_NONBLOCK);
+        }
+    } else {
+        session->wake_pipe[0] = -1;
+        session->wake_pipe[1] = -1;
+    }
+    if (session_register(manager, session) != 0) {
+        send_line(session->out, "접속자가 많아 연결할 수 없습니다. 잠시 후 다시 시도해주세요.");
+        LOG_WARN(COMPONENT, "Rejected %s: max_sessions reached", session->peer != NULL ? session->peer : "-");
+    } else {
+        run_session(session);
+        timer_cancel(manager->timers, &session->idle_timer);
+        session_unregister(manager, session);
+    }
+    pthread_mutex_destroy(&session->notice_lock);
+    if (session->wake_pipe[0] >= 0) {
+        close(session->wake_pipe[0]);
+        close(session->wake_pipe[1]);
+    }
+    if (session->converted != NULL) {
+        fclose(session->converted);
+    }
+}
+
+void session_manager_run(session_manager_t *manager,
+                         session_transport_t transport,
+                         FILE *input,
+                         FILE *output,
+                         const char *peer_identity)
+{
+    if (manager == NULL || input == NULL || output == NULL) {
+        return;
+    }
+    struct session session;
+    session_prepare(&session, manager, transport, fileno(input), peer_identity);
+    run_streams(&session, input, output);
+}
+
+size_t session_manager_active_count(session_manager_t *manager)
+{
+    if (manager == NULL) {
+        return 0;
+    }
+    profiled_mutex_lock(&manager->lock);
+    size_t count = manager->active_sessions;
+    profiled_mutex_unlock(&manager->lock);
+    return count;
+}
+
+size_t session_manager_wait_idle(session_manager_t *manager, unsigned int timeout_ms)
+{
+    if (manager == NULL) {
+        return 0;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    profiled_mutex_lock(&manager->lock);
+    while (manager->active_sessions > 0) {
+        if (profiled_cond_timedwait(&manager->idle_cond, &manager->lock, &deadline) != 0) {
+            break;
         }
     }
+    size_t count = manager->active_sessions;
+    profiled_mutex_unlock(&manager->lock);
+    return count;
+}
+
+void session_manager_notify_all(session_manager_t *manager, const char *message)
+{
+    if (manager == NULL || message == NULL) {
+        return;
+    }
 
-    send_line(output, "안녕히 가세요, %s님!", username);
+    // Held sessions stay registered, so the writes can happen unlocked; a
+    // client that stopped reading then only delays its own notice.
+    profiled_mutex_lock(&manager->lock);
+    size_t count = 0;
+    size_t capacity = manager->active_sessions;
+    struct session **held = capacity > 0 ? malloc(capacity * sizeof(*held)) : NULL;
+    FILE **outputs = capacity > 0 ? malloc(capacity * sizeof(*outputs)) : NULL;
+    for (struct session *session = manager->sessions; held != NULL && outputs != NULL && session != NULL;
+         session = session->next) {
+        session->holds++;
+        held[count] = session;
+        outputs[count++] = session->out;
+    }
+    profiled_mutex_unlock(&manager->lock);
+
+    struct timeval timeout = {.tv_sec = NOTIFY_SEND_TIMEOUT_MS / 1000,
+                              .tv_usec = (NOTIFY_SEND_TIMEOUT_MS % 1000) * 1000};
+    for (size_t i = 0; i < count; ++i) {
+        // Not a socket for --stdio sessions; those are pipes to a local process.
+        setsockopt(held[i]->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        send_line(outputs[i], "");
+        send_line(outputs[i], "%s", message);
+    }
+
+    profiled_mutex_lock(&manager->lock);
+    for (size_t i = 0; i < count; ++i) {
+        held[i]->holds--;
+    }
+    pthread_cond_broadcast(&manager->idle_cond);
+    profiled_mutex_unlock(&manager->lock);
+    free(held);
+    free(outputs);
+}
+
+void session_manager_expire_all(session_manager_t *manager)
+{
+    if (manager == NULL) {
+        return;
+    }
+
+    profiled_mutex_lock(&manager->lock);
+    for (struct session *session = manager->sessions; session != NULL; session = session->next) {
+        session_interrupt(session, SESSION_EXPIRE_SHUTDOWN);
+    }
+    profiled_mutex_unlock(&manager->lock);
+}
+
+static const char *phase_label(session_phase_t phase)
+{
+    switch (phase) {
+    case SESSION_PHASE_LOGIN:
+        return "login";
+    case SESSION_PHASE_CHAT:
+        return "chat";
+    case SESSION_PHASE_MENU:
+    default:
+        return "menu";
+    }
+}
+
+int session_manager_list(session_manager_t *manager, session_info_t **sessions, size_t *count)
+{
+    if (manager == NULL || sessions == NULL || count == NULL) {
+        return -1;
+    }
+
+    *sessions = NULL;
+    *count = 0;
+    time_t now = monotonic_seconds();
+
+    profiled_mutex_lock(&manager->lock);
+    size_t total = manager->active_sessions;
+    session_info_t *items = total > 0 ? calloc(total, sizeof(*items)) : NULL;
+    if (total > 0 && items == NULL) {
+        profiled_mutex_unlock(&manager->lock);
+        return -1;
+    }
+
+    size_t index = 0;
+    for (struct session *session = manager->sessions; session != NULL && index < total;
+         session = session->next, ++index) {
+        session_info_t *info = &items[index];
+        info->id = session->id;
+        info->transport = transport_label(session->transport);
+        info->state = phase_label(session->phase);
+        snprintf(info->peer, sizeof(info->peer), "%s", session->peer != NULL ? session->peer : "-");
+        snprintf(info->username, sizeof(info->username), "%s",
+                 session->phase != SESSION_PHASE_LOGIN ? session->username : "-");
+        info->bytes_in = atomic_load_explicit(&session->bytes_in, memory_order_relaxed);
+        info->bytes_out = atomic_load_explicit(&session->bytes_out, memory_order_relaxed);
+        info->connected_seconds = (unsigned int)(now - session->connected_at);
+        info->idle_seconds =
+            (unsigned int)(now - (time_t)atomic_load_explicit(&session->last_input, memory_order_relaxed));
+    }
+    profiled_mutex_unlock(&manager->lock);
+
+    *sessions = items;
+    *count = index;
+    return 0;
+}
+
+int session_manager_kick(session_manager_t *manager, unsigned int id)
+{
+    if (manager == NULL) {
+        return -1;
+    }
+
+    int found = -1;
+    profiled_mutex_lock(&manager->lock);
+    for (struct session *session = manager->sessions; session != NULL; session = session->next) {
+        if (session->id == id) {
+            session_interrupt(session, SESSION_EXPIRE_KICKED);
+            found = 0;
+            break;
+        }
+    }
+    profiled_mutex_unlock(&manager->lock);
+    return found;
+}
+
+board_t *session_manager_board(session_manager_t *manager)
+{
+    return manager != NULL ? board_directory_open(manager->boards, 0) : NULL;
+}
+
+board_directory_t *session_manager_boards(session_manager_t *manager)
+{
+    return manager != NULL ? manager->boards : NULL;
+}
+
+int session_manager_start_relay(session_manager_t *manager, const config_peer_t *peers, size_t count)
+{
+    if (manager == NULL || manager->relay != NULL) {
+        return -1;
+    }
+    manager->relay = relay_create(peers, count, relay_deliver, manager);
+    return manager->relay != NULL ? 0 : -1;
+}
+
+relay_t *session_manager_relay(session_manager_t *manager)
+{
+    return manager != NULL ? manager->relay : NULL;
+}
+
+int session_manager_start_replication(session_manager_t *manager, const maum_config_t *config)
+{
+    if (manager == NULL || config == NULL || manager->replica != NULL) {
+        return -1;
+    }
+    if (config->replication_role == CONFIG_REPLICATION_LEADER) {
+        manager->replica = replica_leader_create(manager->boards, manager->hub);
+    } else if (config->replication_role == CONFIG_REPLICATION_FOLLOWER) {
+        manager->replica = replica_follower_create(manager->boards, &config->replication_leader);
+    } else {
+        return 0;
+    }
+    return manager->replica != NULL ? 0 : -1;
+}
+
+replica_t *session_manager_replica(session_manager_t *manager)
+{
+    return manager != NULL ? manager->replica : NULL;
+}
+
+int session_manager_snapshot(session_manager_t *manager, char *path, size_t size)
+{
+    if (manager == NULL) {
+        return -1;
+    }
+    return snapshot_create(manager->boards, manager->cursors, config_current()->snapshot_dir, path, size);
+}
+
+int session_manager_run_fd(session_manager_t *manager,
+                           session_transport_t transport,
+                           int fd,
+                           const char *peer_identity)
+{
+    if (manager == NULL || fd < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    struct session session;
+    session_prepare(&session, manager, transport, fd, peer_identity);
+
+    // Every stream counts its own bytes; telnet also feeds the process totals.
+    int telnet = (transport == SESSION_TRANSPORT_TELNET);
+    FILE *input = metrics_fdopen(fd, "r", telnet ? METRIC_TELNET_BYTES_IN : METRIC_COUNTER_COUNT,
+                                 &session.bytes_in);
+    if (input == NULL) {
+        LOG_WARN(COMPONENT, "%s", "fdopen failed for client input");
+        close(fd);
+        return -1;
+    }
+
+    int dup_fd = dup(fd);
+    if (dup_fd < 0) {
+        LOG_WARN(COMPONENT, "%s", "dup failed for client output");
+        fclose(input);
+        return -1;
+    }
+
+    FILE *output = metrics_fdopen(dup_fd, "w", telnet ? METRIC_TELNET_BYTES_OUT : METRIC_COUNTER_COUNT,
+                                  &session.bytes_out);
+    if (output == NULL) {
+        LOG_WARN(COMPONENT, "%s", "fdopen failed for client output");
+        fclose(input);
+        close(dup_fd);
+        return -1;
+    }
+
+    setvbuf(input, NULL, _IONBF, 0);
+    setvbuf(output, NULL, _IONBF, 0);
+
+    if (transport == SESSION_TRANSPORT_TELNET) {
+        telnet_send_initial_negotiation(output);
+    }
+
+    run_streams(&session, input, output);
+
+    fclose(output);
+    fclose(input);
+    return 0;
 }
@@ -0,0 +1,240 @@
+#include "snapshot.h"
+
+#include "log.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#define COMPONENT "snapshot"
+
+#define SNAPSHOT_PATH_MAX 512
+#define SNAPSHOT_MANIFEST "MANIFEST"
+#define SNAPSHOT_CURSORS "cursors.db"
+
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int sync_path(const char *path, int flags)
+{
+    int fd = open(path, flags);
+    if (fd < 0) {
+        return -1;
+    }
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+// Copies the first length bytes of in (-1 for an empty board) to a new file.
+static int copy_captured(int in, unsigned long long length, const char *path)
+{
+    int out = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out < 0) {
+        return -1;
+    }
+    off_t position = 0;
+    int rc = 0;
+    while (in >= 0 && (unsigned long long)position < length) {
+        ssize_t n = sendfile(out, in, &position, (size_t)(length - (unsigned long long)position));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            rc = -1;
+            break;
+        }
+    }
+    if (rc == 0 && fsync(out) != 0) {
+        rc = -1;
+    }
+    close(out);
+    return rc;
+}
+
+static int write_cursors(const char *data, size_t size, const char *path)
+{
+    int out = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out < 0) {
+        return -1;
+    }
+    int rc = 0;
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(out, data + written, size - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            rc = -1;
+            break;
+        }
+        written += (size_t)n;
+    }
+    if (rc == 0 && fsync(out) != 0) {
+        rc = -1;
+    }
+    close(out);
+    return rc;
+}
+
+// Removes what a failed snapshot left in its working directory.
+static void discard(const char *work, const board_directory_t *boards)
+{
+    char file[SNAPSHOT_PATH_MAX + BOARD_NAME_MAX + 8];
+    for (size_t i = 0; i < board_directory_count(boards); ++i) {
+        snprintf(file, sizeof(file), "%s/%s.db", work, board_directory_spec(boards, i)->name);
+        unlink(file);
+    }
+    snprintf(file, sizeof(file), "%s/%s", work, SNAPSHOT_CURSORS);
+    unlink(file);
+    snprintf(file, sizeof(file), "%s/%s", work, SNAPSHOT_MANIFEST);
+    unlink(file);
+    rmdir(work);
+}
+
+// Two snapshots in the same second get -2, -3, ... after the time.
+static int publish(const char *work, const char *dir, const char *name, char *path, size_t size)
+{
+    char final[SNAPSHOT_PATH_MAX];
+    for (unsigned int attempt = 1; attempt < 100; ++attempt) {
+        if (attempt == 1) {
+            snprintf(final, sizeof(final), "%s/%s", dir, name);
+        } else {
+            snprintf(final, sizeof(final), "%s/%s-%u", dir, name, attempt);
+        }
+        struct stat st;
+        if (stat(final, &st) == 0) {
+            continue;
+        }
+        if (rename(work, final) != 0) {
+            return -1;
+        }
+        snprintf(path, size, "%s", final);
+        return sync_path(dir, O_RDONLY);
+    }
+    errno = EEXIST;
+    return -1;
+}
+
+int snapshot_create(board_directory_t *boards, cursor_store_t *cursors, const char *dir, char *path, size_t size)
+{
+    if (boards == NULL || dir == NULL || dir[0] == '\0' || path == NULL || size == 0) {
+        return -1;
+    }
+    if (pthread_mutex_trylock(&snapshot_lock) != 0) {
+        return 1;
+    }
+
+    uint64_t started = metrics_now();
+    char name[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(name, sizeof(name), "%Y%m%d-%H%M%S", &tm);
+    char work[SNAPSHOT_PATH_MAX];
+    snprintf(work, sizeof(work), "%s/.%s.tmp", dir, name);
+    if ((mkdir(dir, 0755) != 0 && errno != EEXIST) || mkdir(work, 0755) != 0) {
+        LOG_ERROR(COMPONENT, "Unable to create snapshot directory under '%s': %s", dir, strerror(errno));
+        pthread_mutex_unlock(&snapshot_lock);
+        return -1;
+    }
+
+    char file[SNAPSHOT_PATH_MAX + BOARD_NAME_MAX + 8];
+    snprintf(file, sizeof(file), "%s/%s", work, SNAPSHOT_MANIFEST);
+    FILE *manifest = fopen(file, "w");
+    int rc = manifest != NULL ? 0 : -1;
+    if (manifest != NULL) {
+        fprintf(manifest, "# maum snapshot %s\n# board <name> <bytes> <source file>\n", name);
+    }
+
+    // Everything is captured first, back to back, so the boards and cursors
+    // come from one moment; the slow copying happens afterwards.
+    size_t count = board_directory_count(boards);
+    int *fds = malloc(count * sizeof(*fds));
+    unsigned long long *lengths = malloc(count * sizeof(*lengths));
+    if (fds == NULL || lengths == NULL) {
+        rc = -1;
+    }
+    size_t captured = 0;
+    char *cursor_data = NULL;
+    size_t cursor_size = 0;
+    uint64_t capture_started = metrics_now();
+    while (rc == 0 && captured < count) {
+        rc = board_directory_capture(boards, captured, &fds[captured], &lengths[captured]);
+        if (rc != 0) {
+            LOG_ERROR(COMPONENT, "Unable to capture board '%s'", board_directory_spec(boards, captured)->name);
+            break;
+        }
+        captured++;
+    }
+    if (rc == 0 && cursors != NULL && cursor_store_capture(cursors, &cursor_data, &cursor_size) != 0) {
+        LOG_ERROR(COMPONENT, "%s", "Unable to capture read cursors");
+        rc = -1;
+    }
+    uint64_t capture = metrics_now() - capture_started;
+
+    unsigned long long total = 0;
+    for (size_t i = 0; rc == 0 && i < count; ++i) {
+        const board_spec_t *spec = board_directory_spec(boards, i);
+        snprintf(file, sizeof(file), "%s/%s.db", work, spec->name);
+        rc = copy_captured(fds[i], lengths[i], file);
+        if (rc != 0) {
+            LOG_ERROR(COMPONENT, "Unable to copy board '%s': %s", spec->name, strerror(errno));
+            break;
+        }
+        fprintf(manifest, "board %s %llu %s\n", spec->name, lengths[i], spec->path);
+        total += lengths[i];
+    }
+    for (size_t i = 0; i < captured && fds != NULL; ++i) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    free(fds);
+    free(lengths);
+
+    if (rc == 0 && cursors != NULL) {
+        snprintf(file, sizeof(file), "%s/%s", work, SNAPSHOT_CURSORS);
+        rc = write_cursors(cursor_data, cursor_size, file);
+        if (rc != 0) {
+            LOG_ERROR(COMPONENT, "Unable to copy read cursors: %s", strerror(errno));
+        } else {
+            fprintf(manifest, "cursors %s\n", SNAPSHOT_CURSORS);
+        }
+    }
+    free(cursor_data);
+
+    if (manifest != NULL) {
+        if (fflush(manifest) != 0 || fsync(fileno(manifest)) != 0) {
+            rc = -1;
+        }
+        fclose(manifest);
+    }
+    if (rc == 0 && sync_path(work, O_RDONLY) != 0) {
+        rc = -1;
+    }
+    if (rc == 0 && publish(work, dir, name, path, size) != 0) {
+        LOG_ERROR(COMPONENT, "Unable to publish snapshot in '%s': %s", dir, strerror(errno));
+        rc = -1;
+    }
+    if (rc != 0) {
+        discard(work, boards);
+        pthread_mutex_unlock(&snapshot_lock);
+        return -1;
+    }
+
+    LOG_INFO(COMPONENT, "Snapshot %s: %zu boards, %llu bytes in %llu ms; captured in %llu us", path, count, total,
+             (unsigned long long)((metrics_now() - started) / 1000000), (unsigned long long)(capture / 1000));
+    pthread_mutex_unlock(&snapshot_lock);
+    return 0;
+}
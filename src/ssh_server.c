@@ -0,0 +1,450 @@
+#include "ssh_server.h"
+
+#include "log.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+
+#define COMPONENT "ssh"
+
+#ifdef MAUM_HAVE_LIBSSH
+
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SSH_HOST_MAX 128
+#define SSH_SERVICE_MAX 16
+#define SSH_PEER_MAX (SSH_HOST_MAX + SSH_SERVICE_MAX + 2)
+#define SSH_POLL_MS 100
+#define SSH_IO_CHUNK 4096
+
+struct ssh_server {
+    session_manager_t *sessions;
+    ssh_bind bind;
+    int listen_fd;
+};
+
+struct ssh_connection {
+    session_manager_t *sessions;
+    ssh_session session;
+    ssh_channel channel;
+    int local_fd;
+    char peer[SSH_PEER_MAX];
+};
+
+struct ssh_session_args {
+    session_manager_t *sessions;
+    int fd;
+    const char *peer;
+};
+
+static pthread_once_t ssh_init_once = PTHREAD_ONCE_INIT;
+
+static void ssh_library_init(void)
+{
+    ssh_init();
+}
+
+static int ensure_host_key(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) == 0 && st.st_size > 0) {
+        return 0;
+    }
+
+    ssh_key key = NULL;
+    if (ssh_pki_generate(SSH_KEYTYPE_ED25519, 0, &key) != SSH_OK) {
+        LOG_ERROR(COMPONENT, "%s", "Failed to generate ed25519 host key");
+        return -1;
+    }
+
+    int rc = ssh_pki_export_privkey_file(key, NULL, NULL, NULL, path);
+    ssh_key_free(key);
+    if (rc != SSH_OK) {
+        LOG_ERROR(COMPONENT, "Unable to write host key '%s'", path);
+        return -1;
+    }
+
+    chmod(path, 0600);
+    LOG_INFO(COMPONENT, "Generated new host key at %s", path);
+    return 0;
+}
+
+static void describe_peer(ssh_session session, char *buffer, size_t size)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    char host[SSH_HOST_MAX];
+    char service[SSH_SERVICE_MAX];
+
+    if (getpeername(ssh_get_fd(session), (struct sockaddr *)&addr, &addrlen) == 0 &&
+        getnameinfo((struct sockaddr *)&addr, addrlen, host, sizeof(host), service, sizeof(service),
+                    NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+        snprintf(buffer, size, "%s:%s", host, service);
+        return;
+    }
+    snprintf(buffer, size, "%s", "unknown");
+}
+
+// Anonymous BBS access: every user name is accepted and the nickname is asked
+// for by the session itself, exactly as for telnet users.
+static int authenticate(ssh_session session)
+{
+    while (1) {
+        ssh_message message = ssh_message_get(session);
+        if (message == NULL) {
+            return -1;
+        }
+
+        if (ssh_message_type(message) == SSH_REQUEST_AUTH) {
+            switch (ssh_message_subtype(message)) {
+            case SSH_AUTH_METHOD_NONE:
+            case SSH_AUTH_METHOD_PASSWORD:
+            case SSH_AUTH_METHOD_INTERACTIVE:
+                ssh_message_auth_reply_success(message, 0);
+                ssh_message_free(message);
+                return 0;
+            default:
+                ssh_message_auth_set_methods(message, SSH_AUTH_METHOD_NONE | SSH_AUTH_METHOD_PASSWORD);
+                ssh_message_reply_default(message);
+                break;
+            }
+        } else {
+            ssh_message_reply_default(message);
+        }
+        ssh_message_free(message);
+    }
+}
+
+static ssh_channel open_shell_channel(ssh_session session)
+{
+    ssh_channel channel = NULL;
+    while (channel == NULL) {
+        ssh_message message = ssh_message_get(session);
+        if (message == NULL) {
+            return NULL;
+        }
+        if (ssh_message_type(message) == SSH_REQUEST_CHANNEL_OPEN &&
+            ssh_message_subtype(message) == SSH_CHANNEL_SESSION) {
+            channel = ssh_message_channel_request_open_reply_accept(message);
+        } else {
+            ssh_message_reply_default(message);
+        }
+        ssh_message_free(message);
+    }
+
+    while (1) {
+        ssh_message message = ssh_message_get(session);
+        if (message == NULL) {
+            ssh_channel_free(channel);
+            return NULL;
+        }
+        int done = 0;
+        if (ssh_message_type(message) == SSH_REQUEST_CHANNEL) {
+            switch (ssh_message_subtype(message)) {
+            case SSH_CHANNEL_REQUEST_PTY:
+            case SSH_CHANNEL_REQUEST_ENV:
+                ssh_message_channel_request_reply_success(message);
+                break;
+            case SSH_CHANNEL_REQUEST_SHELL:
+                ssh_message_channel_request_reply_success(message);
+                done = 1;
+                break;
+            default:
+                ssh_message_reply_default(message);
+                break;
+            }
+        } else {
+            ssh_message_reply_default(message);
+        }
+        ssh_message_free(message);
+        if (done) {
+            return channel;
+        }
+    }
+}
+
+static int write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+static void pump_channel(struct ssh_connection *conn)
+{
+    char buffer[SSH_IO_CHUNK];
+
+    while (ssh_channel_is_open(conn->channel) && !ssh_channel_is_eof(conn->channel)) {
+        struct pollfd fds[2];
+        fds[0].fd = ssh_get_fd(conn->session);
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = conn->local_fd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+
+        if (poll(fds, 2, SSH_POLL_MS) < 0 && errno != EINTR) {
+            break;
+        }
+
+        int received = ssh_channel_read_nonblocking(conn->channel, buffer, sizeof(buffer), 0);
+        if (received < 0) {
+            break;
+        }
+        if (received > 0) {
+            // A raw pty sends a bare CR for Enter; translate it the way a
+            // tty line discipline would (ICRNL) for the shared line editor.
+            for (int i = 0; i < received; ++i) {
+                if (buffer[i] == '\r') {
+                    buffer[i] = '\n';
+                }
+            }
+            if (write_all(conn->local_fd, buffer, (size_t)received) != 0) {
+                break;
+            }
+        }
+
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t count = read(conn->local_fd, buffer, sizeof(buffer));
+            if (count <= 0) {
+                break;
+            }
+            if (ssh_channel_write(conn->channel, buffer, (uint32_t)count) == SSH_ERROR) {
+                break;
+            }
+        }
+    }
+}
+
+static void *ssh_session_thread(void *arg)
+{
+    struct ssh_session_args *args = arg;
+    session_manager_run_fd(args->sessions, SESSION_TRANSPORT_SSH, args->fd, args->peer);
+    free(args);
+    return NULL;
+}
+
+static void serve_connection(struct ssh_connection *conn)
+{
+    if (ssh_handle_key_exchange(conn->session) != SSH_OK) {
+        LOG_WARN(COMPONENT, "Key exchange with %s failed: %s", conn->peer, ssh_get_error(conn->session));
+        return;
+    }
+
+    if (authenticate(conn->session) != 0) {
+        return;
+    }
+
+    conn->channel = open_shell_channel(conn->session);
+    if (conn->channel == NULL) {
+        return;
+    }
+
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+        LOG_WARN(COMPONENT, "socketpair failed: %s", strerror(errno));
+        return;
+    }
+    conn->local_fd = pair[1];
+
+    struct ssh_session_args *args = calloc(1, sizeof(*args));
+    if (args == NULL) {
+        close(pair[0]);
+        return;
+    }
+    args->sessions = conn->sessions;
+    args->fd = pair[0];
+    args->peer = conn->peer;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ssh_session_thread, args) != 0) {
+        LOG_WARN(COMPONENT, "%s", "Failed to create SSH session thread");
+        close(pair[0]);
+        free(args);
+        return;
+    }
+
+    LOG_INFO(COMPONENT, "SSH session started for %s", conn->peer);
+    pump_channel(conn);
+
+    shutdown(conn->local_fd, SHUT_RDWR);
+    pthread_join(thread, NULL);
+    LOG_INFO(COMPONENT, "SSH session closed for %s", conn->peer);
+}
+
+static void *ssh_connection_thread(void *arg)
+{
+    struct ssh_connection *conn = arg;
+
+    serve_connection(conn);
+
+    if (conn->local_fd >= 0) {
+        close(conn->local_fd);
+    }
+    if (conn->channel != NULL) {
+        ssh_channel_send_eof(conn->channel);
+        ssh_channel_close(conn->channel);
+        ssh_channel_free(conn->channel);
+    }
+    ssh_disconnect(conn->session);
+    ssh_free(conn->session);
+    free(conn);
+    return NULL;
+}
+
+ssh_server_t *ssh_server_create(const maum_config_t *config, session_manager_t *sessions, int listen_fd)
+{
+    if (config == NULL || sessions == NULL) {
+        return NULL;
+    }
+
+    pthread_once(&ssh_init_once, ssh_library_init);
+
+    if (ensure_host_key(config->host_key_path) != 0) {
+        return NULL;
+    }
+
+    ssh_server_t *server = calloc(1, sizeof(*server));
+    if (server == NULL) {
+        return NULL;
+    }
+    server->sessions = sessions;
+    server->listen_fd = -1;
+
+    server->bind = ssh_bind_new();
+    if (server->bind == NULL) {
+        free(server);
+        return NULL;
+    }
+
+    char port[8];
+    snprintf(port, sizeof(port), "%u", config->ssh_port);
+    ssh_bind_options_set(server->bind, SSH_BIND_OPTIONS_BINDADDR, config->ssh_host);
+    ssh_bind_options_set(server->bind, SSH_BIND_OPTIONS_BINDPORT_STR, port);
+    if (ssh_bind_options_set(server->bind, SSH_BIND_OPTIONS_HOSTKEY, config->host_key_path) != SSH_OK) {
+        LOG_ERROR(COMPONENT, "Unable to load host key '%s'", config->host_key_path);
+        ssh_bind_free(server->bind);
+        free(server);
+        return NULL;
+    }
+
+    if (listen_fd >= 0) {
+        ssh_bind_set_fd(server->bind, listen_fd);
+    } else if (ssh_bind_listen(server->bind) != SSH_OK) {
+        LOG_ERROR(COMPONENT, "SSH listen failed: %s", ssh_get_error(server->bind));
+        ssh_bind_free(server->bind);
+        free(server);
+        return NULL;
+    }
+
+    server->listen_fd = ssh_bind_get_fd(server->bind);
+    LOG_INFO(COMPONENT, "SSH listening on %s:%u", config->ssh_host, config->ssh_port);
+    return server;
+}
+
+void ssh_server_destroy(ssh_server_t *server)
+{
+    if (server == NULL) {
+        return;
+    }
+    ssh_bind_free(server->bind);
+    free(server);
+}
+
+int ssh_server_listen_fd(const ssh_server_t *server)
+{
+    return (server != NULL) ? server->listen_fd : -1;
+}
+
+void ssh_server_accept(ssh_server_t *server)
+{
+    if (server == NULL) {
+        return;
+    }
+
+    ssh_session session = ssh_new();
+    if (session == NULL) {
+        return;
+    }
+
+    if (ssh_bind_accept(server->bind, session) != SSH_OK) {
+        LOG_WARN(COMPONENT, "SSH accept failed: %s", ssh_get_error(server->bind));
+        ssh_free(session);
+        return;
+    }
+    metrics_add(METRIC_ACCEPTS_SSH, 1);
+
+    struct ssh_connection *conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+        ssh_disconnect(session);
+        ssh_free(session);
+        return;
+    }
+    conn->sessions = server->sessions;
+    conn->session = session;
+    conn->local_fd = -1;
+    describe_peer(session, conn->peer, sizeof(conn->peer));
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ssh_connection_thread, conn) != 0) {
+        LOG_WARN(COMPONENT, "%s", "Failed to create SSH connection thread");
+        ssh_disconnect(session);
+        ssh_free(session);
+        free(conn);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+#else
+
+#include <unistd.h>
+
+ssh_server_t *ssh_server_create(const maum_config_t *config, session_manager_t *sessions, int listen_fd)
+{
+    (void)config;
+    (void)sessions;
+    if (listen_fd >= 0) {
+        close(listen_fd);
+    }
+    LOG_WARN(COMPONENT, "%s", "Built-in SSH server requested but libssh is not available. Use --stdio mode with your SSH daemon.");
+    return NULL;
+}
+
+void ssh_server_destroy(ssh_server_t *server)
+{
+    (void)server;
+}
+
+int ssh_server_listen_fd(const ssh_server_t *server)
+{
+    (void)server;
+    return -1;
+}
+
+void ssh_server_accept(ssh_server_t *server)
+{
+    (void)server;
+}
+
+#endif
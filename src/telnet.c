@@ -1,6 +1,10 @@
 #include "telnet.h"
 
+#include "charset.h"
+#include "vscreen.h"
+
 #include <errno.h>
+#include <string.h>
 
 static void telnet_send_command(FILE *out, unsigned char command, unsigned char option)
 {
@@ -85,22 +89,43 @@ static void telnet_handle_negotiation(FILE *out, unsigned char command, unsigned
     }
 }
 
-static int telnet_skip_subnegotiation(FILE *in)
+#define TELNET_SB_MAX 16
+
+// Reads up to IAC SE, keeping the first bytes with IAC IAC undoubled.
+static int telnet_read_subnegotiation(FILE *in, unsigned char *data, size_t *length)
 {
-    int prev = 0;
+    size_t count = 0;
     while (1) {
         int ch = fgetc(in);
         if (ch == EOF) {
             return -1;
         }
-        if (prev == TELNET_IAC && ch == TELNET_SE) {
-            return 0;
+        if (ch == TELNET_IAC) {
+            ch = fgetc(in);
+            if (ch == EOF) {
+                return -1;
+            }
+            if (ch == TELNET_SE) {
+                *length = count;
+                return 0;
+            }
         }
-        prev = ch;
+        if (count < TELNET_SB_MAX) {
+            data[count++] = (unsigned char)ch;
+        }
+    }
+}
+
+static void telnet_handle_subnegotiation(const unsigned char *data, size_t length, telnet_terminal_t *terminal)
+{
+    if (terminal == NULL || length != 5 || data[0] != TELNET_OPT_NAWS) {
+        return;
     }
+    terminal->width = (unsigned short)((data[1] << 8) | data[2]);
+    terminal->height = (unsigned short)((data[3] << 8) | data[4]);
 }
 
-static int telnet_getc(FILE *in, FILE *out)
+static int telnet_getc(FILE *in, FILE *out, telnet_terminal_t *terminal)
 {
     while (1) {
         int ch = fgetc(in);
@@ -130,9 +155,12 @@ static int telnet_getc(FILE *in, FILE *out)
         }
 
         if (command == TELNET_SB) {
-            if (telnet_skip_subnegotiation(in) != 0) {
+            unsigned char data[TELNET_SB_MAX];
+            size_t length = 0;
+            if (telnet_read_subnegotiation(in, data, &length) != 0) {
                 return EOF;
             }
+            telnet_handle_subnegotiation(data, length, terminal);
             continue;
         }
 
@@ -155,7 +183,60 @@ void telnet_send_initial_negotiation(FILE *out)
     telnet_send_command(out, TELNET_DO, TELNET_OPT_NAWS);
 }
 
-int telnet_read_line(FILE *in, FILE *out, char *buffer, size_t size)
+// Adds ch to the line as UTF-8 and echoes it. A CP949 terminal sends a lead
+// byte and a trail byte per character, so the trail is read here.
+static int telnet_append(FILE *in, FILE *out, telnet_terminal_t *terminal, int ch, char *buffer, size_t size,
+                         size_t *index)
+{
+    char text[CHARSET_DECODE_MAX(2)];
+    size_t length = 1;
+    text[0] = (char)ch;
+    if (ch >= 0x80 && terminal != NULL &&
+        atomic_load_explicit(&terminal->charset, memory_order_relaxed) == CHARSET_CP949) {
+        int trail = telnet_getc(in, out, terminal);
+        if (trail == EOF) {
+            return EOF;
+        }
+        char pair[2] = {(char)ch, (char)trail};
+        size_t consumed = 0;
+        length = charset_decode(CHARSET_CP949, pair, sizeof(pair), text, &consumed);
+        if (consumed < sizeof(pair)) {
+            text[length++] = '?';
+        }
+    }
+
+    if (*index + length >= size) {
+        telnet_echo_char(out, '\a');
+        return 0;
+    }
+    memcpy(buffer + *index, text, length);
+    *index += length;
+    if (length > 1 || telnet_is_printable(ch)) {
+        if (terminal != NULL && terminal->masked) {
+            telnet_echo_char(out, '*');
+        } else {
+            telnet_echo(out, text, length);
+        }
+    }
+    return 0;
+}
+
+// Removes the last character and erases as many columns as it took.
+static void telnet_erase(FILE *out, const telnet_terminal_t *terminal, char *buffer, size_t *index)
+{
+    size_t start = *index - 1;
+    while (start > 0 && *index - start < 4 && ((unsigned char)buffer[start] & 0xc0) == 0x80) {
+        start--;
+    }
+    buffer[*index] = '\0';
+    unsigned int width = terminal != NULL && terminal->masked ? 1 : vscreen_text_width(buffer + start);
+    *index = start;
+    for (unsigned int i = 0; i < width; ++i) {
+        telnet_echo(out, "\b \b", 3);
+    }
+}
+
+int telnet_read_line(FILE *in, FILE *out, telnet_terminal_t *terminal, char *buffer, size_t size)
 {
     if (in == NULL || buffer == NULL || size == 0) {
         errno = EINVAL;
@@ -163,9 +244,8 @@ int telnet_read_line(FILE *in, FILE *out, char *buffer, size_t size)
     }
 
     size_t index = 0;
-    int running = 1;
-    while (running) {
-        int ch = telnet_getc(in, out);
+    while (1) {
+        int ch = telnet_getc(in, out, terminal);
         if (ch == EOF) {
             if (index == 0) {
                 return -1;
@@ -175,8 +255,7 @@ int telnet_read_line(FILE *in, FILE *out, char *buffer, size_t size)
 
         if (ch == '\b' || ch == 0x7f) {
             if (index > 0) {
-                index--;
-                telnet_echo(out, "\b \b", 3);
+                telnet_erase(out, terminal, buffer, &index);
             }
             continue;
         }
@@ -186,22 +265,12 @@ int telnet_read_line(FILE *in, FILE *out, char *buffer, size_t size)
         }
 
         if (ch == '\r') {
-            int next = telnet_getc(in, out);
+            int next = telnet_getc(in, out, terminal);
             telnet_echo(out, "\r\n", 2);
-            if (next == '\n' || next == 0 || next == EOF) {
-                running = 0;
-            } else {
-                if (next != EOF && next != '\r' && next != '\n') {
-                    if (index + 1 < size) {
-                        buffer[index++] = (char)next;
-                        if (telnet_is_printable(next)) {
-                            telnet_echo_char(out, (unsigned char)next);
-                        }
-                    }
-                }
-                running = 0;
+            if (next != EOF && next != 0 && next != '\r' && next != '\n') {
+                telnet_append(in, out, terminal, next, buffer, size, &index);
             }
-            continue;
+            break;
         }
 
         if (ch == '\n') {
@@ -209,13 +278,8 @@ int telnet_read_line(FILE *in, FILE *out, char *buffer, size_t size)
             break;
         }
 
-        if (index + 1 < size) {
-            buffer[index++] = (char)ch;
-            if (telnet_is_printable(ch)) {
-                telnet_echo_char(out, (unsigned char)ch);
-            }
-        } else {
-            telnet_echo_char(out, '\a');
+        if (telnet_append(in, out, terminal, ch, buffer, size, &index) == EOF) {
+            break;
         }
     }
 
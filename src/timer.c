@@ -0,0 +1,255 @@
+#include "timer.h"
+
+#include "log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define COMPONENT "timer"
+
+#define TIMER_LEVELS 4
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1u << TIMER_BITS)
+#define TIMER_MASK (TIMER_SLOTS - 1)
+#define TIMER_MAX_DELTA ((1ull << (TIMER_BITS * TIMER_LEVELS)) - 1)
+
+// Upper bound on ticks replayed after a stall so one wakeup stays bounded.
+#define TIMER_MAX_CATCHUP 4096
+
+struct timer_wheel {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+    unsigned int tick_ms;
+    uint64_t now;
+    struct timespec started;
+    timer_entry_t *slots[TIMER_LEVELS][TIMER_SLOTS];
+};
+
+static void slot_insert(timer_entry_t **slot, timer_entry_t *timer)
+{
+    timer->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->pprev = &timer->next;
+    }
+    *slot = timer;
+    timer->pprev = slot;
+}
+
+static void slot_unlink(timer_entry_t *timer)
+{
+    if (timer->pprev == NULL) {
+        return;
+    }
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+static void wheel_place(timer_wheel_t *wheel, timer_entry_t *timer)
+{
+    uint64_t expires = timer->expires;
+    if (expires < wheel->now) {
+        expires = wheel->now;
+    }
+    uint64_t delta = expires - wheel->now;
+    if (delta > TIMER_MAX_DELTA) {
+        delta = TIMER_MAX_DELTA;
+        expires = wheel->now + delta;
+    }
+
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1ull << (TIMER_BITS * (level + 1)))) {
+        level++;
+    }
+    unsigned int index = (unsigned int)((expires >> (TIMER_BITS * level)) & TIMER_MASK);
+    slot_insert(&wheel->slots[level][index], timer);
+}
+
+static unsigned int wheel_cascade(timer_wheel_t *wheel, int level)
+{
+    unsigned int index = (unsigned int)((wheel->now >> (TIMER_BITS * level)) & TIMER_MASK);
+    timer_entry_t *timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    while (timer != NULL) {
+        timer_entry_t *next = timer->next;
+        timer->next = NULL;
+        timer->pprev = NULL;
+        wheel_place(wheel, timer);
+        timer = next;
+    }
+    return index;
+}
+
+static void wheel_tick(timer_wheel_t *wheel)
+{
+    unsigned int index = (unsigned int)(wheel->now & TIMER_MASK);
+    if (index == 0) {
+        for (int level = 1; level < TIMER_LEVELS; ++level) {
+            if (wheel_cascade(wheel, level) != 0) {
+                break;
+            }
+        }
+    }
+
+    timer_entry_t *timer = wheel->slots[0][index];
+    wheel->slots[0][index] = NULL;
+    while (timer != NULL) {
+        timer_entry_t *next = timer->next;
+        timer->next = NULL;
+        timer->pprev = NULL;
+        if (timer->callback != NULL) {
+            timer->callback(timer->arg);
+        }
+        timer = next;
+    }
+
+    wheel->now++;
+}
+
+static uint64_t elapsed_ticks(const timer_wheel_t *wheel)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t elapsed_ms = (uint64_t)(ts.tv_sec - wheel->started.tv_sec) * 1000u;
+    elapsed_ms += (uint64_t)((ts.tv_nsec - wheel->started.tv_nsec) / 1000000);
+    return elapsed_ms / wheel->tick_ms;
+}
+
+static void *wheel_thread(void *arg)
+{
+    timer_wheel_t *wheel = arg;
+
+    pthread_mutex_lock(&wheel->lock);
+    while (wheel->running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += wheel->tick_ms / 1000;
+        deadline.tv_nsec += (long)(wheel->tick_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        int rc = pthread_cond_timedwait(&wheel->cond, &wheel->lock, &deadline);
+        if (!wheel->running) {
+            break;
+        }
+        if (rc != 0 && rc != ETIMEDOUT) {
+            continue;
+        }
+
+        uint64_t target = elapsed_ticks(wheel);
+        if (target > wheel->now + TIMER_MAX_CATCHUP) {
+            LOG_WARN(COMPONENT, "Timer wheel fell behind by %llu ticks",
+                     (unsigned long long)(target - wheel->now));
+            target = wheel->now + TIMER_MAX_CATCHUP;
+        }
+        while (wheel->now < target) {
+            wheel_tick(wheel);
+        }
+    }
+    pthread_mutex_unlock(&wheel->lock);
+    return NULL;
+}
+
+timer_wheel_t *timer_wheel_create(unsigned int tick_ms)
+{
+    timer_wheel_t *wheel = calloc(1, sizeof(*wheel));
+    if (wheel == NULL) {
+        return NULL;
+    }
+
+    wheel->tick_ms = (tick_ms == 0) ? 1000 : tick_ms;
+    clock_gettime(CLOCK_MONOTONIC, &wheel->started);
+
+    if (pthread_mutex_init(&wheel->lock, NULL) != 0) {
+        free(wheel);
+        return NULL;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int rc = pthread_cond_init(&wheel->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (rc != 0) {
+        pthread_mutex_destroy(&wheel->lock);
+        free(wheel);
+        return NULL;
+    }
+
+    wheel->running = 1;
+    if (pthread_create(&wheel->thread, NULL, wheel_thread, wheel) != 0) {
+        LOG_ERROR(COMPONENT, "%s", "Failed to start timer wheel thread");
+        pthread_cond_destroy(&wheel->cond);
+        pthread_mutex_destroy(&wheel->lock);
+        free(wheel);
+        return NULL;
+    }
+
+    return wheel;
+}
+
+void timer_wheel_destroy(timer_wheel_t *wheel)
+{
+    if (wheel == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&wheel->lock);
+    wheel->running = 0;
+    pthread_cond_signal(&wheel->cond);
+    pthread_mutex_unlock(&wheel->lock);
+    pthread_join(wheel->thread, NULL);
+
+    pthread_cond_destroy(&wheel->cond);
+    pthread_mutex_destroy(&wheel->lock);
+    free(wheel);
+}
+
+void timer_init(timer_entry_t *timer, timer_callback_t callback, void *arg)
+{
+    if (timer == NULL) {
+        return;
+    }
+    memset(timer, 0, sizeof(*timer));
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+void timer_arm(timer_wheel_t *wheel, timer_entry_t *timer, unsigned int timeout_ms)
+{
+    if (wheel == NULL || timer == NULL) {
+        return;
+    }
+
+    uint64_t ticks = (timeout_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+    if (ticks == 0) {
+        ticks = 1;
+    }
+
+    pthread_mutex_lock(&wheel->lock);
+    slot_unlink(timer);
+    timer->expires = wheel->now + ticks;
+    wheel_place(wheel, timer);
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+void timer_cancel(timer_wheel_t *wheel, timer_entry_t *timer)
+{
+    if (wheel == NULL || timer == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&wheel->lock);
+    slot_unlink(timer);
+    pthread_mutex_unlock(&wheel->lock);
+}
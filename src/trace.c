@@ -0,0 +1,236 @@
+#include "trace.h"
+
+#include "trace_format.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COMPONENT "trace"
+
+#define TRACE_SITE_CAPACITY 1024
+#define TRACE_MIN_RECORDS 1024
+
+#define TRACE_SITE_PENDING UINT_MAX
+#define TRACE_SITE_UNTRACEABLE (UINT_MAX - 1)
+
+static atomic_bool trace_enabled;
+static trace_file_header_t *trace_header;
+static trace_site_t *trace_sites;
+static trace_record_t *trace_records;
+static atomic_uint next_thread_number;
+static _Thread_local uint32_t thread_number;
+
+bool trace_active(void)
+{
+    return atomic_load_explicit(&trace_enabled, memory_order_acquire);
+}
+
+int trace_open(const char *path, size_t size_kb)
+{
+    if (path == NULL || path[0] == '\0' || trace_active()) {
+        return -1;
+    }
+
+    size_t record_count = size_kb * 1024 / sizeof(trace_record_t);
+    if (record_count < TRACE_MIN_RECORDS) {
+        record_count = TRACE_MIN_RECORDS;
+    }
+    size_t total = sizeof(trace_file_header_t) + TRACE_SITE_CAPACITY * sizeof(trace_site_t) +
+                   record_count * sizeof(trace_record_t);
+
+    // A still-running predecessor keeps writing to the renamed inode.
+    char previous[PATH_MAX];
+    if (snprintf(previous, sizeof(previous), "%s.1", path) < (int)sizeof(previous)) {
+        if (rename(path, previous) != 0 && errno != ENOENT) {
+            LOG_WARN(COMPONENT, "Failed to keep previous trace %s: %s", path, strerror(errno));
+        }
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR(COMPONENT, "Failed to open trace %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)total) != 0) {
+        LOG_ERROR(COMPONENT, "Failed to size trace %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    void *mapping = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        LOG_ERROR(COMPONENT, "Failed to map trace %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    trace_header = mapping;
+    trace_sites = (trace_site_t *)(trace_header + 1);
+    trace_records = (trace_record_t *)(trace_sites + TRACE_SITE_CAPACITY);
+
+    memcpy(trace_header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    trace_header->version = TRACE_VERSION;
+    trace_header->record_size = sizeof(trace_record_t);
+    trace_header->record_count = (uint32_t)record_count;
+    trace_header->site_capacity = TRACE_SITE_CAPACITY;
+    atomic_init(&trace_header->site_count, 0);
+    atomic_init(&trace_header->next_seq, 0);
+
+    atomic_store_explicit(&trace_enabled, true, memory_order_release);
+    LOG_INFO(COMPONENT, "Tracing to %s (%zu records)", path, record_count);
+    return 0;
+}
+
+static unsigned int register_site(log_site_t *site)
+{
+    uint8_t types[TRACE_MAX_ARGS];
+    int arg_count = trace_format_parse(site->fmt, types, TRACE_MAX_ARGS);
+    if (arg_count < 0 || strlen(site->fmt) >= TRACE_FORMAT_MAX) {
+        return TRACE_SITE_UNTRACEABLE;
+    }
+
+    uint32_t index = atomic_fetch_add_explicit(&trace_header->site_count, 1, memory_order_relaxed);
+    if (index >= TRACE_SITE_CAPACITY) {
+        return TRACE_SITE_UNTRACEABLE;
+    }
+
+    trace_site_t *entry = &trace_sites[index];
+    entry->level = (uint8_t)site->level;
+    entry->arg_count = (uint8_t)arg_count;
+    memcpy(entry->arg_types, types, (size_t)arg_count);
+    snprintf(entry->component, sizeof(entry->component), "%s", site->component);
+    snprintf(entry->format, sizeof(entry->format), "%s", site->fmt);
+    atomic_store_explicit(&entry->ready, 1, memory_order_release);
+    return index + 1;
+}
+
+// Returns the 1-based site id, or 0 when this call should not be traced.
+static unsigned int site_id(log_site_t *site)
+{
+    unsigned int id = atomic_load_explicit(&site->trace_id, memory_order_acquire);
+    if (id == 0) {
+        if (!atomic_compare_exchange_strong(&site->trace_id, &id, TRACE_SITE_PENDING)) {
+            return (id == TRACE_SITE_PENDING || id == TRACE_SITE_UNTRACEABLE) ? 0 : id;
+        }
+        id = register_site(site);
+        atomic_store_explicit(&site->trace_id, id, memory_order_release);
+    }
+    return (id == TRACE_SITE_PENDING || id == TRACE_SITE_UNTRACEABLE) ? 0 : id;
+}
+
+static int encode_args(trace_record_t *record, const uint8_t *types, size_t count, va_list args)
+{
+    size_t used = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t raw = 0;
+        const char *text = NULL;
+
+        switch (types[i]) {
+        case TRACE_ARG_INT:
+            raw = (uint64_t)(int64_t)va_arg(args, int);
+            break;
+        case TRACE_ARG_UINT:
+            raw = va_arg(args, unsigned int);
+            break;
+        case TRACE_ARG_LONG:
+            raw = (uint64_t)(int64_t)va_arg(args, long);
+            break;
+        case TRACE_ARG_ULONG:
+            raw = va_arg(args, unsigned long);
+            break;
+        case TRACE_ARG_LLONG:
+            raw = (uint64_t)va_arg(args, long long);
+            break;
+        case TRACE_ARG_ULLONG:
+            raw = va_arg(args, unsigned long long);
+            break;
+        case TRACE_ARG_SIZE:
+            raw = va_arg(args, size_t);
+            break;
+        case TRACE_ARG_SSIZE:
+            raw = (uint64_t)(int64_t)va_arg(args, ptrdiff_t);
+            break;
+        case TRACE_ARG_DOUBLE: {
+            double value = va_arg(args, double);
+            memcpy(&raw, &value, sizeof(raw));
+            break;
+        }
+        case TRACE_ARG_STRING:
+            text = va_arg(args, const char *);
+            if (text == NULL) {
+                text = "(null)";
+            }
+            break;
+        case TRACE_ARG_POINTER:
+            raw = (uint64_t)(uintptr_t)va_arg(args, void *);
+            break;
+        default:
+            return -1;
+        }
+
+        if (text != NULL) {
+            size_t length = strnlen(text, TRACE_STRING_MAX);
+            if (used + 1 + length > TRACE_PAYLOAD_MAX) {
+                return -1;
+            }
+            record->payload[used++] = (unsigned char)length;
+            memcpy(record->payload + used, text, length);
+            used += length;
+        } else {
+            if (used + sizeof(raw) > TRACE_PAYLOAD_MAX) {
+                return -1;
+            }
+            memcpy(record->payload + used, &raw, sizeof(raw));
+            used += sizeof(raw);
+        }
+        record->payload_length = (uint8_t)used;
+    }
+    return 0;
+}
+
+void trace_record(log_site_t *site, va_list args)
+{
+    // trace_header is never NULL once tracing is active; checking it anyway
+    // lets profile-guided builds prove the mapping is there.
+    if (!trace_active() || site == NULL || trace_header == NULL) {
+        return;
+    }
+
+    unsigned int id = site_id(site);
+    if (id == 0) {
+        return;
+    }
+    const trace_site_t *entry = &trace_sites[id - 1];
+
+    if (thread_number == 0) {
+        thread_number = atomic_fetch_add_explicit(&next_thread_number, 1, memory_order_relaxed) + 1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    uint64_t seq = atomic_fetch_add_explicit(&trace_header->next_seq, 1, memory_order_relaxed);
+    trace_record_t *record = &trace_records[seq % trace_header->record_count];
+    atomic_store_explicit(&record->seq, 0, memory_order_relaxed);
+    // Keeps the payload stores below from becoming visible ahead of the zero,
+    // so a reader that sees the old seq again also saw the old payload.
+    atomic_thread_fence(memory_order_release);
+
+    record->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    record->thread = thread_number;
+    record->site = (uint16_t)id;
+    record->flags = 0;
+    record->payload_length = 0;
+    if (encode_args(record, entry->arg_types, entry->arg_count, args) != 0) {
+        record->flags |= TRACE_RECORD_TRUNCATED;
+    }
+
+    atomic_store_explicit(&record->seq, seq + 1, memory_order_release);
+}
@@ -0,0 +1,90 @@
+#include "trace_format.h"
+
+#include <string.h>
+
+static int integer_type(const char *length, char conversion)
+{
+    int is_unsigned = (conversion != 'd' && conversion != 'i');
+    if (strcmp(length, "") == 0 || strcmp(length, "h") == 0 || strcmp(length, "hh") == 0) {
+        return is_unsigned ? TRACE_ARG_UINT : TRACE_ARG_INT;
+    }
+    if (strcmp(length, "l") == 0) {
+        return is_unsigned ? TRACE_ARG_ULONG : TRACE_ARG_LONG;
+    }
+    if (strcmp(length, "ll") == 0 || strcmp(length, "j") == 0) {
+        return is_unsigned ? TRACE_ARG_ULLONG : TRACE_ARG_LLONG;
+    }
+    if (strcmp(length, "z") == 0 || strcmp(length, "t") == 0) {
+        return is_unsigned ? TRACE_ARG_SIZE : TRACE_ARG_SSIZE;
+    }
+    return -1;
+}
+
+int trace_format_parse(const char *fmt, uint8_t *types, size_t max_types)
+{
+    size_t count = 0;
+
+    for (const char *p = fmt; *p != '\0'; ++p) {
+        if (*p != '%') {
+            continue;
+        }
+        ++p;
+        if (*p == '%') {
+            continue;
+        }
+
+        while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+            ++p;
+        }
+        // Width and precision; '*' consumes an int argument.
+        while (*p != '\0' && (strchr("0123456789.*", *p) != NULL)) {
+            if (*p == '*') {
+                if (count >= max_types) {
+                    return -1;
+                }
+                types[count++] = TRACE_ARG_INT;
+            }
+            ++p;
+        }
+
+        char length[3] = {0};
+        size_t length_size = 0;
+        while (*p != '\0' && strchr("hljzt", *p) != NULL && length_size < 2) {
+            length[length_size++] = *p++;
+        }
+
+        int type;
+        switch (*p) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+            type = integer_type(length, *p);
+            break;
+        case 'f':
+        case 'e':
+        case 'g':
+            type = (length_size == 0 || strcmp(length, "l") == 0) ? TRACE_ARG_DOUBLE : -1;
+            break;
+        case 's':
+            type = (length_size == 0) ? TRACE_ARG_STRING : -1;
+            break;
+        case 'p':
+            type = TRACE_ARG_POINTER;
+            break;
+        default:
+            type = -1;
+            break;
+        }
+
+        if (type < 0 || count >= max_types) {
+            return -1;
+        }
+        types[count++] = (uint8_t)type;
+    }
+
+    return (int)count;
+}
@@ -0,0 +1,75 @@
+#include "unix_socket.h"
+
+#include "log.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define COMPONENT "unix"
+
+static int fill_address(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (path == NULL || path[0] == '\0' || strlen(path) >= sizeof(addr->sun_path)) {
+        return -1;
+    }
+    strncpy(addr->sun_path, path, sizeof(addr->sun_path) - 1);
+    return 0;
+}
+
+int unix_socket_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    if (fill_address(&addr, path) != 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int unix_socket_listen(const char *path, mode_t mode, bool replace)
+{
+    struct sockaddr_un addr;
+    if (fill_address(&addr, path) != 0) {
+        LOG_ERROR(COMPONENT, "Invalid socket path '%s'", path != NULL ? path : "");
+        return -1;
+    }
+
+    if (!replace) {
+        int existing = unix_socket_connect(path);
+        if (existing >= 0) {
+            close(existing);
+            LOG_ERROR(COMPONENT, "Another process already serves %s", path);
+            return -1;
+        }
+    }
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LOG_ERROR(COMPONENT, "socket failed: %s", strerror(errno));
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        LOG_ERROR(COMPONENT, "Unable to listen on %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    chmod(path, mode);
+    return fd;
+}
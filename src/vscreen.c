@@ -0,0 +1,523 @@
+#include "vscreen.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CURSOR_UNKNOWN UINT32_MAX
+#define ATTR_UNKNOWN 0xffu
+#define STALE_NONE UINT32_MAX
+
+typedef struct {
+    char glyph[4];
+    unsigned char length;
+    // 1 or 2 columns; 0 marks the right half of a wide glyph.
+    unsigned char width;
+    unsigned char attr;
+} cell_t;
+
+struct vscreen {
+    unsigned int width;
+    unsigned int height;
+    cell_t *back;
+    // What the terminal shows, as far as we know.
+    cell_t *front;
+    // First column of each row the terminal may no longer match, or
+    // STALE_NONE.
+    unsigned int *stale_from;
+    bool repaint;
+    unsigned int cursor_x;
+    unsigned int cursor_y;
+    uint32_t term_x;
+    uint32_t term_y;
+    unsigned int term_attr;
+    char *out;
+    size_t out_length;
+    size_t out_capacity;
+    bool out_failed;
+};
+
+static const cell_t blank_cell = {{' '}, 1, 1, 0};
+// Never equal to a drawable cell, so whatever the back buffer holds there is
+// sent again.
+static const cell_t unknown_cell = {{0}, 0, 1, ATTR_UNKNOWN};
+
+static bool cell_equal(const cell_t *left, const cell_t *right)
+{
+    return left->length == right->length && left->width == right->width && left->attr == right->attr &&
+           memcmp(left->glyph, right->glyph, left->length) == 0;
+}
+
+static void fill(cell_t *cells, size_t count, const cell_t *value)
+{
+    for (size_t i = 0; i < count; ++i) {
+        cells[i] = *value;
+    }
+}
+
+vscreen_t *vscreen_create(unsigned int width, unsigned int height)
+{
+    vscreen_t *screen = calloc(1, sizeof(*screen));
+    if (screen == NULL) {
+        return NULL;
+    }
+    if (vscreen_resize(screen, width, height) != 0) {
+        free(screen);
+        return NULL;
+    }
+    return screen;
+}
+
+void vscreen_destroy(vscreen_t *screen)
+{
+    if (screen == NULL) {
+        return;
+    }
+    free(screen->back);
+    free(screen->front);
+    free(screen->stale_from);
+    free(screen->out);
+    free(screen);
+}
+
+int vscreen_resize(vscreen_t *screen, unsigned int width, unsigned int height)
+{
+    if (screen == NULL || width == 0 || height == 0) {
+        return -1;
+    }
+    size_t cells = (size_t)width * height;
+    cell_t *back = malloc(cells * sizeof(*back));
+    cell_t *front = malloc(cells * sizeof(*front));
+    unsigned int *stale_from = malloc(height * sizeof(*stale_from));
+    if (back == NULL || front == NULL || stale_from == NULL) {
+        free(back);
+        free(front);
+        free(stale_from);
+        return -1;
+    }
+    free(screen->back);
+    free(screen->front);
+    free(screen->stale_from);
+    screen->back = back;
+    screen->front = front;
+    screen->stale_from = stale_from;
+    screen->width = width;
+    screen->height = height;
+    screen->cursor_x = 0;
+    screen->cursor_y = 0;
+    fill(screen->back, cells, &blank_cell);
+    for (unsigned int y = 0; y < height; ++y) {
+        screen->stale_from[y] = STALE_NONE;
+    }
+    vscreen_invalidate(screen);
+    return 0;
+}
+
+unsigned int vscreen_width(const vscreen_t *screen)
+{
+    return screen != NULL ? screen->width : 0;
+}
+
+unsigned int vscreen_height(const vscreen_t *screen)
+{
+    return screen != NULL ? screen->height : 0;
+}
+
+void vscreen_invalidate(vscreen_t *screen)
+{
+    if (screen == NULL) {
+        return;
+    }
+    screen->repaint = true;
+    screen->term_x = CURSOR_UNKNOWN;
+    screen->term_y = CURSOR_UNKNOWN;
+    screen->term_attr = ATTR_UNKNOWN;
+}
+
+void vscreen_invalidate_row(vscreen_t *screen, unsigned int row, unsigned int column)
+{
+    if (screen == NULL || row >= screen->height || column >= screen->width) {
+        return;
+    }
+    if (screen->stale_from[row] > column) {
+        screen->stale_from[row] = column;
+    }
+    screen->term_x = CURSOR_UNKNOWN;
+    screen->term_y = CURSOR_UNKNOWN;
+}
+
+void vscreen_clear(vscreen_t *screen)
+{
+    if (screen != NULL) {
+        fill(screen->back, (size_t)screen->width * screen->height, &blank_cell);
+    }
+}
+
+void vscreen_move(vscreen_t *screen, unsigned int x, unsigned int y)
+{
+    if (screen == NULL) {
+        return;
+    }
+    screen->cursor_x = x < screen->width ? x : screen->width - 1;
+    screen->cursor_y = y < screen->height ? y : screen->height - 1;
+}
+
+// Decodes one UTF-8 sequence; returns its length, or 0 with *codepoint unset
+// when it is malformed.
+static size_t decode_utf8(const unsigned char *text, uint32_t *codepoint)
+{
+    unsigned char lead = text[0];
+    size_t length;
+    uint32_t value;
+    if (lead < 0x80) {
+        *codepoint = lead;
+        return 1;
+    } else if ((lead & 0xe0) == 0xc0) {
+        length = 2;
+        value = lead & 0x1f;
+    } else if ((lead & 0xf0) == 0xe0) {
+        length = 3;
+        value = lead & 0x0f;
+    } else if ((lead & 0xf8) == 0xf0) {
+        length = 4;
+        value = lead & 0x07;
+    } else {
+        return 0;
+    }
+    for (size_t i = 1; i < length; ++i) {
+        if ((text[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        value = (value << 6) | (text[i] & 0x3f);
+    }
+    static const uint32_t minimum[] = {0, 0, 0x80, 0x800, 0x10000};
+    if (value < minimum[length] || value > 0x10ffff || (value >= 0xd800 && value <= 0xdfff)) {
+        return 0;
+    }
+    *codepoint = value;
+    return length;
+}
+
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} range_t;
+
+static bool in_ranges(uint32_t codepoint, const range_t *ranges, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (codepoint >= ranges[i].first && codepoint <= ranges[i].last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Terminal columns for one character: 0 for combining marks (including the
+// Hangul medial and final jamo), 2 for East Asian wide and fullwidth forms.
+// Ambiguous-width characters such as box drawing count as 1.
+static unsigned int char_width(uint32_t codepoint)
+{
+    static const range_t zero[] = {
+        {0x0300, 0x036f}, {0x1160, 0x11ff}, {0x1ab0, 0x1aff}, {0x1dc0, 0x1dff}, {0x200b, 0x200f},
+        {0x20d0, 0x20ff}, {0xd7b0, 0xd7ff}, {0xfe00, 0xfe0f}, {0xfe20, 0xfe2f},
+    };
+    static const range_t wide[] = {
+        {0x1100, 0x115f},   {0x2e80, 0x303e},   {0x3041, 0x33ff},   {0x3400, 0x4dbf}, {0x4e00, 0x9fff},
+        {0xa000, 0xa4cf},   {0xa960, 0xa97f},   {0xac00, 0xd7a3},   {0xf900, 0xfaff}, {0xfe30, 0xfe4f},
+        {0xff00, 0xff60},   {0xffe0, 0xffe6},   {0x1f300, 0x1f64f}, {0x1f900, 0x1f9ff}, {0x20000, 0x3fffd},
+    };
+    if (codepoint < 0x1100) {
+        return (codepoint >= 0x0300 && codepoint <= 0x036f) ? 0 : 1;
+    }
+    if (in_ranges(codepoint, zero, sizeof(zero) / sizeof(zero[0]))) {
+        return 0;
+    }
+    return in_ranges(codepoint, wide, sizeof(wide) / sizeof(wide[0])) ? 2 : 1;
+}
+
+static bool is_control(uint32_t codepoint)
+{
+    return codepoint < 0x20 || (codepoint >= 0x7f && codepoint < 0xa0);
+}
+
+unsigned int vscreen_text_width(const char *text)
+{
+    if (text == NULL) {
+        return 0;
+    }
+    unsigned int columns = 0;
+    const unsigned char *p = (const unsigned char *)text;
+    while (*p != '\0') {
+        uint32_t codepoint = '?';
+        size_t length = decode_utf8(p, &codepoint);
+        columns += (length == 0 || is_control(codepoint)) ? 1 : char_width(codepoint);
+        p += length > 0 ? length : 1;
+    }
+    return columns;
+}
+
+size_t vscreen_text_fit(const char *text, unsigned int columns)
+{
+    if (text == NULL) {
+        return 0;
+    }
+    unsigned int used = 0;
+    const unsigned char *p = (const unsigned char *)text;
+    while (*p != '\0') {
+        uint32_t codepoint = '?';
+        size_t length = decode_utf8(p, &codepoint);
+        unsigned int width = (length == 0 || is_control(codepoint)) ? 1 : char_width(codepoint);
+        if (used + width > columns) {
+            break;
+        }
+        used += width;
+        p += length > 0 ? length : 1;
+    }
+    return (size_t)(p - (const unsigned char *)text);
+}
+
+static cell_t *back_cell(vscreen_t *screen, unsigned int x, unsigned int y)
+{
+    return &screen->back[(size_t)y * screen->width + x];
+}
+
+// Keeps wide glyphs whole: overwriting either half of one blanks the other.
+static void put_cell(vscreen_t *screen, unsigned int x, unsigned int y, const cell_t *cell)
+{
+    cell_t *row = back_cell(screen, 0, y);
+    unsigned int end = x + cell->width;
+    if (row[x].width == 0 && x > 0) {
+        row[x - 1] = blank_cell;
+    }
+    if (end < screen->width && row[end].width == 0) {
+        row[end] = blank_cell;
+    }
+    row[x] = *cell;
+    if (cell->width == 2) {
+        row[x + 1] = (cell_t){{0}, 0, 0, cell->attr};
+    }
+}
+
+unsigned int vscreen_print(vscreen_t *screen, unsigned int x, unsigned int y, unsigned int attr, const char *text)
+{
+    if (screen == NULL || text == NULL || y >= screen->height) {
+        return x;
+    }
+    const unsigned char *p = (const unsigned char *)text;
+    while (*p != '\0' && x < screen->width) {
+        uint32_t codepoint = '?';
+        size_t length = decode_utf8(p, &codepoint);
+        cell_t cell = {{'?'}, 1, 1, (unsigned char)attr};
+        if (length > 0 && !is_control(codepoint)) {
+            unsigned int width = char_width(codepoint);
+            if (width == 0) {
+                p += length;
+                continue;
+            }
+            if (x + width > screen->width) {
+                cell.glyph[0] = ' ';
+            } else {
+                memcpy(cell.glyph, p, length);
+                cell.length = (unsigned char)length;
+                cell.width = (unsigned char)width;
+            }
+        }
+        put_cell(screen, x, y, &cell);
+        x += cell.width;
+        p += length > 0 ? length : 1;
+    }
+    return x;
+}
+
+static void emit(vscreen_t *screen, const char *data, size_t length)
+{
+    if (screen->out_failed) {
+        return;
+    }
+    if (screen->out_length + length > screen->out_capacity) {
+        size_t capacity = screen->out_capacity ? screen->out_capacity : 1024;
+        while (capacity < screen->out_length + length) {
+            capacity *= 2;
+        }
+        char *grown = realloc(screen->out, capacity);
+        if (grown == NULL) {
+            screen->out_failed = true;
+            return;
+        }
+        screen->out = grown;
+        screen->out_capacity = capacity;
+    }
+    memcpy(screen->out + screen->out_length, data, length);
+    screen->out_length += length;
+}
+
+static void emit_text(vscreen_t *screen, const char *text)
+{
+    emit(screen, text, strlen(text));
+}
+
+static void set_attr(vscreen_t *screen, unsigned int attr)
+{
+    if (screen->term_attr == attr) {
+        return;
+    }
+    char sequence[16];
+    snprintf(sequence, sizeof(sequence), "\x1b[0%s%sm", (attr & VSCREEN_BOLD) ? ";1" : "",
+             (attr & VSCREEN_REVERSE) ? ";7" : "");
+    emit_text(screen, sequence);
+    screen->term_attr = attr;
+}
+
+// Bytes needed to reach x by re-sending the unchanged cells in between, or
+// SIZE_MAX when that would change what they show.
+static size_t gap_cost(const vscreen_t *screen, unsigned int x, unsigned int y)
+{
+    const cell_t *back = &screen->back[(size_t)y * screen->width];
+    if (x < screen->width && back[x].width == 0) {
+        return SIZE_MAX;
+    }
+    size_t bytes = 0;
+    for (unsigned int i = screen->term_x; i < x; ++i) {
+        if (back[i].attr != screen->term_attr || (back[i].width == 0 && i == screen->term_x)) {
+            return SIZE_MAX;
+        }
+        bytes += back[i].length;
+    }
+    return bytes;
+}
+
+// Picks the shortest way to get the cursor there from where the terminal has
+// it, including just re-sending a short run of unchanged cells.
+static void move_to(vscreen_t *screen, unsigned int x, unsigned int y)
+{
+    if (screen->term_x == x && screen->term_y == y) {
+        return;
+    }
+    char best[32];
+    if (x == 0 && y == 0) {
+        snprintf(best, sizeof(best), "\x1b[H");
+    } else {
+        snprintf(best, sizeof(best), "\x1b[%u;%uH", y + 1, x + 1);
+    }
+
+    if (screen->term_x != CURSOR_UNKNOWN) {
+        char candidate[32] = "";
+        if (y == screen->term_y) {
+            if (x == 0) {
+                snprintf(candidate, sizeof(candidate), "\r");
+            } else if (x + 1 == screen->term_x) {
+                snprintf(candidate, sizeof(candidate), "\b");
+            } else if (x > screen->term_x) {
+                snprintf(candidate, sizeof(candidate), "\x1b[%uC", x - screen->term_x);
+            } else {
+                snprintf(candidate, sizeof(candidate), "\x1b[%uD", screen->term_x - x);
+            }
+        } else if (y == screen->term_y + 1 && x == 0) {
+            snprintf(candidate, sizeof(candidate), "\r\n");
+        } else if (y > screen->term_y && x == screen->term_x) {
+            snprintf(candidate, sizeof(candidate), "\x1b[%uB", y - screen->term_y);
+        }
+        if (candidate[0] != '\0' && strlen(candidate) < strlen(best)) {
+            memcpy(best, candidate, sizeof(best));
+        }
+        if (y == screen->term_y && x > screen->term_x && gap_cost(screen, x, y) < strlen(best)) {
+            const cell_t *back = &screen->back[(size_t)y * screen->width];
+            for (unsigned int i = screen->term_x; i < x; ++i) {
+                emit(screen, back[i].glyph, back[i].length);
+            }
+            screen->term_x = x;
+            return;
+        }
+    }
+    emit_text(screen, best);
+    screen->term_x = x;
+    screen->term_y = y;
+}
+
+static void flush_row(vscreen_t *screen, unsigned int y)
+{
+    cell_t *back = back_cell(screen, 0, y);
+    cell_t *front = &screen->front[(size_t)y * screen->width];
+    unsigned int stale = screen->stale_from[y];
+    if (stale != STALE_NONE) {
+        move_to(screen, stale, y);
+        set_attr(screen, 0);
+        emit_text(screen, stale == 0 ? "\x1b[2K" : "\x1b[K");
+        // Erasing from the right half of a wide glyph leaves its left half
+        // in an unknown state.
+        if (stale > 0 && front[stale].width == 0) {
+            front[stale - 1] = unknown_cell;
+        }
+        fill(front + stale, screen->width - stale, &blank_cell);
+        screen->stale_from[y] = STALE_NONE;
+    }
+
+    for (unsigned int x = 0; x < screen->width; ++x) {
+        if (cell_equal(&back[x], &front[x])) {
+            continue;
+        }
+        if (back[x].width == 0 && x > 0) {
+            // Only reachable when the left half already matched, which
+            // cannot happen with a consistent front buffer; redraw the pair.
+            x--;
+        }
+        unsigned int width = back[x].width;
+        move_to(screen, x, y);
+        set_attr(screen, back[x].attr);
+        emit(screen, back[x].glyph, back[x].length);
+        front[x] = back[x];
+        if (width == 2) {
+            front[x + 1] = back[x + 1];
+        }
+        // The terminal blanks a wide glyph when half of it is overwritten.
+        if (x + width < screen->width && front[x + width].width == 0) {
+            front[x + width] = unknown_cell;
+        }
+        screen->term_x += width;
+        if (screen->term_x >= screen->width) {
+            // Pending wrap: where the next character goes depends on the
+            // terminal.
+            screen->term_x = CURSOR_UNKNOWN;
+            screen->term_y = CURSOR_UNKNOWN;
+        }
+        x += width - 1;
+    }
+}
+
+size_t vscreen_flush(vscreen_t *screen, FILE *out)
+{
+    if (screen == NULL || out == NULL) {
+        return 0;
+    }
+    screen->out_length = 0;
+    screen->out_failed = false;
+
+    if (screen->repaint) {
+        emit_text(screen, "\x1b[0m\x1b[H\x1b[2J");
+        fill(screen->front, (size_t)screen->width * screen->height, &blank_cell);
+        for (unsigned int y = 0; y < screen->height; ++y) {
+            screen->stale_from[y] = STALE_NONE;
+        }
+        screen->term_x = 0;
+        screen->term_y = 0;
+        screen->term_attr = 0;
+        screen->repaint = false;
+    }
+    for (unsigned int y = 0; y < screen->height; ++y) {
+        flush_row(screen, y);
+    }
+    set_attr(screen, 0);
+    move_to(screen, screen->cursor_x, screen->cursor_y);
+
+    if (screen->out_failed) {
+        // Part of the frame is missing; start over next time.
+        vscreen_invalidate(screen);
+        return 0;
+    }
+    // Session streams are unbuffered, so the frame goes out as one write.
+    size_t written = fwrite(screen->out, 1, screen->out_length, out);
+    fflush(out);
+    return written;
+}
@@ -0,0 +1,239 @@
+#include "wire.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Keepalive probes after WIRE_KEEPALIVE_IDLE_S idle seconds, then every
+// WIRE_KEEPALIVE_INTERVAL_S; WIRE_KEEPALIVE_COUNT unanswered ones drop the
+// link. Unacknowledged data gives up after WIRE_USER_TIMEOUT_MS.
+#define WIRE_KEEPALIVE_IDLE_S 15
+#define WIRE_KEEPALIVE_INTERVAL_S 5
+#define WIRE_KEEPALIVE_COUNT 3
+#define WIRE_USER_TIMEOUT_MS 30000
+
+void wire_configure(int fd)
+{
+    int one = 1;
+    int idle = WIRE_KEEPALIVE_IDLE_S;
+    int interval = WIRE_KEEPALIVE_INTERVAL_S;
+    int count = WIRE_KEEPALIVE_COUNT;
+    unsigned int user_timeout = WIRE_USER_TIMEOUT_MS;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout));
+}
+
+// Connects without blocking for longer than timeout_ms, then puts the socket
+// back in blocking mode.
+static int connect_within(int fd, const struct sockaddr *addr, socklen_t addrlen, unsigned int timeout_ms)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        return -1;
+    }
+    if (connect(fd, addr, addrlen) != 0) {
+        if (errno != EINPROGRESS) {
+            return -1;
+        }
+        struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+        int ready;
+        do {
+            ready = poll(&pfd, 1, (int)timeout_ms);
+        } while (ready < 0 && errno == EINTR);
+        if (ready == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (ready < 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0) {
+            return -1;
+        }
+        if (error != 0) {
+            errno = error;
+            return -1;
+        }
+    }
+    return fcntl(fd, F_SETFL, flags);
+}
+
+int wire_connect(const char *host, unsigned short port, unsigned int timeout_ms)
+{
+    char port_str[6];
+    snprintf(port_str, sizeof(port_str), "%u", port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *result = NULL;
+    if (getaddrinfo(host, port_str, &hints, &result) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *res = result; res != NULL; res = res->ai_next) {
+        fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect_within(fd, res->ai_addr, res->ai_addrlen, timeout_ms) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    if (fd >= 0) {
+        wire_configure(fd);
+    }
+    return fd;
+}
+
+int wire_send(int fd, uint8_t type, const void *payload, size_t length)
+{
+    if (length > WIRE_PAYLOAD_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    unsigned char header[WIRE_HEADER_SIZE];
+    wire_put_u32(header, (uint32_t)length);
+    header[4] = type;
+
+    // One writev per frame keeps header and payload in one segment.
+    struct iovec iov[2] = {
+        {.iov_base = header, .iov_len = sizeof(header)},
+        {.iov_base = (void *)payload, .iov_len = length},
+    };
+    struct iovec *next = iov;
+    int remaining = length > 0 ? 2 : 1;
+    while (remaining > 0) {
+        ssize_t written = writev(fd, next, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (remaining > 0 && (size_t)written >= next->iov_len) {
+            written -= (ssize_t)next->iov_len;
+            next++;
+            remaining--;
+        }
+        if (remaining > 0) {
+            next->iov_base = (char *)next->iov_base + written;
+            next->iov_len -= (size_t)written;
+        }
+    }
+    return 0;
+}
+
+// 0 once size bytes are read, 1 on end of stream before the first byte.
+static int read_exact(int fd, void *buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, (char *)buffer + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            return done == 0 ? 1 : -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+int wire_receive(int fd, uint8_t *type, void *buffer, size_t size, size_t *length)
+{
+    unsigned char header[WIRE_HEADER_SIZE];
+    int rc = read_exact(fd, header, sizeof(header));
+    if (rc != 0) {
+        return rc;
+    }
+    size_t offset = 0;
+    uint32_t payload_length = 0;
+    wire_get_u32(header, sizeof(header), &offset, &payload_length);
+    if (payload_length > size || payload_length > WIRE_PAYLOAD_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    *type = header[4];
+    *length = payload_length;
+    return payload_length > 0 && read_exact(fd, buffer, payload_length) != 0 ? -1 : 0;
+}
+
+void wire_put_u16(unsigned char *out, uint16_t value)
+{
+    out[0] = (unsigned char)(value >> 8);
+    out[1] = (unsigned char)value;
+}
+
+void wire_put_u32(unsigned char *out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        out[i] = (unsigned char)(value >> (24 - 8 * i));
+    }
+}
+
+void wire_put_u64(unsigned char *out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i) {
+        out[i] = (unsigned char)(value >> (56 - 8 * i));
+    }
+}
+
+static int get_bytes(const unsigned char *payload, size_t length, size_t *offset, size_t width, uint64_t *value)
+{
+    if (*offset > length || length - *offset < width) {
+        return -1;
+    }
+    uint64_t result = 0;
+    for (size_t i = 0; i < width; ++i) {
+        result = (result << 8) | payload[*offset + i];
+    }
+    *offset += width;
+    *value = result;
+    return 0;
+}
+
+int wire_get_u16(const unsigned char *payload, size_t length, size_t *offset, uint16_t *value)
+{
+    uint64_t result = 0;
+    if (get_bytes(payload, length, offset, 2, &result) != 0) {
+        return -1;
+    }
+    *value = (uint16_t)result;
+    return 0;
+}
+
+int wire_get_u32(const unsigned char *payload, size_t length, size_t *offset, uint32_t *value)
+{
+    uint64_t result = 0;
+    if (get_bytes(payload, length, offset, 4, &result) != 0) {
+        return -1;
+    }
+    *value = (uint32_t)result;
+    return 0;
+}
+
+int wire_get_u64(const unsigned char *payload, size_t length, size_t *offset, uint64_t *value)
+{
+    return get_bytes(payload, length, offset, 8, value);
+}
@@ -0,0 +1,77 @@
+#!/bin/sh
+# End-to-end benchmark behind `make bench`: starts ./maum on a private
+# localhost port with a throwaway board, runs maum-loadgen against it and
+# reports the server's CPU time and memory alongside the latency table.
+#
+#   tools/bench.sh --clients 100 --duration 20 --mix chat=70,list=20,post=10
+#
+# Options are passed to maum-loadgen unchanged; BENCH_PORT picks the port.
+set -eu
+
+PORT=${BENCH_PORT:-24323}
+WORKDIR=$(mktemp -d "${TMPDIR:-/tmp}/maum-bench.XXXXXX")
+SERVER_PID=
+
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+    fi
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT INT TERM
+
+cat > "$WORKDIR/bench.conf" <<EOF
+telnet_host=127.0.0.1
+telnet_port=$PORT
+motd_path=$WORKDIR/motd.txt
+board_path=$WORKDIR/posts.db
+mailbox_dir=$WORKDIR/mail
+library_dir=$WORKDIR/library
+cursor_path=$WORKDIR/cursors.db
+broker_socket_path=
+upgrade_socket_path=
+admin_socket_path=
+login_timeout=0
+idle_timeout=0
+chat_idle_timeout=0
+log_level=warn
+EOF
+echo "마음 BBS 벤치마크" > "$WORKDIR/motd.txt"
+
+./maum --config "$WORKDIR/bench.conf" > "$WORKDIR/server.log" 2>&1 &
+SERVER_PID=$!
+
+# utime + stime in clock ticks (fields 14 and 15 of /proc/<pid>/stat).
+cpu_ticks() {
+    sed 's/^.*) //' "/proc/$SERVER_PID/stat" | awk '{ print $12 + $13 }'
+}
+
+status_kb() {
+    awk -v key="$1:" '$1 == key { print $2 }' "/proc/$SERVER_PID/status"
+}
+
+sleep 0.2
+START_TICKS=$(cpu_ticks)
+START_NS=$(date +%s%N)
+
+STATUS=0
+tools/maum-loadgen --port "$PORT" "$@" || STATUS=$?
+
+END_NS=$(date +%s%N)
+END_TICKS=$(cpu_ticks)
+HZ=$(getconf CLK_TCK)
+
+awk -v ticks=$((END_TICKS - START_TICKS)) -v hz="$HZ" -v ns=$((END_NS - START_NS)) \
+    -v rss="$(status_kb VmRSS)" -v hwm="$(status_kb VmHWM)" 'BEGIN {
+    cpu = ticks / hz
+    wall = ns / 1e9
+    printf "server   cpu %.2f s over %.1f s wall (%.0f%% of one core), rss %.1f MiB, peak rss %.1f MiB\n",
+           cpu, wall, 100 * cpu / wall, rss / 1024, hwm / 1024
+}'
+
+if [ "$STATUS" -ne 0 ]; then
+    echo "loadgen reported errors; server log:" >&2
+    tail -n 20 "$WORKDIR/server.log" >&2
+fi
+exit "$STATUS"
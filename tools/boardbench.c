@@ -0,0 +1,480 @@
+// Board storage microbenchmark. Generates boards of increasing size with
+// Korean UTF-8 posts of varied length and times every board operation on
+// each storage backend:
+//
+//   maum-boardbench --sizes 1000,10000,100000,1000000 --repeat 3
+//
+// open     board_create(), which scans the file to index post offsets (load_index)
+// scan     board_stats(), which parses every line without keeping it (parse_line)
+// list     board_list(), materializing every post
+// since    board_list_since() of the newest SINCE_POSTS posts
+// add      board_add() of one post
+// remove   board_remove() of a post in the middle of the board
+//
+// "cold" is the first run after the board's pages were dropped from the page
+// cache, "warm" the median of --repeat runs after that. list runs in a child
+// process so its peak RSS can be reported on its own.
+#include "board.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define SIZES_MAX 16
+#define REPEAT_MAX 32
+#define ADDS_PER_RUN 100
+#define SINCE_POSTS 20
+
+typedef struct {
+    const char *name;
+    // Writes a board of count posts at path in the backend's own format.
+    int (*generate)(const char *path, size_t count);
+} backend_t;
+
+typedef struct {
+    double cold_ms;
+    double warm_ms;
+    long peak_rss_kb;
+} timing_t;
+
+// board is an already opened board, or NULL for open, which times opening it.
+typedef int (*operation_fn)(board_t *board, const char *path, size_t count, unsigned int run);
+
+static struct {
+    size_t sizes[SIZES_MAX];
+    size_t size_count;
+    unsigned int repeat;
+    const char *dir;
+} options = {{1000, 10000, 100000, 1000000}, 4, 3, NULL};
+
+static const char *const phrases[] = {
+    "안녕하세요", "오늘", "날씨가", "정말", "좋네요", "마음 BBS", "게시판에", "처음으로", "글을", "남깁니다",
+    "다들", "잘", "지내시죠?", "주말에", "산책을", "다녀왔어요", "커피", "한 잔", "하면서", "읽고", "있습니다",
+    "새로운", "기능이", "추가되었다고", "들었어요", "감사합니다!", "ㅎㅎ", "채팅방에서", "만나요", "질문이",
+    "있는데요,", "혹시", "아시는 분", "계신가요?", "텔넷으로", "접속하니", "옛날 생각이", "나네요", "2024년",
+    "서울", "부산", "비가", "와서", "집에", "있어요", "점심", "메뉴", "추천", "부탁드려요", "😊",
+};
+
+static const char *const authors[] = {
+    "마음이", "별빛", "guest", "하늘바라기", "sysop", "달팽이", "bbs_fan", "초보", "바람", "kim", "이웃집토토로",
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint32_t next_random(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 32);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Whole phrases only, so the content stays valid UTF-8 at any length.
+static void random_content(char *buffer, size_t size)
+{
+    size_t target = 16 + next_random() % (size - 32);
+    size_t length = 0;
+    buffer[0] = '\0';
+    while (length < target) {
+        const char *phrase = phrases[next_random() % (sizeof(phrases) / sizeof(phrases[0]))];
+        size_t phrase_length = strlen(phrase);
+        if (length + phrase_length + 2 >= size) {
+            break;
+        }
+        if (length > 0) {
+            buffer[length++] = ' ';
+        }
+        memcpy(buffer + length, phrase, phrase_length + 1);
+        length += phrase_length;
+    }
+}
+
+static int generate_flat_file(const char *path, size_t count)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    time_t stamp = 1700000000;
+    char content[BOARD_CONTENT_MAX];
+    char timestamp[BOARD_TIMESTAMP_MAX];
+    for (size_t i = 1; i <= count; ++i) {
+        stamp += next_random() % 600;
+        struct tm tm_stamp;
+        localtime_r(&stamp, &tm_stamp);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M", &tm_stamp);
+        random_content(content, sizeof(content));
+        fprintf(file, "%zu|%s|%s|%s\n", i, timestamp, authors[next_random() % (sizeof(authors) / sizeof(authors[0]))],
+                content);
+    }
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        fclose(file);
+        return -1;
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+// Every storage engine the board can run on. A new backend adds its generator
+// here and is measured on the same operations and sizes.
+static const backend_t backends[] = {
+    {"flat-file", generate_flat_file},
+};
+
+static void drop_cache(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static int operation_open(board_t *board, const char *path, size_t count, unsigned int run)
+{
+    (void)board;
+    (void)count;
+    (void)run;
+    board_t *opened = board_create(path);
+    if (opened == NULL) {
+        return -1;
+    }
+    board_destroy(opened);
+    return 0;
+}
+
+static int operation_list(board_t *board, const char *path, size_t count, unsigned int run)
+{
+    (void)path;
+    (void)run;
+    board_post_t *posts = NULL;
+    size_t listed = 0;
+    int rc = board_list(board, &posts, &listed);
+    free(posts);
+    return rc == 0 && listed == count ? 0 : -1;
+}
+
+static int operation_since(board_t *board, const char *path, size_t count, unsigned int run)
+{
+    (void)path;
+    (void)run;
+    size_t expected = count < SINCE_POSTS ? count : SINCE_POSTS;
+    board_post_t *posts = NULL;
+    size_t listed = 0;
+    int rc = board_list_since(board, (unsigned int)(count - expected), &posts, &listed);
+    free(posts);
+    return rc == 0 && listed == expected ? 0 : -1;
+}
+
+static int operation_scan(board_t *board, const char *path, size_t count, unsigned int run)
+{
+    (void)path;
+    (void)run;
+    board_stats_t stats;
+    int rc = board_stats(board, &stats);
+    return rc == 0 && stats.posts == count ? 0 : -1;
+}
+
+static int operation_add(board_t *board, const char *path, size_t count, unsigned int run)
+{
+    (void)path;
+    (void)count;
+    (void)run;
+    char content[BOARD_CONTENT_MAX];
+    random_content(content, sizeof(content));
+    return board_add(board, "benchmark", content, NULL);
+}
+
+static int operation_remove(board_t *board, const char *path, size_t count, unsigned int run)
+{
+    (void)path;
+    return board_remove(board, (unsigned int)(count / 2 + run + 1), NULL, NULL);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double left = *(const double *)a;
+    double right = *(const double *)b;
+    return (left > right) - (left < right);
+}
+
+static int timed_runs(operation_fn operation, board_t *board, const char *path, size_t count, timing_t *timing)
+{
+    unsigned int run = 0;
+    drop_cache(path);
+    uint64_t started = now_ns();
+    if (operation(board, path, count, run++) != 0) {
+        return -1;
+    }
+    timing->cold_ms = (double)(now_ns() - started) / 1e6;
+
+    if (operation(board, path, count, run++) != 0) {
+        return -1;
+    }
+    double samples[REPEAT_MAX];
+    for (unsigned int i = 0; i < options.repeat; ++i) {
+        started = now_ns();
+        if (operation(board, path, count, run++) != 0) {
+            return -1;
+        }
+        samples[i] = (double)(now_ns() - started) / 1e6;
+    }
+    qsort(samples, options.repeat, sizeof(samples[0]), compare_double);
+    timing->warm_ms = samples[options.repeat / 2];
+    return 0;
+}
+
+// Times one cold run, one untimed warm-up and --repeat warm runs. Every
+// operation but open runs on a board opened beforehand, so the id scan in
+// board_create() is only counted once. Returns -1 if any run failed.
+static int measure(operation_fn operation, const char *path, size_t count, timing_t *timing)
+{
+    if (operation == operation_open) {
+        return timed_runs(operation, NULL, path, count, timing);
+    }
+    board_t *board = board_create(path);
+    if (board == NULL) {
+        return -1;
+    }
+    int rc = timed_runs(operation, board, path, count, timing);
+    board_destroy(board);
+    return rc;
+}
+
+// A single add is too quick to time, so cold and warm are each the average of
+// ADDS_PER_RUN adds; cold ones drop the cache before every add.
+static int measure_add(const char *path, size_t count, timing_t *timing)
+{
+    board_t *board = board_create(path);
+    if (board == NULL) {
+        return -1;
+    }
+    double totals[2] = {0, 0};
+    for (int warm = 0; warm < 2; ++warm) {
+        for (unsigned int i = 0; i < ADDS_PER_RUN; ++i) {
+            if (!warm) {
+                drop_cache(path);
+            }
+            uint64_t started = now_ns();
+            if (operation_add(board, path, count, i) != 0) {
+                board_destroy(board);
+                return -1;
+            }
+            totals[warm] += (double)(now_ns() - started) / 1e6;
+        }
+    }
+    board_destroy(board);
+    timing->cold_ms = totals[0] / ADDS_PER_RUN;
+    timing->warm_ms = totals[1] / ADDS_PER_RUN;
+    return 0;
+}
+
+static long self_rss_kb(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Runs list in a child so the parent's heap does not hide its peak RSS. The
+// child reports its timings and peak RSS through a pipe.
+static int measure_list(const char *path, size_t count, timing_t *timing)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (child == 0) {
+        close(fds[0]);
+        timing_t result;
+        int rc = measure(operation_list, path, count, &result);
+        result.peak_rss_kb = self_rss_kb();
+        if (rc == 0 && write(fds[1], &result, sizeof(result)) != (ssize_t)sizeof(result)) {
+            rc = -1;
+        }
+        _exit(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    timing_t result;
+    ssize_t received = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    if (waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+        received != (ssize_t)sizeof(result)) {
+        return -1;
+    }
+    *timing = result;
+    return 0;
+}
+
+static void print_row(const char *backend, size_t count, double file_mib, const char *operation, int rc,
+                      const timing_t *timing, size_t per)
+{
+    if (rc != 0) {
+        printf("%-10s %9zu %9.1f %-7s %11s %11s %11s %10s\n", backend, count, file_mib, operation, "failed", "-",
+               "-", "-");
+        return;
+    }
+    char rss[32] = "-";
+    if (timing->peak_rss_kb > 0) {
+        snprintf(rss, sizeof(rss), "%.1f", (double)timing->peak_rss_kb / 1024);
+    }
+    printf("%-10s %9zu %9.1f %-7s %11.3f %11.3f %11.1f %10s\n", backend, count, file_mib, operation,
+           timing->cold_ms, timing->warm_ms, per > 0 ? timing->warm_ms * 1e6 / (double)per : 0, rss);
+}
+
+static int parse_sizes(const char *text)
+{
+    options.size_count = 0;
+    const char *p = text;
+    while (*p != '\0') {
+        char *end = NULL;
+        unsigned long long value = strtoull(p, &end, 10);
+        if (end == p || value == 0 || options.size_count == SIZES_MAX) {
+            return -1;
+        }
+        if (*end == 'k' || *end == 'K') {
+            value *= 1000;
+            end++;
+        } else if (*end == 'm' || *end == 'M') {
+            value *= 1000000;
+            end++;
+        }
+        options.sizes[options.size_count++] = (size_t)value;
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        p = end;
+    }
+    return options.size_count > 0 ? 0 : -1;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--sizes 1k,10k,100k,1m] [--repeat n] [--dir path]\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "--sizes") == 0) {
+            if (parse_sizes(argv[++i]) != 0) {
+                fprintf(stderr, "Invalid --sizes '%s'\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--repeat") == 0) {
+            options.repeat = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--dir") == 0) {
+            options.dir = argv[++i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.repeat == 0 || options.repeat > REPEAT_MAX) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char workdir[256];
+    const char *tmpdir = getenv("TMPDIR");
+    snprintf(workdir, sizeof(workdir), "%s/maum-boardbench.XXXXXX",
+             options.dir != NULL ? options.dir : (tmpdir != NULL ? tmpdir : "/tmp"));
+    if (mkdtemp(workdir) == NULL) {
+        fprintf(stderr, "mkdtemp failed: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    log_set_level(LOG_LEVEL_WARN);
+
+    printf("times in ms; warm is the median of %u runs; ns/post is warm time per post on the board "
+           "(per added post for add)\n",
+           options.repeat);
+    printf("harness rss before list children: %.1f MiB\n", (double)self_rss_kb() / 1024);
+    printf("%-10s %9s %9s %-7s %11s %11s %11s %10s\n", "backend", "posts", "file MiB", "op", "cold ms", "warm ms",
+           "ns/post", "peak MiB");
+
+    int failed = 0;
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+        const backend_t *backend = &backends[b];
+        for (size_t s = 0; s < options.size_count; ++s) {
+            size_t count = options.sizes[s];
+            char path[320];
+            snprintf(path, sizeof(path), "%s/%s-%zu.db", workdir, backend->name, count);
+            rng_state = 0x9e3779b97f4a7c15ull ^ count;
+            if (backend->generate(path, count) != 0) {
+                fprintf(stderr, "%s: could not generate %zu posts: %s\n", backend->name, count, strerror(errno));
+                unlink(path);
+                failed = 1;
+                continue;
+            }
+            struct stat st;
+            double file_mib = stat(path, &st) == 0 ? (double)st.st_size / (1024.0 * 1024.0) : 0;
+
+            timing_t timing = {0, 0, 0};
+            int rc = measure(operation_open, path, count, &timing);
+            print_row(backend->name, count, file_mib, "open", rc, &timing, count);
+            failed |= rc != 0;
+
+            timing = (timing_t){0, 0, 0};
+            rc = measure(operation_scan, path, count, &timing);
+            print_row(backend->name, count, file_mib, "scan", rc, &timing, count);
+            failed |= rc != 0;
+
+            timing = (timing_t){0, 0, 0};
+            rc = measure_list(path, count, &timing);
+            print_row(backend->name, count, file_mib, "list", rc, &timing, count);
+            failed |= rc != 0;
+
+            timing = (timing_t){0, 0, 0};
+            rc = measure(operation_since, path, count, &timing);
+            print_row(backend->name, count, file_mib, "since", rc, &timing, SINCE_POSTS);
+            failed |= rc != 0;
+
+            timing = (timing_t){0, 0, 0};
+            rc = measure_add(path, count, &timing);
+            print_row(backend->name, count, file_mib, "add", rc, &timing, 1);
+            failed |= rc != 0;
+
+            timing = (timing_t){0, 0, 0};
+            rc = measure(operation_remove, path, count, &timing);
+            print_row(backend->name, count, file_mib, "remove", rc, &timing, count);
+            failed |= rc != 0;
+
+            unlink(path);
+        }
+    }
+    rmdir(workdir);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
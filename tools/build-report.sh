@@ -0,0 +1,57 @@
+#!/bin/sh
+# Speedup report behind `make build-report`: builds the debug (plain `make`),
+# release and PGO variants in turn, runs the in-process replay harness and the
+# telnet benchmark on each and prints one table. The tree is left with the
+# last variant built.
+#
+#   REPORT_BENCH_ARGS="--clients 80 --duration 20" tools/build-report.sh
+#
+# Server CPU per operation is the figure to compare for the telnet benchmark;
+# its throughput is bounded by the clients, not by the server.
+set -eu
+
+BENCH_ARGS=${REPORT_BENCH_ARGS:---clients 40 --duration 10 --mix chat=50,list=30,post=15,delete=5}
+WORKDIR=$(mktemp -d "${TMPDIR:-/tmp}/maum-report.XXXXXX")
+trap 'rm -rf "$WORKDIR"' EXIT INT TERM
+
+build() {
+    case "$1" in
+    debug) make -s clean && make -s all ;;
+    *) make -s "$1" ;;
+    esac
+}
+
+for variant in debug release pgo; do
+    echo "building $variant..." >&2
+    build "$variant" > "$WORKDIR/$variant.build" 2>&1 || {
+        cat "$WORKDIR/$variant.build" >&2
+        exit 1
+    }
+    echo "measuring $variant..." >&2
+    size=$(wc -c < maum)
+    tools/maum-perftest --repeat 3 tools/perftest/*.script > "$WORKDIR/$variant.perftest"
+    sh tools/bench.sh $BENCH_ARGS > "$WORKDIR/$variant.bench"
+    awk -v variant="$variant" -v size="$size" '
+        FILENAME ~ /perftest$/ && NF >= 8 && $4 ~ /^[0-9.]+$/ { perf[$1] = $4 }
+        FILENAME ~ /bench$/ && $1 == "total" { ops = $2 }
+        FILENAME ~ /bench$/ && $1 == "server" { cpu = $3 }
+        END {
+            printf "%s %d %s %s %s %s %s\n", variant, size, perf["browse"], perf["chat"], perf["post"], ops, cpu
+        }' "$WORKDIR/$variant.perftest" "$WORKDIR/$variant.bench" >> "$WORKDIR/results"
+done
+
+awk '
+    {
+        name[NR] = $1; size[NR] = $2; browse[NR] = $3; chat[NR] = $4; post[NR] = $5
+        us[NR] = $6 > 0 ? $7 * 1e6 / $6 : 0
+    }
+    END {
+        printf "%-8s %9s %12s %12s %12s %14s %9s\n", "variant", "size KiB", "browse op/s", "chat op/s",
+               "post op/s", "server us/op", "speedup"
+        for (i = 1; i <= NR; i++) {
+            speedup = us[i] > 0 ? us[1] / us[i] : 0
+            printf "%-8s %9.0f %12.0f %12.0f %12.0f %14.1f %8.2fx\n", name[i], size[i] / 1024, browse[i], chat[i],
+                   post[i], us[i], speedup
+        }
+    }' "$WORKDIR/results"
+echo "op/s: maum-perftest, best of 3; server us/op: make bench CPU time per operation ($BENCH_ARGS)"
@@ -0,0 +1,600 @@
+// Telnet load generator used by `make bench`. Opens N connections to a local
+// maum, logs each one in and drives a weighted mix of menu operations:
+//
+//   maum-loadgen --port 2323 --clients 50 --duration 10 --mix chat=50,list=30,post=15,delete=5
+//
+// chat latency is one message until its broadcast comes back; the other
+// operations run from the menu choice until the next menu prompt.
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BUFFER_SIZE 65536
+#define OWN_POSTS_MAX 64
+#define OP_TIMEOUT_MS 10000
+#define CONNECT_RETRY_MS 5000
+// The server listens with a short backlog, so connections ramp up a few
+// logins at a time instead of all at once.
+#define LOGINS_IN_FLIGHT 8
+
+#define NICKNAME_PROMPT "사용할 닉네임을 입력하세요: "
+// Without the item range, which grows with the menu.
+#define MENU_PROMPT "메뉴 선택 (1-"
+#define CHAT_PROMPT "나갑니다.\r\n"
+#define POST_PROMPT "(한 줄): "
+#define DELETE_PROMPT "삭제할 게시물 번호: "
+
+#define TELNET_IAC 255
+#define TELNET_SB 250
+#define TELNET_SE 240
+
+typedef enum {
+    OP_CHAT = 0,
+    OP_LIST,
+    OP_POST,
+    OP_DELETE,
+    OP_COUNT
+} op_t;
+
+static const char *const op_names[OP_COUNT] = {"chat", "list", "post", "delete"};
+
+typedef struct {
+    uint64_t *samples;
+    size_t count;
+    size_t capacity;
+    uint64_t failures;
+} op_samples_t;
+
+typedef enum {
+    IAC_NONE = 0,
+    IAC_COMMAND,
+    IAC_OPTION,
+    IAC_SUBNEGOTIATION,
+    IAC_SUBNEGOTIATION_IAC
+} iac_state_t;
+
+typedef struct {
+    int index;
+    int fd;
+    unsigned int seed;
+    char name[32];
+    unsigned char buffer[BUFFER_SIZE];
+    size_t length;
+    iac_state_t iac;
+    unsigned int posts[OWN_POSTS_MAX];
+    size_t post_count;
+    unsigned long sequence;
+    op_samples_t ops[OP_COUNT];
+    bool ready;
+    bool failed;
+} client_t;
+
+static struct {
+    const char *host;
+    const char *port;
+    unsigned int clients;
+    unsigned int duration;
+    unsigned int chat_burst;
+    unsigned int weights[OP_COUNT];
+} options = {"127.0.0.1", "2323", 20, 10, 5, {50, 30, 15, 5}};
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int reported;
+static unsigned int logging_in;
+static bool started;
+static atomic_bool stopping;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void record(op_samples_t *op, uint64_t nanoseconds)
+{
+    if (op->count == op->capacity) {
+        size_t capacity = op->capacity == 0 ? 1024 : op->capacity * 2;
+        uint64_t *samples = realloc(op->samples, capacity * sizeof(*samples));
+        if (samples == NULL) {
+            return;
+        }
+        op->samples = samples;
+        op->capacity = capacity;
+    }
+    op->samples[op->count++] = nanoseconds;
+}
+
+// Appends received bytes with telnet commands removed.
+static void append_filtered(client_t *client, const unsigned char *data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char ch = data[i];
+        switch (client->iac) {
+        case IAC_NONE:
+            if (ch == TELNET_IAC) {
+                client->iac = IAC_COMMAND;
+                continue;
+            }
+            break;
+        case IAC_COMMAND:
+            if (ch == TELNET_IAC) {
+                client->iac = IAC_NONE;
+                break;
+            }
+            client->iac = (ch == TELNET_SB) ? IAC_SUBNEGOTIATION : (ch >= 251 ? IAC_OPTION : IAC_NONE);
+            continue;
+        case IAC_OPTION:
+            client->iac = IAC_NONE;
+            continue;
+        case IAC_SUBNEGOTIATION:
+            if (ch == TELNET_IAC) {
+                client->iac = IAC_SUBNEGOTIATION_IAC;
+            }
+            continue;
+        case IAC_SUBNEGOTIATION_IAC:
+            client->iac = (ch == TELNET_SE) ? IAC_NONE : IAC_SUBNEGOTIATION;
+            continue;
+        }
+        if (client->length == sizeof(client->buffer)) {
+            // Keep the newer half; whatever we wait for arrives at the end.
+            memmove(client->buffer, client->buffer + BUFFER_SIZE / 2, BUFFER_SIZE / 2);
+            client->length = BUFFER_SIZE / 2;
+        }
+        client->buffer[client->length++] = ch;
+    }
+}
+
+static const unsigned char *find(const unsigned char *haystack, size_t length, const char *needle)
+{
+    size_t needle_length = strlen(needle);
+    if (needle_length == 0 || needle_length > length) {
+        return NULL;
+    }
+    for (size_t i = 0; i + needle_length <= length; ++i) {
+        if (haystack[i] == (unsigned char)needle[0] && memcmp(haystack + i, needle, needle_length) == 0) {
+            return haystack + i;
+        }
+    }
+    return NULL;
+}
+
+// Waits for pattern and consumes input through it. The text before the
+// pattern is copied to capture when one is given.
+static int read_until(client_t *client, const char *pattern, char *capture, size_t capture_size)
+{
+    uint64_t deadline = now_ns() + (uint64_t)OP_TIMEOUT_MS * 1000000ull;
+    while (1) {
+        const unsigned char *match = find(client->buffer, client->length, pattern);
+        if (match != NULL) {
+            size_t before = (size_t)(match - client->buffer);
+            if (capture != NULL && capture_size > 0) {
+                size_t copy = before < capture_size - 1 ? before : capture_size - 1;
+                memcpy(capture, match - copy, copy);
+                capture[copy] = '\0';
+            }
+            size_t consumed = before + strlen(pattern);
+            memmove(client->buffer, client->buffer + consumed, client->length - consumed);
+            client->length -= consumed;
+            return 0;
+        }
+
+        uint64_t now = now_ns();
+        if (now >= deadline) {
+            return -1;
+        }
+        struct pollfd pfd = {client->fd, POLLIN, 0};
+        int rc = poll(&pfd, 1, (int)((deadline - now) / 1000000ull) + 1);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            return -1;
+        }
+        unsigned char chunk[8192];
+        ssize_t n = recv(client->fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return -1;
+        }
+        append_filtered(client, chunk, (size_t)n);
+    }
+}
+
+static int send_line(client_t *client, const char *text)
+{
+    char line[256];
+    int length = snprintf(line, sizeof(line), "%s\r\n", text);
+    const char *data = line;
+    size_t remaining = (size_t)length;
+    while (remaining > 0) {
+        ssize_t n = send(client->fd, data, remaining, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        remaining -= (size_t)n;
+    }
+    return 0;
+}
+
+static int connect_server(void)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    uint64_t deadline = now_ns() + (uint64_t)CONNECT_RETRY_MS * 1000000ull;
+    do {
+        struct addrinfo *result = NULL;
+        if (getaddrinfo(options.host, options.port, &hints, &result) == 0) {
+            for (struct addrinfo *res = result; res != NULL; res = res->ai_next) {
+                int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+                if (fd < 0) {
+                    continue;
+                }
+                if (connect(fd, res->ai_addr, res->ai_addrlen) == 0) {
+                    // Each line goes out as soon as it is written, like an
+                    // interactive terminal.
+                    int nodelay = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+                    freeaddrinfo(result);
+                    return fd;
+                }
+                close(fd);
+            }
+            freeaddrinfo(result);
+        }
+        struct timespec pause = {0, 50 * 1000000L};
+        nanosleep(&pause, NULL);
+    } while (now_ns() < deadline);
+    return -1;
+}
+
+static int do_chat(client_t *client)
+{
+    if (send_line(client, "1") != 0 || read_until(client, CHAT_PROMPT, NULL, 0) != 0) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < options.chat_burst; ++i) {
+        char message[64];
+        char echo[128];
+        snprintf(message, sizeof(message), "m%d-%lu", client->index, ++client->sequence);
+        snprintf(echo, sizeof(echo), "[TELNET][%s] %s\r\n", client->name, message);
+        uint64_t started_at = now_ns();
+        if (send_line(client, message) != 0 || read_until(client, echo, NULL, 0) != 0) {
+            client->ops[OP_CHAT].failures++;
+            return -1;
+        }
+        record(&client->ops[OP_CHAT], now_ns() - started_at);
+    }
+    if (send_line(client, "/exit") != 0 || read_until(client, MENU_PROMPT, NULL, 0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int do_list(client_t *client)
+{
+    uint64_t started_at = now_ns();
+    if (send_line(client, "2") != 0 || read_until(client, MENU_PROMPT, NULL, 0) != 0) {
+        client->ops[OP_LIST].failures++;
+        return -1;
+    }
+    record(&client->ops[OP_LIST], now_ns() - started_at);
+    return 0;
+}
+
+static int do_post(client_t *client)
+{
+    char content[160];
+    char id_text[32];
+    snprintf(content, sizeof(content), "%s 님의 부하 테스트 게시물 %lu번입니다.", client->name,
+             ++client->sequence);
+
+    uint64_t started_at = now_ns();
+    if (send_line(client, "3") != 0 || read_until(client, POST_PROMPT, NULL, 0) != 0 ||
+        send_line(client, content) != 0 || read_until(client, "[#", NULL, 0) != 0 ||
+        read_until(client, "]", id_text, sizeof(id_text)) != 0 || read_until(client, MENU_PROMPT, NULL, 0) != 0) {
+        client->ops[OP_POST].failures++;
+        return -1;
+    }
+    record(&client->ops[OP_POST], now_ns() - started_at);
+
+    unsigned int id = (unsigned int)strtoul(id_text, NULL, 10);
+    if (id != 0 && client->post_count < OWN_POSTS_MAX) {
+        client->posts[client->post_count++] = id;
+    }
+    return 0;
+}
+
+static int do_delete(client_t *client)
+{
+    if (client->post_count == 0) {
+        return do_post(client);
+    }
+    char id_text[16];
+    snprintf(id_text, sizeof(id_text), "%u", client->posts[--client->post_count]);
+
+    uint64_t started_at = now_ns();
+    if (send_line(client, "4") != 0 || read_until(client, DELETE_PROMPT, NULL, 0) != 0 ||
+        send_line(client, id_text) != 0 || read_until(client, MENU_PROMPT, NULL, 0) != 0) {
+        client->ops[OP_DELETE].failures++;
+        return -1;
+    }
+    record(&client->ops[OP_DELETE], now_ns() - started_at);
+    return 0;
+}
+
+static op_t pick_op(client_t *client)
+{
+    unsigned int total = 0;
+    for (int op = 0; op < OP_COUNT; ++op) {
+        total += options.weights[op];
+    }
+    unsigned int roll = (unsigned int)rand_r(&client->seed) % total;
+    for (int op = 0; op < OP_COUNT; ++op) {
+        if (roll < options.weights[op]) {
+            return (op_t)op;
+        }
+        roll -= options.weights[op];
+    }
+    return OP_LIST;
+}
+
+static void begin_login(void)
+{
+    pthread_mutex_lock(&start_lock);
+    while (logging_in >= LOGINS_IN_FLIGHT) {
+        pthread_cond_wait(&start_cond, &start_lock);
+    }
+    logging_in++;
+    pthread_mutex_unlock(&start_lock);
+}
+
+static void report_ready(client_t *client, bool ready)
+{
+    pthread_mutex_lock(&start_lock);
+    logging_in--;
+    client->ready = ready;
+    reported++;
+    pthread_cond_broadcast(&start_cond);
+    while (!started) {
+        pthread_cond_wait(&start_cond, &start_lock);
+    }
+    pthread_mutex_unlock(&start_lock);
+}
+
+static void *client_thread(void *arg)
+{
+    client_t *client = arg;
+    begin_login();
+    client->fd = connect_server();
+    const char *problem = NULL;
+    if (client->fd < 0) {
+        problem = "connect failed";
+    } else if (read_until(client, NICKNAME_PROMPT, NULL, 0) != 0) {
+        problem = "no nickname prompt";
+    } else if (send_line(client, client->name) != 0 || read_until(client, MENU_PROMPT, NULL, 0) != 0) {
+        problem = "no menu after login";
+    }
+    if (problem != NULL) {
+        fprintf(stderr, "%s: %s\n", client->name, problem);
+    }
+    bool ready = (problem == NULL);
+    report_ready(client, ready);
+    if (!ready) {
+        client->failed = true;
+        if (client->fd >= 0) {
+            close(client->fd);
+        }
+        return NULL;
+    }
+
+    static int (*const handlers[OP_COUNT])(client_t *) = {do_chat, do_list, do_post, do_delete};
+    while (!atomic_load(&stopping)) {
+        op_t op = pick_op(client);
+        if (handlers[op](client) != 0) {
+            fprintf(stderr, "%s: %s failed\n", client->name, op_names[op]);
+            client->failed = true;
+            break;
+        }
+    }
+    send_line(client, "q");
+    close(client->fd);
+    return NULL;
+}
+
+static int compare_u64(const void *left, const void *right)
+{
+    uint64_t a = *(const uint64_t *)left;
+    uint64_t b = *(const uint64_t *)right;
+    return (a > b) - (a < b);
+}
+
+static double percentile_ms(const op_samples_t *op, double fraction)
+{
+    if (op->count == 0) {
+        return 0.0;
+    }
+    size_t index = (size_t)(fraction * (double)(op->count - 1) + 0.5);
+    return (double)op->samples[index] / 1e6;
+}
+
+static void print_row(const char *name, op_samples_t *op, double seconds)
+{
+    qsort(op->samples, op->count, sizeof(*op->samples), compare_u64);
+    printf("%-8s %9zu %10.1f %9.3f %9.3f %9.3f %9.3f %8llu\n", name, op->count, (double)op->count / seconds,
+           percentile_ms(op, 0.50), percentile_ms(op, 0.99), percentile_ms(op, 0.999),
+           op->count > 0 ? (double)op->samples[op->count - 1] / 1e6 : 0.0, (unsigned long long)op->failures);
+}
+
+static void merge(op_samples_t *into, const op_samples_t *from)
+{
+    for (size_t i = 0; i < from->count; ++i) {
+        record(into, from->samples[i]);
+    }
+    into->failures += from->failures;
+}
+
+static int parse_mix(const char *text)
+{
+    unsigned int weights[OP_COUNT] = {0};
+    char copy[128];
+    snprintf(copy, sizeof(copy), "%s", text);
+    char *saveptr = NULL;
+    for (char *item = strtok_r(copy, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+        char *equals = strchr(item, '=');
+        if (equals == NULL) {
+            return -1;
+        }
+        *equals = '\0';
+        int op = 0;
+        while (op < OP_COUNT && strcmp(item, op_names[op]) != 0) {
+            op++;
+        }
+        if (op == OP_COUNT) {
+            return -1;
+        }
+        weights[op] = (unsigned int)strtoul(equals + 1, NULL, 10);
+    }
+    unsigned int total = 0;
+    for (int op = 0; op < OP_COUNT; ++op) {
+        total += weights[op];
+    }
+    if (total == 0) {
+        return -1;
+    }
+    memcpy(options.weights, weights, sizeof(weights));
+    return 0;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--host h] [--port p] [--clients n] [--duration s] [--chat-burst n]\n"
+            "          [--mix chat=50,list=30,post=15,delete=5]\n",
+            program);
+}
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "--host") == 0) {
+            options.host = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0) {
+            options.port = argv[++i];
+        } else if (strcmp(argv[i], "--clients") == 0) {
+            options.clients = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--duration") == 0) {
+            options.duration = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--chat-burst") == 0) {
+            options.chat_burst = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--mix") == 0) {
+            if (parse_mix(argv[++i]) != 0) {
+                fprintf(stderr, "Invalid --mix '%s'\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.clients == 0 || options.duration == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    client_t *clients = calloc(options.clients, sizeof(*clients));
+    pthread_t *threads = calloc(options.clients, sizeof(*threads));
+    if (clients == NULL || threads == NULL) {
+        fprintf(stderr, "%s\n", "Out of memory");
+        return EXIT_FAILURE;
+    }
+
+    unsigned int created = 0;
+    for (unsigned int i = 0; i < options.clients; ++i) {
+        clients[i].index = (int)i;
+        clients[i].fd = -1;
+        clients[i].seed = 0x9e3779b9u ^ i;
+        snprintf(clients[i].name, sizeof(clients[i].name), "bench%u", i);
+        if (pthread_create(&threads[i], NULL, client_thread, &clients[i]) != 0) {
+            break;
+        }
+        created++;
+    }
+
+    pthread_mutex_lock(&start_lock);
+    while (reported < created) {
+        pthread_cond_wait(&start_cond, &start_lock);
+    }
+    unsigned int ready = 0;
+    for (unsigned int i = 0; i < created; ++i) {
+        ready += clients[i].ready ? 1 : 0;
+    }
+    started = true;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&start_lock);
+
+    uint64_t started_at = now_ns();
+    struct timespec pause = {(time_t)options.duration, 0};
+    while (nanosleep(&pause, &pause) != 0 && errno == EINTR) {
+    }
+    atomic_store(&stopping, true);
+    for (unsigned int i = 0; i < created; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = (double)(now_ns() - started_at) / 1e9;
+
+    op_samples_t totals[OP_COUNT];
+    op_samples_t all;
+    memset(totals, 0, sizeof(totals));
+    memset(&all, 0, sizeof(all));
+    unsigned int dropped = 0;
+    for (unsigned int i = 0; i < created; ++i) {
+        dropped += (clients[i].ready && clients[i].failed) ? 1 : 0;
+        for (int op = 0; op < OP_COUNT; ++op) {
+            merge(&totals[op], &clients[i].ops[op]);
+            merge(&all, &clients[i].ops[op]);
+            free(clients[i].ops[op].samples);
+        }
+    }
+
+    printf("clients %u (logged in %u, dropped after an error %u), %.1f s\n", options.clients, ready, dropped, seconds);
+    printf("%-8s %9s %10s %9s %9s %9s %9s %8s\n", "op", "count", "ops/s", "p50 ms", "p99 ms", "p999 ms", "max ms",
+           "errors");
+    for (int op = 0; op < OP_COUNT; ++op) {
+        print_row(op_names[op], &totals[op], seconds);
+        free(totals[op].samples);
+    }
+    print_row("total", &all, seconds);
+    free(all.samples);
+    free(clients);
+    free(threads);
+    // Timed-out operations are results, not harness failures; they show up
+    // in the errors column.
+    return ready == options.clients ? EXIT_SUCCESS : EXIT_FAILURE;
+}
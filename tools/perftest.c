@@ -0,0 +1,492 @@
+// In-process replay harness behind `make perftest`. Each script under
+// tools/perftest/ is the input of one recorded session (nickname, menu
+// choices, chat lines, posts). For every script the harness starts a fresh
+// session manager on a seeded temporary board, replays the script from many
+// threads at once through session_manager_run() and reports operations per
+// second and heap allocations per operation:
+//
+//   maum-perftest --sessions 32 --rounds 20 --baseline tools/perftest/baseline.txt tools/perftest/*.script
+//
+// One operation is one replayed input line. Allocations are counted by
+// wrapping malloc/calloc/realloc at link time, so they cover maum's own calls
+// and not allocations made inside libc. With --baseline the run fails when a
+// scenario loses more than --tolerance percent of its recorded throughput or
+// allocates noticeably more per operation; --update rewrites the baseline.
+#include "board.h"
+#include "config.h"
+#include "log.h"
+#include "mailbox.h"
+#include "session.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SCRIPT_MAX 65536
+#define SCENARIO_NAME_MAX 64
+#define SCENARIOS_MAX 32
+#define SCENARIO_MAILBOXES_MAX 4
+#define SEED_AUTHOR "seed"
+#define SEED_CONTENT "성능 측정을 위해 미리 등록한 게시물입니다. 마음 BBS에 오신 것을 환영합니다."
+// Allocation counts barely move between runs, so they get a tight fixed bound
+// instead of the throughput tolerance.
+#define ALLOC_TOLERANCE 0.05
+
+typedef struct {
+    char name[SCENARIO_NAME_MAX];
+    char *script;
+    size_t length;
+    unsigned int lines;
+    unsigned int rounds;
+    // Registered before the run so the script only has to unlock them.
+    struct {
+        char owner[BOARD_AUTHOR_MAX];
+        char password[64];
+    } mailboxes[SCENARIO_MAILBOXES_MAX];
+    unsigned int mailbox_count;
+} scenario_t;
+
+typedef struct {
+    char name[SCENARIO_NAME_MAX];
+    double ops_per_sec;
+    double allocs_per_op;
+} result_t;
+
+typedef struct {
+    session_manager_t *manager;
+    const scenario_t *scenario;
+    pthread_barrier_t *start;
+    unsigned int failures;
+} replay_t;
+
+static struct {
+    unsigned int sessions;
+    unsigned int rounds;
+    unsigned int seed_posts;
+    unsigned int repeat;
+    double tolerance;
+    const char *baseline;
+    int update;
+} options = {32, 20, 200, 5, 25.0, NULL, 0};
+
+static atomic_uint_fast64_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_realloc(pointer, size);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Keeps every line except '#' comments; the result is what a user would type.
+// A "#! rounds N" line overrides --rounds for scripts too quick to time, and
+// "#! mailbox NICK PASSWORD" registers a mailbox before the run.
+static int load_scenario(const char *path, scenario_t *scenario)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    scenario->script = malloc(SCRIPT_MAX);
+    if (scenario->script == NULL) {
+        fclose(file);
+        return -1;
+    }
+    scenario->length = 0;
+    scenario->lines = 0;
+    scenario->rounds = options.rounds;
+    scenario->mailbox_count = 0;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        unsigned int rounds = 0;
+        if (sscanf(line, "#! rounds %u", &rounds) == 1 && rounds > 0) {
+            scenario->rounds = rounds;
+        }
+        if (strncmp(line, "#! mailbox ", 11) == 0 && scenario->mailbox_count < SCENARIO_MAILBOXES_MAX) {
+            char owner[BOARD_AUTHOR_MAX];
+            char password[64];
+            if (sscanf(line + 11, "%31s %63s", owner, password) == 2) {
+                snprintf(scenario->mailboxes[scenario->mailbox_count].owner, sizeof(owner), "%s", owner);
+                snprintf(scenario->mailboxes[scenario->mailbox_count].password, sizeof(password), "%s", password);
+                scenario->mailbox_count++;
+            }
+        }
+        if (line[0] == '#') {
+            continue;
+        }
+        size_t length = strlen(line);
+        if (length == 0 || line[length - 1] != '\n') {
+            if (length + 1 >= sizeof(line)) {
+                fprintf(stderr, "%s: line too long\n", path);
+                fclose(file);
+                return -1;
+            }
+            line[length++] = '\n';
+        }
+        if (scenario->length + length > SCRIPT_MAX) {
+            fprintf(stderr, "%s: script too long\n", path);
+            fclose(file);
+            return -1;
+        }
+        memcpy(scenario->script + scenario->length, line, length);
+        scenario->length += length;
+        scenario->lines++;
+    }
+    fclose(file);
+    if (scenario->lines == 0) {
+        fprintf(stderr, "%s: empty script\n", path);
+        return -1;
+    }
+
+    const char *base = strrchr(path, '/');
+    base = base != NULL ? base + 1 : path;
+    snprintf(scenario->name, sizeof(scenario->name), "%s", base);
+    char *dot = strrchr(scenario->name, '.');
+    if (dot != NULL) {
+        *dot = '\0';
+    }
+    return 0;
+}
+
+static void *replay_thread(void *arg)
+{
+    replay_t *replay = arg;
+    pthread_barrier_wait(replay->start);
+    for (unsigned int round = 0; round < replay->scenario->rounds; ++round) {
+        FILE *in = fmemopen(replay->scenario->script, replay->scenario->length, "r");
+        FILE *out = fopen("/dev/null", "w");
+        if (in == NULL || out == NULL) {
+            replay->failures++;
+        } else {
+            session_manager_run(replay->manager, SESSION_TRANSPORT_STDIO, in, out, "perftest");
+        }
+        if (in != NULL) {
+            fclose(in);
+        }
+        if (out != NULL) {
+            fclose(out);
+        }
+    }
+    return NULL;
+}
+
+static void remove_directory(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char file[600];
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        unlink(file);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+static int run_scenario(const maum_config_t *base, const scenario_t *scenario, result_t *result)
+{
+    char workdir[] = "/tmp/maum-perftest.XXXXXX";
+    if (mkdtemp(workdir) == NULL) {
+        fprintf(stderr, "mkdtemp failed: %s\n", strerror(errno));
+        return -1;
+    }
+    maum_config_t config = *base;
+    snprintf(config.board_path, sizeof(config.board_path), "%s/posts.db", workdir);
+    snprintf(config.motd_path, sizeof(config.motd_path), "%s/motd.txt", workdir);
+    snprintf(config.mailbox_dir, sizeof(config.mailbox_dir), "%s/mail", workdir);
+    snprintf(config.library_dir, sizeof(config.library_dir), "%s/library", workdir);
+    snprintf(config.cursor_path, sizeof(config.cursor_path), "%s/cursors.db", workdir);
+    FILE *motd = fopen(config.motd_path, "w");
+    if (motd != NULL) {
+        fputs("마음 BBS 성능 측정\n", motd);
+        fclose(motd);
+    }
+
+    int status = -1;
+    if (scenario->mailbox_count > 0) {
+        mailbox_store_t *store = mailbox_store_create(config.mailbox_dir);
+        for (unsigned int i = 0; store != NULL && i < scenario->mailbox_count; ++i) {
+            if (mailbox_register(store, scenario->mailboxes[i].owner, scenario->mailboxes[i].password) != 0) {
+                fprintf(stderr, "%s: could not register %s\n", scenario->name, scenario->mailboxes[i].owner);
+            }
+        }
+        mailbox_store_destroy(store);
+    }
+
+    replay_t *replays = calloc(options.sessions, sizeof(*replays));
+    pthread_t *threads = calloc(options.sessions, sizeof(*threads));
+    session_manager_t *manager = session_manager_create(&config);
+    if (replays == NULL || threads == NULL || manager == NULL) {
+        fprintf(stderr, "%s: could not create session manager\n", scenario->name);
+        goto cleanup;
+    }
+    for (unsigned int i = 0; i < options.seed_posts; ++i) {
+        if (board_add(session_manager_board(manager), SEED_AUTHOR, SEED_CONTENT, NULL) != 0) {
+            fprintf(stderr, "%s: could not seed the board\n", scenario->name);
+            goto cleanup;
+        }
+    }
+
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, options.sessions + 1);
+    unsigned int created = 0;
+    for (; created < options.sessions; ++created) {
+        replays[created] = (replay_t){manager, scenario, &start, 0};
+        if (pthread_create(&threads[created], NULL, replay_thread, &replays[created]) != 0) {
+            break;
+        }
+    }
+    if (created < options.sessions) {
+        // The barrier can never fill; the harness cannot recover from this.
+        fprintf(stderr, "%s: could only start %u of %u sessions\n", scenario->name, created, options.sessions);
+        exit(EXIT_FAILURE);
+    }
+
+    uint_fast64_t allocations_before = atomic_load(&allocations);
+    pthread_barrier_wait(&start);
+    uint64_t started_at = now_ns();
+    unsigned int failures = 0;
+    for (unsigned int i = 0; i < created; ++i) {
+        pthread_join(threads[i], NULL);
+        failures += replays[i].failures;
+    }
+    double seconds = (double)(now_ns() - started_at) / 1e9;
+    uint_fast64_t allocated = atomic_load(&allocations) - allocations_before;
+    pthread_barrier_destroy(&start);
+
+    if (failures > 0) {
+        fprintf(stderr, "%s: %u sessions could not open their streams\n", scenario->name, failures);
+        goto cleanup;
+    }
+    double ops = (double)scenario->lines * options.sessions * scenario->rounds;
+    snprintf(result->name, sizeof(result->name), "%s", scenario->name);
+    result->ops_per_sec = seconds > 0 ? ops / seconds : 0;
+    result->allocs_per_op = (double)allocated / ops;
+    status = 0;
+
+cleanup:
+    session_manager_destroy(manager);
+    free(threads);
+    free(replays);
+    unlink(config.board_path);
+    unlink(config.motd_path);
+    unlink(config.cursor_path);
+    remove_directory(config.mailbox_dir);
+    rmdir(workdir);
+    return status;
+}
+
+// Baseline lines are "<scenario> <ops/s> <allocs/op>"; '#' starts a comment.
+static size_t load_baseline(const char *path, result_t *entries, size_t max)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    size_t count = 0;
+    char line[256];
+    while (count < max && fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') {
+            continue;
+        }
+        result_t *entry = &entries[count];
+        if (sscanf(line, "%63s %lf %lf", entry->name, &entry->ops_per_sec, &entry->allocs_per_op) == 3) {
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static int save_baseline(const char *path, const result_t *results, size_t count)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(file, "# maum-perftest baseline: --sessions %u --rounds %u --seed-posts %u --repeat %u\n",
+            options.sessions, options.rounds, options.seed_posts, options.repeat);
+    fprintf(file, "%s\n", "# scenario ops_per_sec allocs_per_op");
+    for (size_t i = 0; i < count; ++i) {
+        fprintf(file, "%s %.0f %.2f\n", results[i].name, results[i].ops_per_sec, results[i].allocs_per_op);
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static const result_t *find_result(const result_t *entries, size_t count, const char *name)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(entries[i].name, name) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--sessions n] [--rounds n] [--seed-posts n] [--repeat n] [--baseline file [--update]]\n"
+            "          [--tolerance percent] script...\n",
+            program);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *scripts[SCENARIOS_MAX];
+    size_t script_count = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--update") == 0) {
+            options.update = 1;
+            continue;
+        }
+        if (strncmp(argv[i], "--", 2) != 0) {
+            if (script_count == SCENARIOS_MAX) {
+                fprintf(stderr, "At most %d scripts\n", SCENARIOS_MAX);
+                return EXIT_FAILURE;
+            }
+            scripts[script_count++] = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "--sessions") == 0) {
+            options.sessions = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--rounds") == 0) {
+            options.rounds = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed-posts") == 0) {
+            options.seed_posts = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--repeat") == 0) {
+            options.repeat = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--baseline") == 0) {
+            options.baseline = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0) {
+            options.tolerance = strtod(argv[++i], NULL);
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (script_count == 0 || options.sessions == 0 || options.rounds == 0 || options.repeat == 0 ||
+        (options.update && options.baseline == NULL)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+
+    // Scripts load after the options so --rounds is known when they do.
+    scenario_t scenarios[SCENARIOS_MAX];
+    size_t scenario_count = 0;
+    for (; scenario_count < script_count; ++scenario_count) {
+        if (load_scenario(scripts[scenario_count], &scenarios[scenario_count]) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    log_set_level(LOG_LEVEL_WARN);
+    maum_config_t config;
+    config_init(&config);
+    config.login_timeout = 0;
+    config.idle_timeout = 0;
+    config.chat_idle_timeout = 0;
+    config.max_sessions = 0;
+    config.log_level = LOG_LEVEL_WARN;
+    config_publish(&config);
+
+    result_t baseline[SCENARIOS_MAX];
+    size_t baseline_count = options.baseline != NULL && !options.update
+                                ? load_baseline(options.baseline, baseline, SCENARIOS_MAX)
+                                : 0;
+
+    result_t results[SCENARIOS_MAX];
+    int regressed = 0;
+    printf("%u sessions per scenario, %u seeded posts, best of %u runs\n", options.sessions, options.seed_posts,
+           options.repeat);
+    printf("%-12s %7s %8s %11s %10s %13s %10s  %s\n", "scenario", "rounds", "ops", "ops/s", "allocs/op", "baseline ops/s",
+           "change", "status");
+    for (size_t i = 0; i < scenario_count; ++i) {
+        // Scheduling noise only ever slows a run down, so the best of a few
+        // fresh runs is the steadiest number to compare against.
+        for (unsigned int attempt = 0; attempt < options.repeat; ++attempt) {
+            result_t run;
+            if (run_scenario(&config, &scenarios[i], &run) != 0) {
+                return EXIT_FAILURE;
+            }
+            if (attempt == 0 || run.ops_per_sec > results[i].ops_per_sec) {
+                results[i] = run;
+            }
+        }
+        const result_t *result = &results[i];
+        unsigned long ops = (unsigned long)scenarios[i].lines * options.sessions * scenarios[i].rounds;
+        const result_t *previous = find_result(baseline, baseline_count, result->name);
+        if (previous == NULL) {
+            printf("%-12s %7u %8lu %11.0f %10.2f %13s %10s  %s\n", result->name, scenarios[i].rounds, ops, result->ops_per_sec,
+                   result->allocs_per_op, "-", "-", options.update ? "recorded" : "no baseline");
+            continue;
+        }
+
+        double change = previous->ops_per_sec > 0 ? 100.0 * (result->ops_per_sec / previous->ops_per_sec - 1) : 0;
+        const char *status = "ok";
+        if (change < -options.tolerance) {
+            status = "REGRESSED (throughput)";
+            regressed = 1;
+        } else if (result->allocs_per_op > previous->allocs_per_op * (1 + ALLOC_TOLERANCE) + 0.01) {
+            status = "REGRESSED (allocations)";
+            regressed = 1;
+        }
+        printf("%-12s %7u %8lu %11.0f %10.2f %13.0f %+9.1f%%  %s\n", result->name, scenarios[i].rounds, ops, result->ops_per_sec,
+               result->allocs_per_op, previous->ops_per_sec, change, status);
+    }
+
+    for (size_t i = 0; i < scenario_count; ++i) {
+        free(scenarios[i].script);
+    }
+    if (options.update) {
+        if (save_baseline(options.baseline, results, scenario_count) != 0) {
+            return EXIT_FAILURE;
+        }
+        printf("Baseline written to %s\n", options.baseline);
+    }
+    return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,275 @@
+// Decodes a binary trace written with trace_path back into log lines:
+//
+//   maum-tracedump data/maum.trace
+#include "trace_format.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SPEC_MAX 32
+
+typedef struct {
+    const trace_record_t *record;
+    size_t offset;
+    bool exhausted;
+} payload_reader_t;
+
+static const char *level_name(uint8_t level)
+{
+    static const char *const names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+    return (level < sizeof(names) / sizeof(names[0])) ? names[level] : "UNKNOWN";
+}
+
+static bool read_raw(payload_reader_t *reader, uint64_t *value)
+{
+    if (reader->exhausted || reader->offset + sizeof(*value) > reader->record->payload_length) {
+        reader->exhausted = true;
+        return false;
+    }
+    memcpy(value, reader->record->payload + reader->offset, sizeof(*value));
+    reader->offset += sizeof(*value);
+    return true;
+}
+
+static bool read_string(payload_reader_t *reader, char *buffer, size_t size)
+{
+    if (reader->exhausted || reader->offset + 1 > reader->record->payload_length) {
+        reader->exhausted = true;
+        return false;
+    }
+    size_t length = reader->record->payload[reader->offset++];
+    if (reader->offset + length > reader->record->payload_length || length >= size) {
+        reader->exhausted = true;
+        return false;
+    }
+    memcpy(buffer, reader->record->payload + reader->offset, length);
+    buffer[length] = '\0';
+    reader->offset += length;
+    return true;
+}
+
+// Prints one conversion. spec holds the flags/width/precision as written with
+// any '*' already substituted; the length modifier is chosen here.
+static void print_argument(const char *spec, char conversion, uint8_t type, payload_reader_t *reader)
+{
+    char format[SPEC_MAX + 4];
+    uint64_t raw = 0;
+
+    switch (type) {
+    case TRACE_ARG_STRING: {
+        char text[TRACE_STRING_MAX + 1];
+        if (!read_string(reader, text, sizeof(text))) {
+            fputs("<?>", stdout);
+            return;
+        }
+        snprintf(format, sizeof(format), "%%%ss", spec);
+        printf(format, text);
+        return;
+    }
+    case TRACE_ARG_DOUBLE: {
+        if (!read_raw(reader, &raw)) {
+            fputs("<?>", stdout);
+            return;
+        }
+        double value;
+        memcpy(&value, &raw, sizeof(value));
+        snprintf(format, sizeof(format), "%%%s%c", spec, conversion);
+        printf(format, value);
+        return;
+    }
+    case TRACE_ARG_POINTER:
+        if (!read_raw(reader, &raw)) {
+            fputs("<?>", stdout);
+            return;
+        }
+        printf("%p", (void *)(uintptr_t)raw);
+        return;
+    default:
+        break;
+    }
+
+    if (!read_raw(reader, &raw)) {
+        fputs("<?>", stdout);
+        return;
+    }
+    if (conversion == 'c') {
+        snprintf(format, sizeof(format), "%%%sc", spec);
+        printf(format, (int)raw);
+        return;
+    }
+    snprintf(format, sizeof(format), "%%%sll%c", spec, conversion);
+    if (conversion == 'd' || conversion == 'i') {
+        printf(format, (long long)(int64_t)raw);
+    } else {
+        printf(format, (unsigned long long)raw);
+    }
+}
+
+static void print_message(const trace_site_t *site, const trace_record_t *record)
+{
+    payload_reader_t reader = {record, 0, false};
+    size_t arg = 0;
+
+    for (const char *p = site->format; *p != '\0'; ++p) {
+        if (*p != '%') {
+            putchar(*p);
+            continue;
+        }
+        ++p;
+        if (*p == '%') {
+            putchar('%');
+            continue;
+        }
+
+        char spec[SPEC_MAX];
+        size_t length = 0;
+        while (*p != '\0' && strchr("-+ #0123456789.*", *p) != NULL) {
+            if (*p == '*') {
+                uint64_t width = 0;
+                if (arg < site->arg_count) {
+                    arg++;
+                    read_raw(&reader, &width);
+                }
+                length += (size_t)snprintf(spec + length, sizeof(spec) - length, "%d", (int)(int64_t)width);
+            } else if (length + 1 < sizeof(spec)) {
+                spec[length++] = *p;
+            }
+            ++p;
+        }
+        spec[length < sizeof(spec) ? length : sizeof(spec) - 1] = '\0';
+        while (*p != '\0' && strchr("hljzt", *p) != NULL) {
+            ++p;
+        }
+        if (*p == '\0') {
+            break;
+        }
+
+        if (arg < site->arg_count) {
+            print_argument(spec, *p, site->arg_types[arg++], &reader);
+        } else {
+            fputs("<?>", stdout);
+        }
+    }
+
+    if (record->flags & TRACE_RECORD_TRUNCATED) {
+        fputs(" <truncated>", stdout);
+    }
+}
+
+// Copies a record the daemon may be rewriting at this moment; a copy taken
+// while seq changed underneath it is torn and dropped.
+static bool snapshot_record(const trace_record_t *live, trace_record_t *copy)
+{
+    uint64_t seq = atomic_load_explicit(&live->seq, memory_order_acquire);
+    if (seq == 0) {
+        return false;
+    }
+    copy->timestamp_ns = live->timestamp_ns;
+    copy->thread = live->thread;
+    copy->site = live->site;
+    copy->flags = live->flags;
+    copy->payload_length = live->payload_length;
+    memcpy(copy->payload, live->payload, sizeof(copy->payload));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&live->seq, memory_order_relaxed) != seq) {
+        return false;
+    }
+    atomic_init(&copy->seq, seq);
+    return true;
+}
+
+static int compare_records(const void *left, const void *right)
+{
+    uint64_t a = atomic_load_explicit(&((const trace_record_t *)left)->seq, memory_order_relaxed);
+    uint64_t b = atomic_load_explicit(&((const trace_record_t *)right)->seq, memory_order_relaxed);
+    return (a > b) - (a < b);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <trace-file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(trace_file_header_t)) {
+        fprintf(stderr, "%s: not a trace file\n", argv[1]);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    void *mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    trace_file_header_t *header = mapping;
+    size_t expected = sizeof(*header) + (size_t)header->site_capacity * sizeof(trace_site_t) +
+                      (size_t)header->record_count * sizeof(trace_record_t);
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || header->version != TRACE_VERSION ||
+        header->record_size != sizeof(trace_record_t) || expected > (size_t)st.st_size) {
+        fprintf(stderr, "%s: unsupported trace format\n", argv[1]);
+        munmap(mapping, (size_t)st.st_size);
+        return EXIT_FAILURE;
+    }
+
+    trace_site_t *sites = (trace_site_t *)(header + 1);
+    trace_record_t *records = (trace_record_t *)(sites + header->site_capacity);
+
+    trace_record_t *ordered = malloc(header->record_count * sizeof(*ordered));
+    if (ordered == NULL) {
+        munmap(mapping, (size_t)st.st_size);
+        return EXIT_FAILURE;
+    }
+    size_t count = 0;
+    for (uint32_t i = 0; i < header->record_count; ++i) {
+        if (snapshot_record(&records[i], &ordered[count])) {
+            count++;
+        }
+    }
+    qsort(ordered, count, sizeof(*ordered), compare_records);
+
+    uint32_t site_count = atomic_load(&header->site_count);
+    for (size_t i = 0; i < count; ++i) {
+        const trace_record_t *record = &ordered[i];
+        time_t seconds = (time_t)(record->timestamp_ns / 1000000000ull);
+        struct tm tm_snapshot;
+        char timestamp[32] = "?";
+        if (localtime_r(&seconds, &tm_snapshot) != NULL) {
+            strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_snapshot);
+        }
+
+        if (record->site == 0 || record->site > site_count || record->site > header->site_capacity ||
+            !atomic_load(&sites[record->site - 1].ready)) {
+            printf("%s.%06llu [?] t%u: <unknown site %u>\n", timestamp,
+                   (unsigned long long)(record->timestamp_ns % 1000000000ull / 1000), record->thread, record->site);
+            continue;
+        }
+
+        const trace_site_t *site = &sites[record->site - 1];
+        printf("%s.%06llu [%s] t%u %s: ", timestamp,
+               (unsigned long long)(record->timestamp_ns % 1000000000ull / 1000), level_name(site->level),
+               record->thread, site->component);
+        print_message(site, record);
+        putchar('\n');
+    }
+
+    free(ordered);
+    munmap(mapping, (size_t)st.st_size);
+    return EXIT_SUCCESS;
+}